@@ -0,0 +1,226 @@
+/* File: alloc.cc
+ * --------------
+ * Inline allocation. The runtime hands out memory from a chunk it gets
+ * from sbrk, keeping the next free byte and the end of the chunk in the
+ * two words at _heap (see runtime.cc). Every call
+ *
+ *      PushParam size ; dst = LCall _Alloc ; PopParams 4
+ *
+ * is expanded into a fast path that bumps the pointer in place, with
+ * the call left only for when the chunk is full:
+ *
+ *      heap = _heap ; dst = *(heap) ; next = dst + size
+ *      end = *(heap + 4) ; full = end < next ; IfZ full Goto fast
+ *      PushParam size ; dst = LCall _Alloc ; PopParams 4 ; Goto done
+ *    fast:
+ *      *(heap) = next
+ *    done:
+ *
+ * Earlier passes look for the plain call (see escape.cc and modref.cc),
+ * so this runs after them. A fresh chunk comes from sbrk, which clears
+ * it, so objects start out zeroed as before.
+ *
+ * Under the collector (see gc.h) every block starts with a header, the
+ * size with 4 added, and the size passed carries the kind of the block
+ * in its top bits, so the fast path becomes
+ *
+ *      heap = _heap ; blk = *(heap) ; hdr = size + 4
+ *      bytes = hdr & 0x0ffffffc ; next = blk + bytes ; ...
+ *    fast:
+ *      *(heap) = next ; *(blk) = hdr ; dst = blk + 4
+ *    done:
+ *
+ * The blocks given back by Delete go on a list for their size, which
+ * the runtime's _Alloc tries first (see runtime.cc). For an allocation of
+ * a constant size that the program deletes, so does the fast path:
+ *
+ *      list = _free ; dst = *(list + size) ; IfZ dst Goto bump
+ *      link = *(dst) ; *(list + size) = link ; link = 0 ; *(dst) = link
+ *      Goto done
+ *    bump:
+ *      ...
+ *
+ * A Delete of constant size is expanded too (one that reads the size from
+ * the vtable, see DeleteStmt::Emit, stays a call):
+ *
+ *      IfZ obj Goto skip ; list = _free ; link = *(list + size)
+ *      *(obj) = link ; *(list + size) = obj
+ *      link = 0 ; *(obj + 4) = link ; ... ; *(obj + size - 4) = link
+ *    skip:
+ *
+ * -fno-inline-alloc keeps the calls; -fheap-chunk=n sets the size in
+ * bytes of the chunks the runtime asks for (65536).
+ */
+
+#include "codegen.h"
+#include "gc.h"
+#include "tac.h"
+#include <string.h>
+
+// Blocks of this size and more are not put on free lists, see _Alloc
+// and _Delete in runtime.cc.
+static const int FreeListLimit = 256;
+
+// Finds the constant loc holds right before code[at], looking back
+// through the straight-line code up to the nearest label.
+static bool ConstantBefore(List<Instruction *> *code, int at, Location *loc,
+                           int *value) {
+  for (int i = at - 1; i >= 0; i--) {
+    auto inst = code->Nth(i);
+    if (dynamic_cast<Label *>(inst) || dynamic_cast<BeginFunc *>(inst))
+      return false;
+    if (!inst->Kill().count(loc))
+      continue;
+    auto constant = dynamic_cast<LoadConstant *>(inst);
+    if (constant)
+      *value = constant->GetValue();
+    return constant != NULL;
+  }
+  return false;
+}
+
+void CodeGenerator::ExpandAllocations() {
+  if (!GetIntOption("inline-alloc", 1))
+    return;
+
+  // the sizes of the blocks given back, which may be on a free list;
+  // a Delete through a base class gives back a size read at run time
+  std::set<int> freed;
+  bool anySize = false;
+  for (int i = 2; i < code->NumElements(); i++) {
+    auto call = dynamic_cast<LCall *>(code->Nth(i));
+    auto push = dynamic_cast<PushParam *>(code->Nth(i - 2));
+    int size;
+    if (!call || strcmp(call->GetLabel(), "_Delete") != 0 || !push)
+      continue;
+    if (!ConstantBefore(code, i - 2, push->GetParam(), &size))
+      anySize = true;
+    else if (size < FreeListLimit)
+      freed.insert(size);
+  }
+
+  auto result = new List<Instruction *>;
+  BeginFunc *fn = NULL;
+  Location *heap = NULL, *next, *end, *full;
+  Location *blk, *hdr, *bytes, *four, *mask; // with the collector
+  Location *list = NULL, *link;              // with Delete
+  bool gc = GCEnabled();
+  for (int i = 0; i < code->NumElements(); i++) {
+    auto inst = code->Nth(i);
+    if (auto begin = dynamic_cast<BeginFunc *>(inst)) {
+      fn = begin;
+      heap = list = NULL;
+    }
+
+    auto call = dynamic_cast<LCall *>(inst);
+    int n = result->NumElements(), constant;
+    if (call && strcmp(call->GetLabel(), "_Delete") == 0 && n >= 2 &&
+        i + 1 < code->NumElements() &&
+        dynamic_cast<PopParams *>(code->Nth(i + 1))) {
+      auto objPush = dynamic_cast<PushParam *>(result->Nth(n - 1));
+      auto sizePush = dynamic_cast<PushParam *>(result->Nth(n - 2));
+      if (objPush && sizePush &&
+          ConstantBefore(result, n - 2, sizePush->GetParam(), &constant) &&
+          constant < FreeListLimit) {
+        if (!list) {
+          list = GenFrameVar(fn, "list");
+          link = GenFrameVar(fn, "link");
+        }
+        auto obj = objPush->GetParam();
+        auto skip = NewLabel();
+        result->RemoveAt(n - 1);
+        result->RemoveAt(n - 2);
+        result->Append(new IfZ(obj, skip));
+        result->Append(new LoadLabel(list, "_free"));
+        result->Append(new Load(link, list, constant, "free"));
+        result->Append(new Store(obj, link, 0, "free"));
+        result->Append(new Store(list, obj, constant, "free"));
+        result->Append(new LoadConstant(link, 0));
+        for (int offset = VarSize; offset < constant; offset += VarSize)
+          result->Append(new Store(obj, link, offset, "free"));
+        result->Append(new Label(skip));
+        i++;
+        continue;
+      }
+    }
+    auto push = result->NumElements()
+                    ? dynamic_cast<PushParam *>(
+                          result->Nth(result->NumElements() - 1))
+                    : NULL;
+    auto pop = i + 1 < code->NumElements()
+                   ? dynamic_cast<PopParams *>(code->Nth(i + 1))
+                   : NULL;
+    if (!call || strcmp(call->GetLabel(), "_Alloc") != 0 || !push || !pop ||
+        !call->GetDst()) {
+      result->Append(inst);
+      continue;
+    }
+
+    // the temps are dead outside the expansion, so one set serves all
+    if (!heap) {
+      heap = GenFrameVar(fn, "heap");
+      next = GenFrameVar(fn, "next");
+      end = GenFrameVar(fn, "end");
+      full = GenFrameVar(fn, "full");
+      if (gc) {
+        blk = GenFrameVar(fn, "blk");
+        hdr = GenFrameVar(fn, "hdr");
+        bytes = GenFrameVar(fn, "bytes");
+        four = GenFrameVar(fn, "four");
+        mask = GenFrameVar(fn, "mask");
+      }
+    }
+    auto dst = call->GetDst(), size = push->GetParam();
+    auto fast = NewLabel(), done = NewLabel();
+    result->RemoveAt(result->NumElements() - 1);
+    if (!gc && (anySize || !freed.empty()) &&
+        ConstantBefore(result, result->NumElements(), size, &constant) &&
+        constant < FreeListLimit && (anySize || freed.count(constant))) {
+      if (!list) {
+        list = GenFrameVar(fn, "list");
+        link = GenFrameVar(fn, "link");
+      }
+      auto bump = NewLabel();
+      result->Append(new LoadLabel(list, "_free"));
+      result->Append(new Load(dst, list, constant, "free"));
+      result->Append(new IfZ(dst, bump));
+      result->Append(new Load(link, dst, 0, "free"));
+      result->Append(new Store(list, link, constant, "free"));
+      result->Append(new LoadConstant(link, 0));
+      result->Append(new Store(dst, link, 0, "free"));
+      result->Append(new Goto(done));
+      result->Append(new Label(bump));
+    }
+    result->Append(new LoadLabel(heap, "_heap"));
+    if (gc) {
+      result->Append(new Load(blk, heap, 0, "heap"));
+      result->Append(new LoadConstant(four, VarSize));
+      result->Append(new BinaryOp(Mips::Add, hdr, size, four));
+      result->Append(new LoadConstant(mask, 0x0ffffffc));
+      result->Append(new BinaryOp(Mips::And, bytes, hdr, mask));
+      result->Append(new BinaryOp(Mips::Add, next, blk, bytes));
+    } else {
+      result->Append(new Load(dst, heap, 0, "heap"));
+      result->Append(new BinaryOp(Mips::Add, next, dst, size));
+    }
+    result->Append(new Load(end, heap, VarSize, "heap"));
+    result->Append(new BinaryOp(Mips::Less, full, end, next));
+    result->Append(new IfZ(full, fast));
+    result->Append(push);
+    result->Append(call);
+    result->Append(pop);
+    result->Append(new Goto(done));
+    result->Append(new Label(fast));
+    result->Append(new Store(heap, next, 0, "heap"));
+    if (gc) {
+      result->Append(new Store(blk, hdr, 0, "heap"));
+      result->Append(new BinaryOp(Mips::Add, dst, blk, four));
+    }
+    result->Append(new Label(done));
+    i++;
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
@@ -0,0 +1,323 @@
+/* File: allocstats.cc
+ * -------------------
+ * The -d alloc report, see allocstats.h. Every block allocated is
+ * counted, with the bytes malloc actually gave it, for the innermost
+ * phase running (see PhaseTimer) and for the return address of the call
+ * to operator new or strdup. The tables have a fixed size so that
+ * counting never allocates itself; the addresses are turned into the
+ * names of the functions holding them only for the report, which is why
+ * ALLOCSTATS=1 links with -rdynamic. A function of the standard library
+ * that allocates, such as the allocator of a std::set, is named with the
+ * type of what it holds, so the report tells a LocationSet node from a
+ * List or a yyltype.
+ */
+
+#include "allocstats.h"
+#include "timing.h"
+#include "utility.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#ifdef ALLOC_STATS
+
+#include <algorithm>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <malloc.h>
+#include <map>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Counts {
+  long allocs, bytes, frees, freed;
+  long peakRss; // in KB, at the end of the phase
+};
+
+const int MaxPhases = 64, MaxSites = 8192, MaxFrames = 24;
+
+struct {
+  const char *name;
+  Counts counts;
+} phases[MaxPhases];
+int numPhases;
+
+// the return addresses of the calls that led to an allocation, the
+// hooks below included
+struct Site {
+  void *frames[MaxFrames];
+  int depth;
+  long allocs, bytes;
+} sites[MaxSites];
+long lostSites; // allocations of sites the table had no room for
+
+Counts all;
+long live, peakLive;
+bool reporting; // the report's own allocations are not counted
+bool counting;  // backtrace may allocate the first time it is called
+
+long MaxRss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+Counts &PhaseCounts(const char *name) {
+  if (!name)
+    name = "(none)";
+  for (int i = 0; i < numPhases; i++)
+    if (strcmp(phases[i].name, name) == 0)
+      return phases[i].counts;
+  if (numPhases == MaxPhases)
+    return phases[MaxPhases - 1].counts;
+  phases[numPhases].name = name;
+  return phases[numPhases++].counts;
+}
+
+void CountSite(long bytes) {
+  void *frames[MaxFrames];
+  int depth = backtrace(frames, MaxFrames);
+  size_t hash = depth;
+  for (int i = 0; i < depth; i++)
+    hash = hash * 31 + ((uintptr_t)frames[i] >> 2);
+
+  size_t i = hash % MaxSites;
+  for (int probes = 0; probes < MaxSites; probes++) {
+    Site &site = sites[i];
+    if (!site.depth) {
+      site.depth = depth;
+      memcpy(site.frames, frames, depth * sizeof(void *));
+    }
+    if (site.depth == depth &&
+        memcmp(site.frames, frames, depth * sizeof(void *)) == 0) {
+      site.allocs++;
+      site.bytes += bytes;
+      return;
+    }
+    i = (i + 1) % MaxSites;
+  }
+  lostSites++;
+}
+
+void Count(void *block) {
+  if (!block || reporting || counting)
+    return;
+  counting = true;
+  long bytes = malloc_usable_size(block);
+  Counts &phase = PhaseCounts(CurrentPhase());
+  phase.allocs++;
+  phase.bytes += bytes;
+  all.allocs++;
+  all.bytes += bytes;
+  live += bytes;
+  peakLive = std::max(peakLive, live);
+  CountSite(bytes);
+  counting = false;
+}
+
+void Uncount(void *block) {
+  if (!block || reporting || counting)
+    return;
+  long bytes = malloc_usable_size(block);
+  Counts &phase = PhaseCounts(CurrentPhase());
+  phase.frees++;
+  phase.freed += bytes;
+  all.frees++;
+  all.freed += bytes;
+  live -= bytes;
+}
+
+void *Allocate(size_t size) {
+  void *block = malloc(size ? size : 1);
+  Count(block);
+  return block;
+}
+
+void Free(void *block) {
+  Uncount(block);
+  free(block);
+}
+
+// The name of the function holding addr, without its parameters.
+std::string FunctionAt(void *addr) {
+  Dl_info info;
+  if (!dladdr(addr, &info) || !info.dli_sname)
+    return "?";
+  int status;
+  char *demangled =
+      abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+  std::string name = status == 0 ? demangled : info.dli_sname;
+  free(demangled);
+  for (std::string from : {"std::__cxx11::basic_string<char, "
+                           "std::char_traits<char>, std::allocator<char> >",
+                           "std::__cxx11::"}) {
+    std::string to = from.size() > 14 ? "std::string" : "std::";
+    for (size_t at; (at = name.find(from)) != std::string::npos;)
+      name.replace(at, from.size(), to);
+  }
+  int depth = 0;
+  for (size_t i = 0; i < name.size(); i++) {
+    if (name[i] == '<')
+      depth++;
+    else if (name[i] == '>')
+      depth--;
+    else if (name[i] == '(' && depth == 0 && i > 0)
+      return name.substr(0, i);
+  }
+  return name;
+}
+
+bool InLibrary(std::string name) {
+  // the name of a function template starts with its return type
+  size_t space = name.find(' ');
+  if (space != std::string::npos && space < name.find_first_of("<:"))
+    name = name.substr(space + 1);
+  return name.compare(0, 5, "std::") == 0 ||
+         name.compare(0, 11, "__gnu_cxx::") == 0 || name == "?";
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+  void *block = Allocate(size);
+  if (!block)
+    throw std::bad_alloc();
+  return block;
+}
+
+void *operator new[](size_t size) {
+  void *block = Allocate(size);
+  if (!block)
+    throw std::bad_alloc();
+  return block;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size);
+}
+
+void operator delete(void *block) noexcept { Free(block); }
+void operator delete[](void *block) noexcept { Free(block); }
+
+extern "C" char *strdup(const char *s) __THROW {
+  size_t size = strlen(s) + 1;
+  char *copy = (char *)malloc(size);
+  if (copy) {
+    memcpy(copy, s, size);
+    Count(copy);
+  }
+  return copy;
+}
+
+void AllocPhaseEnd(const char *phase) {
+  Counts &counts = PhaseCounts(phase);
+  counts.peakRss = std::max(counts.peakRss, MaxRss());
+}
+
+void PrintAllocStats() {
+  if (!IsDebugOn("alloc"))
+    return;
+  reporting = true;
+
+  fprintf(stderr, "alloc: %-20s %10s %12s %10s %12s %10s\n", "phase",
+          "allocs", "bytes", "frees", "freed", "rss KB");
+  for (int i = 0; i < numPhases; i++) {
+    auto &c = phases[i].counts;
+    fprintf(stderr, "       %-20s %10ld %12ld %10ld %12ld %10ld\n",
+            phases[i].name, c.allocs, c.bytes, c.frees, c.freed, c.peakRss);
+  }
+  fprintf(stderr, "       %-20s %10ld %12ld %10ld %12ld %10ld\n", "(all)",
+          all.allocs, all.bytes, all.frees, all.freed, MaxRss());
+  fprintf(stderr, "alloc: peak live %ld bytes, peak rss %ld KB\n", peakLive,
+          MaxRss());
+
+  // by the function that called operator new, which for the containers
+  // of the standard library names the type allocated, and the first
+  // function of the compiler on the way to it, the largest first
+  typedef std::pair<std::string, std::string> Key;
+  std::map<Key, std::pair<long, long>> bySite;
+  for (auto &site : sites) {
+    if (!site.depth)
+      continue;
+    // the frame after the hook is the function that allocated
+    int first = 0;
+    for (int i = 0; i < site.depth; i++) {
+      auto name = FunctionAt(site.frames[i]);
+      if (name.compare(0, 12, "operator new") == 0 || name == "strdup") {
+        first = i + 1;
+        break;
+      }
+    }
+    if (first == site.depth)
+      continue;
+    Key key(FunctionAt(site.frames[first]), "");
+    // the allocator of a container is named by the type it allocates
+    std::string allocator = "std::__new_allocator<", allocate = ">::allocate";
+    if (key.first.compare(0, allocator.size(), allocator) == 0 &&
+        key.first.size() > allocator.size() + allocate.size())
+      key.first = "new " + key.first.substr(allocator.size(),
+                                            key.first.size() -
+                                                allocator.size() -
+                                                allocate.size());
+    if (key.first.back() == ' ')
+      key.first.pop_back();
+    for (int i = first; i < site.depth && key.second.empty(); i++) {
+      auto name = FunctionAt(site.frames[i]);
+      if (!InLibrary(name))
+        key.second = name;
+    }
+    if (key.second == key.first)
+      key.second.clear();
+    auto &entry = bySite[key];
+    entry.first += site.allocs;
+    entry.second += site.bytes;
+  }
+  std::vector<std::pair<Key, std::pair<long, long>>> order(bySite.begin(),
+                                                           bySite.end());
+  std::sort(order.begin(), order.end(), [](const decltype(order[0]) &a,
+                                           const decltype(order[0]) &b) {
+    return a.second.second > b.second.second;
+  });
+  fprintf(stderr, "alloc: %10s %12s  %s\n", "allocs", "bytes", "allocated by");
+  const size_t MaxLines = 40;
+  for (size_t i = MaxLines; i < order.size(); i++) {
+    order[MaxLines - 1].second.first += order[i].second.first;
+    order[MaxLines - 1].second.second += order[i].second.second;
+  }
+  if (order.size() > MaxLines) {
+    order[MaxLines - 1].first = Key("(the rest)", "");
+    order.resize(MaxLines);
+  }
+  for (auto &entry : order) {
+    fprintf(stderr, "       %10ld %12ld  %s", entry.second.first,
+            entry.second.second, entry.first.first.c_str());
+    if (!entry.first.second.empty())
+      fprintf(stderr, " in %s", entry.first.second.c_str());
+    fprintf(stderr, "\n");
+  }
+  if (lostSites)
+    fprintf(stderr, "alloc: %ld allocations from sites not recorded\n",
+            lostSites);
+}
+
+#else
+
+void AllocPhaseEnd(const char *phase) {}
+
+void PrintAllocStats() {
+  if (IsDebugOn("alloc"))
+    fprintf(stderr, "alloc: dcc was built without ALLOCSTATS=1, so its "
+                    "allocations were not counted\n");
+}
+
+#endif
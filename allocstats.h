@@ -0,0 +1,20 @@
+/* File: allocstats.h
+ * ------------------
+ * Accounting of the memory the compiler itself allocates, for -d alloc.
+ * It is built in only with make ALLOCSTATS=1, which replaces the global
+ * operator new and delete (and strdup) with versions that count the
+ * blocks, their bytes and the bytes still live, by compiler phase (see
+ * timing.h) and by the function that asked for them. See allocstats.cc.
+ */
+
+#ifndef _H_allocstats
+#define _H_allocstats
+
+// Notes the peak RSS at the end of a run of the given phase; called by
+// PhaseTimer.
+void AllocPhaseEnd(const char *phase);
+
+// Prints the report to stderr if -d alloc is given.
+void PrintAllocStats();
+
+#endif
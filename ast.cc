@@ -11,11 +11,13 @@
 Node::Node(yyltype loc) {
   location = new yyltype(loc);
   parent = NULL;
+  symbols = NULL;
 }
 
 Node::Node() {
   location = NULL;
   parent = NULL;
+  symbols = NULL;
 }
 
 Decl *Node::FindSymbol(const char *name) const {
@@ -6,6 +6,7 @@
 #include "ast_stmt.h"
 #include "ast_type.h"
 #include "codegen.h"
+#include "profile.h"
 #include <algorithm>
 
 extern CodeGenerator &codeGen;
@@ -41,11 +42,15 @@ void VarDecl::Emit() {
     valLoc = codeGen.GenParamVar(name);
   else if (dynamic_cast<StmtBlock *>(parent))
     valLoc = codeGen.GenLocalVar(name);
+  if (valLoc)
+    valLoc->SetType(type);
+  if (valLoc && dynamic_cast<Program *>(parent))
+    GCRecordGlobal(valLoc);
 }
 
 ClassDecl::ClassDecl(Identifier *n, NamedType *ex, List<NamedType *> *imp,
                      List<Decl *> *m)
-    : Decl(n), size{0}, methods{nullptr} {
+    : Decl(n), size{0}, methods{nullptr}, derived{new List<ClassDecl *>} {
   // extends can be NULL, impl & mem may be empty lists but cannot be NULL
   Assert(n != NULL && imp != NULL && m != NULL);
   extends = ex;
@@ -67,6 +72,8 @@ void ClassDecl::Check() {
     }
     if (base->IsDerivedFrom(this))
       extends = nullptr;
+    if (extends)
+      base->derived->Append(this);
   }
 
   for (auto member : members->Get()) {
@@ -86,7 +93,11 @@ void ClassDecl::Emit() {
   auto methodLabels = new List<const char *>;
   for (auto fn : methods->Get())
     methodLabels->Append(fn->GetLabel());
-  codeGen.GenVTable(GetName(), methodLabels);
+  // the size of an object, for Delete on a reference of a base class
+  std::vector<int> header{size};
+  if (GCEnabled())
+    header = GCClassMap(GetWordKinds());
+  codeGen.GenVTable(GetName(), methodLabels, header);
 }
 
 Decl *ClassDecl::FindSymbolInClass(const char *name) const {
@@ -155,6 +166,19 @@ void ClassDecl::CollectVar() {
     }
 }
 
+std::vector<RefKind> ClassDecl::GetWordKinds() const {
+  std::vector<RefKind> kinds;
+  if (auto base = GetBase())
+    kinds = base->GetWordKinds();
+  else
+    kinds.push_back(RefNone); // the vtable
+  kinds.resize(size / codeGen.VarSize, RefNone);
+  for (auto member : members->Get())
+    if (auto var = dynamic_cast<VarDecl *>(member))
+      kinds[var->GetOffset() / codeGen.VarSize] = GCRefKind(var->GetType());
+  return kinds;
+}
+
 ClassDecl *ClassDecl::GetBase() const {
   if (!extends)
     return nullptr;
@@ -171,6 +195,23 @@ bool ClassDecl::IsDerivedFrom(ClassDecl *other) const {
   return false;
 }
 
+bool ClassDecl::IsOverridden(const FnDecl *fn) const {
+  int slot = fn->GetOffset() / codeGen.VarSize;
+  for (auto cls : derived->Get()) {
+    cls->CollectFn();
+    if (cls->methods->Nth(slot) != fn || cls->IsOverridden(fn))
+      return true;
+  }
+  return false;
+}
+
+bool ClassDecl::IsSizeFixed() const {
+  for (auto cls : derived->Get())
+    if (cls->size != size || !cls->IsSizeFixed())
+      return false;
+  return true;
+}
+
 InterfaceDecl::InterfaceDecl(Identifier *n, List<Decl *> *m) : Decl(n) {
   Assert(n != NULL && m != NULL);
   (members = m)->SetParentAll(this);
@@ -229,14 +270,21 @@ void FnDecl::Emit() {
   codeGen.GenLabel(label);
   auto beginFunc = codeGen.GenBeginFunc();
 
-  if (dynamic_cast<ClassDecl *>(parent))
+  if (auto cls = dynamic_cast<ClassDecl *>(parent)) {
     codeGen.GenParamVar("this");
+    codeGen.GenThis()->SetType(cls->GetType());
+  }
   for (auto var : formals->Get())
     var->Emit();
   if (body)
     body->Emit();
+  // the output is buffered until the program ends, see runtime.cc, and
+  // the counters of -fprofile-generate are written out then too
+  if (IsMain())
+    codeGen.GenBuiltInCall(ProfileGenerate() ? Profile : Flush);
 
   beginFunc->SetFrameSize(codeGen.GetFrameSize());
+  beginFunc->SetParamSize(codeGen.GetParamSize());
   codeGen.GenEndFunc();
 }
 
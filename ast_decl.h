@@ -15,6 +15,7 @@
 #include "ast.h"
 #include "ast_type.h"
 #include "codegen.h"
+#include "gc.h"
 #include "list.h"
 
 class Identifier;
@@ -60,6 +61,7 @@ protected:
   NamedType *type;
   int size;
   List<FnDecl *> *methods;
+  List<ClassDecl *> *derived; // direct subclasses in the whole program
 
 public:
   ClassDecl(Identifier *name, NamedType *extends, List<NamedType *> *implements,
@@ -75,6 +77,13 @@ public:
   int GetSize() const { return size; }
   ClassDecl *GetBase() const;
   bool IsDerivedFrom(ClassDecl *other) const;
+  // Whether some class derived from this one puts another method
+  // into the vtable slot of fn.
+  bool IsOverridden(const FnDecl *fn) const;
+  // Whether every class derived from this one has objects of its size.
+  bool IsSizeFixed() const;
+  // The references held by each word of an object, the vtable first.
+  std::vector<RefKind> GetWordKinds() const;
 };
 
 class InterfaceDecl : public Decl {
@@ -106,6 +115,7 @@ public:
 
   void SetLabel(const char *className = nullptr);
   char *GetLabel() const { return label; }
+  bool IsMain() const { return strcmp(label, "main") == 0; }
 
   void SetOffset(int offset) { this->offset = offset; }
   int GetOffset() const { return offset; }
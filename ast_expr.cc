@@ -143,17 +143,31 @@ Type *EqualityExpr::Eval() {
 }
 
 void EqualityExpr::Emit() {
-  left->Emit();
-  right->Emit();
   auto tok = op->GetName();
-  auto lhs = left->GetValue();
-  auto rhs = right->GetValue();
   Location *eq = nullptr;
 
-  if (left->GetType() == Type::stringType)
-    eq = codeGen.GenBuiltInCall(StringEqual, lhs, rhs);
-  else
-    eq = codeGen.GenBinaryOp("==", lhs, rhs);
+  // a literal need not be loaded to be compared with
+  auto literal = dynamic_cast<StringConstant *>(right);
+  auto other = left;
+  if (!literal) {
+    literal = dynamic_cast<StringConstant *>(left);
+    other = right;
+  }
+
+  if (literal && left->GetType() == Type::stringType &&
+      right->GetType() == Type::stringType) {
+    other->Emit();
+    eq = codeGen.GenStringEqual(other->GetValue(), literal->GetString());
+  } else {
+    left->Emit();
+    right->Emit();
+    auto lhs = left->GetValue();
+    auto rhs = right->GetValue();
+    if (left->GetType() == Type::stringType)
+      eq = codeGen.GenBuiltInCall(StringEqual, lhs, rhs);
+    else
+      eq = codeGen.GenBinaryOp("==", lhs, rhs);
+  }
 
   if (strcmp(tok, "==") == 0)
     valLoc = eq;
@@ -204,6 +218,16 @@ void LogicalExpr::Emit() {
 Type *AssignExpr::Eval() {
   auto lhs = left->Eval();
   auto rhs = right->Eval();
+
+  // the for loops around learn that the variable changes in them
+  auto access = dynamic_cast<FieldAccess *>(left);
+  if (access && !access->GetBase() && access->GetVar()) {
+    Node *child = this;
+    for (auto node = parent; node; child = node, node = node->GetParent())
+      if (auto loop = dynamic_cast<ForStmt *>(node))
+        loop->NoteAssigned(child, access->GetVar());
+  }
+
   if (lhs == Type::errorType || rhs == Type::errorType)
     type = Type::errorType;
   else if (!rhs->IsConvertableTo(lhs)) {
@@ -245,7 +269,9 @@ Location *LValue::GetValue() const {
     return valLoc;
   else {
     Assert(addr);
-    return codeGen.GenLoad(addr, offset);
+    auto value = codeGen.GenLoad(addr, offset, region);
+    value->SetType(type);
+    return value;
   }
 }
 
@@ -255,7 +281,7 @@ void LValue::Assign(Location *src) const {
   else {
     Assert(addr);
     Assert(src);
-    codeGen.GenStore(addr, src, offset);
+    codeGen.GenStore(addr, src, offset, region);
   }
 }
 
@@ -288,7 +314,7 @@ void ArrayAccess::Emit() {
 
   auto array = base->GetValue();
   auto index = subscript->GetValue();
-  auto length = codeGen.GenLoad(array, -codeGen.VarSize);
+  auto length = codeGen.GenLoad(array, -codeGen.VarSize, "length");
 
   // runtime check for index bound
   auto labelHalt = codeGen.NewLabel();
@@ -302,6 +328,8 @@ void ArrayAccess::Emit() {
   auto varSize = codeGen.GenLoadConstant(codeGen.VarSize);
   auto offset = codeGen.GenBinaryOp("*", index, varSize);
   addr = codeGen.GenBinaryOp("+", array, offset);
+  addr->SetType(type, true);
+  region = base->GetType()->GetName();
   codeGen.GenGoto(labelAfter);
 
   codeGen.GenLabel(labelHalt);
@@ -330,7 +358,8 @@ Type *FieldAccess::Eval() {
     if (auto namedType = dynamic_cast<NamedType *>(type)) {
       cls = namedType->FindClassDecl();
       auto parent = FindParentByType<ClassDecl *>();
-      if (!(parent->IsDerivedFrom(cls)))
+      // fields are only visible inside the methods of the class
+      if (!parent || !parent->IsDerivedFrom(cls))
         ReportError::InaccessibleField(field, type);
     } else {
       ReportError::FieldNotFoundInBase(field, type);
@@ -362,6 +391,11 @@ void FieldAccess::Emit() {
     valLoc = loc;
   else {
     offset = var->GetOffset();
+    auto cls = dynamic_cast<ClassDecl *>(var->GetParent());
+    Assert(cls);
+    char name[1024];
+    sprintf(name, "%s.%s", cls->GetName(), var->GetName());
+    region = strdup(name);
     if (base) {
       base->Emit();
       addr = base->GetValue(); // pointer to the base object
@@ -459,9 +493,19 @@ void Call::Emit() {
       object = base->GetValue();
     } else
       object = codeGen.GenThis();
-    auto vtable = codeGen.GenLoad(object);
-    int offset = fn->GetOffset();
-    addr = codeGen.GenLoad(vtable, offset);
+    // a method that no class derived from the receiver's static type
+    // overrides is called directly
+    ClassDecl *cls = FindParentByType<ClassDecl *>();
+    if (base)
+      if (auto namedType = dynamic_cast<NamedType *>(base->GetType()))
+        cls = namedType->FindClassDecl();
+    bool direct = GetIntOption("devirtualize", 1) && cls &&
+                  !cls->IsOverridden(fn);
+    if (!direct) {
+      auto vtable = codeGen.GenLoad(object, 0, "vtable");
+      int offset = fn->GetOffset();
+      addr = codeGen.GenLoad(vtable, offset, "methods");
+    }
 
     List<Location *> params;
     params.Append(object); // the first param is 'this'
@@ -472,14 +516,19 @@ void Call::Emit() {
     }
     for (auto param : params.Get())
       codeGen.GenPushParam(param);
-    valLoc = codeGen.GenACall(addr, hasReturn);
+    if (direct)
+      valLoc = codeGen.GenLCall(fn->GetLabel(), hasReturn);
+    else
+      valLoc = codeGen.GenACall(addr, hasReturn, fn->GetName());
     codeGen.GenPopParams(params.NumElements() * codeGen.VarSize);
   } else if (fn == arrayLengthFn) {
     Assert(base);
     base->Emit();
     auto array = base->GetValue();
-    valLoc = codeGen.GenLoad(array, -codeGen.VarSize);
+    valLoc = codeGen.GenLoad(array, -codeGen.VarSize, "length");
   }
+  if (valLoc)
+    valLoc->SetType(type);
 }
 
 NewExpr::NewExpr(yyltype loc, NamedType *c) : Expr(loc) {
@@ -503,11 +552,18 @@ void NewExpr::Emit() {
   auto cls = cType->FindClassDecl();
   Assert(cls);
 
-  auto size = codeGen.GenLoadConstant(cls->GetSize());
+  // under the collector the size carries what the block holds
+  int kind = BlockPlain;
+  if (GCEnabled())
+    for (auto word : cls->GetWordKinds())
+      if (word != RefNone)
+        kind = BlockObject;
+  auto size = codeGen.GenLoadConstant(cls->GetSize() | kind << BlockKindShift);
   valLoc = codeGen.GenBuiltInCall(Alloc, size);
+  valLoc->SetType(cType);
 
   auto vtable = codeGen.GenLoadLabel(cls->GetName());
-  codeGen.GenStore(valLoc, vtable);
+  codeGen.GenStore(valLoc, vtable, 0, "vtable");
 }
 
 NewArrayExpr::NewArrayExpr(yyltype loc, Expr *sz, Type *et) : Expr(loc) {
@@ -544,9 +600,19 @@ void NewArrayExpr::Emit() {
   auto varSize = codeGen.GenLoadConstant(codeGen.VarSize);
   auto arraySize = codeGen.GenBinaryOp("*", varSize, length);
   auto totalSize = codeGen.GenBinaryOp("+", varSize, arraySize);
+  if (GCEnabled()) {
+    int kind = BlockPlain;
+    if (auto elem = GCRefKind(elemType))
+      kind = elem == RefObject ? BlockObjects : BlockArrays;
+    if (kind != BlockPlain)
+      totalSize = codeGen.GenBinaryOp(
+          "+", totalSize, codeGen.GenLoadConstant(kind << BlockKindShift));
+  }
   auto addr = codeGen.GenBuiltInCall(Alloc, totalSize);
-  codeGen.GenStore(addr, length);
+  addr->SetType(type, true);
+  codeGen.GenStore(addr, length, 0, "length");
   valLoc = codeGen.GenBinaryOp("+", addr, varSize);
+  valLoc->SetType(type);
 }
 
 void ReadIntegerExpr::Emit() { valLoc = codeGen.GenBuiltInCall(ReadInteger); }
@@ -53,6 +53,7 @@ protected:
 
 public:
   IntConstant(yyltype loc, int val);
+  int GetConstant() const { return value; }
   Type *Eval() { return type = Type::intType; }
   void Emit();
 };
@@ -73,6 +74,7 @@ protected:
 
 public:
   BoolConstant(yyltype loc, bool val);
+  bool GetConstant() const { return value; }
   Type *Eval() { return type = Type::boolType; }
   void Emit();
 };
@@ -84,6 +86,7 @@ protected:
 public:
   StringConstant(yyltype loc, const char *val);
   Type *Eval() { return type = Type::stringType; }
+  const char *GetString() const { return value; }
   void Emit();
 };
 
@@ -114,6 +117,10 @@ protected:
 public:
   CompoundExpr(Expr *lhs, Operator *op, Expr *rhs); // for binary
   CompoundExpr(Operator *op, Expr *rhs);            // for unary
+
+  Operator *GetOp() const { return op; }
+  Expr *GetLeft() const { return left; }
+  Expr *GetRight() const { return right; }
 };
 
 class ArithmeticExpr : public CompoundExpr {
@@ -165,9 +172,11 @@ class LValue : public Expr {
 protected:
   Location *addr;
   int offset;
+  const char *region; // the memory at addr, see Load in tac.h
 
 public:
-  LValue(yyltype loc) : Expr(loc), addr{nullptr}, offset{0} {}
+  LValue(yyltype loc)
+      : Expr(loc), addr{nullptr}, offset{0}, region{nullptr} {}
   Location *GetValue() const;
   void Assign(Location *src) const;
 };
@@ -203,6 +212,8 @@ protected:
 
 public:
   FieldAccess(Expr *base, Identifier *field); // ok to pass NULL base
+  Expr *GetBase() const { return base; }
+  VarDecl *GetVar() const { return var; }
   Type *Eval();
   void Emit();
 };
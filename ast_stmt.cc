@@ -6,6 +6,10 @@
 #include "ast_decl.h"
 #include "ast_expr.h"
 #include "ast_type.h"
+#include "profile.h"
+#include "timing.h"
+#include <string.h>
+#include <string>
 
 extern CodeGenerator &codeGen;
 extern FnDecl *arrayLengthFn;
@@ -21,6 +25,7 @@ void Program::Check() {
    * you want to avoid the clutter.  We won't test pp4 against
    * semantically-invalid programs.
    */
+  PhaseTimer timer("check");
   arrayLengthFn = new FnDecl(new Identifier(yylloc, "length"), Type::intType,
                              new List<VarDecl *>);
 
@@ -46,8 +51,11 @@ void Program::Emit() {
    *      which makes for a great use of inheritance and
    *      polymorphism in the node classes.
    */
-  for (auto decl : decls->Get())
-    decl->Emit();
+  {
+    PhaseTimer timer("tac");
+    for (auto decl : decls->Get())
+      decl->Emit();
+  }
 
   codeGen.PostProcess();
   // codeGen.DoFinalCodeGen();
@@ -105,10 +113,71 @@ void ForStmt::Check() {
   body->Check();
 }
 
+void ForStmt::NoteAssigned(Node *child, VarDecl *var) {
+  if (child != init && child != step)
+    assigned.insert(var);
+}
+
+/* Matches
+ *      for (v = a; v < b; v = v + c)
+ * with constants a, b and c, and the variants with <=, > and >= and
+ * with v - c, where v is not assigned in the test or the body (see
+ * AssignExpr::Eval). v may still change in a call, if it is a field;
+ * the result is only used as a hint.
+ */
+int ForStmt::GetTripCount() const {
+  auto constant = [](Expr *e, int &value) {
+    auto c = dynamic_cast<IntConstant *>(e);
+    if (c)
+      value = c->GetConstant();
+    return c != nullptr;
+  };
+  auto variable = [](Expr *e) -> VarDecl * {
+    auto access = dynamic_cast<FieldAccess *>(e);
+    return access && !access->GetBase() ? access->GetVar() : nullptr;
+  };
+
+  auto start = dynamic_cast<AssignExpr *>(init);
+  auto cond = dynamic_cast<RelationalExpr *>(test);
+  auto next = dynamic_cast<AssignExpr *>(step);
+  auto update = next ? dynamic_cast<ArithmeticExpr *>(next->GetRight())
+                     : nullptr;
+  int a, b, c;
+  if (!start || !cond || !update || !update->GetLeft() ||
+      !constant(start->GetRight(), a) || !constant(cond->GetRight(), b) ||
+      !constant(update->GetRight(), c))
+    return -1;
+  auto var = variable(start->GetLeft());
+  if (!var || variable(cond->GetLeft()) != var ||
+      variable(next->GetLeft()) != var ||
+      variable(update->GetLeft()) != var || assigned.count(var))
+    return -1;
+
+  auto op = cond->GetOp()->GetName();
+  if (strcmp(update->GetOp()->GetName(), "-") == 0)
+    c = -c;
+  else if (strcmp(update->GetOp()->GetName(), "+") != 0)
+    return -1;
+  if (strcmp(op, "<=") == 0)
+    b++;
+  else if (strcmp(op, ">=") == 0)
+    b--;
+  else if (strcmp(op, "<") != 0 && strcmp(op, ">") != 0)
+    return -1;
+
+  bool up = op[0] == '<';
+  if ((up && c <= 0) || (!up && c >= 0))
+    return -1;
+  long long distance = up ? (long long)b - a : (long long)a - b;
+  int stride = up ? c : -c;
+  return distance <= 0 ? 0 : (distance + stride - 1) / stride;
+}
+
 void ForStmt::Emit() {
   LoopStmt::Emit();
   init->Emit();
 
+  codeGen.SetTripCount(labelBefore, GetTripCount());
   codeGen.GenLabel(labelBefore);
   test->Emit();
   auto val = test->GetValue();
@@ -198,6 +267,8 @@ void ReturnStmt::Check() {
 void ReturnStmt::Emit() {
   expr->Emit();
   auto val = expr->GetValue();
+  if (FindParentByType<FnDecl *>()->IsMain())
+    codeGen.GenBuiltInCall(ProfileGenerate() ? Profile : Flush);
   codeGen.GenReturn(val);
 }
 
@@ -216,8 +287,40 @@ void PrintStmt::Check() {
   }
 }
 
+// Appends the text a constant argument of Print prints to text, unless
+// the argument is not a constant or holds a null, which would end the
+// string it is merged into.
+static bool AppendConstant(Expr *expr, std::string *text) {
+  if (auto str = dynamic_cast<StringConstant *>(expr)) {
+    std::string value = str->GetString();
+    if (value.find("\\0") != std::string::npos)
+      return false;
+    *text += value.substr(1, value.size() - 2);
+  } else if (auto num = dynamic_cast<IntConstant *>(expr))
+    *text += std::to_string(num->GetConstant());
+  else if (auto flag = dynamic_cast<BoolConstant *>(expr))
+    *text += flag->GetConstant() ? "true" : "false";
+  else
+    return false;
+  return true;
+}
+
 void PrintStmt::Emit() {
-  for (auto expr : args->Get()) {
+  auto &exprs = args->Get();
+  for (int i = 0; i < exprs.size(); i++) {
+    // adjacent constants are printed as one string
+    std::string text;
+    int end = i;
+    while (end < exprs.size() && AppendConstant(exprs[end], &text))
+      end++;
+    if (end - i > 1) {
+      auto str = codeGen.GenLoadConstant(("\"" + text + "\"").c_str());
+      codeGen.GenBuiltInCall(PrintString, str);
+      i = end - 1;
+      continue;
+    }
+
+    auto expr = exprs[i];
     expr->Emit();
     auto type = expr->GetType();
     auto val = expr->GetValue();
@@ -228,4 +331,38 @@ void PrintStmt::Emit() {
     else if (type == Type::boolType)
       codeGen.GenBuiltInCall(PrintBool, val);
   }
-}
\ No newline at end of file
+}
+
+DeleteStmt::DeleteStmt(Expr *a) {
+  Assert(a != NULL);
+  (arg = a)->SetParent(this);
+}
+
+void DeleteStmt::Check() {
+  auto type = arg->Eval();
+  auto namedType = dynamic_cast<NamedType *>(type);
+  if (type != Type::errorType && !(namedType && namedType->FindClassDecl()))
+    ReportError::DeleteArgMismatch(arg, type);
+}
+
+void DeleteStmt::Emit() {
+  arg->Emit();
+  auto obj = arg->GetValue();
+  // the collector finds dead objects by itself
+  if (GCEnabled())
+    return;
+  auto cls = dynamic_cast<NamedType *>(arg->GetType())->FindClassDecl();
+  if (cls->IsSizeFixed()) {
+    auto size = codeGen.GenLoadConstant(cls->GetSize());
+    codeGen.GenBuiltInCall(Delete, obj, size);
+    return;
+  }
+  // the object may be of a derived class, whose size is in the word
+  // before its vtable
+  auto skip = codeGen.NewLabel();
+  codeGen.GenIfZ(obj, skip);
+  auto vtable = codeGen.GenLoad(obj, 0, "vtable");
+  auto size = codeGen.GenLoad(vtable, -codeGen.VarSize, "size");
+  codeGen.GenBuiltInCall(Delete, obj, size);
+  codeGen.GenLabel(skip);
+}
@@ -14,6 +14,7 @@
 
 #include "ast.h"
 #include "list.h"
+#include <set>
 
 class Decl;
 class VarDecl;
@@ -75,11 +76,18 @@ public:
 class ForStmt : public LoopStmt {
 protected:
   Expr *init, *step;
+  std::set<VarDecl *> assigned; // in the test or the body
 
 public:
   ForStmt(Expr *init, Expr *test, Expr *step, Stmt *body);
   void Check();
   void Emit();
+  // Records, for an assignment to var below child, a child of the loop,
+  // that var changes outside the init and the step.
+  void NoteAssigned(Node *child, VarDecl *var);
+  // Number of iterations when the loop counts a variable from one
+  // constant to another by a constant step, or -1.
+  int GetTripCount() const;
 };
 
 class WhileStmt : public LoopStmt {
@@ -129,4 +137,16 @@ public:
   void Emit();
 };
 
+// Delete(obj) hands an object back to the allocator, which reuses its
+// block for the next object of the same size.
+class DeleteStmt : public Stmt {
+protected:
+  Expr *arg;
+
+public:
+  DeleteStmt(Expr *arg);
+  void Check();
+  void Emit();
+};
+
 #endif
@@ -7,6 +7,9 @@
 
 #include "codegen.h"
 #include "mips.h"
+#include "profile.h"
+#include "runtime.h"
+#include "timing.h"
 #include "tac.h"
 #include <algorithm>
 #include <string.h>
@@ -26,6 +29,17 @@ CodeGenerator &CodeGenerator::Instance() {
 
 int CodeGenerator::GetFrameSize() { return VarSize * localCounter; }
 
+int CodeGenerator::GetParamSize() { return VarSize * paramCounter; }
+
+void CodeGenerator::SetTripCount(const char *header, int count) {
+  tripCounts[header] = count;
+}
+
+int CodeGenerator::GetTripCount(const char *header) const {
+  auto iter = tripCounts.find(header);
+  return iter == tripCounts.end() ? -1 : iter->second;
+}
+
 char *CodeGenerator::NewLabel() {
   static int nextLabelNum = 0;
   char temp[10];
@@ -64,6 +78,12 @@ Location *CodeGenerator::GenParamVar(const char *name) {
   return new Location(fpRelative, offset, name);
 }
 
+Location *CodeGenerator::GenFrameVar(BeginFunc *fn, const char *name) {
+  int frameSize = fn->GetFrameSize();
+  fn->SetFrameSize(frameSize + VarSize);
+  return new Location(fpRelative, OffsetToFirstLocal - frameSize, name);
+}
+
 Location *CodeGenerator::GenThis() {
   static auto loc = new Location(fpRelative, OffsetToFirstParam, "this");
   return loc;
@@ -91,14 +111,16 @@ void CodeGenerator::GenAssign(Location *dst, Location *src) {
   code->Append(new Assign(dst, src));
 }
 
-Location *CodeGenerator::GenLoad(Location *ref, int offset) {
+Location *CodeGenerator::GenLoad(Location *ref, int offset,
+                                 const char *region) {
   Location *result = GenTempVar();
-  code->Append(new Load(result, ref, offset));
+  code->Append(new Load(result, ref, offset, region));
   return result;
 }
 
-void CodeGenerator::GenStore(Location *dst, Location *src, int offset) {
-  code->Append(new Store(dst, src, offset));
+void CodeGenerator::GenStore(Location *dst, Location *src, int offset,
+                             const char *region) {
+  code->Append(new Store(dst, src, offset, region));
 }
 
 Location *CodeGenerator::GenBinaryOp(const char *opName, Location *op1,
@@ -113,7 +135,9 @@ void CodeGenerator::GenLabel(const char *label) {
 }
 
 void CodeGenerator::GenIfZ(Location *test, const char *label) {
-  code->Append(new IfZ(test, label));
+  auto branch = new IfZ(test, label);
+  branch->SetProbe(NewProbes(2, label));
+  code->Append(branch);
 }
 
 void CodeGenerator::GenGoto(const char *label) {
@@ -124,6 +148,8 @@ void CodeGenerator::GenReturn(Location *val) { code->Append(new Return(val)); }
 
 BeginFunc *CodeGenerator::GenBeginFunc() {
   BeginFunc *result = new BeginFunc;
+  auto label = dynamic_cast<Label *>(code->Nth(code->NumElements() - 1));
+  result->SetProbe(NewProbes(1, label ? label->GetLabel() : ""));
   code->Append(result);
   return result;
 }
@@ -151,9 +177,10 @@ Location *CodeGenerator::GenLCall(const char *label, bool fnHasReturnValue) {
   return result;
 }
 
-Location *CodeGenerator::GenACall(Location *fnAddr, bool fnHasReturnValue) {
+Location *CodeGenerator::GenACall(Location *fnAddr, bool fnHasReturnValue,
+                                  const char *method) {
   Location *result = fnHasReturnValue ? GenTempVar() : NULL;
-  code->Append(new ACall(fnAddr, result));
+  code->Append(new ACall(fnAddr, result, method));
   return result;
 }
 
@@ -164,7 +191,9 @@ static struct _builtin {
 } builtins[] = {{"_Alloc", 1, true},       {"_ReadLine", 0, true},
                 {"_ReadInteger", 0, true}, {"_StringEqual", 2, true},
                 {"_PrintInt", 1, false},   {"_PrintString", 1, false},
-                {"_PrintBool", 1, false},  {"_Halt", 0, false}};
+                {"_PrintBool", 1, false},  {"_Halt", 0, false},
+                {"_Delete", 2, false},     {"_Flush", 0, false},
+                {"_Profile", 0, false}};
 
 Location *CodeGenerator::GenBuiltInCall(BuiltIn bn, Location *arg1,
                                         Location *arg2) {
@@ -187,9 +216,38 @@ Location *CodeGenerator::GenBuiltInCall(BuiltIn bn, Location *arg1,
   return result;
 }
 
+Location *CodeGenerator::GenStringEqual(Location *str, const char *literal) {
+  int length = Mips::StringLength(literal);
+  int limit = GetIntOption("inline-strcmp", 32);
+  auto lit = GenLoadConstant(literal);
+  if (!limit || length > limit)
+    return GenBuiltInCall(StringEqual, str, lit);
+
+  // Both strings are padded with nulls to a whole word, so they are
+  // equal if the words up to the null of the literal are. Strings of
+  // the same length need only the words holding chars compared.
+  bool prefixed = GetIntOption("string-length", 1);
+  auto eq = GenLoadConstant(0);
+  auto out = NewLabel();
+  if (prefixed) {
+    auto same = GenBinaryOp("==", GenLoad(str, -VarSize, "string"),
+                            GenLoadConstant(length));
+    GenIfZ(same, out);
+  }
+  for (int offset = 0; offset < length + !prefixed; offset += VarSize) {
+    auto same = GenBinaryOp("==", GenLoad(str, offset, "string"),
+                            GenLoad(lit, offset, "string"));
+    GenIfZ(same, out);
+  }
+  code->Append(new LoadConstant(eq, 1));
+  GenLabel(out);
+  return eq;
+}
+
 void CodeGenerator::GenVTable(const char *className,
-                              List<const char *> *methodLabels) {
-  code->Append(new VTable(className, methodLabels));
+                              List<const char *> *methodLabels,
+                              const std::vector<int> &header) {
+  code->Append(new VTable(className, methodLabels, header));
 }
 
 void CodeGenerator::DoFinalCodeGen() {
@@ -205,11 +263,19 @@ void CodeGenerator::DoFinalCodeGen() {
 }
 
 void CodeGenerator::CollectLabels() {
+  labels->clear();
   for (auto inst : code->Get())
     if (auto label = dynamic_cast<Label *>(inst))
       labels->emplace(label->GetLabel(), label);
 }
 
+const char *CodeGenerator::FunctionName(int begin) const {
+  auto entry = begin > 0 ? dynamic_cast<Label *>(code->Nth(begin - 1)) : NULL;
+  return entry && dynamic_cast<BeginFunc *>(code->Nth(begin))
+             ? entry->GetLabel()
+             : NULL;
+}
+
 void Goto::AddSucc(Instruction *) {
   auto labels = codeGen.GetLabels();
   auto inst = labels->at(label);
@@ -233,10 +299,15 @@ void CodeGenerator::BuildControlFlow(int begin, int end) {
 }
 
 void CodeGenerator::LiveAnalyze(int begin, int end) {
+  auto fn = FunctionName(begin);
+  PhaseTimer timer("liveness", fn);
   bool changed = true;
   while (changed) {
+    CountEvent("liveness iters", 1, fn);
     changed = false;
-    for (int i = begin; i < end; ++i) {
+    // backwards, the way liveness flows, so that a pass carries it
+    // through a whole block rather than one instruction
+    for (int i = end - 1; i >= begin; --i) {
       auto inst = code->Nth(i);
       if (inst->UpdateLiveVar())
         changed = true;
@@ -256,8 +327,12 @@ void CodeGenerator::DeadCodeElim() {
 }
 
 void CodeGenerator::AllocRegister(int begin, int end) {
+  auto fn = FunctionName(begin);
+  PhaseTimer timer("regalloc", fn);
   Graph<Location *> graph;
   LocationSet varSet;
+  std::map<Location *, double> cost;
+  RegAllocStats stats = {fn ? fn : "?"};
 
   for (int i = begin; i < end; ++i) {
     auto inst = code->Nth(i);
@@ -266,29 +341,146 @@ void CodeGenerator::AllocRegister(int begin, int end) {
     std::set_union(kill.begin(), kill.end(), out.begin(), out.end(),
                    std::inserter(interf, interf.begin()));
 
+    // globals live in memory so that other functions see their values
+    for (auto set : {&interf, &kill, &gen})
+      for (auto iter = set->begin(); iter != set->end();)
+        if ((*iter)->GetSegment() == gpRelative)
+          iter = set->erase(iter);
+        else
+          ++iter;
+
     for (auto u : interf)
       for (auto v : interf) {
         graph.AddEdge(u, v);
       }
+    stats.pressure = std::max(stats.pressure, (int)interf.size());
 
     std::set_union(kill.begin(), kill.end(), gen.begin(), gen.end(),
                    std::inserter(varSet, varSet.begin()));
   }
 
+  // spill cost: uses and defs weighted by how often they run
+  for (int i = begin; i < end; ++i) {
+    auto inst = code->Nth(i);
+    LocationSet used = inst->Gen(), killed = inst->Kill();
+    used.insert(killed.begin(), killed.end());
+    for (auto loc : used)
+      cost[loc] += inst->GetFrequency();
+  }
+  for (auto &c : cost)
+    graph.SetCost(c.first, c.second);
+
+  stats.vertices = graph.NumVerts();
+  stats.edges = graph.NumEdges();
+  CountEvent("edges", stats.edges, fn);
   graph.KColor(Mips::NumGeneralPurposeRegs);
   auto color = graph.GetColor();
 
+  std::set<int> used;
   for (auto var : varSet) {
     auto index = color[var];
     if (index > 0) {
       auto reg = Mips::Register((int)Mips::t0 + index - 1);
       var->SetRegister(reg);
+      used.insert(index);
+    } else {
+      // `this` is one Location shared by every method, so a register an
+      // earlier function gave it must not stick
+      var->SetRegister(Mips::zero);
+      CountEvent("spilled", 1, fn);
+      stats.inMemory++;
     }
   }
+  stats.locations = varSet.size();
+  stats.colors = used.size();
+  regAllocStats.push_back(stats);
+}
+
+void CodeGenerator::ReportRegAlloc() {
+  const char *json = GetOption("regalloc-json");
+  if (!IsDebugOn("regalloc") && !json)
+    return;
+
+  RegAllocStats total = {"(all)"};
+  for (auto &s : regAllocStats) {
+    total.locations += s.locations;
+    total.vertices += s.vertices;
+    total.edges += s.edges;
+    total.pressure = std::max(total.pressure, s.pressure);
+    total.colors = std::max(total.colors, s.colors);
+    total.inMemory += s.inMemory;
+    total.emitted.fills += s.emitted.fills;
+    total.emitted.spills += s.emitted.spills;
+    total.emitted.callFills += s.emitted.callFills;
+    total.emitted.callSpills += s.emitted.callSpills;
+  }
+
+  if (IsDebugOn("regalloc")) {
+    fprintf(stderr, "regalloc: %-20s %5s %5s %6s %8s %6s %6s %6s %6s %6s %6s\n",
+            "function", "locs", "verts", "edges", "pressure", "colors",
+            "memory", "fills", "spills", "call f", "call s");
+    auto print = [](const RegAllocStats &s) {
+      fprintf(stderr,
+              "          %-20s %5d %5d %6d %8d %6d %6d %6d %6d %6d %6d\n",
+              s.fn, s.locations, s.vertices, s.edges, s.pressure, s.colors,
+              s.inMemory, s.emitted.fills, s.emitted.spills,
+              s.emitted.callFills, s.emitted.callSpills);
+    };
+    for (auto &s : regAllocStats)
+      print(s);
+    print(total);
+  }
+
+  if (!json)
+    return;
+  FILE *file = fopen(json, "w");
+  if (!file) {
+    fprintf(stderr, "dcc: cannot write %s\n", json);
+    return;
+  }
+  auto print = [file](const RegAllocStats &s) {
+    fprintf(file,
+            "{\"function\": \"%s\", \"locations\": %d, \"vertices\": %d, "
+            "\"edges\": %d, \"pressure\": %d, \"colors\": %d, "
+            "\"in_memory\": %d, \"fills\": %d, \"spills\": %d, "
+            "\"call_fills\": %d, \"call_spills\": %d}",
+            s.fn, s.locations, s.vertices, s.edges, s.pressure, s.colors,
+            s.inMemory, s.emitted.fills, s.emitted.spills, s.emitted.callFills,
+            s.emitted.callSpills);
+  };
+  fprintf(file, "{\"registers\": %d,\n \"functions\": [",
+          Mips::NumGeneralPurposeRegs);
+  for (size_t i = 0; i < regAllocStats.size(); i++) {
+    fprintf(file, i ? ",\n  " : "\n  ");
+    print(regAllocStats[i]);
+  }
+  fprintf(file, "],\n \"total\": ");
+  print(total);
+  fprintf(file, "}\n");
+  fclose(file);
 }
 
 void CodeGenerator::PostProcess() {
-  CollectLabels();
+  // every pass is timed for -d timing
+  auto run = [this](const char *phase, void (CodeGenerator::*pass)()) {
+    PhaseTimer timer(phase);
+    (this->*pass)();
+  };
+  run("labels", &CodeGenerator::CollectLabels);
+  run("devirtualize", &CodeGenerator::Devirtualize);
+  run("inline", &CodeGenerator::Inline);
+  run("tail calls", &CodeGenerator::EliminateTailCalls);
+  run("summaries", &CodeGenerator::ComputeSummaries);
+  run("stack alloc", &CodeGenerator::AllocateOnStack);
+  run("globals", &CodeGenerator::PromoteGlobals);
+  run("redundancy", &CodeGenerator::EliminateRedundancy);
+  if (GetIntOption("ssa", 0))
+    run("ssa", &CodeGenerator::RunSSA);
+  run("strength", &CodeGenerator::ReduceStrength);
+  run("unroll", &CodeGenerator::UnrollLoops);
+  run("expand alloc", &CodeGenerator::ExpandAllocations);
+  run("layout", &CodeGenerator::LayoutBlocks);
+  run("loops", &CodeGenerator::AnnotateLoops);
 
   int begin = 0, end = 0;
   for (int i = 0; i < code->NumElements(); ++i) {
@@ -308,7 +500,25 @@ void CodeGenerator::PostProcess() {
   }
   // DoFinalCodeGeneration(end, code->NumElements());
 
-  DeadCodeElim();
+  {
+    PhaseTimer timer("dce");
+    DeadCodeElim();
+  }
+
+  // the runtime routines and data the final code refers to
+  for (int i = 0; i < code->NumElements(); ++i) {
+    auto inst = code->Nth(i);
+    if (auto call = dynamic_cast<LCall *>(inst))
+      RuntimeUse(call->GetLabel());
+    else if (auto call = dynamic_cast<TailCall *>(inst)) {
+      if (call->GetLabel())
+        RuntimeUse(call->GetLabel());
+    } else if (auto load = dynamic_cast<LoadLabel *>(inst))
+      RuntimeUse(load->GetLabel());
+  }
+  // the counters bumped by the emitted code
+  if (ProfileGenerate())
+    RuntimeUse("_Profile");
 
   begin = end = 0;
   for (int i = 0; i < code->NumElements(); ++i) {
@@ -319,6 +529,8 @@ void CodeGenerator::PostProcess() {
     } else if (dynamic_cast<EndFunc *>(inst)) {
       end = i;
 
+      auto fn = FunctionName(begin);
+      CountEvent("tac", end - begin + 1, fn);
       BuildControlFlow(begin, end);
       LiveAnalyze(begin, end);
 
@@ -327,9 +539,15 @@ void CodeGenerator::PostProcess() {
     }
   }
   DoFinalCodeGeneration(end, code->NumElements());
+  if (!IsDebugOn("tac")) {
+    PhaseTimer timer("emit");
+    Mips::EmitStringPool();
+  }
+  ReportRegAlloc();
 }
 
 void CodeGenerator::DoFinalCodeGeneration(int begin, int end) {
+  PhaseTimer timer("emit", FunctionName(begin));
   if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
     for (int i = begin; i < end; ++i)
       code->Nth(i)->Print();
@@ -338,5 +556,9 @@ void CodeGenerator::DoFinalCodeGeneration(int begin, int end) {
     mips.EmitPreamble();
     for (int i = begin; i < end; ++i)
       code->Nth(i)->Emit(&mips);
+    // the fills and spills of the function just allocated registers for
+    if (begin < end && dynamic_cast<BeginFunc *>(code->Nth(begin)) &&
+        !regAllocStats.empty())
+      regAllocStats.back().emitted = mips.counts;
   }
 }
\ No newline at end of file
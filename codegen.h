@@ -15,12 +15,14 @@
 #define _H_codegen
 
 #include "list.h"
+#include "modref.h"
 #include "tac.h"
 #include <algorithm>
 #include <map>
 #include <numeric>
 #include <set>
 #include <stdlib.h>
+#include <string>
 #include <vector>
 
 // These codes are used to identify the built-in functions
@@ -33,9 +35,14 @@ typedef enum {
   PrintString,
   PrintBool,
   Halt,
+  Delete,
+  Flush,
+  Profile,
   NumBuiltIns
 } BuiltIn;
 
+class FlowGraph;
+
 class CodeGenerator {
 private:
   List<Instruction *> *code;
@@ -48,12 +55,71 @@ private:
   CodeGenerator();
 
   void CollectLabels();
+  // The label of the function whose BeginFunc is code[begin], or NULL.
+  const char *FunctionName(int begin) const;
 
   void BuildControlFlow(int begin, int end);
   void LiveAnalyze(int begin, int end);
   void AllocRegister(int begin, int end);
   void DeadCodeElim();
 
+  // What AllocRegister made of each function, in code order, with the
+  // fills and spills emitted for it. ReportRegAlloc prints it for
+  // -d regalloc and writes it to the file given by -fregalloc-json.
+  struct RegAllocStats {
+    const char *fn;
+    int locations;       // the non-global variables the function uses
+    int vertices, edges; // of the interference graph
+    int pressure;        // the most variables live at once
+    int colors;          // registers used
+    int inMemory;        // variables left in memory (color 0)
+    Mips::SpillCounts emitted;
+  };
+  std::vector<RegAllocStats> regAllocStats;
+  void ReportRegAlloc();
+
+  // Interprocedural passes over the whole code list, run by PostProcess
+  // before the per-function analyses. See devirt.cc, inline.cc,
+  // tailcall.cc and globals.cc.
+  void Devirtualize();
+  void Inline();
+  void EliminateTailCalls();
+  void PromoteGlobals();
+
+  // Side-effect summaries of every function, by label, and the load and
+  // call elimination that uses them. See modref.cc.
+  std::map<std::string, Summary> summaries;
+  void ComputeSummaries();
+  void EliminateRedundancy();
+
+  // Escape analysis, see escape.cc. ComputeEscapes adds the params that
+  // may escape to the summaries; AllocateOnStack moves objects that do
+  // not escape into the frame or into locals.
+  void ComputeEscapes();
+  void AllocateOnStack();
+
+  // The SSA round trip, see ssa.cc. With -fssa each function is put
+  // into SSA form and back after the passes above; no pass uses it yet.
+  typedef std::vector<std::pair<Location *, Location *>> CopyList;
+  void RunSSA();
+  int BuildSSA(FlowGraph &graph);
+  int CoalesceVersions(FlowGraph &graph);
+  int DestructSSA(FlowGraph &graph);
+  std::vector<Instruction *> SequentializeCopies(BeginFunc *fn,
+                                                 const CopyList &copies);
+  Location *NewVersion(BeginFunc *fn, Location *loc);
+
+  // Trip counts of counted loops, by the label of the loop header, as
+  // recorded by ForStmt::Emit. See loops.cc.
+  std::map<std::string, int> tripCounts;
+  void AnnotateLoops();
+  void ReduceStrength();
+  void UnrollLoops();
+  // Expands calls to _Alloc into an inline fast path, see alloc.cc.
+  void ExpandAllocations();
+  // Orders the blocks of each function by the profile, see layout.cc.
+  void LayoutBlocks();
+
   void DoFinalCodeGeneration(int begin, int end);
 
 public:
@@ -75,6 +141,16 @@ public:
   std::map<std::string, Label *> *GetLabels() { return labels; }
 
   int GetFrameSize();
+  int GetParamSize();
+
+  // Records that the loop with the given header label runs count times
+  // (-1 if unknown). Passes that copy a loop give the copy the same count.
+  void SetTripCount(const char *header, int count);
+  int GetTripCount(const char *header) const;
+
+  // The effects of an LCall, ACall or TailCall, as computed by the last
+  // ComputeSummaries.
+  Summary GetSummary(Instruction *call) const;
 
   // Assigns a new unique label name and returns it. Does not
   // generate any Tac instructions (see GenLabel below if needed)
@@ -88,6 +164,11 @@ public:
   Location *GenParamVar(const char *name);
   Location *GenThis();
 
+  // Creates a new local in the frame of an already generated function,
+  // growing the frame size recorded in its BeginFunc. Used by the
+  // optimizer once code generation for the function is finished.
+  Location *GenFrameVar(BeginFunc *fn, const char *name);
+
   // Generates Tac instructions to load a constant value. Creates
   // a new temp var to hold the result. The constant
   // value is passed as an integer, it can be 0 for integer zero,
@@ -109,7 +190,9 @@ public:
   // (most likely computed from an array or field offset calculation).
   // The optional offset argument can be used to offset the addr by a
   // positive/negative number of bytes. If not given, 0 is assumed.
-  void GenStore(Location *addr, Location *val, int offset = 0);
+  // The region, if known, names the memory written (see Load in tac.h).
+  void GenStore(Location *addr, Location *val, int offset = 0,
+                const char *region = NULL);
 
   // Generates Tac instructions to dereference addr and load contents
   // from a memory location into a new temp var. addr should hold a
@@ -117,8 +200,10 @@ public:
   // field offset calculation). Returns the Location for the new
   // temporary variable where the result was stored. The optional
   // offset argument can be used to offset the addr by a positive or
-  // negative number of bytes. If not given, 0 is assumed.
-  Location *GenLoad(Location *addr, int offset = 0);
+  // negative number of bytes. If not given, 0 is assumed. The region,
+  // if known, names the memory read.
+  Location *GenLoad(Location *addr, int offset = 0,
+                    const char *region = NULL);
 
   // Generates Tac instructions to perform one of the binary ops
   // identified by string name, such as "+" or "==".  Returns a
@@ -150,7 +235,10 @@ public:
   // described above, in terms of return type.
   // The fnAddr Location is expected to hold the address of
   // the code to jump to (typically it was read from the vtable)
-  Location *GenACall(Location *fnAddr, bool fnHasReturnValue);
+  // The method name, if given, lets the optimizer find the methods
+  // that may be called.
+  Location *GenACall(Location *fnAddr, bool fnHasReturnValue,
+                     const char *method = NULL);
 
   // Generates the Tac instructions to call one of
   // the built-in functions (Read, Print, Alloc, etc.) Although
@@ -164,6 +252,13 @@ public:
   Location *GenBuiltInCall(BuiltIn b, Location *arg1 = NULL,
                            Location *arg2 = NULL);
 
+  // Generates the Tac instructions to compare the string in str with
+  // the string literal (quotes included) and returns the temp holding
+  // whether they are equal. Literals of up to -finline-strcmp=n chars
+  // (32) are compared a word at a time in line, longer ones by a call
+  // to _StringEqual.
+  Location *GenStringEqual(Location *str, const char *literal);
+
   // These methods generate the Tac instructions for various
   // control flow (branches, jumps, returns, labels)
   // One minor detail to mention is that you can pass NULL
@@ -184,7 +279,9 @@ public:
   // methods in the order they should be laid out.  The vtable
   // is tagged with a label of the class name, so when you later
   // need access to the vtable, you use LoadLabel of class name.
-  void GenVTable(const char *className, List<const char *> *methodLabels);
+  // The header words are laid out right before the label.
+  void GenVTable(const char *className, List<const char *> *methodLabels,
+                 const std::vector<int> &header = {});
 
   void PostProcess();
 
@@ -202,6 +299,7 @@ template <typename T> class Graph {
 
   std::map<T, Value> data;
   std::map<T, int> color;
+  std::map<T, double> cost;
 
   void RemoveVert(T u) {
     for (auto v : data.at(u))
@@ -210,6 +308,10 @@ template <typename T> class Graph {
   }
 
 public:
+  // The cost of leaving u in memory; when every vertex has k or more
+  // neighbors, the one with the lowest cost per neighbor is spilled.
+  void SetCost(T u, double cost) { this->cost[u] = cost; }
+
   void AddEdge(T u, T v) {
     if (u == v)
       data[u];
@@ -237,7 +339,12 @@ public:
         data.begin(), data.end(),
         [k](const std::pair<T, Value> &p) { return p.second.size() < k; });
     if (iter == data.end())
-      iter = data.begin();
+      iter = std::min_element(
+          data.begin(), data.end(),
+          [this](const std::pair<T, Value> &p, const std::pair<T, Value> &q) {
+            return cost[p.first] / p.second.size() <
+                   cost[q.first] / q.second.size();
+          });
 
     u = iter->first;
     e = iter->second;
@@ -260,6 +367,14 @@ public:
   }
 
   const std::map<T, int> &GetColor() const { return color; }
+
+  int NumVerts() const { return data.size(); }
+  int NumEdges() const {
+    int degrees = 0;
+    for (auto &u : data)
+      degrees += u.second.size();
+    return degrees / 2;
+  }
 };
 
 #endif
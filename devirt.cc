@@ -0,0 +1,133 @@
+/* File: devirt.cc
+ * ---------------
+ * Devirtualization of method calls whose receiver was allocated in the
+ * same function. Call::Emit already binds calls to methods that no
+ * derived class overrides (see ClassDecl::IsOverridden); this pass handles
+ * the remaining ACalls by following the class of a NewExpr forward:
+ *
+ *      _tmp0 = LCall _Alloc          (NewExpr)
+ *      _tmp1 = Cow                   LoadLabel
+ *      *(_tmp0) = _tmp1              Store of the vtable
+ *      c = _tmp0
+ *      _tmp2 = *(c)                  vtable of c is Cow
+ *      _tmp3 = *(_tmp2 + 4)          slot 1 of Cow is _Cow.Moo
+ *      ACall _tmp3                => LCall _Cow.Moo
+ *
+ * Facts about a location are dropped when it is redefined and, for
+ * locations defined more than once, at every label. The vtable word of an
+ * object is only written by NewExpr, so stores and calls never change
+ * what is known. Globals are left alone since any call may reassign
+ * them. The loads of the vtable and the method address become dead and
+ * are removed by DeadCodeElim. -fno-devirtualize turns both this pass
+ * and the binding in Call::Emit off.
+ */
+
+#include "codegen.h"
+#include "tac.h"
+
+namespace {
+
+// What is known about the value held by a location.
+struct Fact {
+  enum Kind { Object, VTableAddr, MethodAddr } kind;
+  const char *label; // the class, the vtable or the method
+};
+
+typedef std::map<Location *, Fact> FactMap;
+typedef std::map<std::string, List<const char *> *> VTableMap;
+
+} // namespace
+
+void CodeGenerator::Devirtualize() {
+  if (!GetIntOption("devirtualize", 1))
+    return;
+
+  VTableMap vtables;
+  for (auto inst : code->Get())
+    if (auto vtable = dynamic_cast<VTable *>(inst))
+      vtables[vtable->GetLabel()] = vtable->GetMethodLabels();
+
+  int numDevirtualized = 0;
+  std::map<Location *, int> numDefs;
+  FactMap facts;
+  for (int i = 0; i < code->NumElements(); i++) {
+    auto inst = code->Nth(i);
+
+    if (dynamic_cast<BeginFunc *>(inst)) {
+      numDefs.clear();
+      facts.clear();
+      for (int j = i; !dynamic_cast<EndFunc *>(code->Nth(j)); j++)
+        for (auto loc : code->Nth(j)->Kill())
+          numDefs[loc]++;
+      continue;
+    }
+    if (dynamic_cast<Label *>(inst)) {
+      for (auto iter = facts.begin(); iter != facts.end();)
+        if (numDefs[iter->first] > 1)
+          iter = facts.erase(iter);
+        else
+          ++iter;
+      continue;
+    }
+
+    if (auto call = dynamic_cast<ACall *>(inst)) {
+      auto iter = facts.find(call->GetMethodAddr());
+      if (iter != facts.end() && iter->second.kind == Fact::MethodAddr) {
+        if (IsDebugOn("devirt"))
+          fprintf(stderr, "devirt: %s\n", iter->second.label);
+        inst = new LCall(iter->second.label, call->GetDst());
+        code->Get()[i] = inst;
+        numDevirtualized++;
+      }
+    }
+
+    // the vtable store does not define a location, it records the class
+    if (auto store = dynamic_cast<Store *>(inst)) {
+      auto iter = facts.find(store->GetSrc());
+      if (store->GetOffset() == 0 && iter != facts.end() &&
+          iter->second.kind == Fact::VTableAddr)
+        facts[store->GetDst()] = {Fact::Object, iter->second.label};
+      continue;
+    }
+
+    Fact fact;
+    bool known = false;
+    if (auto load = dynamic_cast<LoadLabel *>(inst)) {
+      if (vtables.count(load->GetLabel())) {
+        fact = {Fact::VTableAddr, load->GetLabel()};
+        known = true;
+      }
+    } else if (auto assign = dynamic_cast<Assign *>(inst)) {
+      auto iter = facts.find(assign->GetSrc());
+      if (iter != facts.end()) {
+        fact = iter->second;
+        known = true;
+      }
+    } else if (auto load = dynamic_cast<Load *>(inst)) {
+      auto iter = facts.find(load->GetSrc());
+      if (iter != facts.end() && iter->second.kind == Fact::Object &&
+          load->GetOffset() == 0) {
+        fact = {Fact::VTableAddr, iter->second.label};
+        known = true;
+      } else if (iter != facts.end() &&
+                 iter->second.kind == Fact::VTableAddr) {
+        auto methods = vtables[iter->second.label];
+        int slot = load->GetOffset() / VarSize;
+        if (slot >= 0 && slot < methods->NumElements()) {
+          fact = {Fact::MethodAddr, methods->Nth(slot)};
+          known = true;
+        }
+      }
+    }
+
+    for (auto loc : inst->Kill()) {
+      facts.erase(loc);
+      if (known && loc->GetSegment() != gpRelative)
+        facts[loc] = fact;
+    }
+  }
+
+  if (IsDebugOn("devirt"))
+    fprintf(stderr, "devirt: %d calls bound by allocation site\n",
+            numDevirtualized);
+}
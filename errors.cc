@@ -184,6 +184,12 @@ void ReportError::PrintArgMismatch(Expr *arg, int argIndex, Type *given) {
     EmitError(arg->GetLocation(), s.str());
 }
 
+void ReportError::DeleteArgMismatch(Expr *arg, Type *given) {
+    ostringstream s;
+    s << "Incompatible argument: " << given << " given, object expected";
+    EmitError(arg->GetLocation(), s.str());
+}
+
 void ReportError::TestNotBoolean(Expr *expr) {
     EmitError(expr->GetLocation(), "Test expression must have boolean type");
 }
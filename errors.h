@@ -89,6 +89,7 @@ class ReportError
   static void NumArgsMismatch(Identifier *fnIdentifier, int numExpected, int numGiven);
   static void ArgMismatch(Expr *arg, int argIndex, Type *given, Type *expected);
   static void PrintArgMismatch(Expr *arg, int argIndex, Type *given);
+  static void DeleteArgMismatch(Expr *arg, Type *given);
 
 
   // Errors used by semantic analyzer for field access
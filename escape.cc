@@ -0,0 +1,382 @@
+/* File: escape.cc
+ * ---------------
+ * Escape analysis and stack allocation. A pointer escapes a function
+ * when it may still be used after the function returns: when it is
+ * stored into memory or a global, returned, or passed in a param that
+ * escapes in the callee. The params that escape are part of each
+ * function's Summary (see modref.h) and are found here over the call
+ * graph. A TailCall always lets its params escape, since the callee
+ * runs on the frame of the caller.
+ *
+ * An _Alloc of constant size whose result does not escape is replaced
+ * by the address of a block of frame vars, cleared like the heap except
+ * for the words stored right after. No location holding the object may
+ * be live at the allocation, so that an object from an earlier pass of
+ * a loop, which shares the block, is no longer reachable. If besides
+ * every access to the object has a constant offset, and the pointer is
+ * never compared or passed on, each field becomes a frame var of its
+ * own that the register allocator is free to keep in a register, and
+ * the object is gone (scalar replacement).
+ *
+ * Under the collector (see gc.h) an object that holds references stays
+ * in the heap, since the collector does not scan frames for them.
+ *
+ * -fno-stack-alloc turns the pass off; -fstack-alloc-limit=n sets the
+ * size in bytes of the largest object put in the frame (256), and
+ * -fno-scalar-replace leaves every object in memory. -d escape reports
+ * what happened to each allocation.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "gc.h"
+#include "tac.h"
+#include <string.h>
+
+namespace {
+
+// What a function does with the pointers in some locations.
+struct Flow {
+  LocationSet members;                 // the locations holding them
+  std::map<Location *, int> delta;     // bytes from the start, if constant
+  std::map<int, const char *> regions; // fields accessed, by offset
+  bool escapes, compared, passed, indexed;
+
+  Flow() : escapes(false), compared(false), passed(false), indexed(false) {}
+};
+
+class Tracer {
+  CodeGenerator &codeGen;
+  std::map<Location *, std::vector<Instruction *>> uses;
+  // each PushParam with its call and the index of the param
+  std::map<Instruction *, std::pair<Instruction *, int>> params;
+
+public:
+  std::map<Location *, int> defs;      // number of definitions
+  std::map<Location *, int> constants; // locations with a constant value
+
+  Tracer(CodeGenerator &cg, const std::vector<Instruction *> &body);
+  Flow Trace(const LocationSet &roots) const;
+};
+
+Tracer::Tracer(CodeGenerator &cg, const std::vector<Instruction *> &body)
+    : codeGen(cg) {
+  std::vector<Instruction *> pushes;
+  for (auto inst : body) {
+    for (auto loc : inst->Kill())
+      defs[loc]++;
+    for (auto loc : inst->Gen())
+      uses[loc].push_back(inst);
+    if (dynamic_cast<PushParam *>(inst))
+      pushes.push_back(inst);
+    else if (dynamic_cast<LCall *>(inst) || dynamic_cast<ACall *>(inst) ||
+             dynamic_cast<TailCall *>(inst)) {
+      for (int k = 0; k < (int)pushes.size(); k++)
+        params[pushes[pushes.size() - 1 - k]] = {inst, k};
+      pushes.clear();
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto inst : body) {
+      auto kill = inst->Kill();
+      if (kill.size() != 1 || defs[*kill.begin()] != 1 ||
+          constants.count(*kill.begin()))
+        continue;
+      auto dst = *kill.begin();
+      if (auto load = dynamic_cast<LoadConstant *>(inst))
+        constants[dst] = load->GetValue();
+      else if (auto copy = dynamic_cast<Assign *>(inst)) {
+        if (constants.count(copy->GetSrc()))
+          constants[dst] = constants[copy->GetSrc()];
+      } else if (auto op = dynamic_cast<BinaryOp *>(inst)) {
+        auto a = constants.find(op->GetOp1()), b = constants.find(op->GetOp2());
+        if (a == constants.end() || b == constants.end())
+          continue;
+        if (op->GetCode() == Mips::Add)
+          constants[dst] = a->second + b->second;
+        else if (op->GetCode() == Mips::Sub)
+          constants[dst] = a->second - b->second;
+        else if (op->GetCode() == Mips::Mul)
+          constants[dst] = a->second * b->second;
+      }
+      changed |= constants.count(dst) > 0;
+    }
+  }
+}
+
+Flow Tracer::Trace(const LocationSet &roots) const {
+  Flow flow;
+  std::vector<Location *> work;
+  auto add = [&](Location *loc, bool known, int delta) {
+    if (flow.members.insert(loc).second) {
+      work.push_back(loc);
+      if (known)
+        flow.delta[loc] = delta;
+      // a param slot is read by the callee of a TailCall
+      if (loc->GetSegment() == gpRelative ||
+          (loc->GetOffset() > 0 && !roots.count(loc)))
+        flow.escapes = true;
+    } else if (!known || !flow.delta.count(loc) || flow.delta[loc] != delta)
+      flow.delta.erase(loc);
+  };
+  for (auto root : roots)
+    add(root, true, 0);
+
+  while (!work.empty()) {
+    auto loc = work.back();
+    work.pop_back();
+    auto iter = uses.find(loc);
+    if (iter == uses.end())
+      continue;
+    bool known = flow.delta.count(loc);
+    int delta = known ? flow.delta[loc] : 0;
+    auto access = [&](int offset, const char *region) {
+      if (!known)
+        flow.indexed = true;
+      else if (!flow.regions[delta + offset])
+        flow.regions[delta + offset] = region;
+    };
+
+    for (auto inst : iter->second) {
+      if (auto copy = dynamic_cast<Assign *>(inst))
+        add(copy->GetDst(), known, delta);
+      else if (auto op = dynamic_cast<BinaryOp *>(inst)) {
+        auto other = op->GetOp1() == loc ? op->GetOp2() : op->GetOp1();
+        if (op->GetCode() == Mips::Eq || op->GetCode() == Mips::Less)
+          flow.compared = true;
+        else if (op->GetCode() != Mips::Add || flow.members.count(other))
+          flow.escapes = true;
+        else {
+          auto c = constants.find(other);
+          flow.indexed |= c == constants.end();
+          add(op->GetDst(), known && c != constants.end(),
+              delta + (c != constants.end() ? c->second : 0));
+        }
+      } else if (auto load = dynamic_cast<Load *>(inst))
+        access(load->GetOffset(), load->GetRegion());
+      else if (auto store = dynamic_cast<Store *>(inst)) {
+        if (store->GetSrc() == loc)
+          flow.escapes = true;
+        if (store->GetDst() == loc)
+          access(store->GetOffset(), store->GetRegion());
+      } else if (dynamic_cast<IfZ *>(inst))
+        flow.compared = true;
+      else if (dynamic_cast<PushParam *>(inst)) {
+        auto param = params.find(inst);
+        flow.passed = true;
+        flow.escapes |= param == params.end() ||
+                        dynamic_cast<TailCall *>(param->second.first) ||
+                        codeGen.GetSummary(param->second.first)
+                            .Escapes(param->second.second);
+      } else
+        flow.escapes = true;
+    }
+  }
+  return flow;
+}
+
+} // namespace
+
+void CodeGenerator::ComputeEscapes() {
+  std::map<std::string, std::vector<Instruction *>> bodies;
+  std::map<std::string, std::vector<LocationSet>> params;
+  for (int i = 0; i + 1 < code->NumElements(); i++) {
+    auto label = dynamic_cast<Label *>(code->Nth(i));
+    auto fn = dynamic_cast<BeginFunc *>(code->Nth(i + 1));
+    if (!label || !fn)
+      continue;
+    auto &body = bodies[label->GetLabel()];
+    for (i++; !dynamic_cast<EndFunc *>(code->Nth(i)); i++)
+      body.push_back(code->Nth(i));
+
+    // the locations of a param, as there may be several
+    auto &slots = params[label->GetLabel()];
+    slots.resize(fn->GetParamSize() / VarSize);
+    for (auto inst : body) {
+      LocationSet locs = inst->Gen(), kill = inst->Kill();
+      locs.insert(kill.begin(), kill.end());
+      for (auto loc : locs) {
+        int k = (loc->GetOffset() - OffsetToFirstParam) / VarSize;
+        if (loc->GetSegment() == fpRelative && k >= 0 && k < (int)slots.size())
+          slots[k].insert(loc);
+      }
+    }
+  }
+
+  std::map<std::string, Tracer> tracers;
+  for (auto &fn : bodies)
+    tracers.emplace(fn.first, Tracer(*this, fn.second));
+
+  // params only start escaping, so this ends
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &fn : params) {
+      auto &summary = summaries[fn.first];
+      for (int k = 0; k < (int)fn.second.size(); k++)
+        if (!summary.escapes.count(k) && !fn.second[k].empty() &&
+            tracers.at(fn.first).Trace(fn.second[k]).escapes) {
+          summary.escapes.insert(k);
+          changed = true;
+        }
+    }
+  }
+}
+
+void CodeGenerator::AllocateOnStack() {
+  if (!GetIntOption("stack-alloc", 1))
+    return;
+  int limit = GetIntOption("stack-alloc-limit", 256);
+  bool scalars = GetIntOption("scalar-replace", 1);
+
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    auto fn = dynamic_cast<BeginFunc *>(code->Nth(begin));
+    if (!fn) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    auto entry = dynamic_cast<Label *>(code->Nth(begin - 1));
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    Tracer tracer(*this, body);
+    FlowGraph graph(body);
+    graph.ComputeLiveness();
+
+    // what to put in place of an instruction
+    std::map<Instruction *, std::vector<Instruction *>> replace;
+    for (auto block : graph.GetBlocks()) {
+      auto live = block->liveOut;
+      for (int i = (int)block->code.size() - 1; i >= 0; i--) {
+        auto call = dynamic_cast<LCall *>(block->code[i]);
+        for (auto loc : block->code[i]->Kill())
+          live.erase(loc);
+        for (auto loc : block->code[i]->Gen())
+          live.insert(loc);
+        if (!call || strcmp(call->GetLabel(), "_Alloc") != 0 || i == 0 ||
+            i + 1 == (int)block->code.size())
+          continue;
+        auto push = dynamic_cast<PushParam *>(block->code[i - 1]);
+        auto pop = dynamic_cast<PopParams *>(block->code[i + 1]);
+        if (!push || !pop)
+          continue;
+
+        auto dst = call->GetDst();
+        auto size = tracer.constants.find(push->GetParam());
+        auto flow = tracer.Trace({dst});
+        const char *why = NULL;
+        if (size == tracer.constants.end() || size->second <= 0)
+          why = "not of constant size";
+        else if (size->second >> BlockKindShift)
+          why = "holds references"; // the collector may not see it
+        else if (size->second > limit || size->second % VarSize)
+          why = "not of constant size";
+        else if (flow.escapes)
+          why = "escapes";
+        for (auto loc : flow.members)
+          if (!why && live.count(loc))
+            why = "live at allocation";
+        if (why) {
+          if (IsDebugOn("escape"))
+            fprintf(stderr, "escape: %s: %s %s\n", entry->GetLabel(),
+                    dst->GetName(), why);
+          continue;
+        }
+
+        bool scalar = scalars && !flow.compared && !flow.passed &&
+                      !flow.indexed;
+        for (auto loc : flow.members)
+          scalar &= tracer.defs[loc] == 1;
+        for (auto &field : flow.regions)
+          scalar &= field.first >= 0 && field.first < size->second &&
+                    field.first % VarSize == 0;
+
+        // words stored before the object is read need not be cleared
+        std::set<int> stored;
+        for (int j = i + 2; j < (int)block->code.size(); j++) {
+          auto inst = block->code[j];
+          auto store = dynamic_cast<Store *>(inst);
+          auto load = dynamic_cast<Load *>(inst);
+          if (store && flow.delta.count(store->GetDst()))
+            stored.insert(flow.delta[store->GetDst()] + store->GetOffset());
+          else if ((load && flow.members.count(load->GetSrc())) ||
+                   dynamic_cast<LCall *>(inst) || dynamic_cast<ACall *>(inst))
+            break;
+        }
+
+        replace[push] = replace[pop] = {};
+        auto &init = replace[call];
+        char name[64];
+        if (scalar) {
+          std::map<int, Location *> fields;
+          for (auto &field : flow.regions) {
+            sprintf(name, "%s.%d", dst->GetName(), field.first);
+            fields[field.first] = GenFrameVar(fn, name);
+            if (!stored.count(field.first))
+              init.push_back(new LoadConstant(fields[field.first], 0));
+          }
+          for (auto loc : flow.members)
+            for (auto inst : body) {
+              if (inst->Kill().count(loc) && inst != call)
+                replace[inst] = {};
+              if (auto load = dynamic_cast<Load *>(inst))
+                if (load->GetSrc() == loc)
+                  replace[inst] = {new Assign(
+                      load->GetDst(),
+                      fields[flow.delta[loc] + load->GetOffset()])};
+              if (auto store = dynamic_cast<Store *>(inst))
+                if (store->GetDst() == loc)
+                  replace[inst] = {new Assign(
+                      fields[flow.delta[loc] + store->GetOffset()],
+                      store->GetSrc())};
+            }
+        } else {
+          // the block grows down, so the last var is at the start
+          sprintf(name, "%s.obj", dst->GetName());
+          Location *obj = NULL;
+          for (int w = 0; w < size->second / VarSize; w++)
+            obj = GenFrameVar(fn, name);
+          init.push_back(new LoadAddress(dst, obj));
+          Location *zero = NULL;
+          for (int offset = 0; offset < size->second; offset += VarSize) {
+            if (stored.count(offset))
+              continue;
+            if (!zero) {
+              zero = GenFrameVar(fn, "zero");
+              init.push_back(new LoadConstant(zero, 0));
+            }
+            init.push_back(new Store(dst, zero, offset, flow.regions[offset]));
+          }
+        }
+        if (IsDebugOn("escape"))
+          fprintf(stderr, "escape: %s: %s (%d bytes) %s\n", entry->GetLabel(),
+                  dst->GetName(), size->second,
+                  scalar ? "replaced by scalars" : "in the frame");
+      }
+    }
+
+    for (auto block : graph.GetBlocks()) {
+      std::vector<Instruction *> code;
+      for (auto inst : block->code) {
+        auto iter = replace.find(inst);
+        if (iter == replace.end())
+          code.push_back(inst);
+        else
+          code.insert(code.end(), iter->second.begin(), iter->second.end());
+      }
+      block->code = code;
+    }
+    for (auto inst : graph.Flatten())
+      result->Append(inst);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
@@ -0,0 +1,382 @@
+/* File: flowgraph.cc
+ * ------------------
+ * Implementation of the basic block graph, dominators and block-level
+ * liveness. See flowgraph.h.
+ */
+
+#include "flowgraph.h"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string.h>
+
+// _Halt does not return, so a block ends with it and has no successors
+static bool EndsBlock(Instruction *inst) {
+  auto call = dynamic_cast<LCall *>(inst);
+  return dynamic_cast<Goto *>(inst) || dynamic_cast<IfZ *>(inst) ||
+         dynamic_cast<Return *>(inst) || dynamic_cast<TailCall *>(inst) ||
+         (call && strcmp(call->GetLabel(), "_Halt") == 0);
+}
+
+int BasicBlock::GetLoopDepth() const { return loop ? loop->depth : 0; }
+
+const char *BasicBlock::GetLabel() const {
+  if (auto label = dynamic_cast<Label *>(code.front()))
+    return label->GetLabel();
+  return NULL;
+}
+
+Instruction *BasicBlock::GetBranch() const {
+  return EndsBlock(code.back()) ? code.back() : NULL;
+}
+
+bool BasicBlock::FallsThrough() const {
+  auto branch = GetBranch();
+  return !branch || dynamic_cast<IfZ *>(branch);
+}
+
+FlowGraph::FlowGraph(const std::vector<Instruction *> &body) {
+  begin = dynamic_cast<BeginFunc *>(body.front());
+  Assert(begin && dynamic_cast<EndFunc *>(body.back()));
+
+  BasicBlock *block = NULL;
+  for (auto inst : body) {
+    if (!block || dynamic_cast<Label *>(inst)) {
+      block = new BasicBlock(blocks.size());
+      blocks.push_back(block);
+    }
+    block->code.push_back(inst);
+    if (EndsBlock(inst))
+      block = NULL;
+  }
+
+  // an IfZ to the block that follows anyway is a no-op; a block left
+  // empty has no label and just falls through
+  for (size_t i = 0; i + 1 < blocks.size(); i++) {
+    auto test = dynamic_cast<IfZ *>(blocks[i]->GetBranch());
+    auto next = blocks[i + 1]->GetLabel();
+    if (test && next && strcmp(test->GetLabel(), next) == 0)
+      blocks[i]->code.pop_back();
+  }
+  blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                              [](BasicBlock *block) {
+                                return block->code.empty();
+                              }),
+               blocks.end());
+  Update();
+}
+
+void FlowGraph::Link() {
+  std::map<std::string, BasicBlock *> labels;
+  for (auto block : blocks) {
+    block->succ.clear();
+    block->pred.clear();
+    if (auto label = block->GetLabel())
+      labels[label] = block;
+  }
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    auto block = blocks[i];
+    auto branch = block->GetBranch();
+    if (block->FallsThrough() && i + 1 < blocks.size())
+      block->succ.push_back(blocks[i + 1]);
+    if (auto jump = dynamic_cast<Goto *>(branch))
+      block->succ.push_back(labels.at(jump->GetLabel()));
+    else if (auto jump = dynamic_cast<IfZ *>(branch))
+      block->succ.push_back(labels.at(jump->GetLabel()));
+    for (auto succ : block->succ)
+      succ->pred.push_back(block);
+  }
+}
+
+void FlowGraph::Update() {
+  Link();
+
+  for (auto block : blocks)
+    block->postorder = -1;
+  order.clear();
+  std::function<void(BasicBlock *)> visit = [&](BasicBlock *block) {
+    block->postorder = 0; // visited
+    for (auto succ : block->succ)
+      if (succ->postorder < 0)
+        visit(succ);
+    block->postorder = order.size();
+    order.push_back(block);
+  };
+  visit(blocks[0]);
+  std::reverse(order.begin(), order.end());
+
+  // the block with EndFunc stays so that the function is still closed
+  auto last = blocks.back();
+  if (last->postorder < 0)
+    last->code = {last->code.back()};
+  auto end = std::remove_if(
+      blocks.begin(), blocks.end(),
+      [&](BasicBlock *block) { return block->postorder < 0 && block != last; });
+  if (end != blocks.end()) {
+    blocks.erase(end, blocks.end());
+    Link();
+  }
+}
+
+void FlowGraph::InsertBefore(BasicBlock *block, BasicBlock *before) {
+  int id = 0;
+  for (auto b : blocks)
+    id = std::max(id, b->id + 1);
+  block->id = id;
+  blocks.insert(std::find(blocks.begin(), blocks.end(), before), block);
+}
+
+BasicBlock *FlowGraph::InsertPreheader(Loop *loop, const char *label) {
+  Assert(loop->IsReducible());
+  auto header = loop->headers[0];
+  auto target = header->GetLabel();
+  Assert(target);
+
+  auto pre = new BasicBlock(0);
+  pre->code.push_back(new Label(label));
+  for (auto pred : header->pred) {
+    if (loop->blocks.count(pred))
+      continue;
+    auto &branch = pred->code.back();
+    if (dynamic_cast<Goto *>(branch))
+      branch = new Goto(label);
+    else if (auto jump = dynamic_cast<IfZ *>(branch))
+      if (strcmp(jump->GetLabel(), target) == 0) {
+        auto test = new IfZ(jump->GetTest(), label);
+        test->SetProbe(jump->GetProbe(), jump->GetWeight());
+        branch = test;
+      }
+  }
+
+  // a block of the loop falling through to the header jumps over it
+  auto prev = std::find(blocks.begin(), blocks.end(), header);
+  if (prev != blocks.begin() && loop->blocks.count(*(prev - 1)) &&
+      (*(prev - 1))->FallsThrough()) {
+    auto jump = new BasicBlock(0);
+    jump->code.push_back(new Goto(target));
+    InsertBefore(jump, header);
+    for (auto outer = loop; outer; outer = outer->parent)
+      outer->blocks.insert(jump);
+    jump->loop = loop;
+  }
+  InsertBefore(pre, header);
+  for (auto outer = loop->parent; outer; outer = outer->parent)
+    outer->blocks.insert(pre);
+  pre->loop = loop->parent;
+  Update();
+  return pre;
+}
+
+BasicBlock *FlowGraph::Intersect(BasicBlock *a, BasicBlock *b) const {
+  while (a != b) {
+    while (a->postorder < b->postorder)
+      a = a->idom;
+    while (b->postorder < a->postorder)
+      b = b->idom;
+  }
+  return a;
+}
+
+void FlowGraph::ComputeDominators() {
+  for (auto block : blocks) {
+    block->idom = NULL;
+    block->children.clear();
+  }
+  auto entry = GetEntry();
+  entry->idom = entry;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block : order) {
+      if (block == entry)
+        continue;
+      BasicBlock *idom = NULL;
+      for (auto pred : block->pred)
+        if (pred->idom)
+          idom = idom ? Intersect(pred, idom) : pred;
+      if (block->idom != idom) {
+        block->idom = idom;
+        changed = true;
+      }
+    }
+  }
+
+  entry->idom = NULL;
+  for (auto block : order)
+    if (block->idom)
+      block->idom->children.push_back(block);
+}
+
+void FlowGraph::ComputeFrontiers() {
+  for (auto block : blocks)
+    block->frontier.clear();
+  for (auto block : order) {
+    if (block->pred.size() < 2)
+      continue;
+    for (auto pred : block->pred)
+      for (auto runner = pred; runner && runner != block->idom;
+           runner = runner->idom)
+        if (runner->postorder >= 0)
+          runner->frontier.insert(block);
+  }
+}
+
+bool FlowGraph::Dominates(BasicBlock *a, BasicBlock *b) const {
+  for (; b; b = b->idom)
+    if (a == b)
+      return true;
+  return false;
+}
+
+/* Phis are handled the usual way: a phi defines its dst at the top of
+ * its block, and its n-th argument is live out of the n-th predecessor
+ * only.
+ */
+void FlowGraph::ComputeLiveness() {
+  std::map<BasicBlock *, LocationSet> gen, kill, phiDefs;
+  for (auto block : blocks) {
+    block->liveIn.clear();
+    block->liveOut.clear();
+    for (auto inst : block->code) {
+      if (auto phi = dynamic_cast<Phi *>(inst)) {
+        phiDefs[block].insert(phi->GetDst());
+        continue;
+      }
+      for (auto loc : inst->Gen())
+        if (!kill[block].count(loc))
+          gen[block].insert(loc);
+      for (auto loc : inst->Kill())
+        kill[block].insert(loc);
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto iter = order.rbegin(); iter != order.rend(); ++iter) {
+      auto block = *iter;
+      LocationSet out;
+      for (auto succ : block->succ) {
+        for (auto loc : succ->liveIn)
+          if (!phiDefs[succ].count(loc))
+            out.insert(loc);
+        for (auto inst : succ->code)
+          if (auto phi = dynamic_cast<Phi *>(inst)) {
+            for (size_t i = 0; i < succ->pred.size(); i++)
+              if (succ->pred[i] == block && phi->GetArgs()[i])
+                out.insert(phi->GetArgs()[i]);
+          }
+      }
+      LocationSet in = phiDefs[block];
+      in.insert(gen[block].begin(), gen[block].end());
+      for (auto loc : out)
+        if (!kill[block].count(loc))
+          in.insert(loc);
+      if (in != block->liveIn || out != block->liveOut) {
+        block->liveIn = in;
+        block->liveOut = out;
+        changed = true;
+      }
+    }
+  }
+}
+
+void FlowGraph::ComputeLoops() {
+  loops.clear();
+  for (auto block : blocks)
+    block->loop = NULL;
+  FindLoops(std::set<BasicBlock *>(order.begin(), order.end()), {}, NULL);
+}
+
+/* Finds the strongly connected components of the region, leaving out
+ * edges to the given headers, with Tarjan's algorithm. Each component
+ * with a cycle is a loop, searched again for inner loops.
+ */
+void FlowGraph::FindLoops(const std::set<BasicBlock *> &region,
+                          const std::set<BasicBlock *> &headers,
+                          Loop *parent) {
+  std::map<BasicBlock *, int> index, low;
+  std::vector<BasicBlock *> stack;
+  std::set<BasicBlock *> onStack;
+  std::vector<std::set<BasicBlock *>> components;
+  auto inside = [&](BasicBlock *block) {
+    return region.count(block) && !headers.count(block);
+  };
+
+  std::function<void(BasicBlock *)> connect = [&](BasicBlock *block) {
+    int number = index.size();
+    index[block] = low[block] = number;
+    stack.push_back(block);
+    onStack.insert(block);
+    for (auto succ : block->succ) {
+      if (!inside(succ))
+        continue;
+      if (!index.count(succ)) {
+        connect(succ);
+        low[block] = std::min(low[block], low[succ]);
+      } else if (onStack.count(succ))
+        low[block] = std::min(low[block], index[succ]);
+    }
+    if (low[block] == index[block]) {
+      std::set<BasicBlock *> component;
+      BasicBlock *top;
+      do {
+        top = stack.back();
+        stack.pop_back();
+        onStack.erase(top);
+        component.insert(top);
+      } while (top != block);
+      components.push_back(component);
+    }
+  };
+  for (auto block : order) // keeps the result in a stable order
+    if (region.count(block) && !index.count(block))
+      connect(block);
+
+  for (auto &component : components) {
+    auto block = *component.begin();
+    if (component.size() == 1 &&
+        (headers.count(block) ||
+         std::find(block->succ.begin(), block->succ.end(), block) ==
+             block->succ.end()))
+      continue;
+
+    auto loop = new Loop;
+    loop->blocks = component;
+    loop->parent = parent;
+    if (parent) {
+      loop->depth = parent->depth + 1;
+      parent->children.push_back(loop);
+    }
+    for (auto block : order)
+      if (component.count(block)) {
+        block->loop = loop;
+        for (auto pred : block->pred)
+          if (!component.count(pred)) {
+            loop->headers.push_back(block);
+            break;
+          }
+      }
+    loops.push_back(loop);
+    FindLoops(component,
+              std::set<BasicBlock *>(loop->headers.begin(),
+                                     loop->headers.end()),
+              loop);
+  }
+}
+
+std::vector<Instruction *> FlowGraph::Flatten() const {
+  std::vector<Instruction *> body;
+  for (auto block : blocks)
+    for (auto inst : block->code) {
+      // a Goto to the label right after it is dropped
+      auto label = dynamic_cast<Label *>(inst);
+      auto jump = body.empty() ? NULL : dynamic_cast<Goto *>(body.back());
+      if (label && jump && strcmp(label->GetLabel(), jump->GetLabel()) == 0)
+        body.pop_back();
+      body.push_back(inst);
+    }
+  return body;
+}
@@ -0,0 +1,108 @@
+/* File: flowgraph.h
+ * -----------------
+ * The FlowGraph class splits the TAC of one function into basic blocks
+ * and links them into a control flow graph. On top of the graph it
+ * computes the dominator tree (Cooper, Harvey and Kennedy, "A Simple,
+ * Fast Dominance Algorithm"), dominance frontiers, live variables per
+ * block and the loop nesting forest. It is the form the SSA stage and
+ * the loop passes work on; when they are done, Flatten lays the blocks
+ * out as a TAC list again.
+ *
+ * The instruction-level succ lists built by CodeGenerator::BuildControlFlow
+ * are separate and are not touched here.
+ */
+
+#ifndef _H_flowgraph
+#define _H_flowgraph
+
+#include "tac.h"
+#include <set>
+#include <vector>
+
+class Loop;
+
+class BasicBlock {
+public:
+  int id;                           // position in the original layout
+  std::vector<Instruction *> code;  // starts with its Label, if any
+  std::vector<BasicBlock *> succ;   // fall-through successor first
+  std::vector<BasicBlock *> pred;
+  std::vector<BasicBlock *> children; // in the dominator tree
+  std::set<BasicBlock *> frontier;
+  BasicBlock *idom;   // NULL for the entry and unreachable blocks
+  int postorder;      // -1 if unreachable
+  LocationSet liveIn, liveOut;
+  Loop *loop; // innermost loop containing the block, or NULL
+
+  BasicBlock(int i) : id(i), idom(NULL), postorder(-1), loop(NULL) {}
+  int GetLoopDepth() const;
+
+  const char *GetLabel() const;
+  // The Goto, IfZ, Return, TailCall or call to _Halt ending the block,
+  // or NULL if it falls through.
+  Instruction *GetBranch() const;
+  bool FallsThrough() const;
+};
+
+/* A loop is a strongly connected region of blocks. Its headers are the
+ * blocks entered from outside the loop; there is one unless the loop is
+ * irreducible. Loops nested in it are the strongly connected regions
+ * left once the edges back to its headers are ignored (Steensgaard's
+ * loop nesting forest), so irreducible regions nest like the others.
+ */
+class Loop {
+public:
+  std::vector<BasicBlock *> headers;
+  std::set<BasicBlock *> blocks; // nested loops' blocks included
+  Loop *parent;
+  std::vector<Loop *> children;
+  int depth;     // 1 for an outermost loop
+  int tripCount; // from a ForStmt with constant bounds, or -1
+
+  Loop() : parent(NULL), depth(1), tripCount(-1) {}
+  bool IsReducible() const { return headers.size() == 1; }
+};
+
+class FlowGraph {
+  BeginFunc *begin;
+  std::vector<BasicBlock *> blocks; // in layout order
+  std::vector<BasicBlock *> order;  // reachable blocks, reverse postorder
+  std::vector<Loop *> loops;        // outer loops before inner ones
+
+  void Link();
+  BasicBlock *Intersect(BasicBlock *a, BasicBlock *b) const;
+  void FindLoops(const std::set<BasicBlock *> &region,
+                 const std::set<BasicBlock *> &headers, Loop *parent);
+
+public:
+  // body runs from BeginFunc through EndFunc
+  FlowGraph(const std::vector<Instruction *> &body);
+
+  BeginFunc *GetBeginFunc() const { return begin; }
+  BasicBlock *GetEntry() const { return blocks[0]; }
+  const std::vector<BasicBlock *> &GetBlocks() const { return blocks; }
+  const std::vector<BasicBlock *> &GetOrder() const { return order; }
+
+  // Drops unreachable blocks and recomputes the links and the order.
+  // Must be called after blocks are added or branches are changed.
+  void Update();
+  // Inserts a new block, which must be linked by the caller through
+  // labels, right before the given one in the layout.
+  void InsertBefore(BasicBlock *block, BasicBlock *before);
+  // Gives a reducible loop a new block, starting with the given label,
+  // that runs right before the header whenever the loop is entered.
+  // The preheader falls through to the header and is added to the
+  // enclosing loops.
+  BasicBlock *InsertPreheader(Loop *loop, const char *label);
+
+  void ComputeDominators();
+  void ComputeFrontiers();
+  bool Dominates(BasicBlock *a, BasicBlock *b) const;
+  void ComputeLiveness();
+  void ComputeLoops();
+  const std::vector<Loop *> &GetLoops() const { return loops; }
+
+  std::vector<Instruction *> Flatten() const;
+};
+
+#endif
@@ -0,0 +1,440 @@
+/* File: gc.cc
+ * -----------
+ * A mark-sweep collector that does not move objects. The heap is a list
+ * of chunks from sbrk, each one
+ *
+ *      [link to the previous chunk][end of the chunk][block][block]...
+ *
+ * where a block is a header word followed by the object or array (see
+ * gc.h): bit 0 of the header marks a live block, bit 1 a free one. A
+ * reference to an object points just past the header and one to an
+ * array past its length, as without the collector. Allocation bumps a
+ * pointer through the free region kept at _heap, as in alloc.cc; when
+ * the region runs out it is closed as a free block and the first free
+ * block big enough becomes the new region. If there is none and the
+ * heap would grow past its limit, the collector runs first.
+ *
+ * The roots are the globals that hold references and, for every call
+ * in progress, the frame slots the stack map of the call site lists.
+ * The frames are found from the frame of _Alloc by following the saved
+ * fp; the saved ra names the call site, and the walk stops at a return
+ * address that is not one (the start of main). Liveness comes from the
+ * register allocator, whose spills before a call leave every live
+ * location in its home slot. An address inside a block (an array
+ * element, see strength.cc) keeps the block alive, and the block is
+ * found by walking its chunk. Words that are not in the heap, such as
+ * objects in a frame (see escape.cc), are not followed.
+ *
+ * Marking uses the stack below the frame of _Alloc. The sweep merges
+ * runs of dead and free blocks into one free block each, and doubles
+ * the limit when more than half of it is still live.
+ *
+ * -fgc turns the collector on; -fgc-heap=n sets the size in bytes of
+ * the heap before the first collection (1048576). -d gc reports the
+ * size of the stack maps.
+ */
+
+#include "gc.h"
+#include "ast_type.h"
+#include "runtime.h"
+#include "tac.h"
+#include "utility.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+namespace {
+
+struct CallSite {
+  std::string label;
+  std::vector<int> slots; // offset from fp plus the RefKind
+};
+
+std::vector<CallSite> callSites;
+std::vector<int> globals; // offset from gp plus the RefKind
+
+// Routines of the runtime that never allocate, so no collection can
+// happen while they run.
+const char *leaves[] = {"_PrintInt",   "_PrintString", "_PrintBool",
+                        "_StringEqual", "_ReadInteger", "_ReadLine",
+                        "_Halt",        "_Flush",      "_Profile"};
+
+// The runtime's _Alloc with the collector. _heap is the free region,
+// the words at _gc are
+//
+//      0 chunks          4 bytes in chunks   8 limit
+//      12 free list     16 lowest chunk     20 end of the highest chunk
+//      24 bytes to ask sbrk for at least
+//
+// and a free block links to the next one in its second word.
+const char *runtime[] = {
+    "_Alloc:",
+    "subu $sp, $sp, 8      # decrement sp to make space to save ra,fp",
+    "sw $fp, 8($sp)        # save fp",
+    "sw $ra, 4($sp)        # save ra",
+    "addiu $fp, $sp, 8     # set up new fp",
+    "lw $s0, 4($fp)        # bytes | kind << 28",
+    "addiu $s0, $s0, 4     # the header of the block",
+    "li $t0, 0x0ffffffc",
+    "and $s1, $s0, $t0     # the size of the block",
+    "la $s2, _heap",
+    "la $s3, _gc",
+    "li $s7, 0             # not collected yet",
+    "lw $v0, 0($s2)        # next free byte",
+    "lw $t1, 4($s2)        # end of the free region",
+    "addu $t2, $v0, $s1",
+    "ble $t2, $t1, LgcFit  # the block fits",
+    "subu $t2, $t1, $v0    # close the rest of the region",
+    "blez $t2, LgcClosed",
+    "ori $t3, $t2, 2",
+    "sw $t3, 0($v0)        # as a free block",
+    "li $t3, 8",
+    "blt $t2, $t3, LgcClosed",
+    "lw $t3, 12($s3)",
+    "sw $t3, 4($v0)",
+    "sw $v0, 12($s3)       # on the free list",
+    "LgcClosed:",
+    "sw $0, 0($s2)",
+    "sw $0, 4($s2)",
+    "addiu $t0, $s3, 12    # the link to the free block",
+    "LgcFirst:",
+    "lw $t1, 0($t0)",
+    "beqz $t1, LgcNone",
+    "lw $t2, 0($t1)",
+    "li $t3, 0x0ffffffc",
+    "and $t2, $t2, $t3     # its size",
+    "bge $t2, $s1, LgcTake",
+    "addiu $t0, $t1, 4",
+    "b LgcFirst",
+    "LgcTake:",
+    "lw $t3, 4($t1)",
+    "sw $t3, 0($t0)        # unlink it",
+    "addu $t4, $t1, $t2",
+    "sw $t4, 4($s2)        # it becomes the free region",
+    "move $t5, $t1",
+    "LgcClear:",
+    "sw $0, 0($t5)",
+    "addiu $t5, $t5, 4",
+    "blt $t5, $t4, LgcClear",
+    "move $v0, $t1",
+    "addu $t2, $v0, $s1",
+    "b LgcFit",
+    "LgcNone:",
+    "addiu $s4, $s1, 8     # a chunk holds its link and end too",
+    "lw $t0, 24($s3)",
+    "bge $s4, $t0, LgcSize",
+    "move $s4, $t0",
+    "LgcSize:",
+    "bnez $s7, LgcGrow     # collected already",
+    "lw $t0, 4($s3)",
+    "addu $t0, $t0, $s4",
+    "lw $t1, 8($s3)",
+    "bgt $t0, $t1, LgcCollect # the heap would grow past the limit",
+    "LgcGrow:",
+    "move $a0, $s4",
+    "li $v0, 9",
+    "syscall               # sbrk a new chunk",
+    "lw $t0, 0($s3)",
+    "sw $t0, 0($v0)        # link it",
+    "addu $t1, $v0, $s4",
+    "sw $t1, 4($v0)        # and its end",
+    "sw $v0, 0($s3)",
+    "lw $t0, 4($s3)",
+    "addu $t0, $t0, $s4",
+    "sw $t0, 4($s3)",
+    "lw $t0, 16($s3)",
+    "bgeu $v0, $t0, LgcLow",
+    "sw $v0, 16($s3)",
+    "LgcLow:",
+    "lw $t0, 20($s3)",
+    "bgeu $t0, $t1, LgcHigh",
+    "sw $t1, 20($s3)",
+    "LgcHigh:",
+    "addiu $v0, $v0, 8",
+    "sw $t1, 4($s2)",
+    "addu $t2, $v0, $s1",
+    "LgcFit:",
+    "sw $t2, 0($s2)",
+    "sw $s0, 0($v0)        # the header",
+    "addiu $v0, $v0, 4",
+    "# EndFunc",
+    "move $sp, $fp         # pop callee frame off stack",
+    "lw $ra, -4($fp)       # restore saved ra",
+    "lw $fp, 0($fp)        # restore saved fp",
+    "jr $ra                # return from function",
+    "LgcCollect:",
+    "li $s7, 1",
+    "la $s5, _gcglobals",
+    "lw $s6, 0($s5)",
+    "addiu $s5, $s5, 4",
+    "LgcGlobal:",
+    "beqz $s6, LgcStack",
+    "lw $t0, 0($s5)",
+    "andi $a1, $t0, 3      # the kind of reference",
+    "subu $t0, $t0, $a1",
+    "addu $t0, $t0, $gp",
+    "lw $a0, 0($t0)",
+    "jal _GCMark",
+    "addiu $s5, $s5, 4",
+    "addiu $s6, $s6, -1",
+    "b LgcGlobal",
+    "LgcStack:",
+    "move $s4, $fp",
+    "LgcFrame:",
+    "lw $t0, -4($s4)       # the return address into the caller",
+    "lw $s4, 0($s4)        # the frame of the caller",
+    "la $s5, _gcmaps",
+    "LgcFind:",
+    "lw $t1, 0($s5)",
+    "beqz $t1, LgcMark     # not a call site, the stack is done",
+    "lw $s6, 4($s5)",
+    "addiu $s5, $s5, 8",
+    "beq $t1, $t0, LgcSlots",
+    "sll $t2, $s6, 2",
+    "addu $s5, $s5, $t2",
+    "b LgcFind",
+    "LgcSlots:",
+    "beqz $s6, LgcFrame",
+    "lw $t0, 0($s5)",
+    "andi $a1, $t0, 3      # the kind of reference",
+    "subu $t0, $t0, $a1",
+    "addu $t0, $t0, $s4",
+    "lw $a0, 0($t0)",
+    "jal _GCMark",
+    "addiu $s5, $s5, 4",
+    "addiu $s6, $s6, -1",
+    "b LgcSlots",
+    "LgcMark:",
+    "addiu $t0, $fp, -8",
+    "beq $sp, $t0, LgcSweep # no marked block left to scan",
+    "lw $s4, 4($sp)",
+    "addiu $sp, $sp, 4",
+    "lw $t0, 0($s4)",
+    "srl $t0, $t0, 28      # the kind of block",
+    "li $t1, 1",
+    "bne $t0, $t1, LgcArray",
+    "lw $s5, 4($s4)        # an object: the map is before its vtable",
+    "lw $s6, -4($s5)       # the number of words",
+    "li $t8, 1",
+    "LgcField:",
+    "bge $t8, $s6, LgcMark",
+    "srl $t0, $t8, 4",
+    "sll $t0, $t0, 2",
+    "subu $t0, $s5, $t0",
+    "lw $t0, -8($t0)       # the map word of the field",
+    "andi $t1, $t8, 15",
+    "sll $t1, $t1, 1",
+    "srlv $t0, $t0, $t1",
+    "andi $a1, $t0, 3      # the kind of reference",
+    "beqz $a1, LgcNextField",
+    "sll $t0, $t8, 2",
+    "addu $t0, $t0, $s4",
+    "lw $a0, 4($t0)",
+    "jal _GCMark",
+    "LgcNextField:",
+    "addiu $t8, $t8, 1",
+    "b LgcField",
+    "LgcArray:",
+    "addiu $s6, $t0, -1    # the kind of the elements",
+    "lw $s5, 4($s4)        # the length",
+    "addiu $t8, $s4, 8",
+    "LgcElem:",
+    "blez $s5, LgcMark",
+    "lw $a0, 0($t8)",
+    "move $a1, $s6",
+    "jal _GCMark",
+    "addiu $t8, $t8, 4",
+    "addiu $s5, $s5, -1",
+    "b LgcElem",
+    "LgcSweep:",
+    "sw $0, 12($s3)        # the free list is built anew",
+    "li $s6, 0             # bytes still live",
+    "lw $s4, 0($s3)",
+    "LgcChunk:",
+    "beqz $s4, LgcSwept",
+    "lw $s5, 4($s4)        # the end of the chunk",
+    "addiu $t0, $s4, 8",
+    "LgcBlock:",
+    "bgeu $t0, $s5, LgcNextChunk",
+    "lw $t1, 0($t0)",
+    "li $t4, 0x0ffffffc",
+    "and $t2, $t1, $t4     # the size of the block",
+    "andi $t3, $t1, 1",
+    "beqz $t3, LgcFree",
+    "xori $t1, $t1, 1      # live: clear the mark",
+    "sw $t1, 0($t0)",
+    "addu $s6, $s6, $t2",
+    "addu $t0, $t0, $t2",
+    "b LgcBlock",
+    "LgcFree:",
+    "move $t5, $t0         # a run of dead and free blocks",
+    "LgcRun:",
+    "addu $t0, $t0, $t2",
+    "bgeu $t0, $s5, LgcRunEnd",
+    "lw $t1, 0($t0)",
+    "andi $t3, $t1, 1",
+    "bnez $t3, LgcRunEnd",
+    "and $t2, $t1, $t4",
+    "b LgcRun",
+    "LgcRunEnd:",
+    "subu $t2, $t0, $t5",
+    "ori $t1, $t2, 2",
+    "sw $t1, 0($t5)        # becomes one free block",
+    "li $t3, 8",
+    "blt $t2, $t3, LgcBlock",
+    "lw $t3, 12($s3)",
+    "sw $t3, 4($t5)",
+    "sw $t5, 12($s3)",
+    "b LgcBlock",
+    "LgcNextChunk:",
+    "lw $s4, 0($s4)",
+    "b LgcChunk",
+    "LgcSwept:",
+    "lw $t0, 8($s3)",
+    "sll $t1, $s6, 1",
+    "ble $t1, $t0, LgcClosed",
+    "sll $t0, $t0, 1       # more than half is live: double the limit",
+    "sw $t0, 8($s3)",
+    "b LgcClosed",
+    "",
+    // marks the block $a0 refers to as a reference of kind $a1, and
+    // pushes it for scanning if it holds references; uses $t0-$t4 only
+    "_GCMark:",
+    "beqz $a0, LgcmDone",
+    "la $t0, _gc",
+    "li $t1, 3",
+    "beq $a1, $t1, LgcmDerived",
+    "sll $t1, $a1, 2",
+    "subu $t1, $a0, $t1    # the header",
+    "lw $t2, 16($t0)",
+    "bltu $t1, $t2, LgcmDone # not in the heap",
+    "lw $t2, 20($t0)",
+    "bgeu $t1, $t2, LgcmDone",
+    "LgcmBlock:",
+    "lw $t2, 0($t1)",
+    "andi $t3, $t2, 3",
+    "bnez $t3, LgcmDone    # marked already, or free",
+    "ori $t2, $t2, 1",
+    "sw $t2, 0($t1)",
+    "srl $t2, $t2, 28",
+    "beqz $t2, LgcmDone    # nothing to scan",
+    "subu $sp, $sp, 4",
+    "sw $t1, 4($sp)",
+    "LgcmDone:",
+    "jr $ra",
+    "LgcmDerived:",
+    "lw $t1, 0($t0)        # find the chunk",
+    "LgcmChunk:",
+    "beqz $t1, LgcmDone",
+    "lw $t2, 4($t1)",
+    "bltu $a0, $t1, LgcmNextChunk",
+    "bgeu $a0, $t2, LgcmNextChunk",
+    "addiu $t1, $t1, 8     # then the block",
+    "LgcmWalk:",
+    "bgeu $t1, $t2, LgcmDone",
+    "lw $t3, 0($t1)",
+    "li $t4, 0x0ffffffc",
+    "and $t3, $t3, $t4",
+    "addu $t3, $t1, $t3",
+    "bltu $a0, $t3, LgcmBlock",
+    "move $t1, $t3",
+    "b LgcmWalk",
+    "LgcmNextChunk:",
+    "lw $t1, 0($t1)",
+    "b LgcmChunk",
+};
+
+std::string Words(const char *label, const std::vector<int> &words) {
+  std::string line = std::string("      ") + label + ": .word " +
+                     std::to_string(words.size());
+  for (auto word : words)
+    line += ", " + std::to_string(word);
+  return line + "\n";
+}
+
+} // namespace
+
+bool GCEnabled() { return GetIntOption("gc", 0); }
+
+RefKind GCRefKind(Type *type) {
+  if (dynamic_cast<ArrayType *>(type))
+    return RefArray;
+  if (dynamic_cast<NamedType *>(type))
+    return RefObject;
+  return RefNone;
+}
+
+RefKind GCRefKind(Location *loc) {
+  if (loc->IsDerived())
+    return RefDerived;
+  return loc->GetType() ? GCRefKind(loc->GetType()) : RefNone;
+}
+
+std::vector<int> GCClassMap(const std::vector<RefKind> &kinds) {
+  std::vector<int> map((kinds.size() + 15) / 16, 0);
+  for (size_t i = 0; i < kinds.size(); i++)
+    map[i / 16] |= kinds[i] << (i % 16 * 2);
+  // the map grows down from the count, which is right before the vtable
+  std::reverse(map.begin(), map.end());
+  map.push_back(kinds.size());
+  return map;
+}
+
+const char *GCCallSite(const char *callee, const std::set<Location *> &live) {
+  if (!GCEnabled())
+    return NULL;
+  if (callee)
+    for (auto leaf : leaves)
+      if (strcmp(callee, leaf) == 0)
+        return NULL;
+
+  CallSite site;
+  for (auto loc : live)
+    if (loc->GetSegment() == fpRelative)
+      if (auto kind = GCRefKind(loc))
+        site.slots.push_back(loc->GetOffset() + kind);
+
+  // recorded even with no slots, as the frame walk goes through it
+  char label[32];
+  sprintf(label, "_gcsite%d", (int)callSites.size());
+  site.label = label;
+  callSites.push_back(site);
+  return callSites.back().label.c_str();
+}
+
+void GCRecordGlobal(Location *loc) {
+  if (auto kind = GCRefKind(loc))
+    globals.push_back(loc->GetOffset() + kind);
+}
+
+std::string GCRuntime() {
+  size_t slots = 0;
+  char line[64];
+  std::string text = "      .data\n"
+                     "      .align 2\n"
+                     "      _heap: .word 0, 0\n";
+  snprintf(line, sizeof(line), "      _gc: .word 0, 0, %d, 0, -1, 0, %d\n",
+           GetIntOption("gc-heap", 1048576), GetIntOption("heap-chunk", 65536));
+  text += line;
+  text += Words("_gcglobals", globals);
+  text += "      _gcmaps:\n";
+  for (auto &site : callSites) {
+    text += "      .word " + site.label + ", " +
+            std::to_string(site.slots.size());
+    for (auto slot : site.slots)
+      text += ", " + std::to_string(slot);
+    text += "\n";
+    slots += site.slots.size();
+  }
+  text += "      .word 0\n"
+          "      .text\n"
+          "\n";
+  text += RuntimeBlock(Lines(std::begin(runtime), std::end(runtime)));
+  text += "\n";
+
+  if (IsDebugOn("gc"))
+    fprintf(stderr, "gc: %d call sites, %d slots, %d globals\n",
+            (int)callSites.size(), (int)slots, (int)globals.size());
+  return text;
+}
@@ -0,0 +1,55 @@
+/* File: gc.h
+ * ----------
+ * The optional garbage collector, turned on by -fgc. Every block in the
+ * heap starts with a header word holding its size in bytes (header
+ * included) and, in the top bits, the kind of references it holds, so
+ * the size passed to _Alloc carries the kind too. The words of each
+ * class are described by a map placed right before its vtable, and
+ * every call records which slots of the caller's frame hold references
+ * while the callee runs (the stack maps). The collector is part of the
+ * runtime (see GCRuntime in gc.cc).
+ */
+
+#ifndef _H_gc
+#define _H_gc
+
+#include <set>
+#include <string>
+#include <vector>
+
+class Location;
+class Type;
+
+// What a word holds: nothing the collector follows, a reference to an
+// object, one to an array, or an address inside an object or array.
+enum RefKind { RefNone, RefObject, RefArray, RefDerived };
+
+// What the words of a heap block hold: nothing to follow, the fields
+// of an object as given by its class map, or the elements of an array
+// of objects or of arrays.
+enum BlockKind { BlockPlain, BlockObject, BlockObjects, BlockArrays };
+static const int BlockKindShift = 28;
+
+bool GCEnabled();
+
+RefKind GCRefKind(Type *type);
+RefKind GCRefKind(Location *loc);
+
+// The words to lay out before the vtable of a class whose words hold
+// references of the given kinds, the vtable being word 0.
+std::vector<int> GCClassMap(const std::vector<RefKind> &kinds);
+
+// Records the references among the locations live across a call to
+// callee (NULL if computed) and returns the label to place at the
+// return address, or NULL if the call needs no stack map.
+const char *GCCallSite(const char *callee, const std::set<Location *> &live);
+
+// Records a global that may hold a reference.
+void GCRecordGlobal(Location *loc);
+
+// The stack maps, the global roots and the runtime's _Alloc with the
+// collector, laid out as one block of the runtime in place of the plain
+// _Alloc (see runtime.cc).
+std::string GCRuntime();
+
+#endif
@@ -0,0 +1,175 @@
+/* File: globals.cc
+ * ----------------
+ * Promotion of globals to locals inside loops. Globals always live in
+ * memory (see AllocRegister), so a global counter in a loop costs a load
+ * or a store at every use. When no call in the loop may touch a global,
+ * it is copied into a fresh local before the loop header and the loop
+ * uses the local instead, which the register allocator is free to keep
+ * in a register. If the loop writes the global, the local is stored back
+ * on every way out of the loop: on exit branches (through a stub placed
+ * after the loop) and before a Return or TailCall inside it.
+ *
+ * A loop is the range from a label to a later Goto back to it. Decaf
+ * code is structured, so such a range is only entered through its
+ * header; ranges that are entered some other way are skipped.
+ *
+ * Calls are checked against the interprocedural summaries of modref.cc:
+ * the globals each function reads and writes, itself or through the
+ * functions it calls. An ACall may reach any method with its name.
+ *
+ * -fno-promote-globals turns the pass off; -d globals reports each
+ * promotion.
+ */
+
+#include "codegen.h"
+#include "tac.h"
+#include <set>
+
+namespace {
+
+bool Mentions(Instruction *inst, Location *loc) {
+  return inst->Gen().count(loc) || inst->Kill().count(loc);
+}
+
+const char *BranchTarget(Instruction *inst) {
+  if (auto jump = dynamic_cast<Goto *>(inst))
+    return jump->GetLabel();
+  if (auto jump = dynamic_cast<IfZ *>(inst))
+    return jump->GetLabel();
+  return NULL;
+}
+
+} // namespace
+
+/* Tries to promote one global in one loop of the function body, which
+ * runs from BeginFunc through EndFunc. Returns false if there was
+ * nothing left to promote.
+ */
+static bool PromoteOne(CodeGenerator &codeGen,
+                       std::vector<Instruction *> &body,
+                       std::set<std::pair<std::string, int>> &done) {
+  std::map<std::string, int> index;
+  for (int i = 0; i < (int)body.size(); i++)
+    if (auto label = dynamic_cast<Label *>(body[i]))
+      index[label->GetLabel()] = i;
+
+  for (int g = 0; g < (int)body.size(); g++) {
+    auto back = dynamic_cast<Goto *>(body[g]);
+    if (!back || index[back->GetLabel()] >= g)
+      continue;
+    int h = index[back->GetLabel()];
+    auto header = back->GetLabel();
+
+    bool entered = false;
+    for (int i = 0; i < (int)body.size() && !entered; i++) {
+      auto target = BranchTarget(body[i]);
+      entered = target && (i < h || i > g) && index[target] >= h &&
+                index[target] <= g;
+    }
+    if (entered)
+      continue;
+
+    std::map<int, Location *> globals;
+    std::set<int> mod;
+    std::vector<Instruction *> calls;
+    for (int i = h; i <= g; i++) {
+      for (auto loc : body[i]->Gen())
+        if (loc->GetSegment() == gpRelative)
+          globals[loc->GetOffset()] = loc;
+      for (auto loc : body[i]->Kill())
+        if (loc->GetSegment() == gpRelative) {
+          globals[loc->GetOffset()] = loc;
+          mod.insert(loc->GetOffset());
+        }
+      if (dynamic_cast<LCall *>(body[i]) || dynamic_cast<ACall *>(body[i]) ||
+          dynamic_cast<TailCall *>(body[i]))
+        calls.push_back(body[i]);
+    }
+
+    for (auto &global : globals) {
+      int offset = global.first;
+      if (!done.insert({header, offset}).second)
+        continue;
+
+      bool touched = false;
+      for (auto call : calls) {
+        auto summary = codeGen.GetSummary(call);
+        if (summary.WritesGlobal(offset) ||
+            (mod.count(offset) && summary.ReadsGlobal(offset))) {
+          touched = true;
+          break;
+        }
+      }
+      if (touched)
+        continue;
+
+      auto loc = global.second;
+      auto begin = dynamic_cast<BeginFunc *>(body[0]);
+      auto local = codeGen.GenFrameVar(begin, loc->GetName());
+      local->SetTypeOf(loc);
+      bool written = mod.count(offset);
+      Renaming r;
+      r.Map(loc, local);
+
+      std::vector<Instruction *> result(body.begin(), body.begin() + h);
+      std::vector<Instruction *> stubs;
+      result.push_back(new Assign(local, loc));
+      for (int i = h; i <= g; i++) {
+        auto inst = body[i];
+        auto target = BranchTarget(inst);
+        bool exits =
+            written && target && (index[target] < h || index[target] > g);
+        if (exits && !r.labels.count(target)) {
+          auto stub = codeGen.NewLabel();
+          r.labels[target] = stub;
+          stubs.push_back(new Label(stub));
+          stubs.push_back(new Assign(loc, local));
+          stubs.push_back(new Goto(target));
+        }
+        if (written &&
+            (dynamic_cast<Return *>(inst) || dynamic_cast<TailCall *>(inst)))
+          result.push_back(new Assign(loc, local));
+        if (exits || Mentions(inst, loc))
+          result.push_back(inst->Rewrite(r));
+        else
+          result.push_back(inst);
+      }
+      result.insert(result.end(), stubs.begin(), stubs.end());
+      result.insert(result.end(), body.begin() + g + 1, body.end());
+      std::swap(body, result);
+
+      if (IsDebugOn("globals"))
+        fprintf(stderr, "globals: %s promoted in loop %s%s\n", loc->GetName(),
+                header, written ? " (written back)" : "");
+      return true;
+    }
+  }
+  return false;
+}
+
+void CodeGenerator::PromoteGlobals() {
+  if (!GetIntOption("promote-globals", 1))
+    return;
+
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    if (!dynamic_cast<BeginFunc *>(code->Nth(begin))) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    std::set<std::pair<std::string, int>> done;
+    while (PromoteOne(*this, body, done))
+      ;
+    for (auto inst : body)
+      result->Append(inst);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
@@ -0,0 +1,309 @@
+/* File: inline.cc
+ * ---------------
+ * TAC-level inliner. A call to a small function is replaced with a copy
+ * of the callee's body: the callee's parameters, locals and temps are
+ * renamed to fresh Locations in the caller's frame, the parameters are
+ * initialized from the values that were pushed for the call, and each
+ * Return becomes an assignment to the call's result followed by a jump
+ * past the copy. Both plain "_name" functions and methods that were
+ * turned into direct LCalls are candidates.
+ *
+ * Functions are visited callees first, so a callee has already had its
+ * own calls inlined when its size is compared against the budget.
+ * Recursive calls are never inlined. The budget is the number of TAC
+ * instructions in the callee body; it is set with -finline-budget=N and
+ * -fno-inline turns the pass off. With -d inline, every inlined call
+ * site is reported on stderr.
+ *
+ * With a profile (see profile.h) a call that never ran is not inlined,
+ * and one that made at least 1% of the calls of the run is inlined
+ * within a budget of -finline-hot-budget=N (four times the budget).
+ * The counts of the branches of an inlined copy are scaled down to the
+ * share of the calls that came from its call site. -fprofile-generate
+ * turns the pass off, so the counts of each function cover every call.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "profile.h"
+#include "tac.h"
+#include <set>
+#include <string.h>
+
+static const int DefaultInlineBudget = 20;
+
+namespace {
+
+// A function in the code list, from its entry label through EndFunc.
+struct Function {
+  const char *label;
+  BeginFunc *begin;
+  std::vector<Instruction *> code;
+  enum { Unvisited, InProgress, Done } state;
+  int size;
+};
+
+typedef std::map<std::string, Function> FunctionMap;
+
+// Number of instructions in the body, not counting labels.
+int BodySize(const Function &fn) {
+  int size = 0;
+  for (auto inst : fn.code)
+    if (!dynamic_cast<Label *>(inst) && !dynamic_cast<BeginFunc *>(inst) &&
+        !dynamic_cast<EndFunc *>(inst))
+      size++;
+  return size;
+}
+
+} // namespace
+
+class Inliner {
+  CodeGenerator &codeGen;
+  FunctionMap &functions;
+  int budget;
+  int numInlined;
+
+  // with a profile, the times each call ran and the count from which a
+  // call is hot
+  std::map<Instruction *, double> runs;
+  double hotRuns;
+  int hotBudget;
+
+  void CountRuns(const Function &fn);
+
+  bool Expand(Function &caller, const Function &callee, LCall *call,
+              PopParams *pop, std::vector<Instruction *> &out);
+
+public:
+  Inliner(CodeGenerator &cg, FunctionMap &fns, int b);
+
+  void Visit(Function &fn);
+  int GetNumInlined() const { return numInlined; }
+};
+
+Inliner::Inliner(CodeGenerator &cg, FunctionMap &fns, int b)
+    : codeGen(cg), functions(fns), budget(b), numInlined(0) {
+  double calls = 0;
+  for (auto &fn : functions)
+    calls += ProfileCount(fn.second.begin->GetProbe());
+  hotRuns = std::max(calls / 100, 1.0);
+  hotBudget = GetIntOption("inline-hot-budget", 4 * budget);
+}
+
+void Inliner::CountRuns(const Function &fn) {
+  if (!ProfileUsed())
+    return;
+  FlowGraph graph(std::vector<Instruction *>(fn.code.begin() + 1,
+                                             fn.code.end()));
+  std::map<BasicBlock *, double> counts;
+  if (!ProfileBlockCounts(graph, counts))
+    return;
+  for (auto block : graph.GetBlocks())
+    for (auto inst : block->code)
+      if (dynamic_cast<LCall *>(inst))
+        runs[inst] = counts[block];
+}
+
+void Inliner::Visit(Function &fn) {
+  fn.state = Function::InProgress;
+  for (auto inst : fn.code)
+    if (auto call = dynamic_cast<LCall *>(inst)) {
+      auto iter = functions.find(call->GetLabel());
+      if (iter != functions.end() &&
+          iter->second.state == Function::Unvisited)
+        Visit(iter->second);
+    }
+
+  CountRuns(fn);
+  std::vector<Instruction *> out;
+  for (size_t i = 0; i < fn.code.size(); i++) {
+    auto inst = fn.code[i];
+    auto call = dynamic_cast<LCall *>(inst);
+    auto iter = call ? functions.find(call->GetLabel()) : functions.end();
+    auto pop = i + 1 < fn.code.size()
+                   ? dynamic_cast<PopParams *>(fn.code[i + 1])
+                   : NULL;
+    int limit = budget;
+    if (runs.count(inst) && runs[inst] == 0)
+      limit = -1;
+    else if (runs.count(inst) && runs[inst] >= hotRuns)
+      limit = hotBudget;
+    if (iter != functions.end() && iter->second.state == Function::Done &&
+        iter->second.size <= limit &&
+        Expand(fn, iter->second, call, pop, out)) {
+      if (pop)
+        i++;
+    } else
+      out.push_back(inst);
+  }
+  std::swap(fn.code, out);
+
+  fn.size = BodySize(fn);
+  fn.state = Function::Done;
+}
+
+/* Replaces the call, along with the PushParams just before it (they are
+ * already in out) and the PopParams just after it, by the callee body.
+ * Params are pushed right to left, so the last PushParam holds the
+ * first parameter at fp+4. Returns false, leaving out unchanged, if
+ * the call does not follow that calling sequence.
+ */
+bool Inliner::Expand(Function &caller, const Function &callee, LCall *call,
+                     PopParams *pop, std::vector<Instruction *> &out) {
+  int numParams = pop ? pop->GetNumBytes() / CodeGenerator::VarSize : 0;
+  if ((int)out.size() < numParams)
+    return false;
+  std::vector<Location *> actuals;
+  for (int i = 0; i < numParams; i++) {
+    auto push = dynamic_cast<PushParam *>(out[out.size() - 1 - i]);
+    if (!push)
+      return false;
+    actuals.push_back(push->GetParam());
+  }
+  out.resize(out.size() - numParams);
+
+  // fresh locations for everything in the callee's frame
+  Renaming r;
+  std::map<int, Location *> params;
+  for (auto inst : callee.code) {
+    LocationSet used = inst->Gen(), killed = inst->Kill();
+    used.insert(killed.begin(), killed.end());
+    for (auto loc : used) {
+      if (loc->GetSegment() != fpRelative || r.uses.count(loc))
+        continue;
+      int offset = loc->GetOffset();
+      if (offset > 0 && params.count(offset)) {
+        r.Map(loc, params[offset]);
+        continue;
+      }
+      auto fresh = codeGen.GenFrameVar(caller.begin, loc->GetName());
+      fresh->SetTypeOf(loc);
+      r.Map(loc, fresh);
+      if (offset > 0)
+        params[offset] = fresh;
+    }
+    if (auto label = dynamic_cast<Label *>(inst)) {
+      auto copy = codeGen.NewLabel();
+      r.labels[label->GetLabel()] = copy;
+      codeGen.SetTripCount(copy, codeGen.GetTripCount(label->GetLabel()));
+    }
+  }
+
+  for (auto &param : params) {
+    int index = (param.first - CodeGenerator::OffsetToFirstParam) /
+                CodeGenerator::VarSize;
+    Assert(index < (int)actuals.size());
+    out.push_back(new Assign(param.second, actuals[index]));
+  }
+
+  // the share of the calls of the callee made here
+  double scale = 1, calls = ProfileCount(callee.begin->GetProbe());
+  if (runs.count(call) && calls > 0)
+    scale = std::min(runs[call] / calls, 1.0);
+
+  auto labelAfter = codeGen.NewLabel();
+  bool needLabel = false;
+  auto dst = call->GetDst();
+  for (size_t i = 0; i < callee.code.size(); i++) {
+    auto inst = callee.code[i];
+    if (dynamic_cast<BeginFunc *>(inst) || dynamic_cast<EndFunc *>(inst) ||
+        (i == 0 && dynamic_cast<Label *>(inst)))
+      continue;
+    if (auto ret = dynamic_cast<Return *>(inst)) {
+      if (dst && ret->GetValue())
+        out.push_back(new Assign(dst, r.Use(ret->GetValue())));
+      if (!dynamic_cast<EndFunc *>(callee.code[i + 1])) {
+        out.push_back(new Goto(labelAfter));
+        needLabel = true;
+      }
+    } else {
+      auto copy = inst->Rewrite(r);
+      if (auto test = dynamic_cast<IfZ *>(copy))
+        test->SetProbe(test->GetProbe(), test->GetWeight() * scale);
+      out.push_back(copy);
+    }
+  }
+  if (needLabel)
+    out.push_back(new Label(labelAfter));
+
+  numInlined++;
+  if (IsDebugOn("inline")) {
+    fprintf(stderr, "inline: %s into %s (%d instructions", callee.label,
+            caller.label, callee.size);
+    if (runs.count(call))
+      fprintf(stderr, ", run %.0f times", runs[call]);
+    fprintf(stderr, ")\n");
+  }
+  return true;
+}
+
+void CodeGenerator::Inline() {
+  int budget = GetIntOption("inline-budget", DefaultInlineBudget);
+  if (!GetIntOption("inline", 1) || budget <= 0 || ProfileGenerate())
+    return;
+
+  // split the code list into functions and everything else (vtables)
+  FunctionMap functions;
+  std::vector<Instruction *> layout; // entry labels stand for functions
+  for (int i = 0; i < code->NumElements(); i++) {
+    auto inst = code->Nth(i);
+    auto label = dynamic_cast<Label *>(inst);
+    if (label && i + 1 < code->NumElements() &&
+        dynamic_cast<BeginFunc *>(code->Nth(i + 1))) {
+      auto &fn = functions[label->GetLabel()];
+      fn.label = label->GetLabel();
+      fn.begin = dynamic_cast<BeginFunc *>(code->Nth(i + 1));
+      fn.state = Function::Unvisited;
+      for (; !dynamic_cast<EndFunc *>(code->Nth(i)); i++)
+        fn.code.push_back(code->Nth(i));
+      fn.code.push_back(code->Nth(i));
+      fn.size = BodySize(fn);
+    }
+    layout.push_back(inst);
+  }
+
+  Inliner inliner(*this, functions, budget);
+  for (auto &fn : functions)
+    if (fn.second.state == Function::Unvisited)
+      inliner.Visit(fn.second);
+
+  // functions that are no longer called directly or through a vtable
+  // are dropped
+  std::set<std::string> live;
+  std::vector<std::string> work = {"main"};
+  for (auto inst : layout)
+    if (auto vtable = dynamic_cast<VTable *>(inst))
+      for (auto label : vtable->GetMethodLabels()->Get())
+        work.push_back(label);
+  while (!work.empty()) {
+    auto label = work.back();
+    work.pop_back();
+    auto iter = functions.find(label);
+    if (iter == functions.end() || !live.insert(label).second)
+      continue;
+    for (auto inst : iter->second.code)
+      if (auto call = dynamic_cast<LCall *>(inst))
+        work.push_back(call->GetLabel());
+  }
+
+  auto result = new List<Instruction *>;
+  for (auto inst : layout) {
+    auto label = dynamic_cast<Label *>(inst);
+    auto iter = label ? functions.find(label->GetLabel()) : functions.end();
+    if (iter == functions.end())
+      result->Append(inst);
+    else if (live.count(iter->first))
+      for (auto inst : iter->second.code)
+        result->Append(inst);
+    else if (IsDebugOn("inline"))
+      fprintf(stderr, "inline: removed unused function %s\n",
+              iter->second.label);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+  if (IsDebugOn("inline"))
+    fprintf(stderr, "inline: %d call sites inlined\n",
+            inliner.GetNumInlined());
+}
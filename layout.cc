@@ -0,0 +1,183 @@
+/* File: layout.cc
+ * ---------------
+ * Profile-guided block layout. With a profile (see profile.h), the
+ * blocks of each function are joined into chains along the edges that
+ * ran most, heaviest first (Pettis and Hansen, "Profile Guided Code
+ * Positioning"), so that a Goto taken often becomes a fall-through and
+ * is dropped. An IfZ cannot be turned around, so a block ending in one
+ * keeps its fall-through block after it. The chain of the entry comes
+ * first, the chain of the block falling into EndFunc last, and the rest
+ * by the count of their hottest block, so the blocks that never ran end
+ * up out of the way. A block whose fall-through no longer follows it
+ * gets a Goto.
+ *
+ * Functions the profile has no counts for are left as they are. With
+ * -d layout, the jumps dropped and added are reported for every
+ * function.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "profile.h"
+#include "tac.h"
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+struct Chain {
+  std::vector<BasicBlock *> blocks;
+  double hottest;
+  int position; // of its head in the original layout
+};
+
+} // namespace
+
+// Lays out the blocks of graph by counts; the last one, which ends with
+// EndFunc, may move, leaving EndFunc at the end.
+static std::vector<Instruction *>
+Layout(CodeGenerator &codeGen, const FlowGraph &graph,
+       std::map<BasicBlock *, double> &counts, int *dropped, int *added) {
+  auto &blocks = graph.GetBlocks();
+  auto last = blocks.back();
+  std::map<BasicBlock *, int> position;
+  std::map<BasicBlock *, Chain *> chainOf;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    position[blocks[i]] = i;
+    chainOf[blocks[i]] = new Chain{{blocks[i]}, counts[blocks[i]], (int)i};
+  }
+  auto merge = [&](BasicBlock *from, BasicBlock *to) {
+    auto head = chainOf[from], tail = chainOf[to];
+    if (head == tail || head->blocks.back() != from ||
+        tail->blocks.front() != to || to == graph.GetEntry())
+      return;
+    for (auto block : tail->blocks) {
+      head->blocks.push_back(block);
+      chainOf[block] = head;
+    }
+    head->hottest = std::max(head->hottest, tail->hottest);
+    delete tail;
+  };
+
+  // the fall-through of an IfZ first, then the other edges that can
+  // fall through, heaviest first and the ones that already do on a tie
+  struct Edge {
+    BasicBlock *from, *to;
+  };
+  std::vector<Edge> edges;
+  for (auto block : blocks) {
+    if (block == last || block->succ.empty())
+      continue;
+    if (dynamic_cast<IfZ *>(block->GetBranch()))
+      merge(block, block->succ[0]);
+    else if (block->succ.size() == 1)
+      edges.push_back({block, block->succ[0]});
+  }
+  std::stable_sort(edges.begin(), edges.end(), [&](Edge a, Edge b) {
+    if (counts[a.from] != counts[b.from])
+      return counts[a.from] > counts[b.from];
+    return position[a.to] == position[a.from] + 1 &&
+           position[b.to] != position[b.from] + 1;
+  });
+  for (auto &edge : edges)
+    merge(edge.from, edge.to);
+
+  std::vector<Chain *> chains;
+  for (auto block : blocks)
+    if (chainOf[block]->blocks.front() == block)
+      chains.push_back(chainOf[block]);
+  std::stable_sort(chains.begin() + 1, chains.end(), [&](Chain *a, Chain *b) {
+    bool aLast = a == chainOf[last], bLast = b == chainOf[last];
+    if (aLast != bLast)
+      return bLast;
+    if (a->hottest != b->hottest)
+      return a->hottest > b->hottest;
+    return a->position < b->position;
+  });
+  std::vector<BasicBlock *> order;
+  for (auto chain : chains) {
+    order.insert(order.end(), chain->blocks.begin(), chain->blocks.end());
+    delete chain;
+  }
+
+  // a Goto to the block that now follows is dropped; a fall-through to
+  // one that no longer does becomes a Goto, to a label it may need
+  std::map<BasicBlock *, BasicBlock *> jumps;
+  for (size_t i = 0; i < order.size(); i++) {
+    auto block = order[i];
+    auto next = i + 1 < order.size() ? order[i + 1] : NULL;
+    if (block != last && block->FallsThrough() && !block->succ.empty() &&
+        block->succ[0] != next) {
+      auto target = block->succ[0];
+      jumps[block] = target;
+      if (!target->GetLabel())
+        target->code.insert(target->code.begin(),
+                            new Label(codeGen.NewLabel()));
+    }
+  }
+  const char *end = NULL;
+  std::vector<Instruction *> body;
+  for (size_t i = 0; i < order.size(); i++) {
+    auto block = order[i];
+    auto next = i + 1 < order.size() ? order[i + 1] : NULL;
+    for (auto inst : block->code) {
+      auto jump = dynamic_cast<Goto *>(inst);
+      if (jump && next && next->GetLabel() &&
+          strcmp(jump->GetLabel(), next->GetLabel()) == 0) {
+        (*dropped)++;
+        continue;
+      }
+      if (!dynamic_cast<EndFunc *>(inst))
+        body.push_back(inst);
+    }
+    if (block == last) {
+      if (next) {
+        end = codeGen.NewLabel();
+        body.push_back(new Goto(end));
+        (*added)++;
+      }
+    } else if (jumps.count(block)) {
+      body.push_back(new Goto(jumps[block]->GetLabel()));
+      (*added)++;
+    }
+  }
+  if (end)
+    body.push_back(new Label(end));
+  body.push_back(last->code.back());
+  return body;
+}
+
+void CodeGenerator::LayoutBlocks() {
+  if (!ProfileUsed())
+    return;
+
+  auto result = new List<Instruction *>;
+  for (int i = 0; i < code->NumElements(); i++) {
+    auto inst = code->Nth(i);
+    if (!dynamic_cast<BeginFunc *>(inst)) {
+      result->Append(inst);
+      continue;
+    }
+    int begin = i;
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(i)); i++)
+      body.push_back(code->Nth(i));
+    body.push_back(code->Nth(i));
+
+    FlowGraph graph(body);
+    std::map<BasicBlock *, double> counts;
+    int dropped = 0, added = 0;
+    if (ProfileBlockCounts(graph, counts))
+      body = Layout(*this, graph, counts, &dropped, &added);
+    for (auto inst : body)
+      result->Append(inst);
+
+    if (IsDebugOn("layout") && (dropped || added))
+      fprintf(stderr, "layout: %s: %d jumps dropped, %d added\n",
+              FunctionName(begin), dropped, added);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
@@ -0,0 +1,88 @@
+// Hand-written stand-in for flex output, for local verification only.
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "scanner.h"
+#include "utility.h"
+#include "errors.h"
+#include "parser.h"
+#include "list.h"
+#include "timing.h"
+
+char *yytext = (char *)"";
+int yy_flex_debug = 0;
+List<const char*> savedLines;
+static std::string src; static size_t pos = 0; static bool loaded = false;
+static int line = 1, col = 1;
+static std::string cur;
+
+static void load() {
+  if (loaded) return; loaded = true;
+  int c; while ((c = getchar()) != EOF) src.push_back((char)c);
+  size_t s = 0;
+  for (;;) { size_t e = src.find('\n', s);
+    if (e == std::string::npos) { if (s < src.size()) savedLines.Append(strdup(src.substr(s).c_str())); break; }
+    savedLines.Append(strdup(src.substr(s, e - s).c_str())); s = e + 1; }
+}
+void yyrestart(FILE *) {}
+void InitScanner() { line = 1; col = 1; }
+const char *GetLineNumbered(int num) {
+  if (num <= 0 || num > savedLines.NumElements()) return NULL;
+  return savedLines.Nth(num-1);
+}
+static void adv(size_t n) { for (size_t i = 0; i < n; i++) { if (src[pos] == '\n') { line++; col = 1; } else col++; pos++; } }
+static struct { const char *w; int t; } kw[] = {
+ {"void",T_Void},{"int",T_Int},{"double",T_Double},{"bool",T_Bool},{"string",T_String},{"null",T_Null},
+ {"class",T_Class},{"extends",T_Extends},{"this",T_This},{"interface",T_Interface},{"implements",T_Implements},
+ {"while",T_While},{"for",T_For},{"if",T_If},{"else",T_Else},{"return",T_Return},{"break",T_Break},
+ {"New",T_New},{"NewArray",T_NewArray},{"Print",T_Print},{"ReadInteger",T_ReadInteger},{"ReadLine",T_ReadLine},{"Delete",T_Delete}};
+static int ScanToken();
+int yylex() { PhaseTimer timer("scan"); return ScanToken(); }
+static int ScanToken() {
+  load();
+  for (;;) {
+    if (pos >= src.size()) return 0;
+    char c = src[pos];
+    if (isspace((unsigned char)c)) { adv(1); continue; }
+    if (c == '/' && pos + 1 < src.size() && src[pos+1] == '/') { while (pos < src.size() && src[pos] != '\n') adv(1); continue; }
+    if (c == '/' && pos + 1 < src.size() && src[pos+1] == '*') {
+      size_t e = src.find("*/", pos + 2);
+      if (e == std::string::npos) { ReportError::UntermComment(); return 0; }
+      adv(e + 2 - pos); continue; }
+    break;
+  }
+  size_t start = pos; int t = 0;
+  yylloc.first_line = line; yylloc.first_column = col;
+  char c = src[pos];
+  auto set = [&](size_t n) { cur = src.substr(start, n); yytext = (char*)cur.c_str(); adv(n); yylloc.last_column = col - 1; };
+  if (isalpha((unsigned char)c)) {
+    size_t n = 0; while (start + n < src.size() && (isalnum((unsigned char)src[start+n]) || src[start+n]=='_')) n++;
+    set(n);
+    for (auto &k : kw) if (cur == k.w) return k.t;
+    if (cur == "true" || cur == "false") { yylval.boolConstant = cur[0]=='t'; return T_BoolConstant; }
+    strncpy(yylval.identifier, yytext, MaxIdentLen); yylval.identifier[MaxIdentLen] = 0;
+    return T_Identifier;
+  }
+  if (isdigit((unsigned char)c)) {
+    size_t n = 0;
+    if (c == '0' && start+1 < src.size() && (src[start+1]=='x'||src[start+1]=='X')) {
+      n = 2; while (isxdigit((unsigned char)src[start+n])) n++; set(n);
+      yylval.integerConstant = strtol(yytext, NULL, 16); return T_IntConstant; }
+    while (isdigit((unsigned char)src[start+n])) n++;
+    if (src[start+n] == '.') { n++; while (isdigit((unsigned char)src[start+n])) n++; set(n);
+      yylval.doubleConstant = atof(yytext); return T_DoubleConstant; }
+    set(n); yylval.integerConstant = strtol(yytext, NULL, 10); return T_IntConstant;
+  }
+  if (c == '"') {
+    size_t n = 1; while (start+n < src.size() && src[start+n] != '"' && src[start+n] != '\n') n++;
+    if (src[start+n] == '"') { set(n+1); yylval.stringConstant = strdup(yytext); return T_StringConstant; }
+    set(n); ReportError::UntermString(&yylloc, yytext); return ScanToken();
+  }
+  const char *two[] = {"<=",">=","==","!=","&&","||","[]"}; int tt[] = {T_LessEqual,T_GreaterEqual,T_Equal,T_NotEqual,T_And,T_Or,T_Dims};
+  for (int i = 0; i < 7; i++) if (src.compare(start, 2, two[i]) == 0) { set(2); return tt[i]; }
+  set(1);
+  if (strchr("-+/*%=.,;!<>()[]{}", c)) return c;
+  ReportError::UnrecogChar(&yylloc, c); return ScanToken();
+}
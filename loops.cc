@@ -0,0 +1,81 @@
+/* File: loops.cc
+ * --------------
+ * Loop annotation. The loop nesting forest of each function is computed
+ * on its FlowGraph (see FlowGraph::ComputeLoops), and every instruction
+ * is tagged with its loop depth and an estimate of how many times it
+ * runs per call: the product of the trip counts of the loops around it.
+ * A loop whose header was emitted by a ForStmt with constant bounds uses
+ * the trip count recorded for it; any other loop is assumed to run
+ * DefaultTripCount times. The register allocator weighs uses by this
+ * estimate when it has to pick a location to leave in memory. With a
+ * profile (see profile.h) that has counts for the function, the estimate
+ * is the times the block ran per call instead, rounded up, so only the
+ * blocks that never ran weigh nothing.
+ *
+ * -d loops prints the forest of each function.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "profile.h"
+#include "tac.h"
+#include <algorithm>
+#include <math.h>
+
+static const int DefaultTripCount = 10;
+static const int MaxFrequency = 1 << 20;
+
+static void PrintLoop(Loop *loop) {
+  fprintf(stderr, "loops: %*s", 2 * loop->depth, "");
+  for (auto header : loop->headers)
+    fprintf(stderr, "%s ", header->GetLabel() ? header->GetLabel() : "?");
+  fprintf(stderr, "(%d blocks", (int)loop->blocks.size());
+  if (!loop->IsReducible())
+    fprintf(stderr, ", irreducible");
+  if (loop->tripCount >= 0)
+    fprintf(stderr, ", %d trips", loop->tripCount);
+  fprintf(stderr, ")\n");
+  for (auto child : loop->children)
+    PrintLoop(child);
+}
+
+void CodeGenerator::AnnotateLoops() {
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    if (!dynamic_cast<BeginFunc *>(code->Nth(begin)))
+      continue;
+    auto entry = dynamic_cast<Label *>(code->Nth(begin - 1));
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    FlowGraph graph(body);
+    graph.ComputeLoops();
+    for (auto loop : graph.GetLoops())
+      if (loop->IsReducible() && loop->headers[0]->GetLabel())
+        loop->tripCount = GetTripCount(loop->headers[0]->GetLabel());
+
+    std::map<BasicBlock *, double> counts;
+    bool profiled = ProfileBlockCounts(graph, counts);
+    double calls = ProfileCount(graph.GetBeginFunc()->GetProbe());
+    for (auto block : graph.GetBlocks()) {
+      long long frequency = 1;
+      for (auto loop = block->loop; loop; loop = loop->parent) {
+        int trips = loop->tripCount >= 0 ? loop->tripCount : DefaultTripCount;
+        frequency = std::min<long long>(frequency * std::max(trips, 1),
+                                        MaxFrequency);
+      }
+      if (profiled)
+        frequency = std::min<double>(ceil(counts[block] / calls), MaxFrequency);
+      for (auto inst : block->code)
+        inst->SetLoopInfo(block->GetLoopDepth(), frequency);
+    }
+
+    if (IsDebugOn("loops") && !graph.GetLoops().empty()) {
+      fprintf(stderr, "loops: %s\n", entry->GetLabel());
+      for (auto loop : graph.GetLoops())
+        if (!loop->parent)
+          PrintLoop(loop);
+    }
+  }
+}
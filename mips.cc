@@ -22,8 +22,11 @@
 
 #include "mips.h"
 #include "tac.h"
+#include "utility.h"
+#include <map>
 #include <stdarg.h>
 #include <string.h>
+#include <string>
 
 
 
@@ -42,11 +45,13 @@ static bool LocationsAreSame(Location *var1, Location *var2)
 /* Method: SpillRegister
  * ---------------------
  * Used to spill a register from reg to dst.  All it does is emit a store
- * from that register to its location on the stack.
+ * from that register to its location on the stack. aroundCall marks the
+ * spills that save a register across a call, counted apart in counts.
  */
-void Mips::SpillRegister(Location *dst, Register reg)
+void Mips::SpillRegister(Location *dst, Register reg, bool aroundCall)
 {
   Assert(dst);
+  (aroundCall ? counts.callSpills : counts.spills)++;
   const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
   Assert(dst->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("sw %s, %d(%s)\t# spill %s from %s to %s%+d", regs[reg].name,
@@ -57,11 +62,12 @@ void Mips::SpillRegister(Location *dst, Register reg)
 /* Method: FillRegister
  * --------------------
  * Fill a register from location src into reg.
- * Simply load a word into a register.
+ * Simply load a word into a register. aroundCall is as for SpillRegister.
  */
-void Mips::FillRegister(Location *src, Register reg)
+void Mips::FillRegister(Location *src, Register reg, bool aroundCall)
 {
   Assert(src);
+  (aroundCall ? counts.callFills : counts.fills)++;
   const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
   Assert(src->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("lw %s, %d(%s)\t# fill %s to %s from %s%+d", regs[reg].name,
@@ -109,22 +115,59 @@ void Mips::EmitLoadConstant(Location *dst, int val)
 
 /* Method: EmitLoadStringConstant
  * ------------------------------
- * Used to assign a variable a pointer to string constant. Emits
- * assembly directives to create a new null-terminated string in the
- * data segment and assigns it a unique label. Slaves dst into a register
- * and loads that label address into the register.
+ * Used to assign a variable a pointer to string constant. Each string
+ * is given a unique label the first time it is loaded and laid out
+ * once, in the data segment, by EmitStringPool. Slaves dst into a
+ * register and loads that label address into the register.
  */
+// The string constants loaded so far, by contents. The n-th one is
+// labeled _string<n+1>.
+static std::map<std::string, int> strings;
+static std::vector<const char *> pool;
+
 void Mips::EmitLoadStringConstant(Location *dst, const char *str)
 {
-  static int strNum = 1;
-  char label[16];
-  sprintf(label, "_string%d", strNum++);
-  Emit(".data\t\t\t# create string constant marked with label");
-  Emit("%s: .asciiz %s", label, str);
-  Emit(".text");
+  auto iter = strings.insert({str, pool.size()}).first;
+  if (iter->second == pool.size())
+    pool.push_back(str);
+  char label[32];
+  sprintf(label, "_string%d", iter->second + 1);
   EmitLoadLabel(dst, label);
 }
 
+/* Method: EmitStringPool
+ * ----------------------
+ * Emits the string constants loaded by the program. Each string is
+ * word-aligned and padded with nulls to a whole word, so that it can be
+ * compared a word at a time (see _StringEqual in runtime.cc and
+ * GenStringEqual in codegen.cc). Unless -fno-string-length is given its
+ * length is laid out in the word before it, as ReadLine does.
+ */
+void Mips::EmitStringPool()
+{
+  if (pool.empty())
+    return;
+  Emit(".data\t\t\t# string constants");
+  bool prefixed = GetIntOption("string-length", 1);
+  for (int i = 0; i < pool.size(); i++) {
+    Emit(".align 2");
+    if (prefixed)
+      Emit(".word %d", StringLength(pool[i]));
+    Emit("_string%d: .asciiz %s", i + 1, pool[i]);
+  }
+  Emit(".align 2");
+  Emit(".text");
+}
+
+int Mips::StringLength(const char *str)
+{
+  int length = 0;
+  for (const char *p = str + 1; *p && *p != '"'; p++, length++)
+    if (*p == '\\' && *++p == '0')
+      break;
+  return length;
+}
+
 
 /* Method: EmitLoadLabel
  * ---------------------
@@ -139,6 +182,22 @@ void Mips::EmitLoadLabel(Location *dst, const char *label)
 }
  
 
+/* Method: EmitLoadAddress
+ * -----------------------
+ * Used to load the address of a variable in the stack frame or the
+ * global segment. Slaves dst into a register and adds the offset of
+ * the variable to $fp or $gp.
+ */
+void Mips::EmitLoadAddress(Location *dst, Location *var)
+{
+  Register reg = dst->GetRegister() ? dst->GetRegister() : rd;
+  Register base = var->GetSegment() == fpRelative ? fp : gp;
+  Emit("addiu %s, %s, %d\t# address of %s", regs[reg].name,
+       regs[base].name, var->GetOffset(), var->GetName());
+  if (!dst->GetRegister()) SpillRegister(dst, reg);
+}
+ 
+
 /* Method: EmitCopy
  * ----------------
  * Used to copy the value of one variable to another.  Slaves both
@@ -248,12 +307,14 @@ void Mips::EmitGoto(const char *label)
  * either beqz. See comments above on Goto for why we spill
  * all registers here.
  */
-void Mips::EmitIfZ(Location *test, const char *label)
+void Mips::EmitIfZ(Location *test, const char *label, int counter)
 { 
   Register reg = test->GetRegister() ? test->GetRegister() : rs;
   if (!test->GetRegister()) FillRegister(test, reg);
+  if (counter >= 0) EmitCount(counter);
   Emit("beqz %s, %s\t# branch if %s is zero ", regs[reg].name, label,
 	 test->GetName());
+  if (counter >= 0) EmitCount(counter + 1);
 }
 
 
@@ -282,11 +343,14 @@ void Mips::EmitParam(Location *arg)
  * jal for a label, a jalr if address in register. Both will save the
  * return address in $ra. If there is an expected result passed, we slave
  * the var to a register and copy function return value from $v0 into that
- * register.  
+ * register. The site label, if given, marks the return address for the
+ * stack maps of the collector (see gc.h).
  */
-void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
+void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel,
+                         const char *site)
 {
   Emit("%s %-15s\t# jump to function", isLabel? "jal": "jalr", fn);
+  if (site) Emit("%s:", site);
   if (result != NULL) {
     Register reg = result->GetRegister() ? result->GetRegister() : rd;
     Emit("move %s, %s\t\t# copy function return value from $v0",
@@ -297,16 +361,51 @@ void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
 
 
 // Two covers for the above method for specific LCall/ACall variants
-void Mips::EmitLCall(Location *dst, const char *label)
+void Mips::EmitLCall(Location *dst, const char *label, const char *site)
 { 
-  EmitCallInstr(dst, label, true);
+  EmitCallInstr(dst, label, true, site);
 }
 
-void Mips::EmitACall(Location *dst, Location *fn)
+void Mips::EmitACall(Location *dst, Location *fn, const char *site)
 {
   Register reg = fn->GetRegister() ? fn->GetRegister() : rs;
   if (!fn->GetRegister()) FillRegister(fn, reg);
-  EmitCallInstr(dst, regs[reg].name, false);
+  EmitCallInstr(dst, regs[reg].name, false, site);
+}
+
+/* Method: EmitTailCallInstr
+ * -------------------------
+ * Used for a call in tail position when the callee's params fit in the
+ * caller's param area. The params just pushed are copied over the
+ * caller's own params, then we tear down our frame as in EmitReturn but
+ * jump to the callee instead of returning. The callee finds its params
+ * where it expects them and returns straight to our caller, who pops the
+ * param area as usual. $v0 is the only register touched before the jump,
+ * so a method address must not be kept in it.
+ */
+void Mips::EmitTailCallInstr(const char *fn, bool isLabel, int bytes)
+{
+  for (int offset = 4; offset <= bytes; offset += 4) {
+    Emit("lw $v0, %d($sp)\t# move param into caller's param area", offset);
+    Emit("sw $v0, %d($fp)", offset);
+  }
+  Emit("lw $ra, -4($fp)\t# restore saved ra");
+  Emit("move $sp, $fp\t\t# pop callee frame off stack");
+  Emit("lw $fp, 0($fp)\t# restore saved fp");
+  Emit("%s %-15s\t# jump to function in tail position",
+       isLabel? "j": "jr", fn);
+}
+
+void Mips::EmitTailLCall(const char *label, int bytes)
+{
+  EmitTailCallInstr(label, true, bytes);
+}
+
+void Mips::EmitTailACall(Location *fn, int bytes)
+{
+  Register reg = fn->GetRegister() ? fn->GetRegister() : rt;
+  if (!fn->GetRegister()) FillRegister(fn, reg);
+  EmitTailCallInstr(regs[reg].name, false, bytes);
 }
 
 /*
@@ -359,9 +458,10 @@ void Mips::EmitPopParams(int bytes)
  * going to change them), then set up the $fp and bump the $sp down
  * to make space for all our locals/temps.
  */
-void Mips::EmitBeginFunction(int stackFrameSize)
+void Mips::EmitBeginFunction(int stackFrameSize, int counter)
 {
   Assert(stackFrameSize >= 0);
+  if (counter >= 0) EmitCount(counter);
   Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
   Emit("sw $fp, 8($sp)\t# save fp");
   Emit("sw $ra, 4($sp)\t# save ra");
@@ -386,17 +486,42 @@ void Mips::EmitEndFunction()
 }
 
 
+/* Method: EmitCount
+ * -----------------
+ * Bumps one of the counters of -fprofile-generate (see profile.h), the
+ * words at _prof. Uses $k0 and $k1, which hold nothing of the program,
+ * so it can go anywhere.
+ */
+void Mips::EmitCount(int counter)
+{
+  int offset = counter * 4;
+  Emit("la $k0, _prof\t\t# count %d", counter);
+  if (offset > 32764) {
+    Emit("li $k1, %d", offset);
+    Emit("addu $k0, $k0, $k1");
+    offset = 0;
+  }
+  Emit("lw $k1, %d($k0)", offset);
+  Emit("addiu $k1, $k1, 1");
+  Emit("sw $k1, %d($k0)", offset);
+}
+
+
 
 /* Method: EmitVTable
  * ------------------
  * Used to layout a vtable. Uses assembly directives to set up new
  * entry in data segment, emits label, and lays out the function
- * labels one after another.
+ * labels one after another. The header words, if any, go right before
+ * the label (the object size, or the class map of the collector, see gc.h).
  */
-void Mips::EmitVTable(const char *label, List<const char*> *methodLabels)
+void Mips::EmitVTable(const char *label, List<const char*> *methodLabels,
+                      const std::vector<int> &header)
 {
   Emit(".data");
   Emit(".align 2");
+  for (auto word : header)
+    Emit(".word %d", word);
   Emit("%s:\t\t# label for class %s vtable", label, label);
   for (int i = 0; i < methodLabels->NumElements(); i++)
     Emit(".word %s\n", methodLabels->Nth(i));
@@ -438,7 +563,7 @@ const char *Mips::NameForTac(OpCode code)
  * Constructor sets up the mips names and register descriptors to
  * the initial starting state.
  */
-Mips::Mips() {
+Mips::Mips() : counts() {
   mipsName[Add] = "add";
   mipsName[Sub] = "sub";
   mipsName[Mul] = "mul";
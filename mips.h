@@ -19,6 +19,7 @@
 #define _H_mips
 
 #include "list.h"
+#include <vector>
 
 class Location;
 
@@ -39,10 +40,20 @@ class Mips {
 	bool isGeneralPurpose;
     } regs[NumRegs];
 
+    // The fills and spills emitted, with those that keep the registers
+    // live across a call (see LCall and ACall) counted apart, for the
+    // -d regalloc report.
+    struct SpillCounts {
+      int fills, spills, callFills, callSpills;
+    } counts;
+
   private:
     Register rs, rt, rd;
 
-    void EmitCallInstr(Location *dst, const char *fn, bool isL);
+    void EmitCallInstr(Location *dst, const char *fn, bool isL,
+                       const char *site = NULL);
+    void EmitTailCallInstr(const char *fn, bool isL, int bytes);
+    void EmitCount(int counter);
     
     static const char *mipsName[NumOps];
     static const char *NameForTac(OpCode code);
@@ -55,7 +66,12 @@ class Mips {
     
     void EmitLoadConstant(Location *dst, int val);
     void EmitLoadStringConstant(Location *dst, const char *str);
+    // The number of characters in the string the literal str (quotes
+    // included) stands for once its escapes are replaced, up to the
+    // first null.
+    static int StringLength(const char *str);
     void EmitLoadLabel(Location *dst, const char *label);
+    void EmitLoadAddress(Location *dst, Location *var);
 
     void EmitLoad(Location *dst, Location *reference, int offset);
     void EmitStore(Location *reference, Location *value, int offset);
@@ -66,23 +82,32 @@ class Mips {
 
     void EmitLabel(const char *label);
     void EmitGoto(const char *label);
-    void EmitIfZ(Location *test, const char*label);
+    // counter, if not -1, is the first of the two of profile.h to bump
+    // for the test and for the fall-through
+    void EmitIfZ(Location *test, const char*label, int counter = -1);
     void EmitReturn(Location *returnVal);
 
-    void EmitBeginFunction(int frameSize);
+    // counter, if not -1, is the one of profile.h to bump for the call
+    void EmitBeginFunction(int frameSize, int counter = -1);
     void EmitEndFunction();
 
     void EmitParam(Location *arg);
-    void EmitLCall(Location *result, const char* label);
-    void EmitACall(Location *result, Location *fnAddr);
+    void EmitLCall(Location *result, const char* label,
+                   const char *site = NULL);
+    void EmitACall(Location *result, Location *fnAddr,
+                   const char *site = NULL);
     void EmitPopParams(int bytes);
+    void EmitTailLCall(const char *label, int bytes);
+    void EmitTailACall(Location *fnAddr, int bytes);
 
-    void EmitVTable(const char *label, List<const char*> *methodLabels);
+    void EmitVTable(const char *label, List<const char*> *methodLabels,
+                    const std::vector<int> &header);
 
     void EmitPreamble();
+    static void EmitStringPool();
 
-    void FillRegister(Location *src, Register reg);
-    void SpillRegister(Location *dst, Register reg);
+    void FillRegister(Location *src, Register reg, bool aroundCall = false);
+    void SpillRegister(Location *dst, Register reg, bool aroundCall = false);
 };
 
 
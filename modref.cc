@@ -0,0 +1,487 @@
+/* File: modref.cc
+ * ---------------
+ * Interprocedural mod/ref and purity summaries, and the redundancy
+ * elimination built on them.
+ *
+ * A function's own effects come from its instructions: the region of
+ * each Load and Store, the globals it reads and writes and the runtime
+ * routines it calls. Stores into an object the function allocated
+ * itself are not counted, since no caller can see that object before
+ * the call. The effects of the functions it calls are then added until
+ * nothing changes. An ACall may reach any method with its name; a call
+ * that cannot be resolved at all makes a summary unknown, which is
+ * assumed to do anything.
+ *
+ * EliminateRedundancy walks the extended basic blocks of each function
+ * and remembers the values of loads and of pure calls:
+ *   - a Load of the same address and region as an earlier Load or
+ *     Store is replaced by a copy of the value,
+ *   - a pure call with the same target and arguments as an earlier one
+ *     is replaced by a copy of its result,
+ *   - a call that can be removed and whose result is unused is dropped
+ *     together with its params.
+ * A Store forgets the values of its region, and a call forgets those it
+ * may write, along with the values tied to the globals it may assign,
+ * so values survive calls that do not touch them.
+ *
+ * -fno-modref turns the elimination off; -d modref prints the summaries
+ * and what was replaced in each function.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "modref.h"
+#include "tac.h"
+#include <algorithm>
+#include <string.h>
+#include <tuple>
+
+bool Summary::Merge(const Summary &other) {
+  auto size = modGlobals.size() + refGlobals.size() + mod.size() + ref.size() +
+              escapes.size();
+  modGlobals.insert(other.modGlobals.begin(), other.modGlobals.end());
+  refGlobals.insert(other.refGlobals.begin(), other.refGlobals.end());
+  mod.insert(other.mod.begin(), other.mod.end());
+  ref.insert(other.ref.begin(), other.ref.end());
+  escapes.insert(other.escapes.begin(), other.escapes.end());
+  bool changed = size != modGlobals.size() + refGlobals.size() + mod.size() +
+                             ref.size() + escapes.size();
+  changed |= (other.allocates && !allocates) || (other.io && !io) ||
+             (other.halts && !halts) || (other.unknown && !unknown);
+  allocates |= other.allocates;
+  io |= other.io;
+  halts |= other.halts;
+  unknown |= other.unknown;
+  return changed;
+}
+
+bool Summary::Reads(const char *region) const {
+  return unknown || ref.count("*") ||
+         (region ? ref.count(region) > 0 : !ref.empty());
+}
+
+bool Summary::Writes(const char *region) const {
+  return unknown || mod.count("*") ||
+         (region ? mod.count(region) > 0 : !mod.empty());
+}
+
+bool Summary::ReadsGlobal(int offset) const {
+  return unknown || refGlobals.count(offset);
+}
+
+bool Summary::WritesGlobal(int offset) const {
+  return unknown || modGlobals.count(offset);
+}
+
+bool Summary::Clobbers(const Summary &other) const {
+  if (unknown || other.unknown)
+    return true;
+  for (auto &region : mod)
+    if (other.Reads(region == "*" ? NULL : region.c_str()))
+      return true;
+  for (auto offset : modGlobals)
+    if (other.refGlobals.count(offset))
+      return true;
+  return false;
+}
+
+// The effects of the runtime routines. Strings are never written, so
+// comparing them has none. _Delete clears the object and keeps it on a
+// free list.
+static Summary RuntimeSummary(const char *label) {
+  Summary s;
+  if (strcmp(label, "_Alloc") == 0)
+    s.allocates = true;
+  else if (strcmp(label, "_Delete") == 0) {
+    s.mod.insert("*");
+    s.escapes.insert(0);
+  }
+  else if (strcmp(label, "_ReadLine") == 0)
+    s.allocates = s.io = true;
+  else if (strcmp(label, "_ReadInteger") == 0 ||
+           strncmp(label, "_Print", 6) == 0 || strcmp(label, "_Flush") == 0 ||
+           strcmp(label, "_Profile") == 0)
+    s.io = true;
+  else if (strcmp(label, "_Halt") == 0)
+    s.io = s.halts = true;
+  else if (strcmp(label, "_StringEqual") != 0)
+    s.unknown = true;
+  return s;
+}
+
+Summary CodeGenerator::GetSummary(Instruction *call) const {
+  const char *label = NULL, *method = NULL;
+  if (auto lcall = dynamic_cast<LCall *>(call))
+    label = lcall->GetLabel();
+  else if (auto acall = dynamic_cast<ACall *>(call))
+    method = acall->GetMethod();
+  else if (auto tail = dynamic_cast<TailCall *>(call))
+    label = tail->GetLabel();
+
+  if (label) {
+    auto iter = summaries.find(label);
+    return iter != summaries.end() ? iter->second : RuntimeSummary(label);
+  }
+  Summary s;
+  s.unknown = !method;
+  if (method) {
+    std::string suffix = std::string(".") + method;
+    for (auto &fn : summaries) {
+      auto &name = fn.first;
+      if (name.size() > suffix.size() &&
+          name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+              0)
+        s.Merge(fn.second);
+    }
+  }
+  return s;
+}
+
+/* Returns the locations that only ever hold addresses into objects the
+ * function allocated itself: results of _Alloc, addresses of its frame
+ * vars, and sums and copies of such locations.
+ */
+static LocationSet FindFresh(const std::vector<Instruction *> &body) {
+  std::map<Location *, std::vector<Instruction *>> defs;
+  for (auto inst : body)
+    for (auto loc : inst->Kill())
+      defs[loc].push_back(inst);
+
+  LocationSet fresh;
+  for (auto &def : defs)
+    if (def.first->GetSegment() == fpRelative)
+      fresh.insert(def.first);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto iter = fresh.begin(); iter != fresh.end();) {
+      bool ok = true;
+      for (auto inst : defs[*iter]) {
+        auto call = dynamic_cast<LCall *>(inst);
+        auto sum = dynamic_cast<BinaryOp *>(inst);
+        auto copy = dynamic_cast<Assign *>(inst);
+        auto addr = dynamic_cast<LoadAddress *>(inst);
+        ok &= (call && strcmp(call->GetLabel(), "_Alloc") == 0) ||
+              (addr && addr->GetVar()->GetSegment() == fpRelative) ||
+              (sum && sum->GetCode() == Mips::Add &&
+               (fresh.count(sum->GetOp1()) || fresh.count(sum->GetOp2()))) ||
+              (copy && fresh.count(copy->GetSrc()));
+      }
+      if (ok)
+        ++iter;
+      else {
+        iter = fresh.erase(iter);
+        changed = true;
+      }
+    }
+  }
+  return fresh;
+}
+
+void CodeGenerator::ComputeSummaries() {
+  summaries.clear();
+  std::map<std::string, std::vector<Instruction *>> bodies;
+  for (int i = 0; i + 1 < code->NumElements(); i++) {
+    auto label = dynamic_cast<Label *>(code->Nth(i));
+    if (!label || !dynamic_cast<BeginFunc *>(code->Nth(i + 1)))
+      continue;
+    auto &body = bodies[label->GetLabel()];
+    for (i++; !dynamic_cast<EndFunc *>(code->Nth(i)); i++)
+      body.push_back(code->Nth(i));
+    summaries[label->GetLabel()];
+  }
+
+  std::map<std::string, std::vector<Instruction *>> calls;
+  for (auto &fn : bodies) {
+    auto &summary = summaries[fn.first];
+    auto fresh = FindFresh(fn.second);
+    for (auto inst : fn.second) {
+      for (auto loc : inst->Gen())
+        if (loc->GetSegment() == gpRelative)
+          summary.refGlobals.insert(loc->GetOffset());
+      for (auto loc : inst->Kill())
+        if (loc->GetSegment() == gpRelative)
+          summary.modGlobals.insert(loc->GetOffset());
+      if (auto load = dynamic_cast<Load *>(inst))
+        summary.ref.insert(load->GetRegion() ? load->GetRegion() : "*");
+      else if (auto store = dynamic_cast<Store *>(inst)) {
+        if (!fresh.count(store->GetDst()))
+          summary.mod.insert(store->GetRegion() ? store->GetRegion() : "*");
+      } else if (dynamic_cast<LCall *>(inst) || dynamic_cast<ACall *>(inst) ||
+                 dynamic_cast<TailCall *>(inst))
+        calls[fn.first].push_back(inst);
+    }
+  }
+
+  // the summaries of callees only grow, so this ends
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &fn : calls)
+      for (auto call : fn.second)
+        changed |= summaries[fn.first].Merge(GetSummary(call));
+  }
+  ComputeEscapes();
+
+  if (IsDebugOn("modref"))
+    for (auto &fn : summaries) {
+      auto &s = fn.second;
+      fprintf(stderr, "modref: %s:", fn.first.c_str());
+      for (auto &region : s.mod)
+        fprintf(stderr, " mod %s", region.c_str());
+      for (auto &region : s.ref)
+        fprintf(stderr, " ref %s", region.c_str());
+      for (auto offset : s.modGlobals)
+        fprintf(stderr, " mod global %d", offset);
+      for (auto offset : s.refGlobals)
+        fprintf(stderr, " ref global %d", offset);
+      for (auto param : s.escapes)
+        fprintf(stderr, " escapes %d", param);
+      fprintf(stderr, "%s%s%s%s%s\n", s.allocates ? " allocates" : "",
+              s.io ? " io" : "", s.halts ? " halts" : "",
+              s.unknown ? " unknown" : "", s.IsPure() ? " pure" : "");
+    }
+}
+
+namespace {
+
+// What is known at a point of an extended basic block.
+struct Values {
+  // Load address and region -> the location holding the value
+  std::map<std::tuple<Location *, int, std::string>, Location *> loads;
+  // pure calls: target, arguments, summary and result
+  struct Call {
+    std::string label;
+    Location *addr;
+    std::vector<Location *> args;
+    Summary summary;
+    Location *result;
+  };
+  std::vector<Call> calls;
+  std::map<Location *, Location *> copies; // dst -> src of Assigns
+
+  Location *Canonical(Location *loc) const {
+    auto iter = copies.find(loc);
+    return iter == copies.end() ? loc : iter->second;
+  }
+
+  // loc gets a new value
+  void Kill(Location *loc) {
+    for (auto iter = loads.begin(); iter != loads.end();)
+      if (std::get<0>(iter->first) == loc || iter->second == loc)
+        iter = loads.erase(iter);
+      else
+        ++iter;
+    calls.erase(std::remove_if(calls.begin(), calls.end(),
+                               [&](const Call &call) {
+                                 return call.addr == loc ||
+                                        call.result == loc ||
+                                        std::count(call.args.begin(),
+                                                   call.args.end(), loc) ||
+                                        (loc->GetSegment() == gpRelative &&
+                                         call.summary.ReadsGlobal(
+                                             loc->GetOffset()));
+                               }),
+                calls.end());
+    copies.erase(loc);
+    for (auto iter = copies.begin(); iter != copies.end();)
+      if (iter->second == loc)
+        iter = copies.erase(iter);
+      else
+        ++iter;
+  }
+
+  // the globals a call summarized by s may assign get new values
+  void KillGlobals(const Summary &s) {
+    LocationSet globals;
+    auto note = [&](Location *loc) {
+      if (loc && loc->GetSegment() == gpRelative &&
+          s.WritesGlobal(loc->GetOffset()))
+        globals.insert(loc);
+    };
+    for (auto &load : loads) {
+      note(std::get<0>(load.first));
+      note(load.second);
+    }
+    for (auto &call : calls) {
+      note(call.addr);
+      note(call.result);
+      for (auto arg : call.args)
+        note(arg);
+    }
+    for (auto &copy : copies) {
+      note(copy.first);
+      note(copy.second);
+    }
+    for (auto loc : globals)
+      Kill(loc);
+  }
+
+  // memory changes as a call summarized by s does
+  void Clobber(const Summary &s) {
+    for (auto iter = loads.begin(); iter != loads.end();)
+      if (s.Writes(std::get<2>(iter->first).c_str()))
+        iter = loads.erase(iter);
+      else
+        ++iter;
+    calls.erase(std::remove_if(calls.begin(), calls.end(),
+                               [&](const Call &call) {
+                                 return s.Clobbers(call.summary);
+                               }),
+                calls.end());
+  }
+};
+
+} // namespace
+
+void CodeGenerator::EliminateRedundancy() {
+  if (!GetIntOption("modref", 1))
+    return;
+
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    if (!dynamic_cast<BeginFunc *>(code->Nth(begin))) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    auto entry = dynamic_cast<Label *>(code->Nth(begin - 1));
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    std::map<Location *, int> uses;
+    for (auto inst : body)
+      for (auto loc : inst->Gen())
+        uses[loc]++;
+
+    FlowGraph graph(body);
+    int numLoads = 0, numCalls = 0, numRemoved = 0;
+    std::map<BasicBlock *, Values> out;
+    for (auto block : graph.GetOrder()) {
+      Values values;
+      if (block->pred.size() == 1 && out.count(block->pred[0]))
+        values = out[block->pred[0]];
+
+      std::vector<Instruction *> code;
+      for (size_t i = 0; i < block->code.size(); i++) {
+        auto inst = block->code[i];
+        if (auto load = dynamic_cast<Load *>(inst)) {
+          auto region = load->GetRegion();
+          auto key = std::make_tuple(values.Canonical(load->GetSrc()),
+                                     load->GetOffset(),
+                                     std::string(region ? region : "*"));
+          auto known = region ? values.loads.find(key) : values.loads.end();
+          auto dst = load->GetDst();
+          values.Kill(dst);
+          if (known != values.loads.end()) {
+            inst = new Assign(dst, known->second);
+            values.copies[dst] = known->second;
+            numLoads++;
+          } else if (region && std::get<0>(key) != dst)
+            values.loads[key] = dst;
+          code.push_back(inst);
+          continue;
+        }
+
+        if (auto store = dynamic_cast<Store *>(inst)) {
+          auto region = store->GetRegion();
+          Summary s;
+          s.mod.insert(region ? region : "*");
+          values.Clobber(s);
+          if (region)
+            values.loads[std::make_tuple(values.Canonical(store->GetDst()),
+                                         store->GetOffset(),
+                                         std::string(region))] =
+                values.Canonical(store->GetSrc());
+          code.push_back(inst);
+          continue;
+        }
+
+        auto lcall = dynamic_cast<LCall *>(inst);
+        auto acall = dynamic_cast<ACall *>(inst);
+        if (lcall || acall) {
+          auto summary = GetSummary(inst);
+          auto dst = lcall ? lcall->GetDst() : acall->GetDst();
+          auto pop = i + 1 < block->code.size()
+                         ? dynamic_cast<PopParams *>(block->code[i + 1])
+                         : NULL;
+          size_t numParams = pop ? pop->GetNumBytes() / VarSize : 0;
+          bool pushed = code.size() >= numParams;
+          Values::Call call = {lcall ? lcall->GetLabel() : "",
+                               acall ? values.Canonical(acall->GetMethodAddr())
+                                     : NULL,
+                               {}, summary, dst};
+          for (size_t k = 1; pushed && k <= numParams; k++) {
+            auto push = dynamic_cast<PushParam *>(code[code.size() - k]);
+            pushed = push != NULL;
+            if (push)
+              call.args.push_back(values.Canonical(push->GetParam()));
+          }
+
+          if (pushed && summary.IsRemovable() && (!dst || !uses[dst])) {
+            code.resize(code.size() - numParams);
+            i += pop ? 1 : 0;
+            numRemoved++;
+            continue;
+          }
+          auto known = std::find_if(
+              values.calls.begin(), values.calls.end(),
+              [&](const Values::Call &c) {
+                return c.label == call.label && c.addr == call.addr &&
+                       c.args == call.args && (c.result || !dst);
+              });
+          if (pushed && summary.IsPure() && known != values.calls.end()) {
+            code.resize(code.size() - numParams);
+            i += pop ? 1 : 0;
+            if (dst) {
+              auto src = known->result;
+              values.Kill(dst);
+              code.push_back(new Assign(dst, src));
+              values.copies[dst] = src;
+            }
+            numCalls++;
+            continue;
+          }
+
+          values.Clobber(summary);
+          values.KillGlobals(summary);
+          for (auto offset : summary.modGlobals)
+            values.calls.erase(
+                std::remove_if(values.calls.begin(), values.calls.end(),
+                               [&](const Values::Call &c) {
+                                 return c.summary.ReadsGlobal(offset);
+                               }),
+                values.calls.end());
+          if (dst)
+            values.Kill(dst);
+          if (pushed && summary.IsPure() && (!acall || call.addr))
+            values.calls.push_back(call);
+          code.push_back(inst);
+          continue;
+        }
+
+        for (auto loc : inst->Kill())
+          values.Kill(loc);
+        if (auto assign = dynamic_cast<Assign *>(inst))
+          if (assign->GetDst() != assign->GetSrc())
+            values.copies[assign->GetDst()] =
+                values.Canonical(assign->GetSrc());
+        code.push_back(inst);
+      }
+      block->code = code;
+      out[block] = values;
+    }
+
+    if (IsDebugOn("modref") && numLoads + numCalls + numRemoved)
+      fprintf(stderr,
+              "modref: %s: %d loads and %d calls reused, %d calls removed\n",
+              entry->GetLabel(), numLoads, numCalls, numRemoved);
+    for (auto inst : graph.Flatten())
+      result->Append(inst);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
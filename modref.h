@@ -0,0 +1,51 @@
+/* File: modref.h
+ * --------------
+ * A Summary records the side effects a call may have: the globals and
+ * memory regions (see Load in tac.h) it may read or write, and whether
+ * it allocates, does I/O or may halt the program. The summaries of all
+ * functions are computed over the call graph by
+ * CodeGenerator::ComputeSummaries; see modref.cc.
+ */
+
+#ifndef _H_modref
+#define _H_modref
+
+#include <set>
+#include <string>
+
+class Summary {
+public:
+  std::set<int> modGlobals, refGlobals; // by offset
+  std::set<std::string> mod, ref;       // regions, "*" for any memory
+  bool allocates, io, halts;
+  bool unknown; // may call code that is not known
+  std::set<int> escapes; // params that may outlive the call, see escape.cc
+
+  Summary() : allocates(false), io(false), halts(false), unknown(false) {}
+
+  // Adds the effects of other; returns whether anything was new.
+  bool Merge(const Summary &other);
+
+  // region NULL stands for any memory
+  bool Reads(const char *region) const;
+  bool Writes(const char *region) const;
+  bool ReadsGlobal(int offset) const;
+  bool WritesGlobal(int offset) const;
+  // param 0 is the last one pushed
+  bool Escapes(int param) const { return unknown || escapes.count(param); }
+  // Whether running this may change what a call summarized by other
+  // reads.
+  bool Clobbers(const Summary &other) const;
+
+  // A call that can be dropped when its result is not used.
+  bool IsRemovable() const {
+    return !unknown && !io && !halts && mod.empty() && modGlobals.empty();
+  }
+  // A call that returns the same result for the same arguments as long
+  // as nothing it reads is written in between.
+  bool IsPure() const {
+    return !unknown && !io && !allocates && mod.empty() && modGlobals.empty();
+  }
+};
+
+#endif
@@ -47,7 +47,7 @@ void yyerror(const char *msg); // standard error-handling routine
 %token   T_LessEqual T_GreaterEqual T_Equal T_NotEqual T_Dims
 %token   T_And T_Or T_Null T_Extends T_This T_Interface T_Implements
 %token   T_While T_For T_If T_Else T_Return T_Break
-%token   T_New T_NewArray T_Print T_ReadInteger T_ReadLine
+%token   T_New T_NewArray T_Print T_ReadInteger T_ReadLine T_Delete
 
 %token   <identifier> T_Identifier
 %token   <stringConstant> T_StringConstant 
@@ -215,6 +215,8 @@ Stmt      :    OptExpr ';'          { $$ = $1; }
                                     { $$ = new ReturnStmt(@1, new EmptyExpr()); }
           |    T_Print '(' ExprList ')' ';'  
                                     { $$ = new PrintStmt($3); }
+          |    T_Delete '(' Expr ')' ';'
+                                    { $$ = new DeleteStmt($3); }
           |    T_Break ';'          { $$ = new BreakStmt(@1); }
           ;
 
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+#
+# perfcheck.py
+# Usage:  perfcheck.py [-j jobs] [--update] [--baseline file]
+#                      [--report file] [--outputs-only] [--profile]
+#                      [-- dcc flags...]
+#
+# Compiles every program in samples/ and bench/ that has a .out file,
+# runs it under dcc-sim with its .in file, several at a time, and checks
+# that it prints what the .out file holds. The instructions executed,
+# the loads, the stores and the code size of each are compared with the
+# numbers in the baseline file (perf-baseline.json), each of which may
+# grow by the fraction its tolerance allows. The results are written as
+# JSON to the report file (perfcheck.json).
+#
+# The baseline holds the default tolerances and, by program, the numbers
+# and any tolerances of its own:
+#
+#   {"tolerance": {"instructions": 0.01, ...},
+#    "programs": {"bench/sieve": {"instructions": 32768481, ...,
+#                                 "tolerance": {"instructions": 0.05}}}}
+#
+# --update writes the numbers measured into the baseline instead, keeping
+# the tolerances. --outputs-only checks the output alone, for flags that
+# change the numbers. --profile first builds each program with
+# -fprofile-generate and runs it, then compiles it with -fprofile-use.
+# Exits with 1 when a program fails or goes over budget.
+#
+
+import argparse
+import concurrent.futures
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+METRICS = ["instructions", "loads", "stores", "code_size"]
+DEFAULT_TOLERANCE = {"instructions": 0.01, "loads": 0.01, "stores": 0.01,
+                     "code_size": 0.02}
+DIRS = ["samples", "bench"]
+LIMIT = 2000000000  # instructions, so a broken program cannot run forever
+
+
+def programs():
+    found = []
+    for d in DIRS:
+        for source in sorted(glob.glob(os.path.join(d, "*.decaf"))):
+            name = source[:-len(".decaf")]
+            if os.path.exists(name + ".out"):
+                found.append(name)
+    return found
+
+
+def run(name, args, tmp):
+    result = {"name": name}
+    asm = os.path.join(tmp, name.replace("/", "_") + ".s")
+    stats = asm[:-2] + ".json"
+    stdin = name + ".in" if os.path.exists(name + ".in") else os.devnull
+    flags = list(args.flags)
+    if args.profile:
+        prof = asm[:-2] + ".prof"
+        with open(name + ".decaf") as source, open(asm, "w") as out:
+            compiled = subprocess.run(
+                [args.dcc, "-fprofile-generate=" + prof] + flags,
+                stdin=source, stdout=out, stderr=subprocess.PIPE)
+        if compiled.returncode == 0:
+            with open(stdin) as inp:
+                subprocess.run([args.sim, "-limit", str(LIMIT), asm],
+                               stdin=inp, stdout=subprocess.DEVNULL,
+                               stderr=subprocess.DEVNULL)
+        flags.append("-fprofile-use=" + prof)
+
+    with open(name + ".decaf") as source, open(asm, "w") as out:
+        compiled = subprocess.run([args.dcc] + flags, stdin=source,
+                                  stdout=out, stderr=subprocess.PIPE)
+    if compiled.returncode != 0:
+        result["status"] = "compile error"
+        result["error"] = compiled.stderr.decode(errors="replace")[-500:]
+        return result
+
+    with open(stdin) as inp:
+        ran = subprocess.run([args.sim, "-limit", str(LIMIT), "-json", stats,
+                              asm], stdin=inp, stdout=subprocess.PIPE,
+                             stderr=subprocess.PIPE)
+    with open(name + ".out", "rb") as expected:
+        if ran.stdout != expected.read():
+            result["status"] = "wrong output"
+            result["error"] = ran.stderr.decode(errors="replace")[-500:]
+            return result
+    if ran.returncode != 0:
+        result["status"] = "run error"
+        result["error"] = ran.stderr.decode(errors="replace")[-500:]
+        return result
+
+    with open(stats) as f:
+        numbers = json.load(f)
+    result["status"] = "ok"
+    result["code_size"] = numbers["code_size"]
+    for metric in ["instructions", "loads", "stores"]:
+        result[metric] = numbers["total"][metric]
+    return result
+
+
+def compare(result, baseline):
+    tolerance = dict(DEFAULT_TOLERANCE)
+    tolerance.update(baseline.get("tolerance", {}))
+    expected = baseline.get("programs", {}).get(result["name"])
+    if expected is None:
+        result["status"] = "new"
+        return
+    tolerance.update(expected.get("tolerance", {}))
+    result["baseline"] = {m: expected[m] for m in METRICS if m in expected}
+    result["change"] = {}
+    over = []
+    for metric in METRICS:
+        if metric not in expected:
+            continue
+        old, new = expected[metric], result[metric]
+        change = (new - old) / old if old else float(new > 0)
+        result["change"][metric] = round(change, 6)
+        if change > tolerance[metric]:
+            over.append(metric)
+    if over:
+        result["status"] = "over budget"
+        result["over"] = over
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Checks the output and the performance of the code "
+                    "dcc generates against a baseline.")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count())
+    parser.add_argument("--dcc", default="./dcc")
+    parser.add_argument("--sim", default="./dcc-sim")
+    parser.add_argument("--baseline", default="perf-baseline.json")
+    parser.add_argument("--report", default="perfcheck.json")
+    parser.add_argument("--update", action="store_true",
+                        help="write the numbers measured into the baseline")
+    parser.add_argument("--outputs-only", action="store_true",
+                        help="check the output but not the numbers")
+    parser.add_argument("--profile", action="store_true",
+                        help="compile with a profile of a first run")
+    parser.add_argument("flags", nargs="*", help="flags passed to dcc")
+    args = parser.parse_args()
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+            results = list(pool.map(lambda name: run(name, args, tmp),
+                                    programs()))
+
+    failed = False
+    for result in results:
+        if result["status"] == "ok" and not (args.update or args.outputs_only):
+            compare(result, baseline)
+        status = result["status"]
+        failed |= status not in ("ok", "new")
+        line = "%-12s %-20s" % (status, result["name"])
+        if "instructions" in result:
+            line += " %12d instructions" % result["instructions"]
+        for metric, change in sorted(result.get("change", {}).items()):
+            if change:
+                line += "  %s %+.2f%%" % (metric, 100 * change)
+        print(line)
+        if "error" in result:
+            print("    " + result["error"].strip().replace("\n", "\n    "))
+
+    if args.update and not args.outputs_only:
+        entries = baseline.setdefault("programs", {})
+        baseline.setdefault("tolerance", DEFAULT_TOLERANCE)
+        for result in results:
+            if result["status"] != "ok":
+                continue
+            entry = entries.setdefault(result["name"], {})
+            for metric in METRICS:
+                entry[metric] = result[metric]
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+
+    report = {"flags": args.flags, "passed": not failed, "programs": results}
+    with open(args.report, "w") as f:
+        json.dump(report, f, indent=2)
+        f.write("\n")
+    print("%s: %d programs, report in %s" %
+          ("FAILED" if failed else "passed", len(results), args.report))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,217 @@
+/* File: profile.cc
+ * ----------------
+ * The counters of -fprofile-generate and the reading of -fprofile-use,
+ * see profile.h. Every BeginFunc gets one counter, for the calls of the
+ * function, and every IfZ generated two, for the times it runs and the
+ * times it falls through, so the times it branches is the difference.
+ * The code that bumps them is emitted by Mips::EmitBeginFunction and
+ * Mips::EmitIfZ, in $k0 and $k1, which nothing else uses. Passes that
+ * copy an IfZ keep its counters, so the copies count together.
+ *
+ * The counters are words at _prof, right after a header of three words:
+ * a magic number, the number of counters and a checksum of the points
+ * of the program they count. _Profile, which the program calls at _Halt
+ * and when main returns (see FnDecl::Emit), writes the header and the
+ * counters to the file as they are in memory, little-endian words on
+ * spim and dcc-sim, and replaces what the file held. Compiling the
+ * same program with the same options numbers the counters alike, so the
+ * header is enough to tell whether a profile fits; one that does not is
+ * ignored with a warning.
+ *
+ * The instrumented compile does not inline, so the count of the entry
+ * of a function covers every call.
+ */
+
+#include "profile.h"
+#include "flowgraph.h"
+#include "runtime.h"
+#include "tac.h"
+#include "utility.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+const unsigned Magic = 0x70636364; // "dccp"
+
+int numProbes;
+unsigned checksum = 17;
+
+bool loaded, used;
+std::vector<unsigned> counts;
+
+const char *FileOption(const char *name) {
+  const char *value = GetOption(name);
+  if (!value || strcmp(value, "0") == 0)
+    return NULL;
+  return strcmp(value, "1") == 0 ? "dcc.prof" : value;
+}
+
+unsigned ReadWord(FILE *file, bool *ok) {
+  unsigned char bytes[4];
+  if (fread(bytes, 1, 4, file) != 4) {
+    *ok = false;
+    return 0;
+  }
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned)bytes[3] << 24;
+}
+
+void ReadProfile() {
+  if (loaded)
+    return;
+  loaded = true;
+  const char *name = FileOption("profile-use");
+  if (!name)
+    return;
+  FILE *file = fopen(name, "rb");
+  if (!file) {
+    fprintf(stderr, "dcc: cannot read profile %s\n", name);
+    return;
+  }
+  bool ok = true;
+  ok = ReadWord(file, &ok) == Magic && ok;
+  ok = ReadWord(file, &ok) == (unsigned)numProbes && ok;
+  ok = ReadWord(file, &ok) == checksum && ok;
+  for (int i = 0; ok && i < numProbes; i++)
+    counts.push_back(ReadWord(file, &ok));
+  ok = ok && fgetc(file) == EOF;
+  fclose(file);
+  if (!ok) {
+    fprintf(stderr, "dcc: profile %s does not match the program, ignored\n",
+            name);
+    counts.clear();
+    return;
+  }
+  used = true;
+}
+
+} // namespace
+
+const char *ProfileGenerate() {
+  static const char *file = FileOption("profile-generate");
+  return file;
+}
+
+int NewProbes(int n, const char *where) {
+  for (const char *p = where; *p; p++)
+    checksum = checksum * 31 + (unsigned char)*p;
+  checksum = checksum * 31 + n;
+  int first = numProbes;
+  numProbes += n;
+  return first;
+}
+
+std::string ProfileRuntime() {
+  static const Lines code = {
+      "_Profile:",
+      "subu $sp, $sp, 8      # decrement sp to make space to save ra, fp",
+      "sw $fp, 8($sp)        # save fp",
+      "sw $ra, 4($sp)        # save ra",
+      "addiu $fp, $sp, 8     # set up new fp",
+      "jal _Flush",
+      "la $a0, _profname",
+      "li $a1, 577           # O_WRONLY | O_CREAT | O_TRUNC",
+      "li $a2, 420           # 0644",
+      "li $v0, 13",
+      "syscall",
+      "bltz $v0, Lrunt80     # the profile is lost, not the run",
+      "move $a3, $v0",
+      "move $a0, $v0",
+      "la $a1, _profile",
+      "li $a2, %d",
+      "li $v0, 15",
+      "syscall",
+      "move $a0, $a3",
+      "li $v0, 16",
+      "syscall",
+      "Lrunt80:",
+      "move $sp, $fp         # pop callee frame off stack",
+      "lw $ra, -4($fp)       # restore saved ra",
+      "lw $fp, 0($fp)        # restore saved fp",
+      "jr $ra                # return from function"};
+
+  std::string name;
+  for (const char *p = ProfileGenerate(); *p; p++) {
+    if (*p == '"' || *p == '\\')
+      name += '\\';
+    name += *p;
+  }
+  char line[64];
+  std::string text = "      .data\n"
+                     "      .align 2\n";
+  snprintf(line, sizeof(line), "      _profile: .word %u, %d, %u\n", Magic,
+           numProbes, checksum);
+  text += line;
+  snprintf(line, sizeof(line), "      _prof: .space %d\n",
+           std::max(numProbes, 1) * 4);
+  text += line;
+  text += "      _profname: .asciiz \"" + name + "\"\n"
+          "      .align 2\n"
+          "      .text\n"
+          "\n";
+  text += RuntimeBlock(code, 3 * 4 + numProbes * 4);
+  text += "\n";
+  return text;
+}
+
+bool ProfileUsed() {
+  ReadProfile();
+  return used;
+}
+
+long ProfileCount(int counter) {
+  ReadProfile();
+  return counter >= 0 && counter < (int)counts.size() ? counts[counter] : 0;
+}
+
+bool ProfileBlockCounts(const FlowGraph &graph,
+                        std::map<BasicBlock *, double> &result) {
+  int entryProbe = graph.GetBeginFunc()->GetProbe();
+  double entry = ProfileCount(entryProbe);
+  if (!ProfileUsed() || entryProbe < 0 || entry == 0)
+    return false;
+
+  // a block ending in a counted IfZ ran as often as the IfZ; any other
+  // one as often as the edges into it were taken
+  std::map<BasicBlock *, double> counts;
+  std::set<BasicBlock *> known;
+  for (auto block : graph.GetOrder())
+    if (auto test = dynamic_cast<IfZ *>(block->GetBranch()))
+      if (test->GetProbe() >= 0) {
+        counts[block] = ProfileCount(test->GetProbe()) * test->GetWeight();
+        known.insert(block);
+      }
+
+  auto edge = [&](BasicBlock *from, BasicBlock *to) {
+    auto test = dynamic_cast<IfZ *>(from->GetBranch());
+    if (!test || test->GetProbe() < 0 || from->succ.size() != 2)
+      return counts[from] / from->succ.size();
+    double falls = ProfileCount(test->GetProbe() + 1) * test->GetWeight();
+    falls = std::min(falls, counts[from]);
+    return to == from->succ[0] ? falls : counts[from] - falls;
+  };
+
+  // the counts of a loop without a counted test grow with every round
+  const double MaxCount = 1e15;
+  int rounds = 2 * graph.GetOrder().size() + 2;
+  for (bool changed = true; changed && rounds-- > 0;) {
+    changed = false;
+    for (auto block : graph.GetOrder()) {
+      if (known.count(block))
+        continue;
+      double count = block == graph.GetEntry() ? entry : 0;
+      for (auto pred : block->pred)
+        count += edge(pred, block);
+      count = std::min(count, MaxCount);
+      if (fabs(count - counts[block]) > 1e-6 * std::max(count, 1.0))
+        changed = true;
+      counts[block] = count;
+    }
+  }
+  for (auto block : graph.GetBlocks())
+    result[block] = counts.count(block) ? counts[block] : 0;
+  return true;
+}
@@ -0,0 +1,48 @@
+/* File: profile.h
+ * ---------------
+ * Profile-guided optimization. With -fprofile-generate[=file] the
+ * program counts, in words of the data segment, the calls of every
+ * function and the runs of every IfZ and of its fall-through edge, and
+ * writes the counts to the file (dcc.prof) when it halts or main
+ * returns. -fprofile-use=file reads them back into a later compile of
+ * the same program with the same options, where they steer inlining
+ * (inline.cc), the layout of blocks (layout.cc) and the spill costs of
+ * the register allocator (loops.cc). See profile.cc.
+ */
+
+#ifndef _H_profile
+#define _H_profile
+
+#include <map>
+#include <string>
+
+class BasicBlock;
+class FlowGraph;
+
+// The file the instrumented program writes, or NULL unless
+// -fprofile-generate is given.
+const char *ProfileGenerate();
+
+// Allocates n counters for a point of the program, named by where (the
+// label of a function or of a branch target), and returns the index of
+// the first. Called as the TAC is generated, so that every compile of
+// a program numbers them alike.
+int NewProbes(int n, const char *where);
+
+// The runtime's _Profile, which writes the counters out, with the
+// counters.
+std::string ProfileRuntime();
+
+// Whether -fprofile-use read a profile that matches the program.
+bool ProfileUsed();
+
+// The count of a counter in the profile used, 0 if there is none.
+long ProfileCount(int counter);
+
+// The times each block of the function ran in the profiled run, as far
+// as the counts of its entry and its branches tell. Returns false if
+// the profile has none for the function.
+bool ProfileBlockCounts(const FlowGraph &graph,
+                        std::map<BasicBlock *, double> &counts);
+
+#endif
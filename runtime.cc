@@ -0,0 +1,604 @@
+/* File: runtime.cc
+ * ----------------
+ * The runtime library: the routines the generated code calls, such as
+ * _PrintInt or _Alloc, and the data they use. The routines are kept in
+ * a table, each one laid out as one block with the routines it calls or
+ * jumps into, and only those the program refers to (see RuntimeUse) are
+ * printed, along with the ones they need.
+ *
+ * Output is buffered at _outbuf, with _out holding the bytes in it, and
+ * printed by _Flush with one syscall when the buffer is full, before
+ * input is read, at _Halt and when main returns (see FnDecl::Emit and
+ * ReturnStmt::Emit). -foutput-buffer=n sets its size in bytes (4096); 0
+ * makes every Print a syscall of its own.
+ *
+ * Input is read by _Fill into _inbuf, as much as fits at once; _in
+ * holds the next unread byte and the end of the bytes read. The strings
+ * ReadLine returns are carved from chunks at _strs (the next free byte
+ * and the end), taking only the words they need. -finput-buffer=n sets
+ * the size of the buffer (4096); 0 makes every read a syscall.
+ *
+ * Strings are word-aligned and padded with nulls to a whole word (see
+ * EmitStringPool in mips.cc), so _StringEqual compares them a word at a
+ * time while no word holds the null, and byte by byte only where the
+ * words differ or a string is not aligned. Unless -fno-string-length is
+ * given, the lengths in the words before the strings are compared first.
+ */
+
+#include "runtime.h"
+#include "gc.h"
+#include "profile.h"
+#include "utility.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+static const Lines prologue = {
+    "subu $sp, $sp, 8      # decrement sp to make space to save ra, fp",
+    "sw $fp, 8($sp)        # save fp",
+    "sw $ra, 4($sp)        # save ra",
+    "addiu $fp, $sp, 8     # set up new fp"};
+
+static const Lines epilogue = {
+    "# EndFunc",
+    "# (below handles reaching end of fn body with no explicit return)",
+    "move $sp, $fp         # pop callee frame off stack",
+    "lw $ra, -4($fp)       # restore saved ra",
+    "lw $fp, 0($fp)        # restore saved fp",
+    "jr $ra                # return from function"};
+
+// With the output buffered.
+
+static const Lines flush = {
+    "la $a1, _out",
+    "lw $a2, 0($a1)",
+    "beqz $a2, Lrunt40     # nothing to print",
+    "sw $0, 0($a1)",
+    "la $a0, _outbuf",
+    "addu $a2, $a2, $a0",
+    "sb $0, 0($a2)         # end the string",
+    "li $v0, 4",
+    "syscall",
+    "Lrunt40:"};
+
+static const Lines printString = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "Lrunt41:",
+    "la $a1, _out",
+    "lw $a2, 0($a1)",
+    "la $a3, _outbuf",
+    "addu $a3, $a3, $a2    # the next free byte",
+    "li $v1, %d",
+    "subu $v1, $v1, $a2    # the room left",
+    "Lrunt42:",
+    "lbu $v0, 0($a0)",
+    "beqz $v0, Lrunt43     # end of string",
+    "beqz $v1, Lrunt44     # the buffer is full",
+    "sb $v0, 0($a3)",
+    "addiu $a0, $a0, 1",
+    "addiu $a3, $a3, 1",
+    "addiu $v1, $v1, -1",
+    "b Lrunt42",
+    "Lrunt44:",
+    "li $a2, %d",
+    "sw $a2, 0($a1)",
+    "move $a3, $a0         # kept by _Flush",
+    "jal _Flush",
+    "move $a0, $a3",
+    "b Lrunt41",
+    "Lrunt43:",
+    "la $a2, _outbuf",
+    "subu $a2, $a3, $a2",
+    "sw $a2, 0($a1)"};
+
+// _PrintBool ends in _PrintString, whose frame is the same.
+static const Lines printBool = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "beqz $a0, Lrunt45",
+    "la $a0, _PrintBoolTrueString",
+    "b Lrunt41             # on to _PrintString, whose frame is alike",
+    "Lrunt45:",
+    "la $a0, _PrintBoolFalseString",
+    "b Lrunt41"};
+
+// The digits are counted first, then written from the last one back.
+// The magnitude is taken as unsigned, so that of -2^31 is right.
+static const Lines printInt = {
+    "la $a1, _out",
+    "lw $a2, 0($a1)",
+    "li $v0, %d",
+    "ble $a2, $v0, Lrunt46 # room for 11 chars",
+    "jal _Flush",
+    "li $a2, 0",
+    "Lrunt46:",
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "la $a3, _outbuf",
+    "addu $a3, $a3, $a2    # the next free byte",
+    "bgez $a0, Lrunt47",
+    "li $v0, 45            # minus sign",
+    "sb $v0, 0($a3)",
+    "addiu $a3, $a3, 1",
+    "negu $a0, $a0",
+    "Lrunt47:",
+    "li $a2, 10",
+    "move $v1, $a0",
+    "Lrunt48:",
+    "divu $v1, $v1, $a2",
+    "addiu $a3, $a3, 1",
+    "bnez $v1, Lrunt48     # count the digits",
+    "move $a1, $a3         # the end of the number",
+    "Lrunt49:",
+    "remu $v1, $a0, $a2",
+    "divu $a0, $a0, $a2",
+    "addiu $v1, $v1, 48",
+    "addiu $a3, $a3, -1",
+    "sb $v1, 0($a3)",
+    "bnez $a0, Lrunt49",
+    "la $a2, _outbuf",
+    "subu $a1, $a1, $a2",
+    "la $a2, _out",
+    "sw $a1, 0($a2)"};
+
+// With every Print a syscall.
+
+static const Lines printStringPlain = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "li $v0, 4",
+    "syscall"};
+
+static const Lines printBoolPlain = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "li $v0, 4",
+    "beq $a0, $0, PrintBoolFalse",
+    "la $a0, _PrintBoolTrueString",
+    "j PrintBoolEnd",
+    "PrintBoolFalse:",
+    "la $a0, _PrintBoolFalseString",
+    "PrintBoolEnd:",
+    "syscall"};
+
+static const Lines printIntPlain = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "# LCall _PrintInt",
+    "li $v0, 1",
+    "syscall"};
+
+// _heap holds the next free byte and the end of the current chunk;
+// inline allocations bump it too (see alloc.cc). _free holds the blocks
+// given back by Delete, one list for every size below 256 bytes, by
+// size; a block links to the next in its first word.
+static const Lines alloc = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "li $a2, 256",
+    "bgeu $a0, $a2, Lrunt32 # no size class",
+    "la $a2, _free",
+    "addu $a2, $a2, $a0",
+    "lw $v0, 0($a2)",
+    "beqz $v0, Lrunt32     # no block of this size was deleted",
+    "lw $a3, 0($v0)",
+    "sw $a3, 0($a2)        # pop it",
+    "sw $0, 0($v0)         # the rest was cleared by _Delete",
+    "b Lrunt33",
+    "Lrunt32:",
+    "la $a1, _heap",
+    "lw $v0, 0($a1)        # next free byte",
+    "lw $a2, 4($a1)        # end of the chunk",
+    "addu $a3, $v0, $a0",
+    "ble $a3, $a2, Lrunt31 # the block fits in the chunk",
+    "li $a2, %d            # bytes to ask sbrk for",
+    "bge $a2, $a0, Lrunt30",
+    "move $a2, $a0         # a large block gets a chunk of its own",
+    "Lrunt30:",
+    "move $v1, $a0",
+    "move $a0, $a2",
+    "li $v0, 9",
+    "syscall               # sbrk a new chunk",
+    "addu $a2, $v0, $a0",
+    "sw $a2, 4($a1)",
+    "addu $a3, $v0, $v1",
+    "Lrunt31:",
+    "sw $a3, 0($a1)",
+    "Lrunt33:"};
+
+static const Lines deleteBlock = {
+    "lw $a0, 4($fp)        # the object",
+    "lw $a1, 8($fp)        # its size",
+    "beqz $a0, Lrunt35",
+    "li $a2, 256",
+    "bgeu $a1, $a2, Lrunt35 # no size class, the block is lost",
+    "addu $a2, $a0, $a1",
+    "addiu $a3, $a0, 4",
+    "Lrunt34:",
+    "bgeu $a3, $a2, Lrunt36",
+    "sw $0, 0($a3)         # clear the block but for the link",
+    "addiu $a3, $a3, 4",
+    "b Lrunt34",
+    "Lrunt36:",
+    "la $a2, _free",
+    "addu $a2, $a2, $a1",
+    "lw $a3, 0($a2)",
+    "sw $a3, 0($a0)",
+    "sw $a0, 0($a2)        # push it on the list of its size",
+    "Lrunt35:"};
+
+static const Lines halt = {
+    "jal _Flush",
+    "li $v0, 10",
+    "syscall"};
+
+// With -fprofile-generate, which writes the counters out too.
+static const Lines haltProfile = {
+    "jal _Profile",
+    "li $v0, 10",
+    "syscall"};
+
+static const Lines stringEqual = {
+    "lw $a0, 4($fp)        # fill a from $fp+4",
+    "lw $a1, 8($fp)        # fill a from $fp+8",
+    "li $v0, 1",
+    "beq $a0,$a1,Lrunt10   # the same string"};
+
+static const Lines compareLengths = {
+    "lw $a2, -4($a0)",
+    "lw $a3, -4($a1)",
+    "bne $a2,$a3,Lrunt11   # the lengths differ"};
+
+static const Lines compareWords = {
+    "or $a2,$a0,$a1",
+    "andi $a2,$a2,3",
+    "bnez $a2,Lrunt12      # not both aligned",
+    "li $v1,0x01010101",
+    "Lrunt13:",
+    "lw $v0,($a0)",
+    "lw $a2,($a1)",
+    "bne $v0,$a2,Lrunt12   # compare the bytes of this word",
+    "subu $a3,$v0,$v1",
+    "nor $a2,$v0,$0",
+    "and $a3,$a3,$a2",
+    "sll $a2,$v1,7",
+    "and $a3,$a3,$a2       # nonzero if the word holds a null",
+    "addiu $a0,$a0,4",
+    "addiu $a1,$a1,4",
+    "beqz $a3,Lrunt13",
+    "li  $v0,1",
+    "j Lrunt10",
+    "Lrunt12:",
+    "lbu  $v0,($a0)",
+    "lbu  $a2,($a1)",
+    "bne $v0,$a2,Lrunt11",
+    "addiu $a0,$a0,1",
+    "addiu $a1,$a1,1",
+    "bne $v0,$0,Lrunt12",
+    "li  $v0,1",
+    "j Lrunt10",
+    "Lrunt11:",
+    "li  $v0,0",
+    "Lrunt10:"};
+
+// With the input buffered. _Fill returns the bytes read in $v0 (0 at
+// the end of the input) and the next byte and the end in $a0 and $a1,
+// keeping $v1 and $a3.
+static const Lines fill = {
+    "jal _Flush",
+    "li $a0, 0             # standard input",
+    "la $a1, _inbuf",
+    "li $a2, %d",
+    "li $v0, 14",
+    "syscall",
+    "bgez $v0, Lrunt50",
+    "li $v0, 0             # an error ends the input too",
+    "Lrunt50:",
+    "move $a0, $a1",
+    "addu $a1, $a1, $v0"};
+
+// Reads a line like the read_int syscall: blanks, a sign and digits,
+// with the rest of the line skipped.
+static const Lines readInteger = {
+    "la $a2, _in",
+    "lw $a0, 0($a2)",
+    "lw $a1, 4($a2)",
+    "li $v1, 0             # the value",
+    "li $a3, 0             # whether it is negative",
+    "Lrunt51:",
+    "bne $a0, $a1, Lrunt52",
+    "jal _Fill",
+    "beqz $v0, Lrunt59     # end of input",
+    "Lrunt52:",
+    "lbu $v0, 0($a0)",
+    "li $a2, 10",
+    "beq $v0, $a2, Lrunt57 # an empty line",
+    "li $a2, 32",
+    "beq $v0, $a2, Lrunt53",
+    "addiu $a2, $v0, -9",
+    "bgeu $a2, 5, Lrunt54  # not a blank",
+    "Lrunt53:",
+    "addiu $a0, $a0, 1",
+    "b Lrunt51",
+    "Lrunt54:",
+    "li $a2, 45",
+    "beq $v0, $a2, Lrunt61 # minus sign",
+    "li $a2, 43",
+    "bne $v0, $a2, Lrunt55 # no sign",
+    "b Lrunt62",
+    "Lrunt61:",
+    "li $a3, 1",
+    "Lrunt62:",
+    "addiu $a0, $a0, 1",
+    "Lrunt55:",
+    "bne $a0, $a1, Lrunt56",
+    "jal _Fill",
+    "beqz $v0, Lrunt59     # end of input",
+    "Lrunt56:",
+    "lbu $v0, 0($a0)",
+    "addiu $a2, $v0, -48",
+    "bgeu $a2, 10, Lrunt57 # not a digit",
+    "sll $v0, $v1, 3",
+    "sll $v1, $v1, 1",
+    "addu $v1, $v1, $v0",
+    "addu $v1, $v1, $a2",
+    "addiu $a0, $a0, 1",
+    "b Lrunt55",
+    "Lrunt57:",
+    "bne $a0, $a1, Lrunt58",
+    "jal _Fill",
+    "beqz $v0, Lrunt59     # end of input",
+    "Lrunt58:",
+    "lbu $v0, 0($a0)",
+    "addiu $a0, $a0, 1",
+    "li $a2, 10",
+    "bne $v0, $a2, Lrunt57 # skip the rest of the line",
+    "Lrunt59:",
+    "la $a2, _in",
+    "sw $a0, 0($a2)",
+    "sw $a1, 4($a2)",
+    "move $v0, $v1",
+    "beqz $a3, Lrunt60",
+    "negu $v0, $v1",
+    "Lrunt60:"};
+
+// Reads a line like the read_string syscall with room for 100 chars: up
+// to the newline, which is dropped, or the 100th char. The string is
+// word-aligned and followed by nulls up to the next word, as the chunks
+// come cleared from sbrk.
+static const Lines readLine = {
+    "la $a3, _strs",
+    "lw $v1, 0($a3)",
+    "lw $a2, 4($a3)",
+    "addiu $v0, $v1, 108   # the most a line takes",
+    "ble $v0, $a2, Lrunt71",
+    "li $a0, 4096",
+    "li $v0, 9",
+    "syscall               # sbrk a new chunk",
+    "move $v1, $v0",
+    "addiu $a2, $v0, 4096",
+    "sw $a2, 4($a3)",
+    "Lrunt71:",
+    "addiu $v1, $v1, 4     # leave a word for the length",
+    "move $a3, $v1         # the next char",
+    "la $a2, _in",
+    "lw $a0, 0($a2)",
+    "lw $a1, 4($a2)",
+    "Lrunt72:",
+    "subu $a2, $a3, $v1",
+    "bge $a2, 100, Lrunt75 # the string is full",
+    "bne $a0, $a1, Lrunt74",
+    "jal _Fill",
+    "beqz $v0, Lrunt75     # end of input",
+    "Lrunt74:",
+    "lbu $v0, 0($a0)",
+    "addiu $a0, $a0, 1",
+    "li $a2, 10",
+    "beq $v0, $a2, Lrunt75 # the newline ends the line",
+    "sb $v0, 0($a3)",
+    "addiu $a3, $a3, 1",
+    "b Lrunt72",
+    "Lrunt75:",
+    "la $a2, _in",
+    "sw $a0, 0($a2)",
+    "sw $a1, 4($a2)",
+    "subu $a2, $a3, $v1",
+    "sw $a2, -4($v1)       # the length",
+    "addiu $a3, $a3, 4",
+    "li $a2, -4",
+    "and $a3, $a3, $a2     # past the null, on a word",
+    "la $a2, _strs",
+    "sw $a3, 0($a2)",
+    "move $v0, $v1"};
+
+// With every read a syscall. The buffer of _ReadLine is a whole number
+// of words, so the next one stays aligned, and starts out cleared, so
+// the string is padded with nulls.
+
+static const Lines readIntegerPlain = {
+    "jal _Flush            # show what was printed before reading",
+    "li $v0, 5",
+    "syscall"};
+
+static const Lines readLinePlain = {
+    "jal _Flush            # show what was printed before reading",
+    "li $a0, 108",
+    "li $v0, 9",
+    "syscall",
+    "addiu $a0, $v0, 4     # leave a word for the length",
+    "li $v0, 8",
+    "li $a1,101",
+    "syscall",
+    "addiu $v0,$a0,0       # pointer to begin of string",
+    "Lrunt21:",
+    "lbu $a1,($a0)         # load character at pointer",
+    "addiu $a0,$a0,1       # forward pointer",
+    "bnez $a1,Lrunt21      # loop until end of string is reached",
+    "addiu $a0,$a0,-1      # back to the null",
+    "beq $a0,$v0,Lrunt20   # the string is empty",
+    "lbu $a1,-1($a0)       # load character before end of string",
+    "li $a2,10             # newline character",
+    "bne $a1,$a2,Lrunt20   # do not remove last character if not newline",
+    "addiu $a0,$a0,-1",
+    "sb $0,($a0)           # Add the terminating character in its place",
+    "Lrunt20:",
+    "subu $a1,$a0,$v0",
+    "sw $a1,-4($v0)        # the length"};
+
+std::string RuntimeBlock(const Lines &lines, int value) {
+  std::string text;
+  char line[256];
+  for (auto format : lines) {
+    snprintf(line, sizeof(line), format, value);
+    int length = strlen(line);
+    if (!length)
+      text += "\n";
+    else if (line[length - 1] == ':')
+      text += std::string("  ") + line + "\n";
+    else if (line[0] == '.' || strstr(line, ": ."))
+      text += std::string("      ") + line + "\n";
+    else if (line[0] == '#')
+      text += std::string("\t") + line + "\n";
+    else
+      text += std::string("\t  ") + line + "\n";
+  }
+  return text;
+}
+
+static Lines Join(std::initializer_list<Lines> parts) {
+  Lines lines;
+  for (auto &part : parts)
+    lines.insert(lines.end(), part.begin(), part.end());
+  return lines;
+}
+
+// The words a routine lays out in the data segment.
+static Lines Data(const Lines &words) {
+  return Join({{".data", ".align 2"}, words, {".text", ""}});
+}
+
+// A routine with the usual frame around body; one that ends by jumping
+// into another has no epilogue.
+static Lines Framed(const char *label, const Lines &body,
+                    bool returns = true) {
+  return Join({{label}, prologue, body, returns ? epilogue : Lines(), {""}});
+}
+
+struct Routine {
+  const char *label;
+  Lines uses; // the routines it calls or jumps into
+  Lines data; // the labels of its data that inline code refers to
+  std::string code;
+};
+
+// The routines as the options select them, in the order they are
+// printed.
+static std::vector<Routine> Routines() {
+  std::vector<Routine> routines;
+  Lines boolData = Data({"_PrintBoolTrueString: .asciiz \"true\"",
+                         "_PrintBoolFalseString: .asciiz \"false\""});
+
+  int outSize = GetIntOption("output-buffer", 4096);
+  if (outSize > 0) {
+    outSize = std::max(outSize, 16); // room for any number
+    Lines data = Data({"_out: .word 0", "_outbuf: .space %d"});
+    routines.push_back(
+        {"_Flush", {}, {},
+         RuntimeBlock(Join({data, Framed("_Flush:", flush)}), outSize + 1)});
+    routines.push_back(
+        {"_PrintString", {"_Flush"}, {},
+         RuntimeBlock(Framed("_PrintString:", printString), outSize)});
+    routines.push_back(
+        {"_PrintBool", {"_PrintString"}, {},
+         RuntimeBlock(Join({Framed("_PrintBool:", printBool, false),
+                            boolData}))});
+    routines.push_back(
+        {"_PrintInt", {"_Flush"}, {},
+         RuntimeBlock(Framed("_PrintInt:", printInt), outSize - 11)});
+  } else {
+    routines.push_back(
+        {"_Flush", {}, {}, RuntimeBlock({"_Flush:", "jr $ra", ""})});
+    routines.push_back(
+        {"_PrintString", {}, {},
+         RuntimeBlock(Framed("_PrintString:", printStringPlain))});
+    routines.push_back(
+        {"_PrintBool", {}, {},
+         RuntimeBlock(Join({Framed("_PrintBool:", printBoolPlain),
+                            boolData}))});
+    routines.push_back({"_PrintInt", {}, {},
+                        RuntimeBlock(Framed("_PrintInt:", printIntPlain))});
+  }
+
+  if (GCEnabled())
+    routines.push_back({"_Alloc", {}, {"_heap"}, GCRuntime()});
+  else {
+    Lines data = Data({"_heap: .word 0, 0", "_free: .space 256"});
+    routines.push_back({"_Alloc", {}, {"_heap", "_free"},
+                        RuntimeBlock(Join({data, Framed("_Alloc:", alloc)}),
+                                     GetIntOption("heap-chunk", 65536))});
+    routines.push_back({"_Delete", {"_Alloc"}, {},
+                        RuntimeBlock(Framed("_Delete:", deleteBlock))});
+  }
+  if (ProfileGenerate()) {
+    routines.push_back({"_Profile", {"_Flush"}, {}, ProfileRuntime()});
+    routines.push_back({"_Halt", {"_Profile"}, {},
+                        RuntimeBlock(Join({{"_Halt:"}, haltProfile, {""}}))});
+  } else
+    routines.push_back({"_Halt", {"_Flush"}, {},
+                        RuntimeBlock(Join({{"_Halt:"}, halt, {""}}))});
+
+  Lines compare = stringEqual;
+  if (GetIntOption("string-length", 1))
+    compare = Join({compare, compareLengths});
+  routines.push_back(
+      {"_StringEqual", {}, {},
+       RuntimeBlock(Framed("_StringEqual:", Join({compare, compareWords})))});
+
+  int inSize = GetIntOption("input-buffer", 4096);
+  if (inSize > 0) {
+    Lines data =
+        Data({"_in: .word 0, 0", "_strs: .word 0, 0", "_inbuf: .space %d"});
+    routines.push_back(
+        {"_Fill", {"_Flush"}, {},
+         RuntimeBlock(Join({data, Framed("_Fill:", fill)}), inSize)});
+    routines.push_back({"_ReadInteger", {"_Fill"}, {},
+                        RuntimeBlock(Framed("_ReadInteger:", readInteger))});
+    routines.push_back({"_ReadLine", {"_Fill"}, {},
+                        RuntimeBlock(Framed("_ReadLine:", readLine))});
+  } else {
+    routines.push_back(
+        {"_ReadInteger", {"_Flush"}, {},
+         RuntimeBlock(Framed("_ReadInteger:", readIntegerPlain))});
+    routines.push_back({"_ReadLine", {"_Flush"}, {},
+                        RuntimeBlock(Framed("_ReadLine:", readLinePlain))});
+  }
+  return routines;
+}
+
+static std::set<std::string> used;
+
+void RuntimeUse(const char *label) { used.insert(label); }
+
+void RuntimeCodeGen() {
+  auto routines = Routines();
+  std::map<std::string, Routine *> byLabel;
+  for (auto &routine : routines) {
+    byLabel[routine.label] = &routine;
+    for (auto label : routine.data)
+      byLabel[label] = &routine;
+  }
+
+  // the routines referred to and, in turn, the ones they need
+  std::set<Routine *> needed;
+  std::vector<Routine *> work;
+  for (auto &label : used)
+    if (byLabel.count(label))
+      work.push_back(byLabel[label]);
+  while (!work.empty()) {
+    auto routine = work.back();
+    work.pop_back();
+    if (needed.insert(routine).second)
+      for (auto label : routine->uses)
+        work.push_back(byLabel.at(label));
+  }
+
+  for (auto &routine : routines)
+    if (needed.count(&routine))
+      fputs(routine.code.c_str(), stdout);
+}
@@ -0,0 +1,28 @@
+/* File: runtime.h
+ * ---------------
+ * The runtime library printed after the generated code. Only the
+ * routines the code refers to are printed, with those they need; see
+ * runtime.cc.
+ */
+
+#ifndef _H_runtime
+#define _H_runtime
+
+#include <string>
+#include <vector>
+
+typedef std::vector<const char *> Lines;
+
+// Records that the generated code refers to label, the name of a routine
+// or of the data of one.
+void RuntimeUse(const char *label);
+
+// Prints the routines used.
+void RuntimeCodeGen();
+
+// Lays out lines of assembly as the rest of the runtime, with value in
+// place of a %d: labels, data directives and instructions each get
+// their own indent.
+std::string RuntimeBlock(const Lines &lines, int value = 0);
+
+#endif
@@ -0,0 +1,1150 @@
+/* File: simulator.cc
+ * ------------------
+ * dcc-sim, a small simulator for the MIPS subset that dcc emits.
+ *
+ * The assembly file is parsed once into predecoded instructions (opcode,
+ * register numbers, immediates and resolved branch targets) and then run
+ * with a threaded dispatch loop. The simulator implements the SPIM
+ * directives and syscalls used by the compiler and its runtime, so it can
+ * stand in for SPIM when running and measuring generated code.
+ *
+ * Usage:  dcc-sim [-stats] [-json file] [-limit n] [-stack bytes] file.s
+ *
+ * The program reads stdin and writes stdout. With -stats, dynamic
+ * instruction counts by class and by function are reported on stderr;
+ * -json writes the same numbers to a file for scripts.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef enum {
+  ALU,
+  LOAD,
+  STORE,
+  BRANCH,
+  SYSCALL,
+  NumClasses
+} InsnClass;
+
+const char *const className[NumClasses] = {"alu", "loads", "stores",
+                                           "branches", "syscalls"};
+
+#define OPCODES(X)                                                             \
+  X(Add, ALU) X(AddImm, ALU) X(Sub, ALU) X(Mul, ALU) X(Div, ALU)               \
+  X(Rem, ALU) X(Divu, ALU) X(Remu, ALU) X(And, ALU) X(AndImm, ALU)             \
+  X(Or, ALU) X(OrImm, ALU) X(Xor, ALU) X(XorImm, ALU) X(Nor, ALU)              \
+  X(Sll, ALU) X(Srl, ALU) X(Sra, ALU) X(Sllv, ALU) X(Srlv, ALU)                \
+  X(Srav, ALU) X(Slt, ALU) X(SltImm, ALU) X(Sltu, ALU) X(SltuImm, ALU)         \
+  X(Seq, ALU) X(Sne, ALU) X(Sle, ALU) X(Sgt, ALU) X(Sge, ALU) X(Li, ALU)      \
+  X(Move, ALU) X(Neg, ALU) X(Not, ALU)                                         \
+  X(Mult, ALU) X(Div2, ALU) X(Mfhi, ALU) X(Mflo, ALU) X(Nop, ALU)              \
+  X(Lw, LOAD) X(Lb, LOAD) X(Lbu, LOAD) X(Lh, LOAD) X(Lhu, LOAD)                \
+  X(Sw, STORE) X(Sb, STORE) X(Sh, STORE)                                       \
+  X(B, BRANCH) X(Jal, BRANCH) X(Jr, BRANCH) X(Jalr, BRANCH) X(Beq, BRANCH)     \
+  X(Bne, BRANCH) X(Blt, BRANCH) X(Ble, BRANCH) X(Bgt, BRANCH) X(Bge, BRANCH)   \
+  X(Bltu, BRANCH) X(Bgeu, BRANCH) X(Beqz, BRANCH) X(Bnez, BRANCH)              \
+  X(Bltz, BRANCH) X(Blez, BRANCH) X(Bgtz, BRANCH) X(Bgez, BRANCH)              \
+  X(Syscall, SYSCALL) X(Exit, SYSCALL)
+
+#define AS_ENUM(name, cls) name,
+typedef enum { OPCODES(AS_ENUM) NumOpcodes } Opcode;
+#undef AS_ENUM
+
+#define AS_CLASS(name, cls) cls,
+const InsnClass opClass[NumOpcodes] = {OPCODES(AS_CLASS)};
+#undef AS_CLASS
+
+struct Insn {
+  Opcode op;
+  uint8_t rd, rs, rt;
+  int32_t imm;    // immediate, memory offset or absolute address
+  int32_t target; // instruction index for branches and jal
+};
+
+const uint32_t TextBase = 0x00400000;
+const uint32_t DataBase = 0x10000000;
+const uint32_t GlobalPointer = 0x10008000;
+const uint32_t StaticBase = 0x10010000;
+const uint32_t StackTop = 0x80000000;
+
+const char *const regNames[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3", "t0", "t1", "t2",
+    "t3",   "t4", "t5", "t6", "t7", "s0", "s1", "s2", "s3", "s4", "s5",
+    "s6",   "s7", "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"};
+
+void Fatal(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+void Fatal(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fflush(stdout);
+  fprintf(stderr, "dcc-sim: ");
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  exit(2);
+}
+
+// A source line kept for error messages and for the second pass.
+struct Pending {
+  int line;
+  std::string mnemonic;
+  std::vector<std::string> args;
+};
+
+class Program {
+public:
+  std::vector<Insn> text;
+  std::vector<int> textLine;
+  std::vector<uint8_t> data; // static data, placed at StaticBase
+  std::map<std::string, int> textLabels;
+  std::map<std::string, uint32_t> dataLabels;
+  std::vector<std::string> functionName;
+  std::vector<int> functionOf;
+
+  void Parse(FILE *fp, const char *fileName);
+
+private:
+  const char *fileName;
+  std::vector<Pending> pending;
+  struct Fixup {
+    size_t offset;
+    std::string label;
+    int line;
+  };
+  std::vector<Fixup> fixups;
+  std::map<int, std::string> labelAt;
+  int textSize;
+
+  void ParseLine(char *line, int lineNum, bool &inText);
+  void Directive(const std::string &dir, const std::string &rest, int line,
+                 bool &inText);
+  int Size(const Pending &p);
+  void Decode(const Pending &p);
+  void FindFunctions();
+
+  int Reg(const std::string &s, int line);
+  bool IsReg(const std::string &s) { return !s.empty() && s[0] == '$'; }
+  int32_t Imm(const std::string &s, int line);
+  int32_t Address(const std::string &s, int line);
+  int Target(const std::string &s, int line);
+  void Memory(const std::string &s, Insn &insn, int line);
+};
+
+std::string Trim(const std::string &s) {
+  size_t b = s.find_first_not_of(" \t\r\n");
+  if (b == std::string::npos)
+    return "";
+  size_t e = s.find_last_not_of(" \t\r\n");
+  return s.substr(b, e - b + 1);
+}
+
+// Strips a trailing comment, ignoring '#' characters inside quotes.
+std::string StripComment(const char *line) {
+  std::string out;
+  bool quoted = false;
+  for (const char *p = line; *p; p++) {
+    if (quoted && *p == '\\' && p[1]) {
+      out += *p++;
+      out += *p;
+      continue;
+    }
+    if (*p == '"')
+      quoted = !quoted;
+    else if (*p == '#' && !quoted)
+      break;
+    out += *p;
+  }
+  return out;
+}
+
+std::vector<std::string> SplitArgs(const std::string &s) {
+  std::vector<std::string> args;
+  std::string cur;
+  bool quoted = false;
+  for (size_t i = 0; i < s.size(); i++) {
+    char c = s[i];
+    if (c == '"')
+      quoted = !quoted;
+    if (c == ',' && !quoted) {
+      args.push_back(Trim(cur));
+      cur.clear();
+    } else
+      cur += c;
+  }
+  if (!Trim(cur).empty())
+    args.push_back(Trim(cur));
+  return args;
+}
+
+void Program::Parse(FILE *fp, const char *name) {
+  fileName = name;
+  textSize = 0;
+  char buf[4096];
+  int lineNum = 0;
+  bool inText = true;
+  while (fgets(buf, sizeof(buf), fp))
+    ParseLine(buf, ++lineNum, inText);
+
+  for (auto &p : pending)
+    Decode(p);
+  for (auto &f : fixups) {
+    uint32_t addr;
+    auto t = textLabels.find(f.label);
+    if (t != textLabels.end())
+      addr = TextBase + 4 * t->second;
+    else
+      addr = Address(f.label, f.line);
+    memcpy(&data[f.offset], &addr, 4);
+  }
+
+  // sentinel used as the return address of main
+  Insn exit = {Exit, 0, 0, 0, 0, 0};
+  text.push_back(exit);
+  textLine.push_back(0);
+  FindFunctions();
+}
+
+void Program::ParseLine(char *raw, int lineNum, bool &inText) {
+  std::string line = Trim(StripComment(raw));
+  while (!line.empty()) {
+    // peel off any leading labels
+    size_t colon = line.find(':');
+    size_t quote = line.find('"');
+    if (colon == std::string::npos ||
+        (quote != std::string::npos && quote < colon))
+      break;
+    std::string label = Trim(line.substr(0, colon));
+    if (label.empty() || label.find_first_of(" \t") != std::string::npos)
+      break;
+    if (inText) {
+      textLabels[label] = textSize;
+      labelAt.emplace(textSize, label);
+    } else
+      dataLabels[label] = StaticBase + data.size();
+    line = Trim(line.substr(colon + 1));
+  }
+  if (line.empty())
+    return;
+
+  size_t sp = line.find_first_of(" \t");
+  std::string head = line.substr(0, sp);
+  std::string rest = sp == std::string::npos ? "" : Trim(line.substr(sp));
+  if (head[0] == '.') {
+    Directive(head, rest, lineNum, inText);
+    return;
+  }
+  if (!inText)
+    Fatal("%s:%d: instruction in data segment", fileName, lineNum);
+  Pending p = {lineNum, head, SplitArgs(rest)};
+  textSize += Size(p);
+  pending.push_back(p);
+}
+
+void Program::Directive(const std::string &dir, const std::string &rest,
+                        int line, bool &inText) {
+  if (dir == ".text")
+    inText = true;
+  else if (dir == ".data")
+    inText = false;
+  else if (dir == ".globl" || dir == ".extern")
+    ;
+  else if (dir == ".align") {
+    if (inText)
+      return;
+    int align = 1 << Imm(rest, line);
+    while (data.size() % align)
+      data.push_back(0);
+  } else if (dir == ".asciiz" || dir == ".ascii") {
+    size_t b = rest.find('"'), e = rest.rfind('"');
+    if (b == std::string::npos || e == b)
+      Fatal("%s:%d: bad string literal", fileName, line);
+    for (size_t i = b + 1; i < e; i++) {
+      char c = rest[i];
+      if (c == '\\') {
+        switch (rest[++i]) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case '0': c = '\0'; break;
+        default: c = rest[i]; break;
+        }
+      }
+      data.push_back(c);
+    }
+    if (dir == ".asciiz")
+      data.push_back(0);
+  } else if (dir == ".word") {
+    while (data.size() % 4)
+      data.push_back(0);
+    for (auto &arg : SplitArgs(rest)) {
+      int32_t v = 0;
+      if (isdigit((unsigned char)arg[0]) || arg[0] == '-')
+        v = Imm(arg, line);
+      else
+        fixups.push_back({data.size(), arg, line});
+      data.insert(data.end(), (uint8_t *)&v, (uint8_t *)&v + 4);
+    }
+  } else if (dir == ".byte") {
+    for (auto &arg : SplitArgs(rest))
+      data.push_back((uint8_t)Imm(arg, line));
+  } else if (dir == ".space") {
+    data.resize(data.size() + Imm(rest, line));
+  } else
+    Fatal("%s:%d: unsupported directive %s", fileName, line, dir.c_str());
+}
+
+int Program::Reg(const std::string &s, int line) {
+  if (!IsReg(s))
+    Fatal("%s:%d: expected register, got '%s'", fileName, line, s.c_str());
+  std::string name = s.substr(1);
+  if (isdigit((unsigned char)name[0])) {
+    int n = atoi(name.c_str());
+    if (n >= 0 && n < 32)
+      return n;
+  }
+  if (name == "s8")
+    return 30;
+  for (int i = 0; i < 32; i++)
+    if (name == regNames[i])
+      return i;
+  Fatal("%s:%d: unknown register '%s'", fileName, line, s.c_str());
+}
+
+int32_t Program::Imm(const std::string &s, int line) {
+  if (s.size() == 3 && s[0] == '\'' && s[2] == '\'')
+    return s[1];
+  char *end;
+  long v = strtol(s.c_str(), &end, 0);
+  if (s.empty() || *end)
+    Fatal("%s:%d: bad immediate '%s'", fileName, line, s.c_str());
+  return (int32_t)v;
+}
+
+// Resolves "label", "label+n" or a plain number to an address.
+int32_t Program::Address(const std::string &s, int line) {
+  if (isdigit((unsigned char)s[0]) || s[0] == '-')
+    return Imm(s, line);
+  size_t plus = s.find_first_of("+-");
+  std::string label = Trim(s.substr(0, plus));
+  int32_t off = plus == std::string::npos ? 0 : Imm(Trim(s.substr(plus)), line);
+  auto d = dataLabels.find(label);
+  if (d != dataLabels.end())
+    return d->second + off;
+  auto t = textLabels.find(label);
+  if (t != textLabels.end())
+    return TextBase + 4 * t->second + off;
+  Fatal("%s:%d: undefined label '%s'", fileName, line, label.c_str());
+}
+
+int Program::Target(const std::string &s, int line) {
+  auto t = textLabels.find(s);
+  if (t == textLabels.end())
+    Fatal("%s:%d: undefined label '%s'", fileName, line, s.c_str());
+  return t->second;
+}
+
+void Program::Memory(const std::string &s, Insn &insn, int line) {
+  size_t paren = s.find('(');
+  if (paren == std::string::npos) {
+    insn.rs = 0;
+    insn.imm = Address(s, line);
+    return;
+  }
+  std::string off = Trim(s.substr(0, paren));
+  insn.imm = off.empty() ? 0 : Imm(off, line);
+  insn.rs = Reg(Trim(s.substr(paren + 1, s.find(')') - paren - 1)), line);
+}
+
+// Three-operand ALU mnemonics. The last operand may be an immediate;
+// when the hardware has no immediate form the assembler first loads the
+// constant into $at, which costs an extra instruction.
+struct Alu3 {
+  const char *name;
+  Opcode reg, imm;
+  bool negate;
+};
+
+const Alu3 alu3[] = {
+    {"add", Add, AddImm, false},    {"addu", Add, AddImm, false},
+    {"addi", Add, AddImm, false},   {"addiu", Add, AddImm, false},
+    {"sub", Sub, AddImm, true},     {"subu", Sub, AddImm, true},
+    {"mul", Mul, NumOpcodes, false}, {"mulo", Mul, NumOpcodes, false},
+    {"div", Div, NumOpcodes, false}, {"divu", Divu, NumOpcodes, false},
+    {"rem", Rem, NumOpcodes, false}, {"remu", Remu, NumOpcodes, false},
+    {"and", And, AndImm, false},    {"andi", And, AndImm, false},
+    {"or", Or, OrImm, false},       {"ori", Or, OrImm, false},
+    {"xor", Xor, XorImm, false},    {"xori", Xor, XorImm, false},
+    {"nor", Nor, NumOpcodes, false}, {"sll", Sllv, Sll, false},
+    {"srl", Srlv, Srl, false},      {"sra", Srav, Sra, false},
+    {"sllv", Sllv, Sll, false},     {"srlv", Srlv, Srl, false},
+    {"srav", Srav, Sra, false},     {"slt", Slt, SltImm, false},
+    {"slti", Slt, SltImm, false},   {"sltu", Sltu, SltuImm, false},
+    {"sltiu", Sltu, SltuImm, false}, {"seq", Seq, NumOpcodes, false},
+    {"sne", Sne, NumOpcodes, false}, {"sle", Sle, NumOpcodes, false},
+    {"sgt", Sgt, NumOpcodes, false}, {"sge", Sge, NumOpcodes, false}};
+
+struct Branch {
+  const char *name;
+  Opcode op;
+  size_t regs;
+};
+
+const Branch branches[] = {
+    {"beq", Beq, 2},   {"bne", Bne, 2},   {"blt", Blt, 2},   {"ble", Ble, 2},
+    {"bgt", Bgt, 2},   {"bge", Bge, 2},   {"bltu", Bltu, 2}, {"bgeu", Bgeu, 2},
+    {"beqz", Beqz, 1}, {"bnez", Bnez, 1}, {"bltz", Bltz, 1}, {"blez", Blez, 1},
+    {"bgtz", Bgtz, 1}, {"bgez", Bgez, 1}, {"b", B, 0},       {"j", B, 0}};
+
+// Number of machine instructions a source line expands to.
+int Program::Size(const Pending &p) {
+  const std::string &m = p.mnemonic;
+  const std::vector<std::string> &a = p.args;
+  for (auto &op : alu3)
+    if (m == op.name)
+      return (a.size() == 3 && !IsReg(a[2]) && op.imm == NumOpcodes) ? 2 : 1;
+  for (auto &op : branches)
+    if (m == op.name)
+      return (op.regs == 2 && a.size() == 3 && !IsReg(a[1])) ? 2 : 1;
+  return 1;
+}
+
+void Program::Decode(const Pending &p) {
+  const std::string &m = p.mnemonic;
+  const std::vector<std::string> &a = p.args;
+  int line = p.line;
+  Insn in = {Nop, 0, 0, 0, 0, 0};
+  auto need = [&](size_t n) {
+    if (a.size() != n)
+      Fatal("%s:%d: '%s' expects %zu operands", fileName, line, m.c_str(), n);
+  };
+  auto emit = [&](const Insn &insn) {
+    text.push_back(insn);
+    textLine.push_back(line);
+  };
+  auto loadAt = [&](int32_t imm) {
+    Insn li = {Li, 1, 0, 0, imm, 0};
+    emit(li);
+  };
+
+  if (m == "div" && a.size() == 2) {
+    in.op = Div2;
+    in.rs = Reg(a[0], line);
+    in.rt = Reg(a[1], line);
+    emit(in);
+    return;
+  }
+  for (auto &op : alu3)
+    if (m == op.name) {
+      need(3);
+      in.rd = Reg(a[0], line);
+      in.rs = Reg(a[1], line);
+      if (IsReg(a[2])) {
+        in.op = op.reg;
+        in.rt = Reg(a[2], line);
+      } else if (op.imm != NumOpcodes) {
+        in.op = op.imm;
+        in.imm = op.negate ? -Imm(a[2], line) : Imm(a[2], line);
+      } else {
+        loadAt(Imm(a[2], line));
+        in.op = op.reg;
+        in.rt = 1;
+      }
+      emit(in);
+      return;
+    }
+
+  for (auto &op : branches)
+    if (m == op.name) {
+      need(op.regs + 1);
+      in.op = op.op;
+      if (op.regs > 0)
+        in.rs = Reg(a[0], line);
+      if (op.regs > 1) {
+        if (IsReg(a[1]))
+          in.rt = Reg(a[1], line);
+        else {
+          loadAt(Imm(a[1], line));
+          in.rt = 1;
+        }
+      }
+      in.target = Target(a[op.regs], line);
+      emit(in);
+      return;
+    }
+
+  if (m == "li") {
+    need(2);
+    in.op = Li;
+    in.rd = Reg(a[0], line);
+    in.imm = Imm(a[1], line);
+  } else if (m == "la") {
+    need(2);
+    in.rd = Reg(a[0], line);
+    if (a[1].find('(') != std::string::npos) {
+      in.op = AddImm;
+      Memory(a[1], in, line);
+    } else {
+      in.op = Li;
+      in.imm = Address(a[1], line);
+    }
+  } else if (m == "lui") {
+    need(2);
+    in.op = Li;
+    in.rd = Reg(a[0], line);
+    in.imm = Imm(a[1], line) << 16;
+  } else if (m == "move" || m == "neg" || m == "negu" || m == "not") {
+    need(2);
+    in.op = m == "move" ? Move : m == "not" ? Not : Neg;
+    in.rd = Reg(a[0], line);
+    in.rs = Reg(a[1], line);
+  } else if (m == "mult") {
+    need(2);
+    in.op = Mult;
+    in.rs = Reg(a[0], line);
+    in.rt = Reg(a[1], line);
+  } else if (m == "mfhi" || m == "mflo") {
+    need(1);
+    in.op = m == "mfhi" ? Mfhi : Mflo;
+    in.rd = Reg(a[0], line);
+  } else if (m == "lw" || m == "lb" || m == "lbu" || m == "lh" ||
+             m == "lhu") {
+    need(2);
+    in.op = m == "lw"    ? Lw
+            : m == "lb"  ? Lb
+            : m == "lbu" ? Lbu
+            : m == "lh"  ? Lh
+                         : Lhu;
+    in.rd = Reg(a[0], line);
+    Memory(a[1], in, line);
+  } else if (m == "sw" || m == "sb" || m == "sh") {
+    need(2);
+    in.op = m == "sw" ? Sw : m == "sb" ? Sb : Sh;
+    in.rt = Reg(a[0], line);
+    Memory(a[1], in, line);
+  } else if (m == "jal") {
+    need(1);
+    in.op = Jal;
+    in.target = Target(a[0], line);
+  } else if (m == "jr") {
+    need(1);
+    in.op = Jr;
+    in.rs = Reg(a[0], line);
+  } else if (m == "jalr") {
+    need(1);
+    in.op = Jalr;
+    in.rs = Reg(a[0], line);
+  } else if (m == "syscall") {
+    in.op = Syscall;
+  } else if (m == "nop") {
+    in.op = Nop;
+  } else
+    Fatal("%s:%d: unsupported instruction '%s'", fileName, line, m.c_str());
+  emit(in);
+}
+
+// A function starts at main and at every label that is called, loaded
+// with la or stored in a vtable. Every instruction is charged to the
+// nearest function start at or above it.
+void Program::FindFunctions() {
+  std::map<int, std::string> starts;
+  auto mark = [&](int index) {
+    auto l = labelAt.find(index);
+    starts.emplace(index, l != labelAt.end() ? l->second : "?");
+  };
+  for (auto &in : text)
+    if (in.op == Jal)
+      mark(in.target);
+  for (auto &f : fixups) {
+    auto t = textLabels.find(f.label);
+    // a label right after a call is a return address, not a function
+    if (t != textLabels.end() &&
+        !(t->second > 0 && (text[t->second - 1].op == Jal ||
+                            text[t->second - 1].op == Jalr)))
+      mark(t->second);
+  }
+  auto main = textLabels.find("main");
+  if (main != textLabels.end())
+    mark(main->second);
+
+  functionOf.assign(text.size(), -1);
+  int current = -1;
+  for (size_t i = 0; i < text.size(); i++) {
+    auto s = starts.find(i);
+    if (s != starts.end()) {
+      functionName.push_back(s->second);
+      current = functionName.size() - 1;
+    }
+    functionOf[i] = current;
+  }
+}
+
+// The machine state: registers, memory and I/O. Static data and the heap
+// share one growable region starting at DataBase; the stack is a separate
+// region that ends at StackTop.
+class Machine {
+public:
+  Machine(Program &prog, size_t stackBytes);
+  int Run(uint64_t limit);
+  void Report(FILE *out);
+  void WriteJson(FILE *out);
+
+private:
+  Program &prog;
+  int32_t reg[32];
+  int32_t hi, lo;
+  std::vector<uint8_t> data;  // [DataBase, DataBase + data.size())
+  std::vector<uint8_t> stack; // [StackTop - stack.size(), StackTop)
+  uint32_t brk;
+  uint32_t heapBase; // brk at the start
+  std::vector<uint64_t> counts;
+  uint64_t executed;
+
+  uint8_t *Addr(uint32_t addr, int size, int pc);
+  int32_t LoadWord(uint32_t addr, int pc) {
+    int32_t v;
+    memcpy(&v, Addr(addr, 4, pc), 4);
+    return v;
+  }
+  void StoreWord(uint32_t addr, int32_t v, int pc) {
+    memcpy(Addr(addr, 4, pc), &v, 4);
+  }
+  const char *String(uint32_t addr, int pc);
+  int TextIndex(uint32_t addr, int pc);
+  bool Syscall(int pc, int &status);
+  void ReadLine(char *buf, int len);
+  void Totals(uint64_t *byClass, const std::vector<int> &select);
+};
+
+Machine::Machine(Program &p, size_t stackBytes) : prog(p) {
+  memset(reg, 0, sizeof(reg));
+  hi = lo = 0;
+  data.assign(StaticBase - DataBase, 0);
+  data.insert(data.end(), prog.data.begin(), prog.data.end());
+  brk = DataBase + data.size();
+  brk = (brk + 7) & ~7u;
+  data.resize(brk - DataBase);
+  heapBase = brk;
+  stack.assign(stackBytes, 0);
+  reg[28] = GlobalPointer;
+  reg[29] = StackTop - 4096;
+  reg[30] = reg[29];
+  reg[31] = TextBase + 4 * (prog.text.size() - 1);
+  counts.assign(prog.text.size(), 0);
+  executed = 0;
+}
+
+uint8_t *Machine::Addr(uint32_t addr, int size, int pc) {
+  if (addr % size)
+    Fatal("unaligned %d-byte access at 0x%08x (line %d)", size, addr,
+          prog.textLine[pc]);
+  if (addr >= DataBase && addr - DataBase + size <= data.size())
+    return &data[addr - DataBase];
+  uint32_t low = StackTop - stack.size();
+  if (addr >= low && addr - low + size <= stack.size())
+    return &stack[addr - low];
+  Fatal("bad address 0x%08x (line %d)", addr, prog.textLine[pc]);
+}
+
+const char *Machine::String(uint32_t addr, int pc) {
+  const char *s = (const char *)Addr(addr, 1, pc);
+  const uint8_t *end = addr >= DataBase && addr - DataBase < data.size()
+                           ? data.data() + data.size()
+                           : stack.data() + stack.size();
+  if (!memchr(s, 0, end - (const uint8_t *)s))
+    Fatal("unterminated string at 0x%08x (line %d)", addr, prog.textLine[pc]);
+  return s;
+}
+
+int Machine::TextIndex(uint32_t addr, int pc) {
+  uint32_t index = (addr - TextBase) / 4;
+  if (addr < TextBase || addr % 4 || index >= prog.text.size())
+    Fatal("jump to bad address 0x%08x (line %d)", addr, prog.textLine[pc]);
+  return index;
+}
+
+// Reads like SPIM: up to len - 1 characters, stopping after a newline.
+void Machine::ReadLine(char *buf, int len) {
+  int n = 0;
+  while (n < len - 1) {
+    int c = getchar();
+    if (c == EOF)
+      break;
+    buf[n++] = c;
+    if (c == '\n')
+      break;
+  }
+  if (len > 0)
+    buf[n] = '\0';
+}
+
+bool Machine::Syscall(int pc, int &status) {
+  int32_t &v0 = reg[2], a0 = reg[4], a1 = reg[5], a2 = reg[6];
+  switch (v0) {
+  case 1: // print_int
+    printf("%d", a0);
+    break;
+  case 4: // print_string
+    fputs(String(a0, pc), stdout);
+    break;
+  case 5: { // read_int
+    char buf[256];
+    ReadLine(buf, sizeof(buf));
+    v0 = atoi(buf);
+    break;
+  }
+  case 8: { // read_string
+    if (a1 > 0)
+      ReadLine((char *)Addr(a0, 1, pc), a1);
+    if (a1 > 0)
+      Addr(a0 + a1 - 1, 1, pc); // bounds check the whole buffer
+    break;
+  }
+  case 9: { // sbrk
+    uint32_t old = brk;
+    brk += (a0 + 7) & ~7;
+    data.resize(brk - DataBase, 0);
+    v0 = old;
+    break;
+  }
+  case 10: // exit
+    status = 0;
+    return false;
+  case 11: // print_char
+    putchar(a0);
+    break;
+  case 12: // read_char
+    v0 = getchar();
+    break;
+  case 13: // open
+    fflush(stdout);
+    v0 = open(String(a0, pc), a1, a2 ? a2 : 0644);
+    break;
+  case 14: // read
+    if (a0 == 0)
+      fflush(stdout);
+    if (a2 > 0)
+      Addr(a1 + a2 - 1, 1, pc);
+    v0 = read(a0, Addr(a1, 1, pc), a2);
+    break;
+  case 15: // write
+    if (a2 > 0)
+      Addr(a1 + a2 - 1, 1, pc);
+    if (a0 == 1)
+      v0 = fwrite(Addr(a1, 1, pc), 1, a2, stdout);
+    else {
+      if (a0 == 2)
+        fflush(stdout);
+      v0 = write(a0, Addr(a1, 1, pc), a2);
+    }
+    break;
+  case 16: // close
+    v0 = close(a0);
+    break;
+  case 17: // exit2
+    status = a0;
+    return false;
+  default:
+    Fatal("unsupported syscall %d (line %d)", v0, prog.textLine[pc]);
+  }
+  return true;
+}
+
+int Machine::Run(uint64_t limit) {
+#define AS_LABEL(name, cls) &&do_##name,
+  static void *const dispatch[NumOpcodes] = {OPCODES(AS_LABEL)};
+#undef AS_LABEL
+
+  auto main = prog.textLabels.find("main");
+  if (main == prog.textLabels.end())
+    Fatal("no main label");
+  const Insn *code = prog.text.data();
+  uint64_t *count = counts.data();
+  int32_t *r = reg;
+  int pc = main->second;
+  int status = 0;
+  uint64_t steps = 0;
+  const Insn *in;
+
+#define NEXT                                                                   \
+  do {                                                                         \
+    r[0] = 0;                                                                  \
+    if (++steps > limit)                                                       \
+      goto do_limit;                                                           \
+    count[pc]++;                                                               \
+    in = &code[pc];                                                            \
+    goto *dispatch[in->op];                                                    \
+  } while (0)
+#define STEP                                                                   \
+  do {                                                                         \
+    pc++;                                                                      \
+    NEXT;                                                                      \
+  } while (0)
+#define JUMP(t)                                                                \
+  do {                                                                         \
+    pc = (t);                                                                  \
+    NEXT;                                                                      \
+  } while (0)
+#define BRANCH_IF(cond)                                                        \
+  do {                                                                         \
+    if (cond)                                                                  \
+      JUMP(in->target);                                                        \
+    STEP;                                                                      \
+  } while (0)
+
+  NEXT;
+
+do_Add:
+  r[in->rd] = (uint32_t)r[in->rs] + (uint32_t)r[in->rt];
+  STEP;
+do_AddImm:
+  r[in->rd] = (uint32_t)r[in->rs] + (uint32_t)in->imm;
+  STEP;
+do_Sub:
+  r[in->rd] = (uint32_t)r[in->rs] - (uint32_t)r[in->rt];
+  STEP;
+do_Mul:
+  r[in->rd] = (uint32_t)r[in->rs] * (uint32_t)r[in->rt];
+  STEP;
+do_Div:
+  if (r[in->rt] == 0)
+    Fatal("division by zero (line %d)", prog.textLine[pc]);
+  r[in->rd] = r[in->rt] == -1 ? -(uint32_t)r[in->rs] : r[in->rs] / r[in->rt];
+  STEP;
+do_Rem:
+  if (r[in->rt] == 0)
+    Fatal("division by zero (line %d)", prog.textLine[pc]);
+  r[in->rd] = r[in->rt] == -1 ? 0 : r[in->rs] % r[in->rt];
+  STEP;
+do_Divu:
+  if (r[in->rt] == 0)
+    Fatal("division by zero (line %d)", prog.textLine[pc]);
+  r[in->rd] = (uint32_t)r[in->rs] / (uint32_t)r[in->rt];
+  STEP;
+do_Remu:
+  if (r[in->rt] == 0)
+    Fatal("division by zero (line %d)", prog.textLine[pc]);
+  r[in->rd] = (uint32_t)r[in->rs] % (uint32_t)r[in->rt];
+  STEP;
+do_And:
+  r[in->rd] = r[in->rs] & r[in->rt];
+  STEP;
+do_AndImm:
+  r[in->rd] = r[in->rs] & (in->imm & 0xffff);
+  STEP;
+do_Or:
+  r[in->rd] = r[in->rs] | r[in->rt];
+  STEP;
+do_OrImm:
+  r[in->rd] = r[in->rs] | (in->imm & 0xffff);
+  STEP;
+do_Xor:
+  r[in->rd] = r[in->rs] ^ r[in->rt];
+  STEP;
+do_XorImm:
+  r[in->rd] = r[in->rs] ^ (in->imm & 0xffff);
+  STEP;
+do_Nor:
+  r[in->rd] = ~(r[in->rs] | r[in->rt]);
+  STEP;
+do_Sll:
+  r[in->rd] = (uint32_t)r[in->rs] << (in->imm & 31);
+  STEP;
+do_Srl:
+  r[in->rd] = (uint32_t)r[in->rs] >> (in->imm & 31);
+  STEP;
+do_Sra:
+  r[in->rd] = r[in->rs] >> (in->imm & 31);
+  STEP;
+do_Sllv:
+  r[in->rd] = (uint32_t)r[in->rs] << (r[in->rt] & 31);
+  STEP;
+do_Srlv:
+  r[in->rd] = (uint32_t)r[in->rs] >> (r[in->rt] & 31);
+  STEP;
+do_Srav:
+  r[in->rd] = r[in->rs] >> (r[in->rt] & 31);
+  STEP;
+do_Slt:
+  r[in->rd] = r[in->rs] < r[in->rt];
+  STEP;
+do_SltImm:
+  r[in->rd] = r[in->rs] < in->imm;
+  STEP;
+do_Sltu:
+  r[in->rd] = (uint32_t)r[in->rs] < (uint32_t)r[in->rt];
+  STEP;
+do_SltuImm:
+  r[in->rd] = (uint32_t)r[in->rs] < (uint32_t)in->imm;
+  STEP;
+do_Seq:
+  r[in->rd] = r[in->rs] == r[in->rt];
+  STEP;
+do_Sne:
+  r[in->rd] = r[in->rs] != r[in->rt];
+  STEP;
+do_Sle:
+  r[in->rd] = r[in->rs] <= r[in->rt];
+  STEP;
+do_Sgt:
+  r[in->rd] = r[in->rs] > r[in->rt];
+  STEP;
+do_Sge:
+  r[in->rd] = r[in->rs] >= r[in->rt];
+  STEP;
+do_Li:
+  r[in->rd] = in->imm;
+  STEP;
+do_Move:
+  r[in->rd] = r[in->rs];
+  STEP;
+do_Neg:
+  r[in->rd] = -(uint32_t)r[in->rs];
+  STEP;
+do_Not:
+  r[in->rd] = ~r[in->rs];
+  STEP;
+do_Mult: {
+  int64_t p = (int64_t)r[in->rs] * r[in->rt];
+  lo = (int32_t)p;
+  hi = (int32_t)(p >> 32);
+  STEP;
+}
+do_Div2:
+  if (r[in->rt] != 0) {
+    lo = r[in->rt] == -1 ? -(uint32_t)r[in->rs] : r[in->rs] / r[in->rt];
+    hi = r[in->rt] == -1 ? 0 : r[in->rs] % r[in->rt];
+  }
+  STEP;
+do_Mfhi:
+  r[in->rd] = hi;
+  STEP;
+do_Mflo:
+  r[in->rd] = lo;
+  STEP;
+do_Nop:
+  STEP;
+do_Lw:
+  r[in->rd] = LoadWord(r[in->rs] + in->imm, pc);
+  STEP;
+do_Lb:
+  r[in->rd] = *(int8_t *)Addr(r[in->rs] + in->imm, 1, pc);
+  STEP;
+do_Lbu:
+  r[in->rd] = *Addr(r[in->rs] + in->imm, 1, pc);
+  STEP;
+do_Lh: {
+  int16_t h;
+  memcpy(&h, Addr(r[in->rs] + in->imm, 2, pc), 2);
+  r[in->rd] = h;
+  STEP;
+}
+do_Lhu: {
+  uint16_t h;
+  memcpy(&h, Addr(r[in->rs] + in->imm, 2, pc), 2);
+  r[in->rd] = h;
+  STEP;
+}
+do_Sw:
+  StoreWord(r[in->rs] + in->imm, r[in->rt], pc);
+  STEP;
+do_Sb:
+  *Addr(r[in->rs] + in->imm, 1, pc) = r[in->rt];
+  STEP;
+do_Sh: {
+  int16_t h = r[in->rt];
+  memcpy(Addr(r[in->rs] + in->imm, 2, pc), &h, 2);
+  STEP;
+}
+do_B:
+  JUMP(in->target);
+do_Jal:
+  r[31] = TextBase + 4 * (pc + 1);
+  JUMP(in->target);
+do_Jr:
+  JUMP(TextIndex(r[in->rs], pc));
+do_Jalr: {
+  int target = TextIndex(r[in->rs], pc);
+  r[31] = TextBase + 4 * (pc + 1);
+  JUMP(target);
+}
+do_Beq:
+  BRANCH_IF(r[in->rs] == r[in->rt]);
+do_Bne:
+  BRANCH_IF(r[in->rs] != r[in->rt]);
+do_Blt:
+  BRANCH_IF(r[in->rs] < r[in->rt]);
+do_Ble:
+  BRANCH_IF(r[in->rs] <= r[in->rt]);
+do_Bgt:
+  BRANCH_IF(r[in->rs] > r[in->rt]);
+do_Bge:
+  BRANCH_IF(r[in->rs] >= r[in->rt]);
+do_Bltu:
+  BRANCH_IF((uint32_t)r[in->rs] < (uint32_t)r[in->rt]);
+do_Bgeu:
+  BRANCH_IF((uint32_t)r[in->rs] >= (uint32_t)r[in->rt]);
+do_Beqz:
+  BRANCH_IF(r[in->rs] == 0);
+do_Bnez:
+  BRANCH_IF(r[in->rs] != 0);
+do_Bltz:
+  BRANCH_IF(r[in->rs] < 0);
+do_Blez:
+  BRANCH_IF(r[in->rs] <= 0);
+do_Bgtz:
+  BRANCH_IF(r[in->rs] > 0);
+do_Bgez:
+  BRANCH_IF(r[in->rs] >= 0);
+do_Syscall:
+  if (!Syscall(pc, status))
+    goto done;
+  STEP;
+do_Exit:
+  status = 0;
+  goto done;
+do_limit:
+  fflush(stdout);
+  fprintf(stderr, "dcc-sim: instruction limit %llu reached\n",
+          (unsigned long long)limit);
+  executed = steps - 1;
+  return 3;
+done:
+  executed = steps;
+  fflush(stdout);
+  return status;
+#undef NEXT
+#undef STEP
+#undef JUMP
+#undef BRANCH_IF
+}
+
+// Sums the counts of the instructions whose function is in select
+// (all instructions when select is empty).
+void Machine::Totals(uint64_t *byClass, const std::vector<int> &select) {
+  for (int c = 0; c < NumClasses; c++)
+    byClass[c] = 0;
+  for (size_t i = 0; i + 1 < counts.size(); i++) {
+    if (!select.empty() && prog.functionOf[i] != select[0])
+      continue;
+    byClass[opClass[prog.text[i].op]] += counts[i];
+  }
+}
+
+void Machine::Report(FILE *out) {
+  uint64_t total[NumClasses], sum = 0;
+  Totals(total, std::vector<int>());
+  for (int c = 0; c < NumClasses; c++)
+    sum += total[c];
+  fprintf(out, "dcc-sim: %llu instructions, code size %zu, heap %u bytes\n",
+          (unsigned long long)sum, prog.text.size() - 1, brk - heapBase);
+  fprintf(out, "%14s %12s %12s %12s %12s %12s  %s\n", "total", className[0],
+          className[1], className[2], className[3], className[4], "function");
+  for (size_t f = 0; f < prog.functionName.size(); f++) {
+    uint64_t by[NumClasses], all = 0;
+    Totals(by, std::vector<int>(1, f));
+    for (int c = 0; c < NumClasses; c++)
+      all += by[c];
+    if (all == 0)
+      continue;
+    fprintf(out, "%14llu", (unsigned long long)all);
+    for (int c = 0; c < NumClasses; c++)
+      fprintf(out, " %12llu", (unsigned long long)by[c]);
+    fprintf(out, "  %s\n", prog.functionName[f].c_str());
+  }
+  fprintf(out, "%14llu", (unsigned long long)sum);
+  for (int c = 0; c < NumClasses; c++)
+    fprintf(out, " %12llu", (unsigned long long)total[c]);
+  fprintf(out, "  (all)\n");
+}
+
+void Machine::WriteJson(FILE *out) {
+  auto counts = [&](const uint64_t *by) {
+    uint64_t all = 0;
+    for (int c = 0; c < NumClasses; c++)
+      all += by[c];
+    fprintf(out, "{\"instructions\": %llu", (unsigned long long)all);
+    for (int c = 0; c < NumClasses; c++)
+      fprintf(out, ", \"%s\": %llu", className[c], (unsigned long long)by[c]);
+    fprintf(out, "}");
+  };
+  uint64_t total[NumClasses];
+  Totals(total, std::vector<int>());
+  fprintf(out, "{\"code_size\": %zu, \"heap_bytes\": %u, \"total\": ",
+          prog.text.size() - 1, brk - heapBase);
+  counts(total);
+  fprintf(out, ", \"functions\": {");
+  bool first = true;
+  for (size_t f = 0; f < prog.functionName.size(); f++) {
+    uint64_t by[NumClasses];
+    Totals(by, std::vector<int>(1, f));
+    fprintf(out, "%s\n  \"%s\": ", first ? "" : ",",
+            prog.functionName[f].c_str());
+    counts(by);
+    first = false;
+  }
+  fprintf(out, "}}\n");
+}
+
+void Usage() {
+  fprintf(stderr, "Usage: dcc-sim [-stats] [-json file] [-limit n] "
+                  "[-stack bytes] file.s\n");
+  exit(2);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool stats = false;
+  const char *json = NULL, *file = NULL;
+  uint64_t limit = UINT64_MAX;
+  size_t stackBytes = 64 << 20;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-stats"))
+      stats = true;
+    else if (!strcmp(argv[i], "-json") && i + 1 < argc)
+      json = argv[++i];
+    else if (!strcmp(argv[i], "-limit") && i + 1 < argc)
+      limit = strtoull(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-stack") && i + 1 < argc)
+      stackBytes = strtoull(argv[++i], NULL, 0);
+    else if (argv[i][0] == '-' || file)
+      Usage();
+    else
+      file = argv[i];
+  }
+  if (!file)
+    Usage();
+
+  FILE *fp = fopen(file, "r");
+  if (!fp)
+    Fatal("cannot open %s", file);
+  Program prog;
+  prog.Parse(fp, file);
+  fclose(fp);
+
+  Machine machine(prog, stackBytes);
+  int status = machine.Run(limit);
+  if (stats)
+    machine.Report(stderr);
+  if (json) {
+    FILE *out = fopen(json, "w");
+    if (!out)
+      Fatal("cannot write %s", json);
+    machine.WriteJson(out);
+    fclose(out);
+  }
+  return status;
+}
@@ -0,0 +1,403 @@
+/* File: ssa.cc
+ * ------------
+ * The SSA round trip. With -fssa each function is turned into a
+ * FlowGraph, put into SSA form and translated back to plain TAC before
+ * liveness and register allocation. No pass works on SSA form yet, so
+ * this only checks construction and destruction.
+ *
+ * Construction follows Cytron et al. with pruning: a phi for a location
+ * is placed on the iterated dominance frontier of its definitions, but
+ * only in blocks where the location is live on entry. Renaming walks the
+ * dominator tree. Every new version gets its own frame slot; the version
+ * reaching the entry is the original location, so params keep their
+ * place and BeginFunc still loads them. Globals are not renamed, since
+ * they are shared with other functions.
+ *
+ * Destruction first coalesces: the versions of a location go back to
+ * it, and the dst of each phi and its args share one location, whenever
+ * no two of them interfere, that is, when none is live where another is
+ * defined. The copies between them vanish, and as long as no pass moved
+ * code, the renaming is undone. The locations that reach the entry are
+ * never merged with each other, as params must stay in their slots.
+ * -fno-ssa-coalesce leaves every version apart.
+ *
+ * It then replaces the phis of a block with copies at the end of its
+ * predecessors. A predecessor ending with an IfZ gets a new block on that
+ * edge instead, so the copies run on that edge only. The copies of an
+ * edge are a parallel copy; they are sequentialized as in Boissinot et
+ * al., "Revisiting Out-of-SSA Translation", using a fresh temp to break
+ * cycles. An edge left without copies gets no block.
+ *
+ * make perfcheck runs the programs with -fssa too and holds them to the
+ * same numbers, as the round trip must give back the code it was given.
+ * -d ssa reports the phis, the versions coalesced and the copies of each
+ * function.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "tac.h"
+#include <functional>
+
+static bool IsRenamed(Location *loc) {
+  return loc->GetSegment() == fpRelative;
+}
+
+// the location each version was made from
+static std::map<Location *, Location *> origins;
+
+Location *CodeGenerator::NewVersion(BeginFunc *fn, Location *loc) {
+  static std::map<Location *, int> versions;
+  char name[128];
+  snprintf(name, sizeof name, "%s.%d", loc->GetName(), ++versions[loc]);
+  auto version = GenFrameVar(fn, name);
+  version->SetTypeOf(loc);
+  origins[version] = loc;
+  return version;
+}
+
+int CodeGenerator::BuildSSA(FlowGraph &graph) {
+  graph.ComputeDominators();
+  graph.ComputeFrontiers();
+  graph.ComputeLiveness();
+
+  std::map<Location *, std::set<BasicBlock *>> defSites;
+  for (auto block : graph.GetOrder())
+    for (auto inst : block->code)
+      for (auto loc : inst->Kill())
+        if (IsRenamed(loc))
+          defSites[loc].insert(block);
+
+  // the location each phi stands for, as its dst is renamed
+  std::map<Phi *, Location *> phiOrigins;
+  for (auto &def : defSites) {
+    auto loc = def.first;
+    std::set<BasicBlock *> hasPhi;
+    std::vector<BasicBlock *> work(def.second.begin(), def.second.end());
+    while (!work.empty()) {
+      auto block = work.back();
+      work.pop_back();
+      for (auto join : block->frontier) {
+        if (hasPhi.count(join) || !join->liveIn.count(loc))
+          continue;
+        hasPhi.insert(join);
+        auto phi = new Phi(loc, join->pred.size());
+        phiOrigins[phi] = loc;
+        join->code.insert(join->code.begin() + (join->GetLabel() ? 1 : 0),
+                          phi);
+        if (!def.second.count(join))
+          work.push_back(join);
+      }
+    }
+  }
+
+  auto fn = graph.GetBeginFunc();
+  std::map<Location *, std::vector<Location *>> stacks;
+  auto current = [&](Location *loc) {
+    auto &stack = stacks[loc];
+    return stack.empty() ? loc : stack.back();
+  };
+  std::function<void(BasicBlock *)> rename = [&](BasicBlock *block) {
+    std::vector<Location *> pushed;
+    for (auto &inst : block->code) {
+      Renaming r;
+      bool changed = false;
+      auto phi = dynamic_cast<Phi *>(inst);
+      if (!phi)
+        for (auto loc : inst->Gen())
+          if (IsRenamed(loc)) {
+            r.uses[loc] = current(loc);
+            changed = true;
+          }
+      for (auto loc : inst->Kill())
+        if (IsRenamed(loc)) {
+          auto version = NewVersion(fn, loc);
+          r.defs[loc] = version;
+          stacks[loc].push_back(version);
+          pushed.push_back(loc);
+          changed = true;
+        }
+      if (phi)
+        phi->SetDst(r.Def(phi->GetDst()));
+      else if (changed)
+        inst = inst->Rewrite(r);
+    }
+
+    for (auto succ : block->succ) {
+      int index = std::find(succ->pred.begin(), succ->pred.end(), block) -
+                  succ->pred.begin();
+      for (auto inst : succ->code)
+        if (auto phi = dynamic_cast<Phi *>(inst))
+          phi->GetArgs()[index] = current(phiOrigins[phi]);
+    }
+
+    for (auto child : block->children)
+      rename(child);
+    for (auto loc : pushed)
+      stacks[loc].pop_back();
+  };
+  rename(graph.GetEntry());
+  return phiOrigins.size();
+}
+
+/* Returns the copies dst <- src, all done at once, as a sequence of
+ * Assigns. A location that is both read and written is copied only
+ * after its old value was read or saved.
+ */
+std::vector<Instruction *>
+CodeGenerator::SequentializeCopies(BeginFunc *fn, const CopyList &copies) {
+  std::vector<Instruction *> result;
+  std::map<Location *, Location *> pred, loc;
+  std::vector<Location *> ready, todo;
+  for (auto &copy : copies)
+    if (copy.first != copy.second) {
+      loc[copy.second] = copy.second;
+      pred[copy.first] = copy.second;
+      todo.push_back(copy.first);
+    }
+  for (auto dst : todo)
+    if (!loc.count(dst)) // not needed by any other copy
+      ready.push_back(dst);
+
+  std::set<Location *> done;
+  while (done.size() < todo.size()) {
+    while (!ready.empty()) {
+      auto dst = ready.back();
+      ready.pop_back();
+      auto src = pred[dst];
+      auto from = loc[src];
+      result.push_back(new Assign(dst, from));
+      done.insert(dst);
+      loc[src] = dst;
+      if (src == from && pred.count(src) && !done.count(src))
+        ready.push_back(src); // its value is safe in dst now
+    }
+    for (auto dst : todo)
+      if (!done.count(dst)) {
+        // only cycles are left: save one of them to a temp
+        auto temp = NewVersion(fn, dst);
+        result.push_back(new Assign(temp, dst));
+        loc[dst] = temp;
+        ready.push_back(dst);
+        break;
+      }
+  }
+  return result;
+}
+
+int CodeGenerator::CoalesceVersions(FlowGraph &graph) {
+  graph.ComputeLiveness();
+
+  // in SSA form two locations interfere when one is live where the
+  // other is defined; the dsts of the phis of a block are defined
+  // together, at its top
+  std::map<Location *, LocationSet> interferes;
+  LocationSet defined;
+  auto interfere = [&](Location *def, const LocationSet &live) {
+    for (auto loc : live)
+      if (loc != def) {
+        interferes[def].insert(loc);
+        interferes[loc].insert(def);
+      }
+  };
+  for (auto block : graph.GetBlocks()) {
+    LocationSet live = block->liveOut, dsts;
+    for (auto iter = block->code.rbegin(); iter != block->code.rend();
+         ++iter) {
+      auto inst = *iter;
+      if (auto phi = dynamic_cast<Phi *>(inst)) {
+        dsts.insert(phi->GetDst());
+        defined.insert(phi->GetDst());
+        continue;
+      }
+      for (auto loc : inst->Kill()) {
+        interfere(loc, live);
+        defined.insert(loc);
+      }
+      for (auto loc : inst->Kill())
+        live.erase(loc);
+      for (auto loc : inst->Gen())
+        live.insert(loc);
+    }
+    for (auto loc : dsts) {
+      live.erase(loc);
+      interfere(loc, live);
+      interfere(loc, dsts);
+    }
+  }
+
+  std::map<Location *, std::vector<Location *>> classes;
+  std::map<Location *, Location *> classOf;
+  auto find = [&](Location *loc) {
+    if (!classOf.count(loc)) {
+      classOf[loc] = loc;
+      classes[loc] = {loc};
+    }
+    return classOf[loc];
+  };
+  auto merge = [&](Location *a, Location *b) {
+    a = find(a), b = find(b);
+    if (a == b)
+      return false;
+    int entries = 0;
+    for (auto x : classes[a]) {
+      entries += !defined.count(x);
+      for (auto y : classes[b])
+        if (interferes[x].count(y))
+          return false;
+    }
+    for (auto y : classes[b])
+      entries += !defined.count(y);
+    if (entries > 1)
+      return false;
+    // the class is named by the location reaching the entry, if any
+    if (!defined.count(b))
+      std::swap(a, b);
+    for (auto y : classes[b]) {
+      classOf[y] = a;
+      classes[a].push_back(y);
+    }
+    classes.erase(b);
+    return true;
+  };
+
+  int coalesced = 0;
+  for (auto loc : defined)
+    if (origins.count(loc) && merge(origins[loc], loc))
+      coalesced++;
+  for (auto block : graph.GetBlocks())
+    for (auto inst : block->code)
+      if (auto phi = dynamic_cast<Phi *>(inst))
+        for (auto arg : phi->GetArgs())
+          if (arg && merge(phi->GetDst(), arg))
+            coalesced++;
+  if (!coalesced)
+    return 0;
+
+  Renaming r;
+  for (auto &entry : classOf)
+    if (entry.first != entry.second)
+      r.Map(entry.first, entry.second);
+  for (auto block : graph.GetBlocks())
+    for (auto &inst : block->code) {
+      bool renamed = false;
+      for (auto loc : inst->Kill())
+        renamed |= r.defs.count(loc) > 0;
+      for (auto loc : inst->Gen())
+        renamed |= r.uses.count(loc) > 0;
+      if (renamed)
+        inst = inst->Rewrite(r);
+    }
+  return coalesced;
+}
+
+int CodeGenerator::DestructSSA(FlowGraph &graph) {
+  struct Edge {
+    BasicBlock *from, *to;
+    CopyList copies;
+  };
+  std::vector<Edge> edges;
+  for (auto block : graph.GetBlocks()) {
+    std::vector<Phi *> phis;
+    for (auto inst : block->code)
+      if (auto phi = dynamic_cast<Phi *>(inst))
+        phis.push_back(phi);
+    if (phis.empty())
+      continue;
+    for (size_t i = 0; i < block->pred.size(); i++) {
+      Edge edge = {block->pred[i], block, {}};
+      for (auto phi : phis)
+        if (phi->GetDst() != phi->GetArgs()[i])
+          edge.copies.push_back({phi->GetDst(), phi->GetArgs()[i]});
+      if (!edge.copies.empty())
+        edges.push_back(edge);
+    }
+    block->code.erase(block->code.begin() + (block->GetLabel() ? 1 : 0),
+                      block->code.begin() + (block->GetLabel() ? 1 : 0) +
+                          phis.size());
+  }
+
+  auto fn = graph.GetBeginFunc();
+  int numCopies = 0;
+  auto newBlock = [&](const CopyList &copies, BasicBlock *to) {
+    auto block = new BasicBlock(0);
+    block->code.push_back(new Label(NewLabel()));
+    auto seq = SequentializeCopies(fn, copies);
+    numCopies += seq.size();
+    block->code.insert(block->code.end(), seq.begin(), seq.end());
+    Assert(to->GetLabel());
+    block->code.push_back(new Goto(to->GetLabel()));
+    return block;
+  };
+
+  // copies at the end of a block with one successor
+  for (auto &edge : edges)
+    if (edge.from->succ.size() == 1) {
+      auto seq = SequentializeCopies(fn, edge.copies);
+      numCopies += seq.size();
+      auto &code = edge.from->code;
+      auto pos = dynamic_cast<Goto *>(edge.from->GetBranch()) ? code.end() - 1
+                                                               : code.end();
+      code.insert(pos, seq.begin(), seq.end());
+    }
+
+  // a new block right after an IfZ on its fall-through edge
+  for (auto &edge : edges)
+    if (edge.from->succ.size() > 1 && edge.from->succ[0] == edge.to) {
+      auto &blocks = graph.GetBlocks();
+      auto next = std::find(blocks.begin(), blocks.end(), edge.from) + 1;
+      graph.InsertBefore(newBlock(edge.copies, edge.to), *next);
+    }
+
+  // and right before the target on its branch edge
+  for (auto &edge : edges)
+    if (edge.from->succ.size() > 1 && edge.from->succ[0] != edge.to) {
+      auto block = newBlock(edge.copies, edge.to);
+      auto &code = edge.from->code;
+      auto test = dynamic_cast<IfZ *>(code.back());
+      auto jump = new IfZ(test->GetTest(), block->GetLabel());
+      jump->SetProbe(test->GetProbe(), test->GetWeight());
+      code.back() = jump;
+
+      auto &blocks = graph.GetBlocks();
+      auto prev = *(std::find(blocks.begin(), blocks.end(), edge.to) - 1);
+      if (!prev->GetBranch())
+        prev->code.push_back(new Goto(edge.to->GetLabel()));
+      graph.InsertBefore(block, edge.to);
+    }
+
+  graph.Update();
+  return numCopies;
+}
+
+void CodeGenerator::RunSSA() {
+  bool coalesce = GetIntOption("ssa-coalesce", 1);
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    if (!dynamic_cast<BeginFunc *>(code->Nth(begin))) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    FlowGraph graph(body);
+    int numPhis = BuildSSA(graph);
+    int numCoalesced = coalesce ? CoalesceVersions(graph) : 0;
+    int numCopies = DestructSSA(graph);
+    if (IsDebugOn("ssa"))
+      fprintf(stderr, "ssa: %s: %d phis, %d versions coalesced, %d copies\n",
+              dynamic_cast<Label *>(result->Nth(result->NumElements() - 1))
+                  ->GetLabel(),
+              numPhis, numCoalesced, numCopies);
+
+    for (auto inst : graph.Flatten())
+      result->Append(inst);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
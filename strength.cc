@@ -0,0 +1,368 @@
+/* File: strength.cc
+ * -----------------
+ * Induction-variable strength reduction. ArrayAccess::Emit computes the
+ * address of a[i] as a + i * 4 at every access. Inside a loop where a
+ * does not change and i only moves by constant steps (a basic induction
+ * variable, updated as i = i + c), the address is kept in a pointer
+ * instead: the pointer is set to a + (i + k) * 4 in a preheader, and
+ * moved by c * 4 right after every update of i. The address arithmetic
+ * of the accesses is dropped, and an access a[i + k] or a[i - k] gets a
+ * pointer of its own. A use of an address must not be reached through
+ * an update of i after the address was computed, since the pointer has
+ * moved on by then; such addresses are left alone.
+ *
+ * Loops are handled innermost first, so an address that only changes in
+ * an outer loop is moved out of the inner ones as well.
+ *
+ * -fno-strength-reduce turns the pass off; -d ivs reports the addresses
+ * replaced in each function.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "tac.h"
+#include <algorithm>
+#include <tuple>
+
+namespace {
+
+struct Def {
+  BasicBlock *block;
+  size_t pos;
+};
+
+// base + scale * (iv + offset)
+struct Pointer {
+  Location *base, *iv;
+  int scale, offset;
+
+  bool operator<(const Pointer &p) const {
+    return std::tie(base, iv, scale, offset) <
+           std::tie(p.base, p.iv, p.scale, p.offset);
+  }
+};
+
+// An update iv = t of a basic induction variable, where t = iv + step.
+struct Step {
+  Assign *update;
+  int step;
+};
+
+class Reducer {
+  CodeGenerator &codeGen;
+  FlowGraph &graph;
+  BeginFunc *fn;
+
+  std::map<Location *, std::vector<Def>> defs;
+  std::map<Location *, int> uses;
+
+  void Scan();
+  Instruction *DefOf(Location *loc) const;
+  bool GetConstant(Location *loc, int &value) const;
+  bool IsKilledBetween(Location *loc, BasicBlock *block, size_t from,
+                       size_t to) const;
+  bool IsStale(Location *loc, Location *iv) const;
+  bool GetIndex(Location *index,
+                const std::map<Location *, std::vector<Step>> &ivs,
+                Location *&iv, int &offset) const;
+  Location *Compute(BasicBlock *pre, Pointer p, Location *index);
+  Location *Constant(BasicBlock *pre, int value);
+  void RemoveDeadCode();
+
+public:
+  int numAddresses;
+
+  Reducer(CodeGenerator &cg, FlowGraph &g)
+      : codeGen(cg), graph(g), fn(g.GetBeginFunc()), numAddresses(0) {}
+
+  void Reduce(Loop *loop);
+};
+
+void Reducer::Scan() {
+  defs.clear();
+  uses.clear();
+  for (auto block : graph.GetBlocks())
+    for (size_t pos = 0; pos < block->code.size(); pos++) {
+      for (auto loc : block->code[pos]->Kill())
+        defs[loc].push_back({block, pos});
+      for (auto loc : block->code[pos]->Gen())
+        uses[loc]++;
+    }
+}
+
+// The only instruction defining loc, or NULL.
+Instruction *Reducer::DefOf(Location *loc) const {
+  auto iter = defs.find(loc);
+  if (iter == defs.end() || iter->second.size() != 1)
+    return NULL;
+  auto &def = iter->second[0];
+  return def.block->code[def.pos];
+}
+
+bool Reducer::GetConstant(Location *loc, int &value) const {
+  auto constant = dynamic_cast<LoadConstant *>(DefOf(loc));
+  if (constant)
+    value = constant->GetValue();
+  return constant != NULL;
+}
+
+bool Reducer::IsKilledBetween(Location *loc, BasicBlock *block, size_t from,
+                              size_t to) const {
+  for (size_t pos = from + 1; pos < to; pos++)
+    if (block->code[pos]->Kill().count(loc))
+      return true;
+  return false;
+}
+
+/* Whether some use of loc, which has one def, may be reached from the
+ * def through an update of iv. Each block is visited at most twice, once
+ * for each state.
+ */
+bool Reducer::IsStale(Location *loc, Location *iv) const {
+  auto &def = defs.at(loc)[0];
+  auto defInst = def.block->code[def.pos];
+  std::set<std::pair<BasicBlock *, bool>> visited;
+  std::vector<std::tuple<BasicBlock *, size_t, bool>> work = {
+      std::make_tuple(def.block, def.pos + 1, false)};
+  while (!work.empty()) {
+    BasicBlock *block;
+    size_t pos;
+    bool moved;
+    std::tie(block, pos, moved) = work.back();
+    work.pop_back();
+    for (; pos < block->code.size(); pos++) {
+      auto inst = block->code[pos];
+      if (inst == defInst)
+        break;
+      if (moved && inst->Gen().count(loc))
+        return true;
+      moved |= inst->Kill().count(iv) > 0;
+    }
+    if (pos < block->code.size())
+      continue;
+    for (auto succ : block->succ)
+      if (visited.insert({succ, moved}).second)
+        work.push_back(std::make_tuple(succ, 0, moved));
+  }
+  return false;
+}
+
+// Matches index against iv, iv + c, c + iv and iv - c.
+bool Reducer::GetIndex(Location *index,
+                       const std::map<Location *, std::vector<Step>> &ivs,
+                       Location *&iv, int &offset) const {
+  if (ivs.count(index)) {
+    iv = index;
+    offset = 0;
+    return true;
+  }
+  auto sum = dynamic_cast<BinaryOp *>(DefOf(index));
+  if (!sum)
+    return false;
+  auto op1 = sum->GetOp1(), op2 = sum->GetOp2();
+  if (sum->GetCode() == Mips::Add && ivs.count(op2))
+    std::swap(op1, op2);
+  if (!ivs.count(op1) || !GetConstant(op2, offset))
+    return false;
+  if (sum->GetCode() == Mips::Sub)
+    offset = -offset;
+  else if (sum->GetCode() != Mips::Add)
+    return false;
+  iv = op1;
+  return !IsStale(index, iv);
+}
+
+Location *Reducer::Constant(BasicBlock *pre, int value) {
+  auto loc = codeGen.GenFrameVar(fn, "_ivc");
+  pre->code.push_back(new LoadConstant(loc, value));
+  return loc;
+}
+
+// Appends base + scale * (index + offset) to the preheader.
+Location *Reducer::Compute(BasicBlock *pre, Pointer p, Location *index) {
+  if (p.offset) {
+    auto sum = codeGen.GenFrameVar(fn, "_ivs");
+    pre->code.push_back(
+        new BinaryOp(Mips::Add, sum, index, Constant(pre, p.offset)));
+    index = sum;
+  }
+  auto product = codeGen.GenFrameVar(fn, "_ivs");
+  pre->code.push_back(
+      new BinaryOp(Mips::Mul, product, index, Constant(pre, p.scale)));
+  auto result = codeGen.GenFrameVar(fn, "_ptr");
+  result->SetType(p.base->GetType(), true);
+  pre->code.push_back(new BinaryOp(Mips::Add, result, p.base, product));
+  return result;
+}
+
+// Drops arithmetic whose result is no longer used.
+void Reducer::RemoveDeadCode() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    Scan();
+    for (auto block : graph.GetBlocks()) {
+      auto &code = block->code;
+      auto end = std::remove_if(code.begin(), code.end(), [&](Instruction *i) {
+        if (!dynamic_cast<LoadConstant *>(i) && !dynamic_cast<BinaryOp *>(i) &&
+            !dynamic_cast<Assign *>(i))
+          return false;
+        auto dst = *i->Kill().begin();
+        return dst->GetSegment() == fpRelative && !uses.count(dst);
+      });
+      changed |= end != code.end();
+      code.erase(end, code.end());
+    }
+  }
+}
+
+void Reducer::Reduce(Loop *loop) {
+  Scan();
+  std::map<Location *, std::vector<Def>> loopDefs;
+  for (auto block : loop->blocks)
+    for (size_t pos = 0; pos < block->code.size(); pos++)
+      for (auto loc : block->code[pos]->Kill())
+        loopDefs[loc].push_back({block, pos});
+
+  // basic induction variables
+  std::map<Location *, std::vector<Step>> ivs;
+  for (auto &entry : loopDefs) {
+    auto iv = entry.first;
+    if (iv->GetSegment() != fpRelative)
+      continue;
+    std::vector<Step> steps;
+    for (auto &def : entry.second) {
+      auto update = dynamic_cast<Assign *>(def.block->code[def.pos]);
+      auto sum = update ? dynamic_cast<BinaryOp *>(DefOf(update->GetSrc()))
+                        : NULL;
+      auto &sumDef = sum ? defs[update->GetSrc()][0] : def;
+      if (!sum || sumDef.block != def.block || sumDef.pos > def.pos)
+        break;
+      auto op1 = sum->GetOp1(), op2 = sum->GetOp2();
+      if (sum->GetCode() == Mips::Add && op2 == iv)
+        std::swap(op1, op2);
+      int step;
+      if (op1 != iv || !GetConstant(op2, step) ||
+          (sum->GetCode() != Mips::Add && sum->GetCode() != Mips::Sub) ||
+          IsKilledBetween(iv, def.block, sumDef.pos, def.pos))
+        break;
+      steps.push_back({update, sum->GetCode() == Mips::Sub ? -step : step});
+    }
+    if (steps.size() == entry.second.size())
+      ivs[iv] = steps;
+  }
+  if (ivs.empty())
+    return;
+
+  // addresses base + index * scale
+  std::map<Location *, Pointer> addresses;
+  for (auto block : loop->blocks)
+    for (size_t pos = 0; pos < block->code.size(); pos++) {
+      auto add = dynamic_cast<BinaryOp *>(block->code[pos]);
+      if (!add || add->GetCode() != Mips::Add || !DefOf(add->GetDst()))
+        continue;
+      for (auto order : {0, 1}) {
+        auto base = order ? add->GetOp2() : add->GetOp1();
+        auto product = order ? add->GetOp1() : add->GetOp2();
+        auto mul = dynamic_cast<BinaryOp *>(DefOf(product));
+        if (base->GetSegment() != fpRelative || loopDefs.count(base) || !mul ||
+            mul->GetCode() != Mips::Mul)
+          continue;
+        auto index = mul->GetOp1();
+        int scale;
+        if (!GetConstant(mul->GetOp2(), scale)) {
+          index = mul->GetOp2();
+          if (!GetConstant(mul->GetOp1(), scale))
+            continue;
+        }
+        Pointer p = {base, NULL, scale, 0};
+        if (!GetIndex(index, ivs, p.iv, p.offset) || IsStale(product, p.iv) ||
+            IsStale(add->GetDst(), p.iv))
+          continue;
+        addresses[add->GetDst()] = p;
+        break;
+      }
+    }
+  if (addresses.empty())
+    return;
+
+  auto pre = graph.InsertPreheader(loop, codeGen.NewLabel());
+  std::map<Pointer, Location *> pointers;
+  Renaming r;
+  for (auto &address : addresses) {
+    auto &p = pointers[address.second];
+    if (!p)
+      p = Compute(pre, address.second, address.second.iv);
+    r.uses[address.first] = p;
+  }
+
+  std::map<int, Location *> increments;
+  std::map<Instruction *, std::vector<Instruction *>> after;
+  for (auto &pointer : pointers) {
+    auto &p = pointer.first;
+    for (auto &step : ivs[p.iv]) {
+      auto &inc = increments[p.scale * step.step];
+      if (!inc)
+        inc = Constant(pre, p.scale * step.step);
+      after[step.update].push_back(
+          new BinaryOp(Mips::Add, pointer.second, pointer.second, inc));
+    }
+  }
+
+  for (auto block : graph.GetBlocks()) {
+    std::vector<Instruction *> code;
+    for (auto inst : block->code) {
+      auto kill = inst->Kill();
+      if (kill.size() == 1 && addresses.count(*kill.begin()))
+        continue;
+      bool used = false;
+      for (auto loc : inst->Gen())
+        used |= addresses.count(loc) > 0;
+      code.push_back(used ? inst->Rewrite(r) : inst);
+      if (after.count(inst))
+        code.insert(code.end(), after[inst].begin(), after[inst].end());
+    }
+    block->code = code;
+  }
+  numAddresses += addresses.size();
+
+  RemoveDeadCode();
+}
+
+} // namespace
+
+void CodeGenerator::ReduceStrength() {
+  if (!GetIntOption("strength-reduce", 1))
+    return;
+
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    if (!dynamic_cast<BeginFunc *>(code->Nth(begin))) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    auto entry = dynamic_cast<Label *>(code->Nth(begin - 1));
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    FlowGraph graph(body);
+    graph.ComputeLoops();
+    Reducer reducer(*this, graph);
+    auto &loops = graph.GetLoops();
+    for (auto iter = loops.rbegin(); iter != loops.rend(); ++iter)
+      if ((*iter)->IsReducible())
+        reducer.Reduce(*iter);
+    if (IsDebugOn("ivs") && reducer.numAddresses)
+      fprintf(stderr, "ivs: %s: %d addresses\n", entry->GetLabel(),
+              reducer.numAddresses);
+
+    for (auto inst : graph.Flatten())
+      result->Append(inst);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
@@ -4,13 +4,31 @@
  */
 
 #include "tac.h"
+#include "gc.h"
 #include "mips.h"
+#include "profile.h"
 #include <algorithm>
 #include <deque>
 #include <string.h>
 
 Location::Location(Segment s, int o, const char *name)
-    : variableName(strdup(name)), segment(s), offset(o), reg(Mips::zero) {}
+    : variableName(strdup(name)), segment(s), offset(o), reg(Mips::zero),
+      type(NULL), derived(false) {}
+
+Location *Renaming::Use(Location *loc) const {
+  auto iter = uses.find(loc);
+  return iter == uses.end() ? loc : iter->second;
+}
+
+Location *Renaming::Def(Location *loc) const {
+  auto iter = defs.find(loc);
+  return iter == defs.end() ? loc : iter->second;
+}
+
+const char *Renaming::Label(const char *label) const {
+  auto iter = labels.find(label);
+  return iter == labels.end() ? label : iter->second;
+}
 
 void Instruction::Print() {
   printf("\t%s ;", printed);
@@ -30,6 +48,9 @@ LoadConstant::LoadConstant(Location *d, int v) : dst(d), val(v) {
 void LoadConstant::EmitSpecific(Mips *mips) {
   mips->EmitLoadConstant(dst, val);
 }
+Instruction *LoadConstant::Rewrite(const Renaming &r) const {
+  return new LoadConstant(r.Def(dst), val);
+}
 
 LoadStringConstant::LoadStringConstant(Location *d, const char *s) : dst(d) {
   Assert(dst != NULL && s != NULL);
@@ -42,20 +63,39 @@ LoadStringConstant::LoadStringConstant(Location *d, const char *s) : dst(d) {
 void LoadStringConstant::EmitSpecific(Mips *mips) {
   mips->EmitLoadStringConstant(dst, str);
 }
+Instruction *LoadStringConstant::Rewrite(const Renaming &r) const {
+  return new LoadStringConstant(r.Def(dst), str);
+}
 
 LoadLabel::LoadLabel(Location *d, const char *l) : dst(d), label(strdup(l)) {
   Assert(dst != NULL && label != NULL);
   sprintf(printed, "%s = %s", dst->GetName(), label);
 }
 void LoadLabel::EmitSpecific(Mips *mips) { mips->EmitLoadLabel(dst, label); }
+Instruction *LoadLabel::Rewrite(const Renaming &r) const {
+  return new LoadLabel(r.Def(dst), label);
+}
+
+LoadAddress::LoadAddress(Location *d, Location *v) : dst(d), var(v) {
+  Assert(dst != NULL && var != NULL);
+  sprintf(printed, "%s = &%s", dst->GetName(), var->GetName());
+}
+void LoadAddress::EmitSpecific(Mips *mips) { mips->EmitLoadAddress(dst, var); }
+Instruction *LoadAddress::Rewrite(const Renaming &r) const {
+  return new LoadAddress(r.Def(dst), var);
+}
 
 Assign::Assign(Location *d, Location *s) : dst(d), src(s) {
   Assert(dst != NULL && src != NULL);
   sprintf(printed, "%s = %s", dst->GetName(), src->GetName());
 }
 void Assign::EmitSpecific(Mips *mips) { mips->EmitCopy(dst, src); }
+Instruction *Assign::Rewrite(const Renaming &r) const {
+  return new Assign(r.Def(dst), r.Use(src));
+}
 
-Load::Load(Location *d, Location *s, int off) : dst(d), src(s), offset(off) {
+Load::Load(Location *d, Location *s, int off, const char *rgn)
+    : dst(d), src(s), offset(off), region(rgn) {
   Assert(dst != NULL && src != NULL);
   if (offset)
     sprintf(printed, "%s = *(%s + %d)", dst->GetName(), src->GetName(), offset);
@@ -63,8 +103,12 @@ Load::Load(Location *d, Location *s, int off) : dst(d), src(s), offset(off) {
     sprintf(printed, "%s = *(%s)", dst->GetName(), src->GetName());
 }
 void Load::EmitSpecific(Mips *mips) { mips->EmitLoad(dst, src, offset); }
+Instruction *Load::Rewrite(const Renaming &r) const {
+  return new Load(r.Def(dst), r.Use(src), offset, region);
+}
 
-Store::Store(Location *d, Location *s, int off) : dst(d), src(s), offset(off) {
+Store::Store(Location *d, Location *s, int off, const char *rgn)
+    : dst(d), src(s), offset(off), region(rgn) {
   Assert(dst != NULL && src != NULL);
   if (offset)
     sprintf(printed, "*(%s + %d) = %s", dst->GetName(), offset, src->GetName());
@@ -72,6 +116,9 @@ Store::Store(Location *d, Location *s, int off) : dst(d), src(s), offset(off) {
     sprintf(printed, "*(%s) = %s", dst->GetName(), src->GetName());
 }
 void Store::EmitSpecific(Mips *mips) { mips->EmitStore(dst, src, offset); }
+Instruction *Store::Rewrite(const Renaming &r) const {
+  return new Store(r.Use(dst), r.Use(src), offset, region);
+}
 
 const char *const BinaryOp::opName[Mips::NumOps] = {"+",  "-", "*",  "/", "%",
                                                     "==", "<", "&&", "||"};
@@ -95,6 +142,9 @@ BinaryOp::BinaryOp(Mips::OpCode c, Location *d, Location *o1, Location *o2)
 void BinaryOp::EmitSpecific(Mips *mips) {
   mips->EmitBinaryOp(code, dst, op1, op2);
 }
+Instruction *BinaryOp::Rewrite(const Renaming &r) const {
+  return new BinaryOp(code, r.Def(dst), r.Use(op1), r.Use(op2));
+}
 
 Label::Label(const char *l) : label(strdup(l)) {
   Assert(label != NULL);
@@ -102,20 +152,34 @@ Label::Label(const char *l) : label(strdup(l)) {
 }
 void Label::Print() { printf("%s:\n", label); }
 void Label::EmitSpecific(Mips *mips) { mips->EmitLabel(label); }
+Instruction *Label::Rewrite(const Renaming &r) const {
+  return new Label(r.Label(label));
+}
 
 Goto::Goto(const char *l) : label(strdup(l)) {
   Assert(label != NULL);
   sprintf(printed, "Goto %s", label);
 }
 void Goto::EmitSpecific(Mips *mips) { mips->EmitGoto(label); }
+Instruction *Goto::Rewrite(const Renaming &r) const {
+  return new Goto(r.Label(label));
+}
 
-IfZ::IfZ(Location *te, const char *l) : test(te), label(strdup(l)) {
+IfZ::IfZ(Location *te, const char *l)
+    : test(te), label(strdup(l)), probe(-1), weight(1) {
   Assert(test != NULL && label != NULL);
   sprintf(printed, "IfZ %s Goto %s", test->GetName(), label);
 }
-void IfZ::EmitSpecific(Mips *mips) { mips->EmitIfZ(test, label); }
+void IfZ::EmitSpecific(Mips *mips) {
+  mips->EmitIfZ(test, label, ProfileGenerate() ? probe : -1);
+}
+Instruction *IfZ::Rewrite(const Renaming &r) const {
+  auto result = new IfZ(r.Use(test), r.Label(label));
+  result->SetProbe(probe, weight);
+  return result;
+}
 
-BeginFunc::BeginFunc() {
+BeginFunc::BeginFunc() : paramSize(0), probe(-1) {
   sprintf(printed, "BeginFunc (unassigned)");
   frameSize = -555; // used as sentinel to recognized unassigned value
 }
@@ -124,32 +188,49 @@ void BeginFunc::SetFrameSize(int numBytesForAllLocalsAndTemps) {
   sprintf(printed, "BeginFunc %d", frameSize);
 }
 void BeginFunc::EmitSpecific(Mips *mips) {
-  mips->EmitBeginFunction(frameSize);
+  mips->EmitBeginFunction(frameSize, ProfileGenerate() ? probe : -1);
   /* pp5: need to load all parameters to the allocated registers.
    */
   for (auto param : out)
     if (auto reg = param->GetRegister())
       mips->FillRegister(param, reg);
 }
+Instruction *BeginFunc::Rewrite(const Renaming &r) const {
+  auto result = new BeginFunc;
+  result->SetFrameSize(frameSize);
+  result->SetParamSize(paramSize);
+  result->SetProbe(probe);
+  return result;
+}
 
 EndFunc::EndFunc() : Instruction() { sprintf(printed, "EndFunc"); }
 void EndFunc::EmitSpecific(Mips *mips) { mips->EmitEndFunction(); }
+Instruction *EndFunc::Rewrite(const Renaming &r) const { return new EndFunc; }
 
 Return::Return(Location *v) : val(v) {
   sprintf(printed, "Return %s", val ? val->GetName() : "");
 }
 void Return::EmitSpecific(Mips *mips) { mips->EmitReturn(val); }
+Instruction *Return::Rewrite(const Renaming &r) const {
+  return new Return(val ? r.Use(val) : NULL);
+}
 
 PushParam::PushParam(Location *p) : param(p) {
   Assert(param != NULL);
   sprintf(printed, "PushParam %s", param->GetName());
 }
 void PushParam::EmitSpecific(Mips *mips) { mips->EmitParam(param); }
+Instruction *PushParam::Rewrite(const Renaming &r) const {
+  return new PushParam(r.Use(param));
+}
 
 PopParams::PopParams(int nb) : numBytes(nb) {
   sprintf(printed, "PopParams %d", numBytes);
 }
 void PopParams::EmitSpecific(Mips *mips) { mips->EmitPopParams(numBytes); }
+Instruction *PopParams::Rewrite(const Renaming &r) const {
+  return new PopParams(numBytes);
+}
 
 LCall::LCall(const char *l, Location *d) : label(strdup(l)), dst(d) {
   sprintf(printed, "%s%sLCall %s", dst ? dst->GetName() : "", dst ? " = " : "",
@@ -165,16 +246,20 @@ void LCall::EmitSpecific(Mips *mips) {
 
   for (auto param : save)
     if (auto reg = param->GetRegister())
-      mips->SpillRegister(param, reg);
+      mips->SpillRegister(param, reg, true);
 
-  mips->EmitLCall(dst, label);
+  mips->EmitLCall(dst, label, GCCallSite(label, save));
 
   for (auto param : save)
     if (auto reg = param->GetRegister())
-      mips->FillRegister(param, reg);
+      mips->FillRegister(param, reg, true);
+}
+Instruction *LCall::Rewrite(const Renaming &r) const {
+  return new LCall(label, dst ? r.Def(dst) : NULL);
 }
 
-ACall::ACall(Location *ma, Location *d) : dst(d), methodAddr(ma) {
+ACall::ACall(Location *ma, Location *d, const char *m)
+    : dst(d), methodAddr(ma), method(m) {
   Assert(methodAddr != NULL);
   sprintf(printed, "%s%sACall %s", dst ? dst->GetName() : "", dst ? " = " : "",
           methodAddr->GetName());
@@ -189,28 +274,78 @@ void ACall::EmitSpecific(Mips *mips) {
 
   for (auto param : save)
     if (auto reg = param->GetRegister())
-      mips->SpillRegister(param, reg);
+      mips->SpillRegister(param, reg, true);
 
-  mips->EmitACall(dst, methodAddr);
+  mips->EmitACall(dst, methodAddr, GCCallSite(NULL, save));
 
   for (auto param : save)
     if (auto reg = param->GetRegister())
-      mips->FillRegister(param, reg);
+      mips->FillRegister(param, reg, true);
+}
+Instruction *ACall::Rewrite(const Renaming &r) const {
+  return new ACall(r.Use(methodAddr), dst ? r.Def(dst) : NULL, method);
 }
 
-VTable::VTable(const char *l, List<const char *> *m)
-    : methodLabels(m), label(strdup(l)) {
+TailCall::TailCall(const char *l, int nb)
+    : label(strdup(l)), methodAddr(NULL), numBytes(nb) {
+  sprintf(printed, "TailCall %s %d", label, numBytes);
+}
+TailCall::TailCall(Location *ma, int nb)
+    : label(NULL), methodAddr(ma), numBytes(nb) {
+  Assert(methodAddr != NULL);
+  sprintf(printed, "TailCall %s %d", methodAddr->GetName(), numBytes);
+}
+void TailCall::EmitSpecific(Mips *mips) {
+  if (label)
+    mips->EmitTailLCall(label, numBytes);
+  else
+    mips->EmitTailACall(methodAddr, numBytes);
+}
+Instruction *TailCall::Rewrite(const Renaming &r) const {
+  if (label)
+    return new TailCall(label, numBytes);
+  return new TailCall(r.Use(methodAddr), numBytes);
+}
+
+VTable::VTable(const char *l, List<const char *> *m,
+               const std::vector<int> &h)
+    : methodLabels(m), label(strdup(l)), header(h) {
   Assert(methodLabels != NULL && label != NULL);
   sprintf(printed, "VTable for class %s", l);
 }
 
+Phi::Phi(Location *d, int n) : dst(d), args(n) {
+  Assert(dst != NULL);
+  sprintf(printed, "%s = Phi", dst->GetName());
+}
+void Phi::Print() {
+  printf("\t%s = Phi(", dst->GetName());
+  for (size_t i = 0; i < args.size(); i++)
+    printf("%s%s", i ? ", " : "", args[i] ? args[i]->GetName() : "?");
+  printf(") ;\n");
+}
+void Phi::EmitSpecific(Mips *mips) {
+  Failure("phi for %s left in code", dst->GetName());
+}
+Instruction *Phi::Rewrite(const Renaming &r) const {
+  auto result = new Phi(r.Def(dst), args.size());
+  for (size_t i = 0; i < args.size(); i++)
+    result->args[i] = args[i] ? r.Use(args[i]) : NULL;
+  return result;
+}
+
 void VTable::Print() {
   printf("VTable %s =\n", label);
   for (int i = 0; i < methodLabels->NumElements(); i++)
     printf("\t%s,\n", methodLabels->Nth(i));
   printf("; \n");
 }
-void VTable::EmitSpecific(Mips *mips) { mips->EmitVTable(label, methodLabels); }
+void VTable::EmitSpecific(Mips *mips) {
+  mips->EmitVTable(label, methodLabels, header);
+}
+Instruction *VTable::Rewrite(const Renaming &r) const {
+  return new VTable(label, methodLabels, header);
+}
 
 void Instruction::Clear() {
   succ->Clear();
@@ -240,6 +375,9 @@ bool Instruction::UpdateLiveVar() {
 
 bool Instruction::Dead() const {
   LocationSet inter, kill = Kill();
+  for (auto loc : kill)
+    if (loc->GetSegment() == gpRelative)
+      return false; // globals are visible to other functions
   std::set_intersection(kill.begin(), kill.end(), out.begin(), out.end(),
                         std::inserter(inter, inter.begin()));
   return inter != kill;
@@ -26,7 +26,10 @@
 #include "list.h" // for VTable
 #include "mips.h"
 
+#include <map>
 #include <set>
+#include <string>
+#include <vector>
 
 // A Location object is used to identify the operands to the
 // various TAC instructions. A Location is either fp or gp
@@ -38,6 +41,8 @@
 
 typedef enum { fpRelative, gpRelative } Segment;
 
+class Type;
+
 class Location {
 protected:
   const char *variableName;
@@ -48,6 +53,12 @@ protected:
   // A "zero" indicates that no register has been allocated.
   Mips::Register reg;
 
+  // The type of the value held, if known, and whether the value is an
+  // address inside an object or array rather than a reference to it.
+  // Only the collector looks at these, see gc.h.
+  Type *type;
+  bool derived;
+
 public:
   Location(Segment seg, int offset, const char *name);
 
@@ -56,10 +67,31 @@ public:
   int GetOffset() { return offset; }
   void SetRegister(Mips::Register r) { reg = r; }
   Mips::Register GetRegister() { return reg; }
+  void SetType(Type *t, bool d = false) { type = t, derived = d; }
+  void SetTypeOf(Location *other) { SetType(other->type, other->derived); }
+  Type *GetType() { return type; }
+  bool IsDerived() { return derived; }
 };
 
 typedef std::set<Location *> LocationSet;
 
+// A Renaming maps the operands of an instruction when the optimizer
+// copies or rewrites it (see Instruction::Rewrite). Uses and definitions
+// are mapped separately; locations and labels without an entry are left
+// unchanged.
+class Renaming {
+public:
+  std::map<Location *, Location *> uses, defs;
+  std::map<std::string, const char *> labels;
+
+  // maps both the uses and the definitions of from to to
+  void Map(Location *from, Location *to) { uses[from] = defs[from] = to; }
+
+  Location *Use(Location *loc) const;
+  Location *Def(Location *loc) const;
+  const char *Label(const char *label) const;
+};
+
 // base class from which all Tac instructions derived
 // has the interface for the 2 polymorphic messages: Print & Emit
 
@@ -70,8 +102,13 @@ protected:
   List<Instruction *> *succ;
   LocationSet in, out;
 
+  // set by CodeGenerator::AnnotateLoops
+  int loopDepth, frequency;
+
 public:
-  Instruction() { succ = new List<Instruction *>; }
+  Instruction() : loopDepth(0), frequency(1) {
+    succ = new List<Instruction *>;
+  }
 
   void Clear();
 
@@ -87,6 +124,15 @@ public:
 
   virtual bool Dead() const;
 
+  // Loop nesting depth and estimated executions per call of the function.
+  void SetLoopInfo(int depth, int freq) { loopDepth = depth, frequency = freq; }
+  int GetLoopDepth() const { return loopDepth; }
+  int GetFrequency() const { return frequency; }
+
+  // Returns a new instruction of the same kind with its operands
+  // and labels mapped through the renaming.
+  virtual Instruction *Rewrite(const Renaming &r) const = 0;
+
   virtual void Print();
   virtual void EmitSpecific(Mips *mips) = 0;
   virtual void Emit(Mips *mips);
@@ -98,6 +144,7 @@ public:
 class LoadConstant;
 class LoadStringConstant;
 class LoadLabel;
+class LoadAddress;
 class Assign;
 class Load;
 class Store;
@@ -112,6 +159,8 @@ class PushParam;
 class RemoveParams;
 class LCall;
 class ACall;
+class TailCall;
+class Phi;
 class VTable;
 
 class LoadConstant : public Instruction {
@@ -120,7 +169,10 @@ class LoadConstant : public Instruction {
 
 public:
   LoadConstant(Location *dst, int val);
+  Location *GetDst() const { return dst; }
+  int GetValue() const { return val; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const { return {dst}; }
 };
@@ -132,6 +184,7 @@ class LoadStringConstant : public Instruction {
 public:
   LoadStringConstant(Location *dst, const char *s);
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const { return {dst}; }
 };
@@ -142,7 +195,25 @@ class LoadLabel : public Instruction {
 
 public:
   LoadLabel(Location *dst, const char *label);
+  Location *GetDst() const { return dst; }
+  const char *GetLabel() const { return label; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+
+  LocationSet Kill() const { return {dst}; }
+};
+
+// dst = &var, the address of a variable in the frame or the global
+// segment. Used for objects the optimizer places in the frame.
+class LoadAddress : public Instruction {
+  Location *dst, *var;
+
+public:
+  LoadAddress(Location *dst, Location *var);
+  Location *GetDst() const { return dst; }
+  Location *GetVar() const { return var; }
+  void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const { return {dst}; }
 };
@@ -152,19 +223,33 @@ class Assign : public Instruction {
 
 public:
   Assign(Location *dst, Location *src);
+  Location *GetDst() const { return dst; }
+  Location *GetSrc() const { return src; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const { return {dst}; }
   LocationSet Gen() const { return {src}; }
 };
 
+// The region of a Load or Store names the memory it may touch, such as
+// "Node.next" for a field or "int[]" for the elements of int arrays
+// (see modref.cc). Accesses in different regions never overlap; NULL
+// stands for any memory.
 class Load : public Instruction {
   Location *dst, *src;
   int offset;
+  const char *region;
 
 public:
-  Load(Location *dst, Location *src, int offset = 0);
+  Load(Location *dst, Location *src, int offset = 0,
+       const char *region = NULL);
+  Location *GetDst() const { return dst; }
+  Location *GetSrc() const { return src; }
+  int GetOffset() const { return offset; }
+  const char *GetRegion() const { return region; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const { return {dst}; }
   LocationSet Gen() const { return {src}; }
@@ -173,10 +258,16 @@ public:
 class Store : public Instruction {
   Location *dst, *src;
   int offset;
+  const char *region;
 
 public:
-  Store(Location *d, Location *s, int offset = 0);
+  Store(Location *d, Location *s, int offset = 0, const char *region = NULL);
+  Location *GetDst() const { return dst; }
+  Location *GetSrc() const { return src; }
+  int GetOffset() const { return offset; }
+  const char *GetRegion() const { return region; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Gen() const { return {src, dst}; }
 };
@@ -193,7 +284,12 @@ protected:
 
 public:
   BinaryOp(Mips::OpCode c, Location *dst, Location *op1, Location *op2);
+  Mips::OpCode GetCode() const { return code; }
+  Location *GetDst() const { return dst; }
+  Location *GetOp1() const { return op1; }
+  Location *GetOp2() const { return op2; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const { return {dst}; }
   LocationSet Gen() const { return {op1, op2}; }
@@ -206,6 +302,7 @@ public:
   Label(const char *label);
   void Print();
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
   const char *GetLabel() { return label; }
 };
 
@@ -215,6 +312,7 @@ class Goto : public Instruction {
 public:
   Goto(const char *label);
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
   const char *GetLabel() { return label; }
 
   void AddSucc(Instruction *);
@@ -223,10 +321,17 @@ public:
 class IfZ : public Instruction {
   Location *test;
   const char *label;
+  int probe;     // the first of its two counters, or -1; see profile.h
+  double weight; // of the counts, for a copy inlined from a function
 
 public:
   IfZ(Location *test, const char *label);
+  Location *GetTest() const { return test; }
+  void SetProbe(int p, double w = 1) { probe = p, weight = w; }
+  int GetProbe() const { return probe; }
+  double GetWeight() const { return weight; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
   const char *GetLabel() { return label; }
 
   LocationSet Gen() const { return {test}; }
@@ -235,18 +340,27 @@ public:
 
 class BeginFunc : public Instruction {
   int frameSize;
+  int paramSize; // bytes of params the caller pushed, 'this' included
+  int probe;     // the counter of its calls, or -1; see profile.h
 
 public:
   BeginFunc();
+  void SetProbe(int p) { probe = p; }
+  int GetProbe() const { return probe; }
   // used to backpatch the instruction with frame size once known
   void SetFrameSize(int numBytesForAllLocalsAndTemps);
+  int GetFrameSize() const { return frameSize; }
+  void SetParamSize(int numBytesOfParams) { paramSize = numBytesOfParams; }
+  int GetParamSize() const { return paramSize; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 };
 
 class EndFunc : public Instruction {
 public:
   EndFunc();
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   void AddSucc(Instruction *) {}
 };
@@ -257,12 +371,15 @@ class Return : public Instruction {
 public:
   Return(Location *val);
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+  Location *GetValue() const { return val; }
 
   LocationSet Gen() const {
     if (val)
       return {val};
     return LocationSet();
   }
+  void AddSucc(Instruction *) {}
 };
 
 class PushParam : public Instruction {
@@ -271,6 +388,8 @@ class PushParam : public Instruction {
 public:
   PushParam(Location *param);
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+  Location *GetParam() const { return param; }
 
   LocationSet Gen() const { return {param}; }
 };
@@ -281,6 +400,8 @@ class PopParams : public Instruction {
 public:
   PopParams(int numBytesOfParamsToRemove);
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+  int GetNumBytes() const { return numBytes; }
 };
 
 class LCall : public Instruction {
@@ -290,6 +411,9 @@ class LCall : public Instruction {
 public:
   LCall(const char *labe, Location *result);
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+  const char *GetLabel() const { return label; }
+  Location *GetDst() const { return dst; }
 
   LocationSet Kill() const {
     LocationSet set;
@@ -302,10 +426,15 @@ public:
 
 class ACall : public Instruction {
   Location *dst, *methodAddr;
+  const char *method; // the name of the method called, or NULL
 
 public:
-  ACall(Location *meth, Location *result);
+  ACall(Location *meth, Location *result, const char *method = NULL);
+  Location *GetMethodAddr() const { return methodAddr; }
+  const char *GetMethod() const { return method; }
+  Location *GetDst() const { return dst; }
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   LocationSet Kill() const {
     LocationSet set;
@@ -317,14 +446,71 @@ public:
   bool Dead() const { return false; }
 };
 
+// A call in tail position that reuses the caller's frame: the pushed
+// params are copied over the caller's own params, the caller's frame is
+// popped and the callee is entered with a jump, so that it returns
+// directly to the caller's caller. Emitted by EliminateTailCalls only
+// when the callee takes no more param bytes than the caller.
+class TailCall : public Instruction {
+  const char *label;
+  Location *methodAddr;
+  int numBytes;
+
+public:
+  TailCall(const char *label, int numBytesOfParams);
+  TailCall(Location *methodAddr, int numBytesOfParams);
+  const char *GetLabel() const { return label; } // NULL for a method
+  void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+
+  LocationSet Gen() const {
+    if (methodAddr)
+      return {methodAddr};
+    return LocationSet();
+  }
+  bool Dead() const { return false; }
+  void AddSucc(Instruction *) {}
+};
+
+// A phi function at the head of a block. Phis only exist while the SSA
+// stage holds a function as a FlowGraph (see ssa.cc); the n-th argument
+// is the value coming in from the n-th predecessor of the block.
+class Phi : public Instruction {
+  Location *dst;
+  std::vector<Location *> args;
+
+public:
+  Phi(Location *dst, int numArgs);
+  void Print();
+  void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
+  Location *GetDst() const { return dst; }
+  void SetDst(Location *d) { dst = d; }
+  std::vector<Location *> &GetArgs() { return args; }
+
+  LocationSet Kill() const { return {dst}; }
+  LocationSet Gen() const {
+    LocationSet set;
+    for (auto arg : args)
+      if (arg)
+        set.insert(arg);
+    return set;
+  }
+};
+
 class VTable : public Instruction {
   List<const char *> *methodLabels;
   const char *label;
+  std::vector<int> header; // words laid out before the table, see gc.h
 
 public:
-  VTable(const char *labelForTable, List<const char *> *methodLabels);
+  VTable(const char *labelForTable, List<const char *> *methodLabels,
+         const std::vector<int> &header = {});
+  const char *GetLabel() const { return label; }
+  List<const char *> *GetMethodLabels() const { return methodLabels; }
   void Print();
   void EmitSpecific(Mips *mips);
+  Instruction *Rewrite(const Renaming &r) const;
 
   void AddSucc(Instruction *) {}
 };
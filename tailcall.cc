@@ -0,0 +1,176 @@
+/* File: tailcall.cc
+ * -----------------
+ * Tail-call elimination. A call is in tail position when, after its
+ * PopParams, control reaches a Return of the call's result (or a plain
+ * Return or the end of the function for a call without a result),
+ * passing only through labels, gotos and copies of the result into
+ * locals, as left behind by the inliner.
+ *
+ * A tail call of the function to itself becomes a loop: the pushed
+ * values are assigned to the params, going through fresh frame vars for
+ * values that are params themselves so that no param is read after it
+ * was overwritten, and control jumps back to a label placed right after
+ * BeginFunc. Any other tail call whose params take no more room than the
+ * caller's own becomes a TailCall, which enters the callee on the
+ * caller's frame (see Mips::EmitTailCallInstr).
+ *
+ * -fno-tail-calls turns the pass off; -d tailcall reports each call.
+ */
+
+#include "codegen.h"
+#include "tac.h"
+#include <algorithm>
+#include <string.h>
+
+// How many gotos are followed when looking for the Return.
+static const int MaxGotoChain = 8;
+
+/* Returns whether the call whose PopParams (if any) ends at index
+ * next - 1 is followed by a return of its result dst.
+ */
+static bool IsTailPosition(List<Instruction *> *code, int next,
+                           Location *dst, std::map<std::string, int> &index) {
+  int gotos = 0;
+  for (int i = next; i < code->NumElements();) {
+    auto inst = code->Nth(i);
+    if (dynamic_cast<Label *>(inst))
+      i++;
+    else if (auto jump = dynamic_cast<Goto *>(inst)) {
+      if (++gotos > MaxGotoChain || !index.count(jump->GetLabel()))
+        return false;
+      i = index[jump->GetLabel()];
+    } else if (auto assign = dynamic_cast<Assign *>(inst)) {
+      if (!dst || assign->GetSrc() != dst ||
+          assign->GetDst()->GetSegment() == gpRelative)
+        return false;
+      dst = assign->GetDst();
+      i++;
+    } else if (auto ret = dynamic_cast<Return *>(inst))
+      return !ret->GetValue() || ret->GetValue() == dst;
+    else
+      return dynamic_cast<EndFunc *>(inst) != NULL;
+  }
+  return false;
+}
+
+void CodeGenerator::EliminateTailCalls() {
+  if (!GetIntOption("tail-calls", 1))
+    return;
+
+  int numSelf = 0, numOther = 0;
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    auto beginFunc = dynamic_cast<BeginFunc *>(code->Nth(begin));
+    if (!beginFunc) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    auto entry = dynamic_cast<Label *>(code->Nth(begin - 1));
+    Assert(entry);
+    int end = begin;
+    while (!dynamic_cast<EndFunc *>(code->Nth(end)))
+      end++;
+
+    // the params of this function, by offset
+    std::map<std::string, int> index;
+    std::map<int, std::vector<Location *>> params;
+    for (int i = begin; i <= end; i++) {
+      auto inst = code->Nth(i);
+      if (auto label = dynamic_cast<Label *>(inst))
+        index[label->GetLabel()] = i;
+      LocationSet used = inst->Gen(), killed = inst->Kill();
+      used.insert(killed.begin(), killed.end());
+      for (auto loc : used)
+        if (loc->GetSegment() == fpRelative && loc->GetOffset() > 0) {
+          auto &locs = params[loc->GetOffset()];
+          if (std::find(locs.begin(), locs.end(), loc) == locs.end())
+            locs.push_back(loc);
+        }
+    }
+
+    const char *loopLabel = NULL;
+    std::vector<Instruction *> out = {beginFunc};
+    for (int i = begin + 1; i <= end; i++) {
+      auto inst = code->Nth(i);
+      auto lcall = dynamic_cast<LCall *>(inst);
+      auto acall = dynamic_cast<ACall *>(inst);
+      if (!lcall && !acall) {
+        out.push_back(inst);
+        continue;
+      }
+
+      auto pop = dynamic_cast<PopParams *>(code->Nth(i + 1));
+      int numBytes = pop ? pop->GetNumBytes() : 0;
+      int numParams = numBytes / VarSize;
+      auto dst = lcall ? lcall->GetDst() : acall->GetDst();
+      bool pushed = (int)out.size() > numParams;
+      for (int k = 1; pushed && k <= numParams; k++)
+        pushed = dynamic_cast<PushParam *>(out[out.size() - k]) != NULL;
+      if (!pushed || !IsTailPosition(code, pop ? i + 2 : i + 1, dst, index)) {
+        out.push_back(inst);
+        continue;
+      }
+
+      const char *how;
+      if (lcall && strcmp(lcall->GetLabel(), entry->GetLabel()) == 0) {
+        // the last push is the first param
+        std::vector<Location *> actuals;
+        for (int k = 1; k <= numParams; k++)
+          actuals.push_back(
+              dynamic_cast<PushParam *>(out[out.size() - k])->GetParam());
+        out.resize(out.size() - numParams);
+
+        for (int k = 0; k < numParams; k++) {
+          auto actual = actuals[k];
+          int offset = OffsetToFirstParam + k * VarSize;
+          if (actual->GetSegment() == fpRelative && actual->GetOffset() > 0 &&
+              actual->GetOffset() != offset) {
+            actuals[k] = GenFrameVar(beginFunc, actual->GetName());
+            actuals[k]->SetTypeOf(actual);
+            out.push_back(new Assign(actuals[k], actual));
+          }
+        }
+        for (int k = 0; k < numParams; k++)
+          for (auto param : params[OffsetToFirstParam + k * VarSize])
+            if (param != actuals[k])
+              out.push_back(new Assign(param, actuals[k]));
+
+        if (!loopLabel)
+          loopLabel = NewLabel();
+        out.push_back(new Goto(loopLabel));
+        how = "loop";
+        numSelf++;
+      } else if (numBytes <= beginFunc->GetParamSize()) {
+        if (lcall)
+          out.push_back(new TailCall(lcall->GetLabel(), numBytes));
+        else
+          out.push_back(new TailCall(acall->GetMethodAddr(), numBytes));
+        how = "frame reused";
+        numOther++;
+      } else {
+        out.push_back(inst);
+        continue;
+      }
+
+      if (IsDebugOn("tailcall"))
+        fprintf(stderr, "tailcall: %s in %s (%s)\n",
+                lcall ? lcall->GetLabel() : acall->GetMethodAddr()->GetName(),
+                entry->GetLabel(), how);
+      if (pop)
+        i++;
+    }
+
+    if (loopLabel)
+      out.insert(out.begin() + 1, new Label(loopLabel));
+    for (auto inst : out)
+      result->Append(inst);
+    begin = end;
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+  if (IsDebugOn("tailcall"))
+    fprintf(stderr, "tailcall: %d self calls, %d other calls\n", numSelf,
+            numOther);
+}
@@ -0,0 +1,161 @@
+/* File: timing.cc
+ * ---------------
+ * The -d timing report, see timing.h. The report lists the phases in the
+ * order they first ran, with the number of times each ran, the time from
+ * its start to its end (total) and the part of it not spent in another
+ * phase (self), so the self times add up to the time measured. Then come
+ * the counters and a line for every function with its counts and the
+ * time of each phase run on it alone.
+ */
+
+#include "timing.h"
+#include "allocstats.h"
+#include "utility.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Phase {
+  long calls = 0;
+  double total = 0, self = 0;
+};
+
+// names in the order they were first seen
+template <typename T> struct Table {
+  std::vector<std::string> names;
+  std::map<std::string, T> values;
+
+  T &operator[](const std::string &name) {
+    if (!values.count(name))
+      names.push_back(name);
+    return values[name];
+  }
+};
+
+Table<Phase> phases;
+Table<long> counters;
+// by function, the time of each phase and each counter
+Table<Table<double>> fnPhases;
+Table<Table<long>> fnCounters;
+
+PhaseTimer *current = NULL;
+
+// whether the phases are tracked at all, for either report
+bool Tracking() {
+  static bool on = TimingOn() || IsDebugOn("alloc");
+  return on;
+}
+
+} // namespace
+
+bool TimingOn() {
+  static bool on = IsDebugOn("timing");
+  return on;
+}
+
+const char *CurrentPhase() { return current ? current->phase : NULL; }
+
+PhaseTimer::PhaseTimer(const char *phase, const char *fn)
+    : phase(phase), fn(fn), inner(0), outer(NULL) {
+  if (!Tracking())
+    return;
+  outer = current;
+  current = this;
+  start = Clock::now();
+}
+
+PhaseTimer::~PhaseTimer() {
+  if (!Tracking())
+    return;
+  current = outer;
+  AllocPhaseEnd(phase);
+  if (!TimingOn())
+    return;
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  auto &p = phases[phase];
+  p.calls++;
+  p.total += seconds;
+  p.self += seconds - inner;
+  if (fn)
+    fnPhases[fn][phase] += seconds - inner;
+  if (outer)
+    outer->inner += seconds;
+}
+
+void CountEvent(const char *counter, long n, const char *fn) {
+  if (!TimingOn())
+    return;
+  counters[counter] += n;
+  if (fn)
+    fnCounters[fn][counter] += n;
+}
+
+void PrintTimings() {
+  if (!TimingOn())
+    return;
+
+  double all = 0;
+  for (auto &name : phases.names)
+    all += phases[name].self;
+  fprintf(stderr, "timing: %-20s %8s %12s %12s\n", "phase", "calls",
+          "total ms", "self ms");
+  for (auto &name : phases.names) {
+    auto &p = phases[name];
+    fprintf(stderr, "        %-20s %8ld %12.3f %12.3f\n", name.c_str(), p.calls,
+            1000 * p.total, 1000 * p.self);
+  }
+  fprintf(stderr, "        %-20s %8s %12s %12.3f\n", "(all)", "", "",
+          1000 * all);
+
+  fprintf(stderr, "timing: %-20s %8s\n", "counter", "count");
+  for (auto &name : counters.names)
+    fprintf(stderr, "        %-20s %8ld\n", name.c_str(), counters[name]);
+
+  // the columns are every counter and phase seen for some function
+  Table<bool> countColumns, phaseColumns;
+  for (auto &fn : fnCounters.names)
+    for (auto &name : fnCounters[fn].names)
+      countColumns[name] = true;
+  for (auto &fn : fnPhases.names)
+    for (auto &name : fnPhases[fn].names)
+      phaseColumns[name] = true;
+  if (fnCounters.names.empty() && fnPhases.names.empty())
+    return;
+
+  Table<bool> fns;
+  for (auto &fn : fnCounters.names)
+    fns[fn] = true;
+  for (auto &fn : fnPhases.names)
+    fns[fn] = true;
+
+  // method names get long, so the columns are as wide as their names
+  int width = 20;
+  for (auto &fn : fns.names)
+    width = std::max(width, (int)fn.size());
+  std::vector<std::string> headers;
+  for (auto &name : countColumns.names)
+    headers.push_back(name);
+  for (auto &name : phaseColumns.names)
+    headers.push_back(name + " ms");
+  std::vector<int> widths;
+  for (auto &header : headers)
+    widths.push_back(std::max(12, (int)header.size()));
+
+  fprintf(stderr, "timing: %-*s", width, "function");
+  for (size_t i = 0; i < headers.size(); i++)
+    fprintf(stderr, " %*s", widths[i], headers[i].c_str());
+  fprintf(stderr, "\n");
+  for (auto &fn : fns.names) {
+    fprintf(stderr, "        %-*s", width, fn.c_str());
+    size_t i = 0;
+    for (auto &name : countColumns.names)
+      fprintf(stderr, " %*ld", widths[i++], fnCounters[fn].values[name]);
+    for (auto &name : phaseColumns.names)
+      fprintf(stderr, " %*.3f", widths[i++], 1000 * fnPhases[fn].values[name]);
+    fprintf(stderr, "\n");
+  }
+}
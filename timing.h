@@ -0,0 +1,46 @@
+/* File: timing.h
+ * --------------
+ * The -d timing report: the time each phase of the compiler takes, on a
+ * monotonic clock, in all and for every function it works on, and
+ * counters of the work done, such as the TAC instructions or the
+ * variables spilled. The report is printed to stderr by PrintTimings, so
+ * it can be asked for without disturbing the assembly on stdout.
+ */
+
+#ifndef _H_timing
+#define _H_timing
+
+#include <chrono>
+
+class PhaseTimer {
+  typedef std::chrono::steady_clock Clock;
+
+  const char *phase, *fn;
+  Clock::time_point start;
+  double inner; // seconds spent in the phases started within this one
+  PhaseTimer *outer;
+
+  friend const char *CurrentPhase();
+
+public:
+  // Times the given phase until the end of the scope. The time spent in
+  // a phase started within it counts for that phase only. fn, if given,
+  // is the label of the function worked on.
+  PhaseTimer(const char *phase, const char *fn = NULL);
+  ~PhaseTimer();
+};
+
+bool TimingOn();
+
+// The innermost phase running, or NULL; kept for -d alloc too (see
+// allocstats.h).
+const char *CurrentPhase();
+
+// Adds n to a counter of the report, and to its count for the function
+// fn if given.
+void CountEvent(const char *counter, long n, const char *fn = NULL);
+
+// Prints the report if -d timing is given.
+void PrintTimings();
+
+#endif
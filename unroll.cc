@@ -0,0 +1,342 @@
+/* File: unroll.cc
+ * ---------------
+ * Unrolling of counted loops. An innermost loop qualifies when its
+ * header only tests i < b, i > b, i <= b or i >= b, where b does not
+ * change in the loop, and i is updated once per iteration, as
+ * i = i + c at the end of the body, the way ForStmt::Emit lays it out.
+ * Everything between the header and the backward Goto is the body.
+ *
+ * The body is copied k times in front of the loop, guarded by a single
+ * test that k more iterations are due: for i < b, whether
+ * i < b - (k - 1) * c. The copies jump back to that test, and the
+ * original loop runs the remaining iterations. Exits out of the body,
+ * such as a break or a return, keep their targets, so a copy leaves the
+ * loop just like the iteration it stands for.
+ *
+ * A loop whose trip count is known from its ForStmt and small enough is
+ * unrolled fully: k is the trip count and the copies fall through to the
+ * original loop, whose test then fails at once. The trip count is only
+ * a hint, wrong when the loop is left early, which the copies do just
+ * as the loop would; should it run longer, the original loop does the
+ * rest.
+ * Loops with calls are only unrolled fully: the overhead saved is small
+ * next to the call, and the limit of the guard would have to be saved
+ * around each one.
+ *
+ * -funroll-factor=N sets k (default 4), -funroll-full=N the largest trip
+ * count unrolled fully (default 16), -funroll-budget=N the most
+ * instructions the copies of one loop may add (default 200) and
+ * -funroll-growth=N the most the copies of all loops may add to a
+ * function, in percent of its size (default 50), though never less than
+ * the budget of one loop. Liveness and register allocation take more
+ * than linear time in the size of a function.
+ * -fno-unroll turns the pass off; -d unroll reports each loop.
+ */
+
+#include "codegen.h"
+#include "flowgraph.h"
+#include "tac.h"
+#include <algorithm>
+
+namespace {
+
+// The shape of a loop that can be unrolled.
+struct CountedLoop {
+  BasicBlock *header, *latch;
+  std::vector<BasicBlock *> body; // in layout order, after the header
+  Location *iv, *bound;
+  int step;
+  bool up;        // the test is i < b or i <= b rather than i > b or i >= b
+  bool inclusive; // <= or >=
+};
+
+class Unroller {
+  CodeGenerator &codeGen;
+  FlowGraph &graph;
+  std::map<Location *, std::vector<Instruction *>> defs;
+
+  Instruction *DefOf(Location *loc) const;
+  bool GetConstant(Location *loc, int &value) const;
+  bool IsVariant(Loop *loop, Location *loc) const;
+  bool MatchTest(Loop *loop, CountedLoop &counted) const;
+  bool MatchUpdate(Loop *loop, CountedLoop &counted) const;
+
+public:
+  Unroller(CodeGenerator &cg, FlowGraph &g);
+
+  bool Match(Loop *loop, CountedLoop &counted) const;
+  void Unroll(Loop *loop, const CountedLoop &counted, int factor, bool full);
+};
+
+Unroller::Unroller(CodeGenerator &cg, FlowGraph &g) : codeGen(cg), graph(g) {
+  for (auto block : graph.GetBlocks())
+    for (auto inst : block->code)
+      for (auto loc : inst->Kill())
+        defs[loc].push_back(inst);
+}
+
+Instruction *Unroller::DefOf(Location *loc) const {
+  auto iter = defs.find(loc);
+  return iter == defs.end() || iter->second.size() != 1 ? NULL
+                                                        : iter->second[0];
+}
+
+bool Unroller::GetConstant(Location *loc, int &value) const {
+  auto constant = dynamic_cast<LoadConstant *>(DefOf(loc));
+  if (constant)
+    value = constant->GetValue();
+  return constant != NULL;
+}
+
+/* The header must be the Label, constants, the test and the IfZ leaving
+ * the loop, so that skipping it for the copies has no other effect.
+ */
+bool Unroller::MatchTest(Loop *loop, CountedLoop &counted) const {
+  auto &code = counted.header->code;
+  auto exit = dynamic_cast<IfZ *>(code.back());
+  if (!exit || counted.header->succ.size() != 2 ||
+      loop->blocks.count(counted.header->succ[1]))
+    return false;
+  for (size_t i = 1; i + 1 < code.size(); i++)
+    if (!dynamic_cast<LoadConstant *>(code[i]) &&
+        !dynamic_cast<BinaryOp *>(code[i]))
+      return false;
+
+  auto test = dynamic_cast<BinaryOp *>(DefOf(exit->GetTest()));
+  counted.inclusive = false;
+  if (test && test->GetCode() == Mips::Or) {
+    auto less = dynamic_cast<BinaryOp *>(DefOf(test->GetOp1()));
+    auto equal = dynamic_cast<BinaryOp *>(DefOf(test->GetOp2()));
+    if (!less || !equal || less->GetCode() != Mips::Less ||
+        equal->GetCode() != Mips::Eq)
+      return false;
+    LocationSet operands = {less->GetOp1(), less->GetOp2()};
+    if (operands != LocationSet{equal->GetOp1(), equal->GetOp2()})
+      return false;
+    test = less;
+    counted.inclusive = true;
+  }
+  if (!test || test->GetCode() != Mips::Less)
+    return false;
+
+  // i < b counts up, b < i counts down
+  counted.up = IsVariant(loop, test->GetOp1());
+  counted.iv = counted.up ? test->GetOp1() : test->GetOp2();
+  counted.bound = counted.up ? test->GetOp2() : test->GetOp1();
+  return IsVariant(loop, counted.iv) && !IsVariant(loop, counted.bound) &&
+         counted.iv->GetSegment() == fpRelative &&
+         counted.bound->GetSegment() == fpRelative;
+}
+
+// Whether loc may change from one iteration to the next.
+bool Unroller::IsVariant(Loop *loop, Location *loc) const {
+  int value;
+  if (GetConstant(loc, value))
+    return false;
+  for (auto block : loop->blocks)
+    for (auto inst : block->code)
+      if (inst->Kill().count(loc))
+        return true;
+  return false;
+}
+
+/* i must have one def in the loop, i = t at the end of the latch, with
+ * t = i + c or i - c. The guard counts on one step of c per iteration,
+ * so a loop that also assigns i in its body is left alone.
+ */
+bool Unroller::MatchUpdate(Loop *loop, CountedLoop &counted) const {
+  auto iv = counted.iv;
+  Instruction *def = NULL;
+  int count = 0;
+  for (auto block : loop->blocks)
+    for (auto inst : block->code)
+      if (inst->Kill().count(iv)) {
+        def = inst;
+        count++;
+      }
+  auto update = dynamic_cast<Assign *>(def);
+  if (count != 1 || !update ||
+      std::find(counted.latch->code.begin(), counted.latch->code.end(),
+                update) == counted.latch->code.end())
+    return false;
+
+  auto &code = counted.latch->code;
+  auto pos = std::find(code.begin(), code.end(), update);
+  auto sum = dynamic_cast<BinaryOp *>(DefOf(update->GetSrc()));
+  if (!sum || std::find(code.begin(), pos, sum) == pos)
+    return false;
+  for (auto iter = std::find(code.begin(), pos, sum) + 1; iter != pos; ++iter)
+    if ((*iter)->Kill().count(iv))
+      return false;
+
+  auto op1 = sum->GetOp1(), op2 = sum->GetOp2();
+  if (sum->GetCode() == Mips::Add && op2 == iv)
+    std::swap(op1, op2);
+  if (op1 != iv || !GetConstant(op2, counted.step))
+    return false;
+  if (sum->GetCode() == Mips::Sub)
+    counted.step = -counted.step;
+  else if (sum->GetCode() != Mips::Add)
+    return false;
+  return counted.up ? counted.step > 0 : counted.step < 0;
+}
+
+bool Unroller::Match(Loop *loop, CountedLoop &counted) const {
+  if (!loop->IsReducible() || !loop->children.empty())
+    return false;
+  counted.header = loop->headers[0];
+
+  // one backward Goto, the last block of the body
+  auto &blocks = graph.GetBlocks();
+  int h = std::find(blocks.begin(), blocks.end(), counted.header) -
+          blocks.begin();
+  int l = -1;
+  for (auto pred : counted.header->pred)
+    if (loop->blocks.count(pred)) {
+      if (l >= 0 || !dynamic_cast<Goto *>(pred->GetBranch()))
+        return false;
+      l = std::find(blocks.begin(), blocks.end(), pred) - blocks.begin();
+    }
+  if (l <= h)
+    return false;
+  counted.latch = blocks[l];
+
+  // the body may hold blocks outside the loop that end it, like the
+  // error paths of bounds checks, but is entered only through the header
+  counted.body.assign(blocks.begin() + h + 1, blocks.begin() + l + 1);
+  for (int i = 0; i < (int)blocks.size(); i++) {
+    bool inside = i > h && i <= l;
+    if (inside && !loop->blocks.count(blocks[i]) && !blocks[i]->succ.empty())
+      return false;
+    if (!inside && i != h && loop->blocks.count(blocks[i]))
+      return false;
+    for (auto succ : blocks[i]->succ) {
+      int j = std::find(blocks.begin(), blocks.end(), succ) - blocks.begin();
+      if (!inside && i != h && j > h && j <= l)
+        return false;
+    }
+  }
+  if (counted.body.front() != counted.header->succ[0])
+    return false;
+
+  return MatchTest(loop, counted) && MatchUpdate(loop, counted);
+}
+
+void Unroller::Unroll(Loop *loop, const CountedLoop &counted, int factor,
+                      bool full) {
+  auto fn = graph.GetBeginFunc();
+  auto header = counted.header;
+  auto target = header->GetLabel();
+
+  // the guard: k iterations are due while i < b - (k - 1) * c (+ 1 for <=)
+  auto pre = graph.InsertPreheader(loop, codeGen.NewLabel());
+  auto limit = codeGen.GenFrameVar(fn, "_unroll");
+  int adjust = -(factor - 1) * counted.step +
+               (counted.inclusive ? (counted.up ? 1 : -1) : 0);
+  int value;
+  if (GetConstant(counted.bound, value))
+    pre->code.push_back(new LoadConstant(limit, value + adjust));
+  else {
+    auto constant = codeGen.GenFrameVar(fn, "_unroll");
+    pre->code.push_back(new LoadConstant(constant, adjust));
+    pre->code.push_back(
+        new BinaryOp(Mips::Add, limit, counted.bound, constant));
+  }
+
+  auto guard = new BasicBlock(0);
+  auto top = codeGen.NewLabel();
+  auto due = codeGen.GenFrameVar(fn, "_unroll");
+  guard->code.push_back(new Label(top));
+  guard->code.push_back(
+      counted.up ? new BinaryOp(Mips::Less, due, counted.iv, limit)
+                 : new BinaryOp(Mips::Less, due, limit, counted.iv));
+  guard->code.push_back(new IfZ(due, target));
+  graph.InsertBefore(guard, header);
+
+  for (int k = 0; k < factor; k++) {
+    Renaming r;
+    for (auto block : counted.body)
+      if (auto label = block->GetLabel())
+        r.labels[label] = codeGen.NewLabel();
+    for (auto block : counted.body) {
+      auto copy = new BasicBlock(0);
+      for (auto inst : block->code)
+        if (inst != counted.latch->code.back())
+          copy->code.push_back(inst->Rewrite(r));
+      if (!copy->code.empty())
+        graph.InsertBefore(copy, header);
+    }
+  }
+  if (!full) {
+    auto back = new BasicBlock(0);
+    back->code.push_back(new Goto(top));
+    graph.InsertBefore(back, header);
+  }
+  graph.Update();
+
+  int trips = codeGen.GetTripCount(target);
+  codeGen.SetTripCount(top, trips >= 0 ? trips / factor : -1);
+  codeGen.SetTripCount(target, trips >= 0 ? trips % factor : factor - 1);
+}
+
+} // namespace
+
+void CodeGenerator::UnrollLoops() {
+  if (!GetIntOption("unroll", 1))
+    return;
+  int factor = GetIntOption("unroll-factor", 4);
+  int maxFull = GetIntOption("unroll-full", 16);
+  int budget = GetIntOption("unroll-budget", 200);
+  int growth = GetIntOption("unroll-growth", 50);
+
+  auto result = new List<Instruction *>;
+  for (int begin = 0; begin < code->NumElements(); begin++) {
+    if (!dynamic_cast<BeginFunc *>(code->Nth(begin))) {
+      result->Append(code->Nth(begin));
+      continue;
+    }
+    auto entry = dynamic_cast<Label *>(code->Nth(begin - 1));
+    std::vector<Instruction *> body;
+    for (; !dynamic_cast<EndFunc *>(code->Nth(begin)); begin++)
+      body.push_back(code->Nth(begin));
+    body.push_back(code->Nth(begin));
+
+    FlowGraph graph(body);
+    graph.ComputeLoops();
+    auto loops = graph.GetLoops();
+    int room = std::max<int>(budget, body.size() * growth / 100);
+    for (auto loop : loops) {
+      Unroller unroller(*this, graph);
+      CountedLoop counted;
+      if (!unroller.Match(loop, counted))
+        continue;
+      int size = 0;
+      bool calls = false;
+      for (auto block : counted.body) {
+        size += block->code.size();
+        if (loop->blocks.count(block))
+          for (auto inst : block->code)
+            calls |= dynamic_cast<LCall *>(inst) || dynamic_cast<ACall *>(inst);
+      }
+
+      int trips = GetTripCount(counted.header->GetLabel());
+      int most = std::min(budget, room);
+      bool full = trips > 1 && trips <= maxFull && trips * size <= most;
+      int k = full ? trips : std::min(factor, most / std::max(size, 1));
+      if (k < 2 || (calls && !full))
+        continue;
+      room -= k * size;
+      if (IsDebugOn("unroll"))
+        fprintf(stderr, "unroll: %s: loop %s %s by %d\n", entry->GetLabel(),
+                counted.header->GetLabel(), full ? "fully" : "unrolled", k);
+      unroller.Unroll(loop, counted, k, full);
+    }
+
+    for (auto inst : graph.Flatten())
+      result->Append(inst);
+  }
+  std::swap(code, result);
+  delete result;
+
+  CollectLabels();
+}
@@ -8,8 +8,11 @@
 #include <stdarg.h>
 #include <string.h>
 #include "list.h"
+#include <map>
+#include <string>
 
 static List<const char*> debugKeys;
+static std::map<std::string, std::string> options;
 static const int BufferSize = 2048;
 
 void Failure(const char *format, ...)
@@ -66,17 +69,47 @@ void PrintDebug(const char *key, const char *format, ...)
 }
 
 
+void SetOption(const char *name, const char *value)
+{
+  options[name] = value;
+}
+
+const char *GetOption(const char *name)
+{
+  auto iter = options.find(name);
+  return iter == options.end() ? NULL : iter->second.c_str();
+}
+
+int GetIntOption(const char *name, int defaultValue)
+{
+  const char *value = GetOption(name);
+  return value ? atoi(value) : defaultValue;
+}
+
+
 void ParseCommandLine(int argc, char *argv[])
 {
-  if (argc == 1)
-    return;
-  
-  if (strcmp(argv[1], "-d") != 0) { // first arg is not -d
-    printf("Usage:   -d <debug-key-1> <debug-key-2> ... \n");
-    exit(2);
+  bool debug = false;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "-f", 2) && arg[2]) {
+      std::string name = arg + 2;
+      size_t eq = name.find('=');
+      if (eq != std::string::npos)
+        SetOption(name.substr(0, eq).c_str(), name.c_str() + eq + 1);
+      else if (!name.compare(0, 3, "no-"))
+        SetOption(name.c_str() + 3, "0");
+      else
+        SetOption(name.c_str(), "1");
+      debug = false;
+    } else if (!strcmp(arg, "-d"))
+      debug = true;
+    else if (debug)
+      SetDebugForKey(arg, true);
+    else {
+      printf("Usage:   [-f<option>[=value] ...] [-d <debug-key-1> <debug-key-2> ...]\n");
+      exit(2);
+    }
   }
-
-  for (int i = 2; i < argc; i++)
-    SetDebugForKey(argv[i], true);
 }
 
@@ -72,11 +72,34 @@ bool IsDebugOn(const char *key);
 
 
 
+/* Function: SetOption()
+ * Usage: SetOption("inline-budget", "40");
+ * ----------------------------------------
+ * Record the value of a compiler option. Options tune the optimizer
+ * and are given on the command line as -f<name>=<value>; a bare
+ * -f<name> sets the value "1" and -fno-<name> sets "0".
+ */
+void SetOption(const char *name, const char *value);
+
+
+/* Function: GetOption()
+ * Usage: const char *file = GetOption("profile-use");
+ * ---------------------------------------------------
+ * Return the value of an option, or NULL if it was never set.
+ * GetIntOption() is a cover for numeric options that returns the given
+ * default when the option is not set.
+ */
+const char *GetOption(const char *name);
+int GetIntOption(const char *name, int defaultValue);
+
+
+
 /* Function: ParseCommandLine
  * --------------------------
- * Turn on the debugging flags from the command line.  Verifies that
- * first argument is -d, and then interpret all the arguments that follow
- * as being flags to turn on.
+ * Turn on the debugging flags and options from the command line. Every
+ * argument of the form -f<option> sets an option, and a -d argument
+ * interprets all the arguments that follow (up to the next option) as
+ * debug flags to turn on.
  */
 void ParseCommandLine(int argc, char *argv[]);
      
@@ -0,0 +1,2393 @@
+/* A Bison parser, made by GNU Bison 3.8.2.  */
+
+/* Bison implementation for Yacc-like parsers in C
+
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* As a special exception, you may create a larger work that contains
+   part or all of the Bison parser skeleton and distribute that work
+   under terms of your choice, so long as that work isn't itself a
+   parser generator using the skeleton or a modified version thereof
+   as a parser skeleton.  Alternatively, if you modify or redistribute
+   the parser skeleton itself, you may (at your option) remove this
+   special exception, which will cause the skeleton and the resulting
+   Bison output files to be licensed under the GNU General Public
+   License without this special exception.
+
+   This special exception was added by the Free Software Foundation in
+   version 2.2 of Bison.  */
+
+/* C LALR(1) parser skeleton written by Richard Stallman, by
+   simplifying the original so-called "semantic" parser.  */
+
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
+/* All symbols defined below should begin with yy or YY, to avoid
+   infringing on user name space.  This should be done even for local
+   variables, as they might otherwise be expanded by user macros.
+   There are some unavoidable exceptions within include files to
+   define necessary library symbols; they are noted "INFRINGES ON
+   USER NAME SPACE" below.  */
+
+/* Identify Bison output, and Bison version.  */
+#define YYBISON 30802
+
+/* Bison version string.  */
+#define YYBISON_VERSION "3.8.2"
+
+/* Skeleton name.  */
+#define YYSKELETON_NAME "yacc.c"
+
+/* Pure parsers.  */
+#define YYPURE 0
+
+/* Push parsers.  */
+#define YYPUSH 0
+
+/* Pull parsers.  */
+#define YYPULL 1
+
+
+
+
+/* First part of user prologue.  */
+#line 6 "parser.y"
+
+
+#include "scanner.h" // for yylex
+#include "parser.h"
+#include "errors.h"
+
+void yyerror(const char *msg); // standard error-handling routine
+
+
+#line 81 "y.tab.c"
+
+# ifndef YY_CAST
+#  ifdef __cplusplus
+#   define YY_CAST(Type, Val) static_cast<Type> (Val)
+#   define YY_REINTERPRET_CAST(Type, Val) reinterpret_cast<Type> (Val)
+#  else
+#   define YY_CAST(Type, Val) ((Type) (Val))
+#   define YY_REINTERPRET_CAST(Type, Val) ((Type) (Val))
+#  endif
+# endif
+# ifndef YY_NULLPTR
+#  if defined __cplusplus
+#   if 201103L <= __cplusplus
+#    define YY_NULLPTR nullptr
+#   else
+#    define YY_NULLPTR 0
+#   endif
+#  else
+#   define YY_NULLPTR ((void*)0)
+#  endif
+# endif
+
+/* Use api.header.include to #include this header
+   instead of duplicating it here.  */
+#ifndef YY_YY_Y_TAB_H_INCLUDED
+# define YY_YY_Y_TAB_H_INCLUDED
+/* Debug traces.  */
+#ifndef YYDEBUG
+# define YYDEBUG 1
+#endif
+#if YYDEBUG
+extern int yydebug;
+#endif
+
+/* Token kinds.  */
+#ifndef YYTOKENTYPE
+# define YYTOKENTYPE
+  enum yytokentype
+  {
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    T_Void = 258,                  /* T_Void  */
+    T_Bool = 259,                  /* T_Bool  */
+    T_Int = 260,                   /* T_Int  */
+    T_Double = 261,                /* T_Double  */
+    T_String = 262,                /* T_String  */
+    T_Class = 263,                 /* T_Class  */
+    T_LessEqual = 264,             /* T_LessEqual  */
+    T_GreaterEqual = 265,          /* T_GreaterEqual  */
+    T_Equal = 266,                 /* T_Equal  */
+    T_NotEqual = 267,              /* T_NotEqual  */
+    T_Dims = 268,                  /* T_Dims  */
+    T_And = 269,                   /* T_And  */
+    T_Or = 270,                    /* T_Or  */
+    T_Null = 271,                  /* T_Null  */
+    T_Extends = 272,               /* T_Extends  */
+    T_This = 273,                  /* T_This  */
+    T_Interface = 274,             /* T_Interface  */
+    T_Implements = 275,            /* T_Implements  */
+    T_While = 276,                 /* T_While  */
+    T_For = 277,                   /* T_For  */
+    T_If = 278,                    /* T_If  */
+    T_Else = 279,                  /* T_Else  */
+    T_Return = 280,                /* T_Return  */
+    T_Break = 281,                 /* T_Break  */
+    T_New = 282,                   /* T_New  */
+    T_NewArray = 283,              /* T_NewArray  */
+    T_Print = 284,                 /* T_Print  */
+    T_ReadInteger = 285,           /* T_ReadInteger  */
+    T_ReadLine = 286,              /* T_ReadLine  */
+    T_Delete = 287,                /* T_Delete  */
+    T_Identifier = 288,            /* T_Identifier  */
+    T_StringConstant = 289,        /* T_StringConstant  */
+    T_IntConstant = 290,           /* T_IntConstant  */
+    T_DoubleConstant = 291,        /* T_DoubleConstant  */
+    T_BoolConstant = 292,          /* T_BoolConstant  */
+    T_UnaryMinus = 293,            /* T_UnaryMinus  */
+    T_Lower_Than_Else = 294        /* T_Lower_Than_Else  */
+  };
+  typedef enum yytokentype yytoken_kind_t;
+#endif
+/* Token kinds.  */
+#define YYEMPTY -2
+#define YYEOF 0
+#define YYerror 256
+#define YYUNDEF 257
+#define T_Void 258
+#define T_Bool 259
+#define T_Int 260
+#define T_Double 261
+#define T_String 262
+#define T_Class 263
+#define T_LessEqual 264
+#define T_GreaterEqual 265
+#define T_Equal 266
+#define T_NotEqual 267
+#define T_Dims 268
+#define T_And 269
+#define T_Or 270
+#define T_Null 271
+#define T_Extends 272
+#define T_This 273
+#define T_Interface 274
+#define T_Implements 275
+#define T_While 276
+#define T_For 277
+#define T_If 278
+#define T_Else 279
+#define T_Return 280
+#define T_Break 281
+#define T_New 282
+#define T_NewArray 283
+#define T_Print 284
+#define T_ReadInteger 285
+#define T_ReadLine 286
+#define T_Delete 287
+#define T_Identifier 288
+#define T_StringConstant 289
+#define T_IntConstant 290
+#define T_DoubleConstant 291
+#define T_BoolConstant 292
+#define T_UnaryMinus 293
+#define T_Lower_Than_Else 294
+
+/* Value type.  */
+#if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
+union YYSTYPE
+{
+#line 20 "parser.y"
+
+    int integerConstant;
+    bool boolConstant;
+    char *stringConstant;
+    double doubleConstant;
+    char identifier[MaxIdentLen+1]; // +1 for terminating null
+    Decl *decl;
+    List<Decl*> *declList;
+    Type *type;
+    NamedType *cType;
+    List<NamedType*> *cTypeList;
+    FnDecl *fDecl;
+    List<FnDecl*> *fDeclList;
+    VarDecl *var;
+    List<VarDecl*> *varList;
+    Expr *expr;
+    List<Expr*> *exprList;
+    Stmt *stmt;
+    List<Stmt*> *stmtList;
+    LValue *lvalue;
+
+#line 234 "y.tab.c"
+
+};
+typedef union YYSTYPE YYSTYPE;
+# define YYSTYPE_IS_TRIVIAL 1
+# define YYSTYPE_IS_DECLARED 1
+#endif
+
+/* Location type.  */
+#if ! defined YYLTYPE && ! defined YYLTYPE_IS_DECLARED
+typedef struct YYLTYPE YYLTYPE;
+struct YYLTYPE
+{
+  int first_line;
+  int first_column;
+  int last_line;
+  int last_column;
+};
+# define YYLTYPE_IS_DECLARED 1
+# define YYLTYPE_IS_TRIVIAL 1
+#endif
+
+
+extern YYSTYPE yylval;
+extern YYLTYPE yylloc;
+
+int yyparse (void);
+
+
+#endif /* !YY_YY_Y_TAB_H_INCLUDED  */
+/* Symbol kind.  */
+enum yysymbol_kind_t
+{
+  YYSYMBOL_YYEMPTY = -2,
+  YYSYMBOL_YYEOF = 0,                      /* "end of file"  */
+  YYSYMBOL_YYerror = 1,                    /* error  */
+  YYSYMBOL_YYUNDEF = 2,                    /* "invalid token"  */
+  YYSYMBOL_T_Void = 3,                     /* T_Void  */
+  YYSYMBOL_T_Bool = 4,                     /* T_Bool  */
+  YYSYMBOL_T_Int = 5,                      /* T_Int  */
+  YYSYMBOL_T_Double = 6,                   /* T_Double  */
+  YYSYMBOL_T_String = 7,                   /* T_String  */
+  YYSYMBOL_T_Class = 8,                    /* T_Class  */
+  YYSYMBOL_T_LessEqual = 9,                /* T_LessEqual  */
+  YYSYMBOL_T_GreaterEqual = 10,            /* T_GreaterEqual  */
+  YYSYMBOL_T_Equal = 11,                   /* T_Equal  */
+  YYSYMBOL_T_NotEqual = 12,                /* T_NotEqual  */
+  YYSYMBOL_T_Dims = 13,                    /* T_Dims  */
+  YYSYMBOL_T_And = 14,                     /* T_And  */
+  YYSYMBOL_T_Or = 15,                      /* T_Or  */
+  YYSYMBOL_T_Null = 16,                    /* T_Null  */
+  YYSYMBOL_T_Extends = 17,                 /* T_Extends  */
+  YYSYMBOL_T_This = 18,                    /* T_This  */
+  YYSYMBOL_T_Interface = 19,               /* T_Interface  */
+  YYSYMBOL_T_Implements = 20,              /* T_Implements  */
+  YYSYMBOL_T_While = 21,                   /* T_While  */
+  YYSYMBOL_T_For = 22,                     /* T_For  */
+  YYSYMBOL_T_If = 23,                      /* T_If  */
+  YYSYMBOL_T_Else = 24,                    /* T_Else  */
+  YYSYMBOL_T_Return = 25,                  /* T_Return  */
+  YYSYMBOL_T_Break = 26,                   /* T_Break  */
+  YYSYMBOL_T_New = 27,                     /* T_New  */
+  YYSYMBOL_T_NewArray = 28,                /* T_NewArray  */
+  YYSYMBOL_T_Print = 29,                   /* T_Print  */
+  YYSYMBOL_T_ReadInteger = 30,             /* T_ReadInteger  */
+  YYSYMBOL_T_ReadLine = 31,                /* T_ReadLine  */
+  YYSYMBOL_T_Delete = 32,                  /* T_Delete  */
+  YYSYMBOL_T_Identifier = 33,              /* T_Identifier  */
+  YYSYMBOL_T_StringConstant = 34,          /* T_StringConstant  */
+  YYSYMBOL_T_IntConstant = 35,             /* T_IntConstant  */
+  YYSYMBOL_T_DoubleConstant = 36,          /* T_DoubleConstant  */
+  YYSYMBOL_T_BoolConstant = 37,            /* T_BoolConstant  */
+  YYSYMBOL_38_ = 38,                       /* '='  */
+  YYSYMBOL_39_ = 39,                       /* '<'  */
+  YYSYMBOL_40_ = 40,                       /* '>'  */
+  YYSYMBOL_41_ = 41,                       /* '+'  */
+  YYSYMBOL_42_ = 42,                       /* '-'  */
+  YYSYMBOL_43_ = 43,                       /* '*'  */
+  YYSYMBOL_44_ = 44,                       /* '/'  */
+  YYSYMBOL_45_ = 45,                       /* '%'  */
+  YYSYMBOL_T_UnaryMinus = 46,              /* T_UnaryMinus  */
+  YYSYMBOL_47_ = 47,                       /* '!'  */
+  YYSYMBOL_48_ = 48,                       /* '.'  */
+  YYSYMBOL_49_ = 49,                       /* '['  */
+  YYSYMBOL_T_Lower_Than_Else = 50,         /* T_Lower_Than_Else  */
+  YYSYMBOL_51_ = 51,                       /* ';'  */
+  YYSYMBOL_52_ = 52,                       /* '{'  */
+  YYSYMBOL_53_ = 53,                       /* '}'  */
+  YYSYMBOL_54_ = 54,                       /* ','  */
+  YYSYMBOL_55_ = 55,                       /* '('  */
+  YYSYMBOL_56_ = 56,                       /* ')'  */
+  YYSYMBOL_57_ = 57,                       /* ']'  */
+  YYSYMBOL_YYACCEPT = 58,                  /* $accept  */
+  YYSYMBOL_Program = 59,                   /* Program  */
+  YYSYMBOL_DeclList = 60,                  /* DeclList  */
+  YYSYMBOL_Decl = 61,                      /* Decl  */
+  YYSYMBOL_VarDecl = 62,                   /* VarDecl  */
+  YYSYMBOL_Variable = 63,                  /* Variable  */
+  YYSYMBOL_Type = 64,                      /* Type  */
+  YYSYMBOL_IntfDecl = 65,                  /* IntfDecl  */
+  YYSYMBOL_IntfList = 66,                  /* IntfList  */
+  YYSYMBOL_ClassDecl = 67,                 /* ClassDecl  */
+  YYSYMBOL_OptExt = 68,                    /* OptExt  */
+  YYSYMBOL_OptImpl = 69,                   /* OptImpl  */
+  YYSYMBOL_ImpList = 70,                   /* ImpList  */
+  YYSYMBOL_FieldList = 71,                 /* FieldList  */
+  YYSYMBOL_Field = 72,                     /* Field  */
+  YYSYMBOL_FnHeader = 73,                  /* FnHeader  */
+  YYSYMBOL_Formals = 74,                   /* Formals  */
+  YYSYMBOL_FormalList = 75,                /* FormalList  */
+  YYSYMBOL_FnDecl = 76,                    /* FnDecl  */
+  YYSYMBOL_StmtBlock = 77,                 /* StmtBlock  */
+  YYSYMBOL_VarDecls = 78,                  /* VarDecls  */
+  YYSYMBOL_StmtList = 79,                  /* StmtList  */
+  YYSYMBOL_Stmt = 80,                      /* Stmt  */
+  YYSYMBOL_LValue = 81,                    /* LValue  */
+  YYSYMBOL_Call = 82,                      /* Call  */
+  YYSYMBOL_OptExpr = 83,                   /* OptExpr  */
+  YYSYMBOL_Expr = 84,                      /* Expr  */
+  YYSYMBOL_Constant = 85,                  /* Constant  */
+  YYSYMBOL_Actuals = 86,                   /* Actuals  */
+  YYSYMBOL_ExprList = 87,                  /* ExprList  */
+  YYSYMBOL_OptElse = 88                    /* OptElse  */
+};
+typedef enum yysymbol_kind_t yysymbol_kind_t;
+
+
+
+
+#ifdef short
+# undef short
+#endif
+
+/* On compilers that do not define __PTRDIFF_MAX__ etc., make sure
+   <limits.h> and (if available) <stdint.h> are included
+   so that the code can choose integer types of a good width.  */
+
+#ifndef __PTRDIFF_MAX__
+# include <limits.h> /* INFRINGES ON USER NAME SPACE */
+# if defined __STDC_VERSION__ && 199901 <= __STDC_VERSION__
+#  include <stdint.h> /* INFRINGES ON USER NAME SPACE */
+#  define YY_STDINT_H
+# endif
+#endif
+
+/* Narrow types that promote to a signed type and that can represent a
+   signed or unsigned integer of at least N bits.  In tables they can
+   save space and decrease cache pressure.  Promoting to a signed type
+   helps avoid bugs in integer arithmetic.  */
+
+#ifdef __INT_LEAST8_MAX__
+typedef __INT_LEAST8_TYPE__ yytype_int8;
+#elif defined YY_STDINT_H
+typedef int_least8_t yytype_int8;
+#else
+typedef signed char yytype_int8;
+#endif
+
+#ifdef __INT_LEAST16_MAX__
+typedef __INT_LEAST16_TYPE__ yytype_int16;
+#elif defined YY_STDINT_H
+typedef int_least16_t yytype_int16;
+#else
+typedef short yytype_int16;
+#endif
+
+/* Work around bug in HP-UX 11.23, which defines these macros
+   incorrectly for preprocessor constants.  This workaround can likely
+   be removed in 2023, as HPE has promised support for HP-UX 11.23
+   (aka HP-UX 11i v2) only through the end of 2022; see Table 2 of
+   <https://h20195.www2.hpe.com/V2/getpdf.aspx/4AA4-7673ENW.pdf>.  */
+#ifdef __hpux
+# undef UINT_LEAST8_MAX
+# undef UINT_LEAST16_MAX
+# define UINT_LEAST8_MAX 255
+# define UINT_LEAST16_MAX 65535
+#endif
+
+#if defined __UINT_LEAST8_MAX__ && __UINT_LEAST8_MAX__ <= __INT_MAX__
+typedef __UINT_LEAST8_TYPE__ yytype_uint8;
+#elif (!defined __UINT_LEAST8_MAX__ && defined YY_STDINT_H \
+       && UINT_LEAST8_MAX <= INT_MAX)
+typedef uint_least8_t yytype_uint8;
+#elif !defined __UINT_LEAST8_MAX__ && UCHAR_MAX <= INT_MAX
+typedef unsigned char yytype_uint8;
+#else
+typedef short yytype_uint8;
+#endif
+
+#if defined __UINT_LEAST16_MAX__ && __UINT_LEAST16_MAX__ <= __INT_MAX__
+typedef __UINT_LEAST16_TYPE__ yytype_uint16;
+#elif (!defined __UINT_LEAST16_MAX__ && defined YY_STDINT_H \
+       && UINT_LEAST16_MAX <= INT_MAX)
+typedef uint_least16_t yytype_uint16;
+#elif !defined __UINT_LEAST16_MAX__ && USHRT_MAX <= INT_MAX
+typedef unsigned short yytype_uint16;
+#else
+typedef int yytype_uint16;
+#endif
+
+#ifndef YYPTRDIFF_T
+# if defined __PTRDIFF_TYPE__ && defined __PTRDIFF_MAX__
+#  define YYPTRDIFF_T __PTRDIFF_TYPE__
+#  define YYPTRDIFF_MAXIMUM __PTRDIFF_MAX__
+# elif defined PTRDIFF_MAX
+#  ifndef ptrdiff_t
+#   include <stddef.h> /* INFRINGES ON USER NAME SPACE */
+#  endif
+#  define YYPTRDIFF_T ptrdiff_t
+#  define YYPTRDIFF_MAXIMUM PTRDIFF_MAX
+# else
+#  define YYPTRDIFF_T long
+#  define YYPTRDIFF_MAXIMUM LONG_MAX
+# endif
+#endif
+
+#ifndef YYSIZE_T
+# ifdef __SIZE_TYPE__
+#  define YYSIZE_T __SIZE_TYPE__
+# elif defined size_t
+#  define YYSIZE_T size_t
+# elif defined __STDC_VERSION__ && 199901 <= __STDC_VERSION__
+#  include <stddef.h> /* INFRINGES ON USER NAME SPACE */
+#  define YYSIZE_T size_t
+# else
+#  define YYSIZE_T unsigned
+# endif
+#endif
+
+#define YYSIZE_MAXIMUM                                  \
+  YY_CAST (YYPTRDIFF_T,                                 \
+           (YYPTRDIFF_MAXIMUM < YY_CAST (YYSIZE_T, -1)  \
+            ? YYPTRDIFF_MAXIMUM                         \
+            : YY_CAST (YYSIZE_T, -1)))
+
+#define YYSIZEOF(X) YY_CAST (YYPTRDIFF_T, sizeof (X))
+
+
+/* Stored state numbers (used for stacks). */
+typedef yytype_uint8 yy_state_t;
+
+/* State numbers in computations.  */
+typedef int yy_state_fast_t;
+
+#ifndef YY_
+# if defined YYENABLE_NLS && YYENABLE_NLS
+#  if ENABLE_NLS
+#   include <libintl.h> /* INFRINGES ON USER NAME SPACE */
+#   define YY_(Msgid) dgettext ("bison-runtime", Msgid)
+#  endif
+# endif
+# ifndef YY_
+#  define YY_(Msgid) Msgid
+# endif
+#endif
+
+
+#ifndef YY_ATTRIBUTE_PURE
+# if defined __GNUC__ && 2 < __GNUC__ + (96 <= __GNUC_MINOR__)
+#  define YY_ATTRIBUTE_PURE __attribute__ ((__pure__))
+# else
+#  define YY_ATTRIBUTE_PURE
+# endif
+#endif
+
+#ifndef YY_ATTRIBUTE_UNUSED
+# if defined __GNUC__ && 2 < __GNUC__ + (7 <= __GNUC_MINOR__)
+#  define YY_ATTRIBUTE_UNUSED __attribute__ ((__unused__))
+# else
+#  define YY_ATTRIBUTE_UNUSED
+# endif
+#endif
+
+/* Suppress unused-variable warnings by "using" E.  */
+#if ! defined lint || defined __GNUC__
+# define YY_USE(E) ((void) (E))
+#else
+# define YY_USE(E) /* empty */
+#endif
+
+/* Suppress an incorrect diagnostic about yylval being uninitialized.  */
+#if defined __GNUC__ && ! defined __ICC && 406 <= __GNUC__ * 100 + __GNUC_MINOR__
+# if __GNUC__ * 100 + __GNUC_MINOR__ < 407
+#  define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                           \
+    _Pragma ("GCC diagnostic push")                                     \
+    _Pragma ("GCC diagnostic ignored \"-Wuninitialized\"")
+# else
+#  define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                           \
+    _Pragma ("GCC diagnostic push")                                     \
+    _Pragma ("GCC diagnostic ignored \"-Wuninitialized\"")              \
+    _Pragma ("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+# endif
+# define YY_IGNORE_MAYBE_UNINITIALIZED_END      \
+    _Pragma ("GCC diagnostic pop")
+#else
+# define YY_INITIAL_VALUE(Value) Value
+#endif
+#ifndef YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+# define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+# define YY_IGNORE_MAYBE_UNINITIALIZED_END
+#endif
+#ifndef YY_INITIAL_VALUE
+# define YY_INITIAL_VALUE(Value) /* Nothing. */
+#endif
+
+#if defined __cplusplus && defined __GNUC__ && ! defined __ICC && 6 <= __GNUC__
+# define YY_IGNORE_USELESS_CAST_BEGIN                          \
+    _Pragma ("GCC diagnostic push")                            \
+    _Pragma ("GCC diagnostic ignored \"-Wuseless-cast\"")
+# define YY_IGNORE_USELESS_CAST_END            \
+    _Pragma ("GCC diagnostic pop")
+#endif
+#ifndef YY_IGNORE_USELESS_CAST_BEGIN
+# define YY_IGNORE_USELESS_CAST_BEGIN
+# define YY_IGNORE_USELESS_CAST_END
+#endif
+
+
+#define YY_ASSERT(E) ((void) (0 && (E)))
+
+#if !defined yyoverflow
+
+/* The parser invokes alloca or malloc; define the necessary symbols.  */
+
+# ifdef YYSTACK_USE_ALLOCA
+#  if YYSTACK_USE_ALLOCA
+#   ifdef __GNUC__
+#    define YYSTACK_ALLOC __builtin_alloca
+#   elif defined __BUILTIN_VA_ARG_INCR
+#    include <alloca.h> /* INFRINGES ON USER NAME SPACE */
+#   elif defined _AIX
+#    define YYSTACK_ALLOC __alloca
+#   elif defined _MSC_VER
+#    include <malloc.h> /* INFRINGES ON USER NAME SPACE */
+#    define alloca _alloca
+#   else
+#    define YYSTACK_ALLOC alloca
+#    if ! defined _ALLOCA_H && ! defined EXIT_SUCCESS
+#     include <stdlib.h> /* INFRINGES ON USER NAME SPACE */
+      /* Use EXIT_SUCCESS as a witness for stdlib.h.  */
+#     ifndef EXIT_SUCCESS
+#      define EXIT_SUCCESS 0
+#     endif
+#    endif
+#   endif
+#  endif
+# endif
+
+# ifdef YYSTACK_ALLOC
+   /* Pacify GCC's 'empty if-body' warning.  */
+#  define YYSTACK_FREE(Ptr) do { /* empty */; } while (0)
+#  ifndef YYSTACK_ALLOC_MAXIMUM
+    /* The OS might guarantee only one guard page at the bottom of the stack,
+       and a page size can be as small as 4096 bytes.  So we cannot safely
+       invoke alloca (N) if N exceeds 4096.  Use a slightly smaller number
+       to allow for a few compiler-allocated temporary stack slots.  */
+#   define YYSTACK_ALLOC_MAXIMUM 4032 /* reasonable circa 2006 */
+#  endif
+# else
+#  define YYSTACK_ALLOC YYMALLOC
+#  define YYSTACK_FREE YYFREE
+#  ifndef YYSTACK_ALLOC_MAXIMUM
+#   define YYSTACK_ALLOC_MAXIMUM YYSIZE_MAXIMUM
+#  endif
+#  if (defined __cplusplus && ! defined EXIT_SUCCESS \
+       && ! ((defined YYMALLOC || defined malloc) \
+             && (defined YYFREE || defined free)))
+#   include <stdlib.h> /* INFRINGES ON USER NAME SPACE */
+#   ifndef EXIT_SUCCESS
+#    define EXIT_SUCCESS 0
+#   endif
+#  endif
+#  ifndef YYMALLOC
+#   define YYMALLOC malloc
+#   if ! defined malloc && ! defined EXIT_SUCCESS
+void *malloc (YYSIZE_T); /* INFRINGES ON USER NAME SPACE */
+#   endif
+#  endif
+#  ifndef YYFREE
+#   define YYFREE free
+#   if ! defined free && ! defined EXIT_SUCCESS
+void free (void *); /* INFRINGES ON USER NAME SPACE */
+#   endif
+#  endif
+# endif
+#endif /* !defined yyoverflow */
+
+#if (! defined yyoverflow \
+     && (! defined __cplusplus \
+         || (defined YYLTYPE_IS_TRIVIAL && YYLTYPE_IS_TRIVIAL \
+             && defined YYSTYPE_IS_TRIVIAL && YYSTYPE_IS_TRIVIAL)))
+
+/* A type that is properly aligned for any stack member.  */
+union yyalloc
+{
+  yy_state_t yyss_alloc;
+  YYSTYPE yyvs_alloc;
+  YYLTYPE yyls_alloc;
+};
+
+/* The size of the maximum gap between one aligned stack and the next.  */
+# define YYSTACK_GAP_MAXIMUM (YYSIZEOF (union yyalloc) - 1)
+
+/* The size of an array large to enough to hold all stacks, each with
+   N elements.  */
+# define YYSTACK_BYTES(N) \
+     ((N) * (YYSIZEOF (yy_state_t) + YYSIZEOF (YYSTYPE) \
+             + YYSIZEOF (YYLTYPE)) \
+      + 2 * YYSTACK_GAP_MAXIMUM)
+
+# define YYCOPY_NEEDED 1
+
+/* Relocate STACK from its old location to the new one.  The
+   local variables YYSIZE and YYSTACKSIZE give the old and new number of
+   elements in the stack, and YYPTR gives the new location of the
+   stack.  Advance YYPTR to a properly aligned location for the next
+   stack.  */
+# define YYSTACK_RELOCATE(Stack_alloc, Stack)                           \
+    do                                                                  \
+      {                                                                 \
+        YYPTRDIFF_T yynewbytes;                                         \
+        YYCOPY (&yyptr->Stack_alloc, Stack, yysize);                    \
+        Stack = &yyptr->Stack_alloc;                                    \
+        yynewbytes = yystacksize * YYSIZEOF (*Stack) + YYSTACK_GAP_MAXIMUM; \
+        yyptr += yynewbytes / YYSIZEOF (*yyptr);                        \
+      }                                                                 \
+    while (0)
+
+#endif
+
+#if defined YYCOPY_NEEDED && YYCOPY_NEEDED
+/* Copy COUNT objects from SRC to DST.  The source and destination do
+   not overlap.  */
+# ifndef YYCOPY
+#  if defined __GNUC__ && 1 < __GNUC__
+#   define YYCOPY(Dst, Src, Count) \
+      __builtin_memcpy (Dst, Src, YY_CAST (YYSIZE_T, (Count)) * sizeof (*(Src)))
+#  else
+#   define YYCOPY(Dst, Src, Count)              \
+      do                                        \
+        {                                       \
+          YYPTRDIFF_T yyi;                      \
+          for (yyi = 0; yyi < (Count); yyi++)   \
+            (Dst)[yyi] = (Src)[yyi];            \
+        }                                       \
+      while (0)
+#  endif
+# endif
+#endif /* !YYCOPY_NEEDED */
+
+/* YYFINAL -- State number of the termination state.  */
+#define YYFINAL  22
+/* YYLAST -- Last index in YYTABLE.  */
+#define YYLAST   599
+
+/* YYNTOKENS -- Number of terminals.  */
+#define YYNTOKENS  58
+/* YYNNTS -- Number of nonterminals.  */
+#define YYNNTS  31
+/* YYNRULES -- Number of rules.  */
+#define YYNRULES  95
+/* YYNSTATES -- Number of states.  */
+#define YYNSTATES  188
+
+/* YYMAXUTOK -- Last valid token kind.  */
+#define YYMAXUTOK   294
+
+
+/* YYTRANSLATE(TOKEN-NUM) -- Symbol number corresponding to TOKEN-NUM
+   as returned by yylex, with out-of-bounds checking.  */
+#define YYTRANSLATE(YYX)                                \
+  (0 <= (YYX) && (YYX) <= YYMAXUTOK                     \
+   ? YY_CAST (yysymbol_kind_t, yytranslate[YYX])        \
+   : YYSYMBOL_YYUNDEF)
+
+/* YYTRANSLATE[TOKEN-NUM] -- Symbol number corresponding to TOKEN-NUM
+   as returned by yylex.  */
+static const yytype_int8 yytranslate[] =
+{
+       0,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,    47,     2,     2,     2,    45,     2,     2,
+      55,    56,    43,    41,    54,    42,    48,    44,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,    51,
+      39,    38,    40,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,    49,     2,    57,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,    52,     2,    53,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     1,     2,     3,     4,
+       5,     6,     7,     8,     9,    10,    11,    12,    13,    14,
+      15,    16,    17,    18,    19,    20,    21,    22,    23,    24,
+      25,    26,    27,    28,    29,    30,    31,    32,    33,    34,
+      35,    36,    37,    46,    50
+};
+
+#if YYDEBUG
+/* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
+static const yytype_int16 yyrline[] =
+{
+       0,    99,    99,   113,   114,   117,   118,   119,   120,   123,
+     126,   129,   130,   131,   132,   133,   134,   137,   141,   143,
+     146,   150,   152,   155,   157,   160,   162,   165,   166,   169,
+     170,   174,   176,   180,   181,   184,   186,   189,   192,   196,
+     197,   200,   201,   204,   205,   206,   208,   210,   212,   214,
+     216,   218,   220,   223,   224,   225,   228,   230,   234,   235,
+     238,   239,   240,   241,   242,   243,   244,   245,   246,   247,
+     248,   249,   250,   251,   253,   255,   256,   257,   258,   260,
+     261,   263,   264,   266,   268,   271,   272,   273,   274,   275,
+     278,   279,   282,   283,   286,   287
+};
+#endif
+
+/** Accessing symbol of state STATE.  */
+#define YY_ACCESSING_SYMBOL(State) YY_CAST (yysymbol_kind_t, yystos[State])
+
+#if YYDEBUG || 0
+/* The user-facing name of the symbol whose (internal) number is
+   YYSYMBOL.  No bounds checking.  */
+static const char *yysymbol_name (yysymbol_kind_t yysymbol) YY_ATTRIBUTE_UNUSED;
+
+/* YYTNAME[SYMBOL-NUM] -- String name of the symbol SYMBOL-NUM.
+   First, the terminals, then, starting at YYNTOKENS, nonterminals.  */
+static const char *const yytname[] =
+{
+  "\"end of file\"", "error", "\"invalid token\"", "T_Void", "T_Bool",
+  "T_Int", "T_Double", "T_String", "T_Class", "T_LessEqual",
+  "T_GreaterEqual", "T_Equal", "T_NotEqual", "T_Dims", "T_And", "T_Or",
+  "T_Null", "T_Extends", "T_This", "T_Interface", "T_Implements",
+  "T_While", "T_For", "T_If", "T_Else", "T_Return", "T_Break", "T_New",
+  "T_NewArray", "T_Print", "T_ReadInteger", "T_ReadLine", "T_Delete",
+  "T_Identifier", "T_StringConstant", "T_IntConstant", "T_DoubleConstant",
+  "T_BoolConstant", "'='", "'<'", "'>'", "'+'", "'-'", "'*'", "'/'", "'%'",
+  "T_UnaryMinus", "'!'", "'.'", "'['", "T_Lower_Than_Else", "';'", "'{'",
+  "'}'", "','", "'('", "')'", "']'", "$accept", "Program", "DeclList",
+  "Decl", "VarDecl", "Variable", "Type", "IntfDecl", "IntfList",
+  "ClassDecl", "OptExt", "OptImpl", "ImpList", "FieldList", "Field",
+  "FnHeader", "Formals", "FormalList", "FnDecl", "StmtBlock", "VarDecls",
+  "StmtList", "Stmt", "LValue", "Call", "OptExpr", "Expr", "Constant",
+  "Actuals", "ExprList", "OptElse", YY_NULLPTR
+};
+
+static const char *
+yysymbol_name (yysymbol_kind_t yysymbol)
+{
+  return yytname[yysymbol];
+}
+#endif
+
+#define YYPACT_NINF (-144)
+
+#define yypact_value_is_default(Yyn) \
+  ((Yyn) == YYPACT_NINF)
+
+#define YYTABLE_NINF (-60)
+
+#define yytable_value_is_error(Yyn) \
+  ((Yyn) == YYTABLE_NINF)
+
+/* YYPACT[STATE-NUM] -- Index in YYTABLE of the portion describing
+   STATE-NUM.  */
+static const yytype_int16 yypact[] =
+{
+     125,   -15,  -144,  -144,  -144,  -144,    -8,     2,  -144,    33,
+     125,  -144,  -144,   -10,    -1,  -144,  -144,    21,  -144,    -4,
+      35,    22,  -144,  -144,  -144,  -144,    20,  -144,  -144,    77,
+      47,    65,  -144,    77,    72,  -144,    13,    30,    38,  -144,
+      54,    37,     1,    55,  -144,  -144,    57,    60,    61,   514,
+      67,    70,    71,    79,    84,    87,    88,    -2,  -144,  -144,
+    -144,  -144,   544,   544,   544,  -144,  -144,    92,   453,    82,
+    -144,    99,   356,  -144,  -144,  -144,    77,  -144,   103,  -144,
+    -144,    14,   102,  -144,   544,   544,   544,   106,  -144,   300,
+    -144,   129,   544,   544,   107,   116,   544,   544,    -9,    -9,
+     137,  -144,  -144,   544,  -144,   544,   544,   544,   544,   544,
+     544,   544,   544,   544,   544,   544,   544,   544,   140,   544,
+    -144,   151,    17,    20,  -144,   180,   136,   198,  -144,   132,
+     259,   356,   -26,  -144,  -144,   241,   141,   142,  -144,   356,
+     393,   393,   378,   378,   419,   367,   393,   393,   111,   111,
+      -9,    -9,    -9,   143,   126,  -144,  -144,  -144,  -144,  -144,
+     491,   544,   491,  -144,    77,   544,   148,   149,  -144,   544,
+    -144,  -144,   313,   177,    16,   356,  -144,  -144,   146,   544,
+     491,  -144,  -144,  -144,   147,  -144,   491,  -144
+};
+
+/* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
+   Performed when YYTABLE does not specify something else to do.  Zero
+   means the default is an error.  */
+static const yytype_int8 yydefact[] =
+{
+       0,     0,    12,    11,    14,    13,     0,     0,    15,     0,
+       2,     4,     7,     0,     0,     8,     5,     0,     6,     0,
+      22,     0,     1,     3,     9,    16,    10,    40,    37,    34,
+       0,    24,    19,    34,    42,    36,     0,     0,    33,    21,
+       0,     0,     0,     0,    89,    84,     0,     0,     0,     0,
+       0,     0,     0,     0,     0,     0,     0,    53,    88,    85,
+      87,    86,     0,     0,     0,    39,    44,     0,    42,    60,
+      61,     0,    58,    62,    10,    32,     0,    26,    23,    28,
+      17,     0,     0,    31,     0,    59,     0,    53,    49,     0,
+      52,     0,     0,     0,     0,     0,     0,    91,    78,    79,
+       0,    38,    41,     0,    43,     0,     0,     0,     0,     0,
+       0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+      35,     0,     0,     0,    18,     0,     0,     0,    48,     0,
+       0,    93,     0,    80,    81,     0,     0,    90,    77,    63,
+      73,    74,    69,    70,    75,    76,    71,    72,    64,    65,
+      67,    66,    68,    54,     0,    25,    20,    29,    27,    30,
+      59,     0,    59,    82,     0,     0,     0,     0,    56,    91,
+      55,    46,     0,    95,     0,    92,    50,    51,     0,    59,
+      59,    45,    83,    57,     0,    94,    59,    47
+};
+
+/* YYPGOTO[NTERM-NUM].  */
+static const yytype_int16 yypgoto[] =
+{
+    -144,  -144,  -144,   194,   -31,   -20,     0,  -144,  -144,  -144,
+    -144,  -144,  -144,  -144,  -144,   163,   173,  -144,    89,   197,
+    -144,   150,  -143,  -144,  -144,   -83,   -48,  -144,    46,   123,
+    -144
+};
+
+/* YYDEFGOTO[NTERM-NUM].  */
+static const yytype_uint8 yydefgoto[] =
+{
+       0,     9,    10,    11,    12,    13,    36,    15,    42,    16,
+      31,    41,    78,   122,   158,    17,    37,    38,    18,    66,
+      34,    67,    68,    69,    70,    71,    72,    73,   136,   137,
+     181
+};
+
+/* YYTABLE[YYPACT[STATE-NUM]] -- What to do in state STATE-NUM.  If
+   positive, shift that token.  If negative, reduce the rule whose
+   number is the opposite.  If YYTABLE_NINF, syntax error.  */
+static const yytype_int16 yytable[] =
+{
+      14,    89,   126,    65,     1,     2,     3,     4,     5,    35,
+      14,   -15,    25,    35,    98,    99,   100,   171,    19,   173,
+       1,     2,     3,     4,     5,    20,    25,    25,   165,    25,
+     166,   -15,    26,    22,     8,    21,   125,   185,   127,   118,
+     119,    24,    81,   187,   130,   131,    74,   123,   135,   131,
+       8,    29,    30,    97,    80,   139,   120,   140,   141,   142,
+     143,   144,   145,   146,   147,   148,   149,   150,   151,   152,
+     156,   154,   182,    27,    32,    33,     2,     3,     4,     5,
+      39,     2,     3,     4,     5,    40,    75,    77,    44,    79,
+      45,   157,    76,    46,    47,    48,   184,    49,    50,    51,
+      52,    53,    54,    55,    56,    57,    58,    59,    60,    61,
+       8,    83,    84,   172,    62,    85,    86,   175,    90,    63,
+     103,   131,    14,   -59,    27,    91,    92,    64,     1,     2,
+       3,     4,     5,     6,    93,   105,   106,   107,   108,    94,
+     109,   110,    95,    96,     7,   101,   105,   106,   107,   108,
+     104,   109,   110,   124,   115,   116,   117,   121,     8,   118,
+     119,    97,   129,   133,   174,   111,   112,   113,   114,   115,
+     116,   117,   134,   153,   118,   119,   111,   112,   113,   114,
+     115,   116,   117,   170,   155,   118,   119,   161,   163,   105,
+     106,   107,   108,   138,   109,   110,   165,   168,   169,   176,
+     177,   180,   183,   186,    23,    82,    43,   105,   106,   107,
+     108,   159,   109,   110,    28,   178,   132,     0,   102,   111,
+     112,   113,   114,   115,   116,   117,     0,     0,   118,   119,
+       0,     0,     0,     0,     0,     0,   160,   111,   112,   113,
+     114,   115,   116,   117,     0,     0,   118,   119,     0,     0,
+     105,   106,   107,   108,   162,   109,   110,     0,     0,     0,
+       0,     0,     0,     0,     0,     0,     0,     0,   105,   106,
+     107,   108,     0,   109,   110,     0,     0,     0,     0,     0,
+     111,   112,   113,   114,   115,   116,   117,     0,     0,   118,
+     119,     0,     0,     0,     0,     0,     0,   167,   111,   112,
+     113,   114,   115,   116,   117,     0,     0,   118,   119,   105,
+     106,   107,   108,   164,   109,   110,     0,     0,     0,     0,
+       0,     0,   105,   106,   107,   108,     0,   109,   110,     0,
+       0,     0,     0,     0,     0,     0,     0,     0,     0,   111,
+     112,   113,   114,   115,   116,   117,     0,     0,   118,   119,
+       0,   128,   111,   112,   113,   114,   115,   116,   117,     0,
+       0,   118,   119,     0,   179,   105,   106,   107,   108,     0,
+     109,   110,     0,     0,     0,     0,   105,   106,   107,   108,
+       0,   109,     0,     0,     0,     0,     0,   105,   106,   -60,
+     -60,     0,     0,     0,     0,   111,   112,   113,   114,   115,
+     116,   117,   -60,   -60,   118,   119,   111,   112,   113,   114,
+     115,   116,   117,     0,     0,   118,   119,   111,   112,   113,
+     114,   115,   116,   117,     0,     0,   118,   119,   105,   106,
+     107,   108,   -60,   -60,   113,   114,   115,   116,   117,     0,
+       0,   118,   119,     0,     0,     0,     0,     0,     0,     0,
+       0,     0,     0,     0,     0,     0,     0,     0,   111,   112,
+     113,   114,   115,   116,   117,     0,     0,   118,   119,    44,
+       0,    45,     0,     0,    46,    47,    48,     0,    49,    50,
+      51,    52,    53,    54,    55,    56,    87,    58,    59,    60,
+      61,     0,     0,     0,     0,    62,     0,     0,     0,     0,
+      63,     0,     0,     0,   -59,    27,     0,    44,    64,    45,
+       0,     0,    46,    47,    48,     0,    49,    50,    51,    52,
+      53,    54,    55,    56,    87,    58,    59,    60,    61,     0,
+      44,     0,    45,    62,     0,     0,     0,     0,    63,     0,
+       0,    51,    52,    27,    54,    55,    64,    87,    58,    59,
+      60,    61,     0,     0,     0,     0,    62,     0,     0,     0,
+      44,    63,    45,     0,     0,    88,     0,     0,     0,    64,
+       0,    51,    52,     0,    54,    55,     0,    87,    58,    59,
+      60,    61,     0,     0,     0,     0,    62,     0,     0,     0,
+       0,    63,     0,     0,     0,     0,     0,     0,     0,    64
+};
+
+static const yytype_int16 yycheck[] =
+{
+       0,    49,    85,    34,     3,     4,     5,     6,     7,    29,
+      10,    13,    13,    33,    62,    63,    64,   160,    33,   162,
+       3,     4,     5,     6,     7,    33,    13,    13,    54,    13,
+      56,    33,    33,     0,    33,    33,    84,   180,    86,    48,
+      49,    51,    42,   186,    92,    93,    33,    33,    96,    97,
+      33,    55,    17,    55,    53,   103,    76,   105,   106,   107,
+     108,   109,   110,   111,   112,   113,   114,   115,   116,   117,
+      53,   119,    56,    52,    52,    55,     4,     5,     6,     7,
+      33,     4,     5,     6,     7,    20,    56,    33,    16,    52,
+      18,   122,    54,    21,    22,    23,   179,    25,    26,    27,
+      28,    29,    30,    31,    32,    33,    34,    35,    36,    37,
+      33,    56,    55,   161,    42,    55,    55,   165,    51,    47,
+      38,   169,   122,    51,    52,    55,    55,    55,     3,     4,
+       5,     6,     7,     8,    55,     9,    10,    11,    12,    55,
+      14,    15,    55,    55,    19,    53,     9,    10,    11,    12,
+      51,    14,    15,    51,    43,    44,    45,    54,    33,    48,
+      49,    55,    33,    56,   164,    39,    40,    41,    42,    43,
+      44,    45,    56,    33,    48,    49,    39,    40,    41,    42,
+      43,    44,    45,    57,    33,    48,    49,    51,    56,     9,
+      10,    11,    12,    56,    14,    15,    54,    56,    55,    51,
+      51,    24,    56,    56,    10,    42,    33,     9,    10,    11,
+      12,   122,    14,    15,    17,   169,    93,    -1,    68,    39,
+      40,    41,    42,    43,    44,    45,    -1,    -1,    48,    49,
+      -1,    -1,    -1,    -1,    -1,    -1,    56,    39,    40,    41,
+      42,    43,    44,    45,    -1,    -1,    48,    49,    -1,    -1,
+       9,    10,    11,    12,    56,    14,    15,    -1,    -1,    -1,
+      -1,    -1,    -1,    -1,    -1,    -1,    -1,    -1,     9,    10,
+      11,    12,    -1,    14,    15,    -1,    -1,    -1,    -1,    -1,
+      39,    40,    41,    42,    43,    44,    45,    -1,    -1,    48,
+      49,    -1,    -1,    -1,    -1,    -1,    -1,    56,    39,    40,
+      41,    42,    43,    44,    45,    -1,    -1,    48,    49,     9,
+      10,    11,    12,    54,    14,    15,    -1,    -1,    -1,    -1,
+      -1,    -1,     9,    10,    11,    12,    -1,    14,    15,    -1,
+      -1,    -1,    -1,    -1,    -1,    -1,    -1,    -1,    -1,    39,
+      40,    41,    42,    43,    44,    45,    -1,    -1,    48,    49,
+      -1,    51,    39,    40,    41,    42,    43,    44,    45,    -1,
+      -1,    48,    49,    -1,    51,     9,    10,    11,    12,    -1,
+      14,    15,    -1,    -1,    -1,    -1,     9,    10,    11,    12,
+      -1,    14,    -1,    -1,    -1,    -1,    -1,     9,    10,    11,
+      12,    -1,    -1,    -1,    -1,    39,    40,    41,    42,    43,
+      44,    45,     9,    10,    48,    49,    39,    40,    41,    42,
+      43,    44,    45,    -1,    -1,    48,    49,    39,    40,    41,
+      42,    43,    44,    45,    -1,    -1,    48,    49,     9,    10,
+      11,    12,    39,    40,    41,    42,    43,    44,    45,    -1,
+      -1,    48,    49,    -1,    -1,    -1,    -1,    -1,    -1,    -1,
+      -1,    -1,    -1,    -1,    -1,    -1,    -1,    -1,    39,    40,
+      41,    42,    43,    44,    45,    -1,    -1,    48,    49,    16,
+      -1,    18,    -1,    -1,    21,    22,    23,    -1,    25,    26,
+      27,    28,    29,    30,    31,    32,    33,    34,    35,    36,
+      37,    -1,    -1,    -1,    -1,    42,    -1,    -1,    -1,    -1,
+      47,    -1,    -1,    -1,    51,    52,    -1,    16,    55,    18,
+      -1,    -1,    21,    22,    23,    -1,    25,    26,    27,    28,
+      29,    30,    31,    32,    33,    34,    35,    36,    37,    -1,
+      16,    -1,    18,    42,    -1,    -1,    -1,    -1,    47,    -1,
+      -1,    27,    28,    52,    30,    31,    55,    33,    34,    35,
+      36,    37,    -1,    -1,    -1,    -1,    42,    -1,    -1,    -1,
+      16,    47,    18,    -1,    -1,    51,    -1,    -1,    -1,    55,
+      -1,    27,    28,    -1,    30,    31,    -1,    33,    34,    35,
+      36,    37,    -1,    -1,    -1,    -1,    42,    -1,    -1,    -1,
+      -1,    47,    -1,    -1,    -1,    -1,    -1,    -1,    -1,    55
+};
+
+/* YYSTOS[STATE-NUM] -- The symbol kind of the accessing symbol of
+   state STATE-NUM.  */
+static const yytype_int8 yystos[] =
+{
+       0,     3,     4,     5,     6,     7,     8,    19,    33,    59,
+      60,    61,    62,    63,    64,    65,    67,    73,    76,    33,
+      33,    33,     0,    61,    51,    13,    33,    52,    77,    55,
+      17,    68,    52,    55,    78,    63,    64,    74,    75,    33,
+      20,    69,    66,    74,    16,    18,    21,    22,    23,    25,
+      26,    27,    28,    29,    30,    31,    32,    33,    34,    35,
+      36,    37,    42,    47,    55,    62,    77,    79,    80,    81,
+      82,    83,    84,    85,    33,    56,    54,    33,    70,    52,
+      53,    64,    73,    56,    55,    55,    55,    33,    51,    84,
+      51,    55,    55,    55,    55,    55,    55,    55,    84,    84,
+      84,    53,    79,    38,    51,     9,    10,    11,    12,    14,
+      15,    39,    40,    41,    42,    43,    44,    45,    48,    49,
+      63,    54,    71,    33,    51,    84,    83,    84,    51,    33,
+      84,    84,    87,    56,    56,    84,    86,    87,    56,    84,
+      84,    84,    84,    84,    84,    84,    84,    84,    84,    84,
+      84,    84,    84,    33,    84,    33,    53,    62,    72,    76,
+      56,    51,    56,    56,    54,    54,    56,    56,    56,    55,
+      57,    80,    84,    80,    64,    84,    51,    51,    86,    51,
+      24,    88,    56,    56,    83,    80,    56,    80
+};
+
+/* YYR1[RULE-NUM] -- Symbol kind of the left-hand side of rule RULE-NUM.  */
+static const yytype_int8 yyr1[] =
+{
+       0,    58,    59,    60,    60,    61,    61,    61,    61,    62,
+      63,    64,    64,    64,    64,    64,    64,    65,    66,    66,
+      67,    68,    68,    69,    69,    70,    70,    71,    71,    72,
+      72,    73,    73,    74,    74,    75,    75,    76,    77,    78,
+      78,    79,    79,    80,    80,    80,    80,    80,    80,    80,
+      80,    80,    80,    81,    81,    81,    82,    82,    83,    83,
+      84,    84,    84,    84,    84,    84,    84,    84,    84,    84,
+      84,    84,    84,    84,    84,    84,    84,    84,    84,    84,
+      84,    84,    84,    84,    84,    85,    85,    85,    85,    85,
+      86,    86,    87,    87,    88,    88
+};
+
+/* YYR2[RULE-NUM] -- Number of symbols on the right-hand side of rule RULE-NUM.  */
+static const yytype_int8 yyr2[] =
+{
+       0,     2,     1,     2,     1,     1,     1,     1,     1,     2,
+       2,     1,     1,     1,     1,     1,     2,     5,     3,     0,
+       7,     2,     0,     2,     0,     3,     1,     2,     0,     1,
+       1,     5,     5,     1,     0,     3,     1,     2,     4,     2,
+       0,     2,     0,     2,     1,     6,     5,     9,     3,     2,
+       5,     5,     2,     1,     3,     4,     4,     6,     1,     0,
+       1,     1,     1,     3,     3,     3,     3,     3,     3,     3,
+       3,     3,     3,     3,     3,     3,     3,     3,     2,     2,
+       3,     3,     4,     6,     1,     1,     1,     1,     1,     1,
+       1,     0,     3,     1,     2,     0
+};
+
+
+enum { YYENOMEM = -2 };
+
+#define yyerrok         (yyerrstatus = 0)
+#define yyclearin       (yychar = YYEMPTY)
+
+#define YYACCEPT        goto yyacceptlab
+#define YYABORT         goto yyabortlab
+#define YYERROR         goto yyerrorlab
+#define YYNOMEM         goto yyexhaustedlab
+
+
+#define YYRECOVERING()  (!!yyerrstatus)
+
+#define YYBACKUP(Token, Value)                                    \
+  do                                                              \
+    if (yychar == YYEMPTY)                                        \
+      {                                                           \
+        yychar = (Token);                                         \
+        yylval = (Value);                                         \
+        YYPOPSTACK (yylen);                                       \
+        yystate = *yyssp;                                         \
+        goto yybackup;                                            \
+      }                                                           \
+    else                                                          \
+      {                                                           \
+        yyerror (YY_("syntax error: cannot back up")); \
+        YYERROR;                                                  \
+      }                                                           \
+  while (0)
+
+/* Backward compatibility with an undocumented macro.
+   Use YYerror or YYUNDEF. */
+#define YYERRCODE YYUNDEF
+
+/* YYLLOC_DEFAULT -- Set CURRENT to span from RHS[1] to RHS[N].
+   If N is 0, then set CURRENT to the empty location which ends
+   the previous symbol: RHS[0] (always defined).  */
+
+#ifndef YYLLOC_DEFAULT
+# define YYLLOC_DEFAULT(Current, Rhs, N)                                \
+    do                                                                  \
+      if (N)                                                            \
+        {                                                               \
+          (Current).first_line   = YYRHSLOC (Rhs, 1).first_line;        \
+          (Current).first_column = YYRHSLOC (Rhs, 1).first_column;      \
+          (Current).last_line    = YYRHSLOC (Rhs, N).last_line;         \
+          (Current).last_column  = YYRHSLOC (Rhs, N).last_column;       \
+        }                                                               \
+      else                                                              \
+        {                                                               \
+          (Current).first_line   = (Current).last_line   =              \
+            YYRHSLOC (Rhs, 0).last_line;                                \
+          (Current).first_column = (Current).last_column =              \
+            YYRHSLOC (Rhs, 0).last_column;                              \
+        }                                                               \
+    while (0)
+#endif
+
+#define YYRHSLOC(Rhs, K) ((Rhs)[K])
+
+
+/* Enable debugging if requested.  */
+#if YYDEBUG
+
+# ifndef YYFPRINTF
+#  include <stdio.h> /* INFRINGES ON USER NAME SPACE */
+#  define YYFPRINTF fprintf
+# endif
+
+# define YYDPRINTF(Args)                        \
+do {                                            \
+  if (yydebug)                                  \
+    YYFPRINTF Args;                             \
+} while (0)
+
+
+/* YYLOCATION_PRINT -- Print the location on the stream.
+   This macro was not mandated originally: define only if we know
+   we won't break user code: when these are the locations we know.  */
+
+# ifndef YYLOCATION_PRINT
+
+#  if defined YY_LOCATION_PRINT
+
+   /* Temporary convenience wrapper in case some people defined the
+      undocumented and private YY_LOCATION_PRINT macros.  */
+#   define YYLOCATION_PRINT(File, Loc)  YY_LOCATION_PRINT(File, *(Loc))
+
+#  elif defined YYLTYPE_IS_TRIVIAL && YYLTYPE_IS_TRIVIAL
+
+/* Print *YYLOCP on YYO.  Private, do not rely on its existence. */
+
+YY_ATTRIBUTE_UNUSED
+static int
+yy_location_print_ (FILE *yyo, YYLTYPE const * const yylocp)
+{
+  int res = 0;
+  int end_col = 0 != yylocp->last_column ? yylocp->last_column - 1 : 0;
+  if (0 <= yylocp->first_line)
+    {
+      res += YYFPRINTF (yyo, "%d", yylocp->first_line);
+      if (0 <= yylocp->first_column)
+        res += YYFPRINTF (yyo, ".%d", yylocp->first_column);
+    }
+  if (0 <= yylocp->last_line)
+    {
+      if (yylocp->first_line < yylocp->last_line)
+        {
+          res += YYFPRINTF (yyo, "-%d", yylocp->last_line);
+          if (0 <= end_col)
+            res += YYFPRINTF (yyo, ".%d", end_col);
+        }
+      else if (0 <= end_col && yylocp->first_column < end_col)
+        res += YYFPRINTF (yyo, "-%d", end_col);
+    }
+  return res;
+}
+
+#   define YYLOCATION_PRINT  yy_location_print_
+
+    /* Temporary convenience wrapper in case some people defined the
+       undocumented and private YY_LOCATION_PRINT macros.  */
+#   define YY_LOCATION_PRINT(File, Loc)  YYLOCATION_PRINT(File, &(Loc))
+
+#  else
+
+#   define YYLOCATION_PRINT(File, Loc) ((void) 0)
+    /* Temporary convenience wrapper in case some people defined the
+       undocumented and private YY_LOCATION_PRINT macros.  */
+#   define YY_LOCATION_PRINT  YYLOCATION_PRINT
+
+#  endif
+# endif /* !defined YYLOCATION_PRINT */
+
+
+# define YY_SYMBOL_PRINT(Title, Kind, Value, Location)                    \
+do {                                                                      \
+  if (yydebug)                                                            \
+    {                                                                     \
+      YYFPRINTF (stderr, "%s ", Title);                                   \
+      yy_symbol_print (stderr,                                            \
+                  Kind, Value, Location); \
+      YYFPRINTF (stderr, "\n");                                           \
+    }                                                                     \
+} while (0)
+
+
+/*-----------------------------------.
+| Print this symbol's value on YYO.  |
+`-----------------------------------*/
+
+static void
+yy_symbol_value_print (FILE *yyo,
+                       yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep, YYLTYPE const * const yylocationp)
+{
+  FILE *yyoutput = yyo;
+  YY_USE (yyoutput);
+  YY_USE (yylocationp);
+  if (!yyvaluep)
+    return;
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  YY_USE (yykind);
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+}
+
+
+/*---------------------------.
+| Print this symbol on YYO.  |
+`---------------------------*/
+
+static void
+yy_symbol_print (FILE *yyo,
+                 yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep, YYLTYPE const * const yylocationp)
+{
+  YYFPRINTF (yyo, "%s %s (",
+             yykind < YYNTOKENS ? "token" : "nterm", yysymbol_name (yykind));
+
+  YYLOCATION_PRINT (yyo, yylocationp);
+  YYFPRINTF (yyo, ": ");
+  yy_symbol_value_print (yyo, yykind, yyvaluep, yylocationp);
+  YYFPRINTF (yyo, ")");
+}
+
+/*------------------------------------------------------------------.
+| yy_stack_print -- Print the state stack from its BOTTOM up to its |
+| TOP (included).                                                   |
+`------------------------------------------------------------------*/
+
+static void
+yy_stack_print (yy_state_t *yybottom, yy_state_t *yytop)
+{
+  YYFPRINTF (stderr, "Stack now");
+  for (; yybottom <= yytop; yybottom++)
+    {
+      int yybot = *yybottom;
+      YYFPRINTF (stderr, " %d", yybot);
+    }
+  YYFPRINTF (stderr, "\n");
+}
+
+# define YY_STACK_PRINT(Bottom, Top)                            \
+do {                                                            \
+  if (yydebug)                                                  \
+    yy_stack_print ((Bottom), (Top));                           \
+} while (0)
+
+
+/*------------------------------------------------.
+| Report that the YYRULE is going to be reduced.  |
+`------------------------------------------------*/
+
+static void
+yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp, YYLTYPE *yylsp,
+                 int yyrule)
+{
+  int yylno = yyrline[yyrule];
+  int yynrhs = yyr2[yyrule];
+  int yyi;
+  YYFPRINTF (stderr, "Reducing stack by rule %d (line %d):\n",
+             yyrule - 1, yylno);
+  /* The symbols being reduced.  */
+  for (yyi = 0; yyi < yynrhs; yyi++)
+    {
+      YYFPRINTF (stderr, "   $%d = ", yyi + 1);
+      yy_symbol_print (stderr,
+                       YY_ACCESSING_SYMBOL (+yyssp[yyi + 1 - yynrhs]),
+                       &yyvsp[(yyi + 1) - (yynrhs)],
+                       &(yylsp[(yyi + 1) - (yynrhs)]));
+      YYFPRINTF (stderr, "\n");
+    }
+}
+
+# define YY_REDUCE_PRINT(Rule)          \
+do {                                    \
+  if (yydebug)                          \
+    yy_reduce_print (yyssp, yyvsp, yylsp, Rule); \
+} while (0)
+
+/* Nonzero means print parse trace.  It is left uninitialized so that
+   multiple parsers can coexist.  */
+int yydebug;
+#else /* !YYDEBUG */
+# define YYDPRINTF(Args) ((void) 0)
+# define YY_SYMBOL_PRINT(Title, Kind, Value, Location)
+# define YY_STACK_PRINT(Bottom, Top)
+# define YY_REDUCE_PRINT(Rule)
+#endif /* !YYDEBUG */
+
+
+/* YYINITDEPTH -- initial size of the parser's stacks.  */
+#ifndef YYINITDEPTH
+# define YYINITDEPTH 200
+#endif
+
+/* YYMAXDEPTH -- maximum size the stacks can grow to (effective only
+   if the built-in stack extension method is used).
+
+   Do not make this value too large; the results are undefined if
+   YYSTACK_ALLOC_MAXIMUM < YYSTACK_BYTES (YYMAXDEPTH)
+   evaluated with infinite-precision integer arithmetic.  */
+
+#ifndef YYMAXDEPTH
+# define YYMAXDEPTH 10000
+#endif
+
+
+
+
+
+
+/*-----------------------------------------------.
+| Release the memory associated to this symbol.  |
+`-----------------------------------------------*/
+
+static void
+yydestruct (const char *yymsg,
+            yysymbol_kind_t yykind, YYSTYPE *yyvaluep, YYLTYPE *yylocationp)
+{
+  YY_USE (yyvaluep);
+  YY_USE (yylocationp);
+  if (!yymsg)
+    yymsg = "Deleting";
+  YY_SYMBOL_PRINT (yymsg, yykind, yyvaluep, yylocationp);
+
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  YY_USE (yykind);
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+}
+
+
+/* Lookahead token kind.  */
+int yychar;
+
+/* The semantic value of the lookahead symbol.  */
+YYSTYPE yylval;
+/* Location data for the lookahead symbol.  */
+YYLTYPE yylloc
+# if defined YYLTYPE_IS_TRIVIAL && YYLTYPE_IS_TRIVIAL
+  = { 1, 1, 1, 1 }
+# endif
+;
+/* Number of syntax errors so far.  */
+int yynerrs;
+
+
+
+
+/*----------.
+| yyparse.  |
+`----------*/
+
+int
+yyparse (void)
+{
+    yy_state_fast_t yystate = 0;
+    /* Number of tokens to shift before error messages enabled.  */
+    int yyerrstatus = 0;
+
+    /* Refer to the stacks through separate pointers, to allow yyoverflow
+       to reallocate them elsewhere.  */
+
+    /* Their size.  */
+    YYPTRDIFF_T yystacksize = YYINITDEPTH;
+
+    /* The state stack: array, bottom, top.  */
+    yy_state_t yyssa[YYINITDEPTH];
+    yy_state_t *yyss = yyssa;
+    yy_state_t *yyssp = yyss;
+
+    /* The semantic value stack: array, bottom, top.  */
+    YYSTYPE yyvsa[YYINITDEPTH];
+    YYSTYPE *yyvs = yyvsa;
+    YYSTYPE *yyvsp = yyvs;
+
+    /* The location stack: array, bottom, top.  */
+    YYLTYPE yylsa[YYINITDEPTH];
+    YYLTYPE *yyls = yylsa;
+    YYLTYPE *yylsp = yyls;
+
+  int yyn;
+  /* The return value of yyparse.  */
+  int yyresult;
+  /* Lookahead symbol kind.  */
+  yysymbol_kind_t yytoken = YYSYMBOL_YYEMPTY;
+  /* The variables used to return semantic value and location from the
+     action routines.  */
+  YYSTYPE yyval;
+  YYLTYPE yyloc;
+
+  /* The locations where the error started and ended.  */
+  YYLTYPE yyerror_range[3];
+
+
+
+#define YYPOPSTACK(N)   (yyvsp -= (N), yyssp -= (N), yylsp -= (N))
+
+  /* The number of symbols on the RHS of the reduced rule.
+     Keep to zero when no symbol should be popped.  */
+  int yylen = 0;
+
+  YYDPRINTF ((stderr, "Starting parse\n"));
+
+  yychar = YYEMPTY; /* Cause a token to be read.  */
+
+  yylsp[0] = yylloc;
+  goto yysetstate;
+
+
+/*------------------------------------------------------------.
+| yynewstate -- push a new state, which is found in yystate.  |
+`------------------------------------------------------------*/
+yynewstate:
+  /* In all cases, when you get here, the value and location stacks
+     have just been pushed.  So pushing a state here evens the stacks.  */
+  yyssp++;
+
+
+/*--------------------------------------------------------------------.
+| yysetstate -- set current state (the top of the stack) to yystate.  |
+`--------------------------------------------------------------------*/
+yysetstate:
+  YYDPRINTF ((stderr, "Entering state %d\n", yystate));
+  YY_ASSERT (0 <= yystate && yystate < YYNSTATES);
+  YY_IGNORE_USELESS_CAST_BEGIN
+  *yyssp = YY_CAST (yy_state_t, yystate);
+  YY_IGNORE_USELESS_CAST_END
+  YY_STACK_PRINT (yyss, yyssp);
+
+  if (yyss + yystacksize - 1 <= yyssp)
+#if !defined yyoverflow && !defined YYSTACK_RELOCATE
+    YYNOMEM;
+#else
+    {
+      /* Get the current used size of the three stacks, in elements.  */
+      YYPTRDIFF_T yysize = yyssp - yyss + 1;
+
+# if defined yyoverflow
+      {
+        /* Give user a chance to reallocate the stack.  Use copies of
+           these so that the &'s don't force the real ones into
+           memory.  */
+        yy_state_t *yyss1 = yyss;
+        YYSTYPE *yyvs1 = yyvs;
+        YYLTYPE *yyls1 = yyls;
+
+        /* Each stack pointer address is followed by the size of the
+           data in use in that stack, in bytes.  This used to be a
+           conditional around just the two extra args, but that might
+           be undefined if yyoverflow is a macro.  */
+        yyoverflow (YY_("memory exhausted"),
+                    &yyss1, yysize * YYSIZEOF (*yyssp),
+                    &yyvs1, yysize * YYSIZEOF (*yyvsp),
+                    &yyls1, yysize * YYSIZEOF (*yylsp),
+                    &yystacksize);
+        yyss = yyss1;
+        yyvs = yyvs1;
+        yyls = yyls1;
+      }
+# else /* defined YYSTACK_RELOCATE */
+      /* Extend the stack our own way.  */
+      if (YYMAXDEPTH <= yystacksize)
+        YYNOMEM;
+      yystacksize *= 2;
+      if (YYMAXDEPTH < yystacksize)
+        yystacksize = YYMAXDEPTH;
+
+      {
+        yy_state_t *yyss1 = yyss;
+        union yyalloc *yyptr =
+          YY_CAST (union yyalloc *,
+                   YYSTACK_ALLOC (YY_CAST (YYSIZE_T, YYSTACK_BYTES (yystacksize))));
+        if (! yyptr)
+          YYNOMEM;
+        YYSTACK_RELOCATE (yyss_alloc, yyss);
+        YYSTACK_RELOCATE (yyvs_alloc, yyvs);
+        YYSTACK_RELOCATE (yyls_alloc, yyls);
+#  undef YYSTACK_RELOCATE
+        if (yyss1 != yyssa)
+          YYSTACK_FREE (yyss1);
+      }
+# endif
+
+      yyssp = yyss + yysize - 1;
+      yyvsp = yyvs + yysize - 1;
+      yylsp = yyls + yysize - 1;
+
+      YY_IGNORE_USELESS_CAST_BEGIN
+      YYDPRINTF ((stderr, "Stack size increased to %ld\n",
+                  YY_CAST (long, yystacksize)));
+      YY_IGNORE_USELESS_CAST_END
+
+      if (yyss + yystacksize - 1 <= yyssp)
+        YYABORT;
+    }
+#endif /* !defined yyoverflow && !defined YYSTACK_RELOCATE */
+
+
+  if (yystate == YYFINAL)
+    YYACCEPT;
+
+  goto yybackup;
+
+
+/*-----------.
+| yybackup.  |
+`-----------*/
+yybackup:
+  /* Do appropriate processing given the current state.  Read a
+     lookahead token if we need one and don't already have one.  */
+
+  /* First try to decide what to do without reference to lookahead token.  */
+  yyn = yypact[yystate];
+  if (yypact_value_is_default (yyn))
+    goto yydefault;
+
+  /* Not known => get a lookahead token if don't already have one.  */
+
+  /* YYCHAR is either empty, or end-of-input, or a valid lookahead.  */
+  if (yychar == YYEMPTY)
+    {
+      YYDPRINTF ((stderr, "Reading a token\n"));
+      yychar = yylex ();
+    }
+
+  if (yychar <= YYEOF)
+    {
+      yychar = YYEOF;
+      yytoken = YYSYMBOL_YYEOF;
+      YYDPRINTF ((stderr, "Now at end of input.\n"));
+    }
+  else if (yychar == YYerror)
+    {
+      /* The scanner already issued an error message, process directly
+         to error recovery.  But do not keep the error token as
+         lookahead, it is too special and may lead us to an endless
+         loop in error recovery. */
+      yychar = YYUNDEF;
+      yytoken = YYSYMBOL_YYerror;
+      yyerror_range[1] = yylloc;
+      goto yyerrlab1;
+    }
+  else
+    {
+      yytoken = YYTRANSLATE (yychar);
+      YY_SYMBOL_PRINT ("Next token is", yytoken, &yylval, &yylloc);
+    }
+
+  /* If the proper action on seeing token YYTOKEN is to reduce or to
+     detect an error, take that action.  */
+  yyn += yytoken;
+  if (yyn < 0 || YYLAST < yyn || yycheck[yyn] != yytoken)
+    goto yydefault;
+  yyn = yytable[yyn];
+  if (yyn <= 0)
+    {
+      if (yytable_value_is_error (yyn))
+        goto yyerrlab;
+      yyn = -yyn;
+      goto yyreduce;
+    }
+
+  /* Count tokens shifted since error; after three, turn off error
+     status.  */
+  if (yyerrstatus)
+    yyerrstatus--;
+
+  /* Shift the lookahead token.  */
+  YY_SYMBOL_PRINT ("Shifting", yytoken, &yylval, &yylloc);
+  yystate = yyn;
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  *++yyvsp = yylval;
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+  *++yylsp = yylloc;
+
+  /* Discard the shifted token.  */
+  yychar = YYEMPTY;
+  goto yynewstate;
+
+
+/*-----------------------------------------------------------.
+| yydefault -- do the default action for the current state.  |
+`-----------------------------------------------------------*/
+yydefault:
+  yyn = yydefact[yystate];
+  if (yyn == 0)
+    goto yyerrlab;
+  goto yyreduce;
+
+
+/*-----------------------------.
+| yyreduce -- do a reduction.  |
+`-----------------------------*/
+yyreduce:
+  /* yyn is the number of a rule to reduce with.  */
+  yylen = yyr2[yyn];
+
+  /* If YYLEN is nonzero, implement the default value of the action:
+     '$$ = $1'.
+
+     Otherwise, the following line sets YYVAL to garbage.
+     This behavior is undocumented and Bison
+     users should not rely upon it.  Assigning to YYVAL
+     unconditionally makes the parser a bit smaller, and it avoids a
+     GCC warning that YYVAL may be used uninitialized.  */
+  yyval = yyvsp[1-yylen];
+
+  /* Default location. */
+  YYLLOC_DEFAULT (yyloc, (yylsp - yylen), yylen);
+  yyerror_range[1] = yyloc;
+  YY_REDUCE_PRINT (yyn);
+  switch (yyn)
+    {
+  case 2: /* Program: DeclList  */
+#line 99 "parser.y"
+                                   { 
+                                      (yylsp[0]); 
+                                      Program *program = new Program((yyvsp[0].declList));
+                                      // if no errors, advance to next phase
+                                      if (ReportError::NumErrors() == 0) {
+                                          program->Check();
+                                      } 
+                                      if (ReportError::NumErrors() == 0) {
+                                          program->Emit();
+                                      }
+                                    }
+#line 1649 "y.tab.c"
+    break;
+
+  case 3: /* DeclList: DeclList Decl  */
+#line 113 "parser.y"
+                                    { ((yyval.declList)=(yyvsp[-1].declList))->Append((yyvsp[0].decl)); }
+#line 1655 "y.tab.c"
+    break;
+
+  case 4: /* DeclList: Decl  */
+#line 114 "parser.y"
+                                    { ((yyval.declList) = new List<Decl*>)->Append((yyvsp[0].decl)); }
+#line 1661 "y.tab.c"
+    break;
+
+  case 6: /* Decl: FnDecl  */
+#line 118 "parser.y"
+                                    { (yyval.decl)=(yyvsp[0].fDecl); }
+#line 1667 "y.tab.c"
+    break;
+
+  case 7: /* Decl: VarDecl  */
+#line 119 "parser.y"
+                                    { (yyval.decl)=(yyvsp[0].var); }
+#line 1673 "y.tab.c"
+    break;
+
+  case 10: /* Variable: Type T_Identifier  */
+#line 126 "parser.y"
+                                    { (yyval.var) = new VarDecl(new Identifier((yylsp[0]), (yyvsp[0].identifier)), (yyvsp[-1].type)); }
+#line 1679 "y.tab.c"
+    break;
+
+  case 11: /* Type: T_Int  */
+#line 129 "parser.y"
+                                    { (yyval.type) = Type::intType; }
+#line 1685 "y.tab.c"
+    break;
+
+  case 12: /* Type: T_Bool  */
+#line 130 "parser.y"
+                                    { (yyval.type) = Type::boolType; }
+#line 1691 "y.tab.c"
+    break;
+
+  case 13: /* Type: T_String  */
+#line 131 "parser.y"
+                                    { (yyval.type) = Type::stringType; }
+#line 1697 "y.tab.c"
+    break;
+
+  case 14: /* Type: T_Double  */
+#line 132 "parser.y"
+                                    { (yyval.type) = Type::errorType; }
+#line 1703 "y.tab.c"
+    break;
+
+  case 15: /* Type: T_Identifier  */
+#line 133 "parser.y"
+                                    { (yyval.type) = new NamedType(new Identifier((yylsp[0]),(yyvsp[0].identifier))); }
+#line 1709 "y.tab.c"
+    break;
+
+  case 16: /* Type: Type T_Dims  */
+#line 134 "parser.y"
+                                    { (yyval.type) = new ArrayType(Join((yylsp[-1]), (yylsp[0])), (yyvsp[-1].type)); }
+#line 1715 "y.tab.c"
+    break;
+
+  case 17: /* IntfDecl: T_Interface T_Identifier '{' IntfList '}'  */
+#line 138 "parser.y"
+                                    { (yyval.decl) = new InterfaceDecl(new Identifier((yylsp[-3]), (yyvsp[-3].identifier)), (yyvsp[-1].declList)); }
+#line 1721 "y.tab.c"
+    break;
+
+  case 18: /* IntfList: IntfList FnHeader ';'  */
+#line 142 "parser.y"
+                                    { ((yyval.declList)=(yyvsp[-2].declList))->Append((yyvsp[-1].fDecl)); }
+#line 1727 "y.tab.c"
+    break;
+
+  case 19: /* IntfList: %empty  */
+#line 143 "parser.y"
+                                    { (yyval.declList) = new List<Decl*>(); }
+#line 1733 "y.tab.c"
+    break;
+
+  case 20: /* ClassDecl: T_Class T_Identifier OptExt OptImpl '{' FieldList '}'  */
+#line 147 "parser.y"
+                                    { (yyval.decl) = new ClassDecl(new Identifier((yylsp[-5]), (yyvsp[-5].identifier)), (yyvsp[-4].cType), (yyvsp[-3].cTypeList), (yyvsp[-1].declList)); }
+#line 1739 "y.tab.c"
+    break;
+
+  case 21: /* OptExt: T_Extends T_Identifier  */
+#line 151 "parser.y"
+                                    { (yyval.cType) = new NamedType(new Identifier((yylsp[0]), (yyvsp[0].identifier))); }
+#line 1745 "y.tab.c"
+    break;
+
+  case 22: /* OptExt: %empty  */
+#line 152 "parser.y"
+                                    { (yyval.cType) = NULL; }
+#line 1751 "y.tab.c"
+    break;
+
+  case 23: /* OptImpl: T_Implements ImpList  */
+#line 156 "parser.y"
+                                    { (yyval.cTypeList) = (yyvsp[0].cTypeList); }
+#line 1757 "y.tab.c"
+    break;
+
+  case 24: /* OptImpl: %empty  */
+#line 157 "parser.y"
+                                    { (yyval.cTypeList) = new List<NamedType*>; }
+#line 1763 "y.tab.c"
+    break;
+
+  case 25: /* ImpList: ImpList ',' T_Identifier  */
+#line 161 "parser.y"
+                                    { ((yyval.cTypeList)=(yyvsp[-2].cTypeList))->Append(new NamedType(new Identifier((yylsp[0]), (yyvsp[0].identifier)))); }
+#line 1769 "y.tab.c"
+    break;
+
+  case 26: /* ImpList: T_Identifier  */
+#line 162 "parser.y"
+                                    { ((yyval.cTypeList)=new List<NamedType*>)->Append(new NamedType(new Identifier((yylsp[0]), (yyvsp[0].identifier)))); }
+#line 1775 "y.tab.c"
+    break;
+
+  case 27: /* FieldList: FieldList Field  */
+#line 165 "parser.y"
+                                    { ((yyval.declList)=(yyvsp[-1].declList))->Append((yyvsp[0].decl)); }
+#line 1781 "y.tab.c"
+    break;
+
+  case 28: /* FieldList: %empty  */
+#line 166 "parser.y"
+                                    { (yyval.declList) = new List<Decl*>(); }
+#line 1787 "y.tab.c"
+    break;
+
+  case 29: /* Field: VarDecl  */
+#line 169 "parser.y"
+                                    { (yyval.decl) = (yyvsp[0].var); }
+#line 1793 "y.tab.c"
+    break;
+
+  case 30: /* Field: FnDecl  */
+#line 170 "parser.y"
+                                    { (yyval.decl) = (yyvsp[0].fDecl); }
+#line 1799 "y.tab.c"
+    break;
+
+  case 31: /* FnHeader: Type T_Identifier '(' Formals ')'  */
+#line 175 "parser.y"
+                                    { (yyval.fDecl) = new FnDecl(new Identifier((yylsp[-3]), (yyvsp[-3].identifier)), (yyvsp[-4].type), (yyvsp[-1].varList)); }
+#line 1805 "y.tab.c"
+    break;
+
+  case 32: /* FnHeader: T_Void T_Identifier '(' Formals ')'  */
+#line 177 "parser.y"
+                                    { (yyval.fDecl) = new FnDecl(new Identifier((yylsp[-3]), (yyvsp[-3].identifier)), Type::voidType, (yyvsp[-1].varList)); }
+#line 1811 "y.tab.c"
+    break;
+
+  case 33: /* Formals: FormalList  */
+#line 180 "parser.y"
+                                    { (yyval.varList) = (yyvsp[0].varList); }
+#line 1817 "y.tab.c"
+    break;
+
+  case 34: /* Formals: %empty  */
+#line 181 "parser.y"
+                                    { (yyval.varList) = new List<VarDecl*>; }
+#line 1823 "y.tab.c"
+    break;
+
+  case 35: /* FormalList: FormalList ',' Variable  */
+#line 185 "parser.y"
+                                    { ((yyval.varList)=(yyvsp[-2].varList))->Append((yyvsp[0].var)); }
+#line 1829 "y.tab.c"
+    break;
+
+  case 36: /* FormalList: Variable  */
+#line 186 "parser.y"
+                                    { ((yyval.varList) = new List<VarDecl*>)->Append((yyvsp[0].var)); }
+#line 1835 "y.tab.c"
+    break;
+
+  case 37: /* FnDecl: FnHeader StmtBlock  */
+#line 189 "parser.y"
+                                    { ((yyval.fDecl)=(yyvsp[-1].fDecl))->SetFunctionBody((yyvsp[0].stmt)); }
+#line 1841 "y.tab.c"
+    break;
+
+  case 38: /* StmtBlock: '{' VarDecls StmtList '}'  */
+#line 193 "parser.y"
+                                    { (yyval.stmt) = new StmtBlock((yyvsp[-2].varList), (yyvsp[-1].stmtList)); }
+#line 1847 "y.tab.c"
+    break;
+
+  case 39: /* VarDecls: VarDecls VarDecl  */
+#line 196 "parser.y"
+                                    { ((yyval.varList)=(yyvsp[-1].varList))->Append((yyvsp[0].var)); }
+#line 1853 "y.tab.c"
+    break;
+
+  case 40: /* VarDecls: %empty  */
+#line 197 "parser.y"
+                                    { (yyval.varList) = new List<VarDecl*>; }
+#line 1859 "y.tab.c"
+    break;
+
+  case 41: /* StmtList: Stmt StmtList  */
+#line 200 "parser.y"
+                                    { (yyval.stmtList) = (yyvsp[0].stmtList); (yyval.stmtList)->InsertAt((yyvsp[-1].stmt), 0); }
+#line 1865 "y.tab.c"
+    break;
+
+  case 42: /* StmtList: %empty  */
+#line 201 "parser.y"
+                                    { (yyval.stmtList) = new List<Stmt*>; }
+#line 1871 "y.tab.c"
+    break;
+
+  case 43: /* Stmt: OptExpr ';'  */
+#line 204 "parser.y"
+                                    { (yyval.stmt) = (yyvsp[-1].expr); }
+#line 1877 "y.tab.c"
+    break;
+
+  case 45: /* Stmt: T_If '(' Expr ')' Stmt OptElse  */
+#line 207 "parser.y"
+                                    { (yyval.stmt) = new IfStmt((yyvsp[-3].expr), (yyvsp[-1].stmt), (yyvsp[0].stmt)); }
+#line 1883 "y.tab.c"
+    break;
+
+  case 46: /* Stmt: T_While '(' Expr ')' Stmt  */
+#line 209 "parser.y"
+                                    { (yyval.stmt) = new WhileStmt((yyvsp[-2].expr), (yyvsp[0].stmt)); }
+#line 1889 "y.tab.c"
+    break;
+
+  case 47: /* Stmt: T_For '(' OptExpr ';' Expr ';' OptExpr ')' Stmt  */
+#line 211 "parser.y"
+                                    { (yyval.stmt) = new ForStmt((yyvsp[-6].expr), (yyvsp[-4].expr), (yyvsp[-2].expr), (yyvsp[0].stmt)); }
+#line 1895 "y.tab.c"
+    break;
+
+  case 48: /* Stmt: T_Return Expr ';'  */
+#line 213 "parser.y"
+                                    { (yyval.stmt) = new ReturnStmt((yylsp[-1]), (yyvsp[-1].expr)); }
+#line 1901 "y.tab.c"
+    break;
+
+  case 49: /* Stmt: T_Return ';'  */
+#line 215 "parser.y"
+                                    { (yyval.stmt) = new ReturnStmt((yylsp[-1]), new EmptyExpr()); }
+#line 1907 "y.tab.c"
+    break;
+
+  case 50: /* Stmt: T_Print '(' ExprList ')' ';'  */
+#line 217 "parser.y"
+                                    { (yyval.stmt) = new PrintStmt((yyvsp[-2].exprList)); }
+#line 1913 "y.tab.c"
+    break;
+
+  case 51: /* Stmt: T_Delete '(' Expr ')' ';'  */
+#line 219 "parser.y"
+                                    { (yyval.stmt) = new DeleteStmt((yyvsp[-2].expr)); }
+#line 1919 "y.tab.c"
+    break;
+
+  case 52: /* Stmt: T_Break ';'  */
+#line 220 "parser.y"
+                                    { (yyval.stmt) = new BreakStmt((yylsp[-1])); }
+#line 1925 "y.tab.c"
+    break;
+
+  case 53: /* LValue: T_Identifier  */
+#line 223 "parser.y"
+                                     { (yyval.lvalue) = new FieldAccess(NULL, new Identifier((yylsp[0]), (yyvsp[0].identifier))); }
+#line 1931 "y.tab.c"
+    break;
+
+  case 54: /* LValue: Expr '.' T_Identifier  */
+#line 224 "parser.y"
+                                     { (yyval.lvalue) = new FieldAccess((yyvsp[-2].expr), new Identifier((yylsp[0]), (yyvsp[0].identifier))); }
+#line 1937 "y.tab.c"
+    break;
+
+  case 55: /* LValue: Expr '[' Expr ']'  */
+#line 225 "parser.y"
+                                     { (yyval.lvalue) = new ArrayAccess(Join((yylsp[-3]), (yylsp[0])), (yyvsp[-3].expr), (yyvsp[-1].expr)); }
+#line 1943 "y.tab.c"
+    break;
+
+  case 56: /* Call: T_Identifier '(' Actuals ')'  */
+#line 229 "parser.y"
+                                    { (yyval.expr) = new Call(Join((yylsp[-3]),(yylsp[0])), NULL, new Identifier((yylsp[-3]),(yyvsp[-3].identifier)), (yyvsp[-1].exprList)); }
+#line 1949 "y.tab.c"
+    break;
+
+  case 57: /* Call: Expr '.' T_Identifier '(' Actuals ')'  */
+#line 231 "parser.y"
+                                    { (yyval.expr) = new Call(Join((yylsp[-5]),(yylsp[0])), (yyvsp[-5].expr), new Identifier((yylsp[-3]),(yyvsp[-3].identifier)), (yyvsp[-1].exprList)); }
+#line 1955 "y.tab.c"
+    break;
+
+  case 58: /* OptExpr: Expr  */
+#line 234 "parser.y"
+                                    { (yyval.expr) = (yyvsp[0].expr); }
+#line 1961 "y.tab.c"
+    break;
+
+  case 59: /* OptExpr: %empty  */
+#line 235 "parser.y"
+                                    { (yyval.expr) = new EmptyExpr(); }
+#line 1967 "y.tab.c"
+    break;
+
+  case 60: /* Expr: LValue  */
+#line 238 "parser.y"
+                                    { (yyval.expr) = (yyvsp[0].lvalue); }
+#line 1973 "y.tab.c"
+    break;
+
+  case 63: /* Expr: LValue '=' Expr  */
+#line 241 "parser.y"
+                                    { (yyval.expr) = new AssignExpr((yyvsp[-2].lvalue), new Operator((yylsp[-1]),"="), (yyvsp[0].expr)); }
+#line 1979 "y.tab.c"
+    break;
+
+  case 64: /* Expr: Expr '+' Expr  */
+#line 242 "parser.y"
+                                    { (yyval.expr) = new ArithmeticExpr((yyvsp[-2].expr), new Operator((yylsp[-1]), "+"), (yyvsp[0].expr)); }
+#line 1985 "y.tab.c"
+    break;
+
+  case 65: /* Expr: Expr '-' Expr  */
+#line 243 "parser.y"
+                                    { (yyval.expr) = new ArithmeticExpr((yyvsp[-2].expr), new Operator((yylsp[-1]), "-"), (yyvsp[0].expr)); }
+#line 1991 "y.tab.c"
+    break;
+
+  case 66: /* Expr: Expr '/' Expr  */
+#line 244 "parser.y"
+                                    { (yyval.expr) = new ArithmeticExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"/"), (yyvsp[0].expr)); }
+#line 1997 "y.tab.c"
+    break;
+
+  case 67: /* Expr: Expr '*' Expr  */
+#line 245 "parser.y"
+                                    { (yyval.expr) = new ArithmeticExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"*"), (yyvsp[0].expr)); }
+#line 2003 "y.tab.c"
+    break;
+
+  case 68: /* Expr: Expr '%' Expr  */
+#line 246 "parser.y"
+                                    { (yyval.expr) = new ArithmeticExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"%"), (yyvsp[0].expr)); }
+#line 2009 "y.tab.c"
+    break;
+
+  case 69: /* Expr: Expr T_Equal Expr  */
+#line 247 "parser.y"
+                                    { (yyval.expr) = new EqualityExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"=="), (yyvsp[0].expr)); }
+#line 2015 "y.tab.c"
+    break;
+
+  case 70: /* Expr: Expr T_NotEqual Expr  */
+#line 248 "parser.y"
+                                    { (yyval.expr) = new EqualityExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"!="), (yyvsp[0].expr)); }
+#line 2021 "y.tab.c"
+    break;
+
+  case 71: /* Expr: Expr '<' Expr  */
+#line 249 "parser.y"
+                                    { (yyval.expr) = new RelationalExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"<"), (yyvsp[0].expr)); }
+#line 2027 "y.tab.c"
+    break;
+
+  case 72: /* Expr: Expr '>' Expr  */
+#line 250 "parser.y"
+                                    { (yyval.expr) = new RelationalExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),">"), (yyvsp[0].expr)); }
+#line 2033 "y.tab.c"
+    break;
+
+  case 73: /* Expr: Expr T_LessEqual Expr  */
+#line 252 "parser.y"
+                                    { (yyval.expr) = new RelationalExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"<="), (yyvsp[0].expr)); }
+#line 2039 "y.tab.c"
+    break;
+
+  case 74: /* Expr: Expr T_GreaterEqual Expr  */
+#line 254 "parser.y"
+                                    { (yyval.expr) = new RelationalExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),">="), (yyvsp[0].expr)); }
+#line 2045 "y.tab.c"
+    break;
+
+  case 75: /* Expr: Expr T_And Expr  */
+#line 255 "parser.y"
+                                    { (yyval.expr) = new LogicalExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"&&"), (yyvsp[0].expr)); }
+#line 2051 "y.tab.c"
+    break;
+
+  case 76: /* Expr: Expr T_Or Expr  */
+#line 256 "parser.y"
+                                    { (yyval.expr) = new LogicalExpr((yyvsp[-2].expr), new Operator((yylsp[-1]),"||"), (yyvsp[0].expr)); }
+#line 2057 "y.tab.c"
+    break;
+
+  case 77: /* Expr: '(' Expr ')'  */
+#line 257 "parser.y"
+                                    { (yyval.expr) = (yyvsp[-1].expr); }
+#line 2063 "y.tab.c"
+    break;
+
+  case 78: /* Expr: '-' Expr  */
+#line 259 "parser.y"
+                                    { (yyval.expr) = new ArithmeticExpr(new Operator((yylsp[-1]),"-"), (yyvsp[0].expr)); }
+#line 2069 "y.tab.c"
+    break;
+
+  case 79: /* Expr: '!' Expr  */
+#line 260 "parser.y"
+                                    { (yyval.expr) = new LogicalExpr(new Operator((yylsp[-1]),"!"), (yyvsp[0].expr)); }
+#line 2075 "y.tab.c"
+    break;
+
+  case 80: /* Expr: T_ReadInteger '(' ')'  */
+#line 262 "parser.y"
+                                    { (yyval.expr) = new ReadIntegerExpr(Join((yylsp[-2]),(yylsp[0]))); }
+#line 2081 "y.tab.c"
+    break;
+
+  case 81: /* Expr: T_ReadLine '(' ')'  */
+#line 263 "parser.y"
+                                    { (yyval.expr) = new ReadLineExpr(Join((yylsp[-2]),(yylsp[0]))); }
+#line 2087 "y.tab.c"
+    break;
+
+  case 82: /* Expr: T_New '(' T_Identifier ')'  */
+#line 265 "parser.y"
+                                    { (yyval.expr) = new NewExpr(Join((yylsp[-3]),(yylsp[0])),new NamedType(new Identifier((yylsp[-1]),(yyvsp[-1].identifier)))); }
+#line 2093 "y.tab.c"
+    break;
+
+  case 83: /* Expr: T_NewArray '(' Expr ',' Type ')'  */
+#line 267 "parser.y"
+                                    { (yyval.expr) = new NewArrayExpr(Join((yylsp[-5]),(yylsp[0])),(yyvsp[-3].expr), (yyvsp[-1].type)); }
+#line 2099 "y.tab.c"
+    break;
+
+  case 84: /* Expr: T_This  */
+#line 268 "parser.y"
+                                    { (yyval.expr) = new This((yylsp[0])); }
+#line 2105 "y.tab.c"
+    break;
+
+  case 85: /* Constant: T_IntConstant  */
+#line 271 "parser.y"
+                                    { (yyval.expr) = new IntConstant((yylsp[0]),(yyvsp[0].integerConstant)); }
+#line 2111 "y.tab.c"
+    break;
+
+  case 86: /* Constant: T_BoolConstant  */
+#line 272 "parser.y"
+                                    { (yyval.expr) = new BoolConstant((yylsp[0]),(yyvsp[0].boolConstant)); }
+#line 2117 "y.tab.c"
+    break;
+
+  case 87: /* Constant: T_DoubleConstant  */
+#line 273 "parser.y"
+                                    { (yyval.expr) = new DoubleConstant((yylsp[0]),(yyvsp[0].doubleConstant)); }
+#line 2123 "y.tab.c"
+    break;
+
+  case 88: /* Constant: T_StringConstant  */
+#line 274 "parser.y"
+                                    { (yyval.expr) = new StringConstant((yylsp[0]),(yyvsp[0].stringConstant)); }
+#line 2129 "y.tab.c"
+    break;
+
+  case 89: /* Constant: T_Null  */
+#line 275 "parser.y"
+                                    { (yyval.expr) = new NullConstant((yylsp[0])); }
+#line 2135 "y.tab.c"
+    break;
+
+  case 90: /* Actuals: ExprList  */
+#line 278 "parser.y"
+                                    { (yyval.exprList) = (yyvsp[0].exprList); }
+#line 2141 "y.tab.c"
+    break;
+
+  case 91: /* Actuals: %empty  */
+#line 279 "parser.y"
+                                    { (yyval.exprList) = new List<Expr*>; }
+#line 2147 "y.tab.c"
+    break;
+
+  case 92: /* ExprList: ExprList ',' Expr  */
+#line 282 "parser.y"
+                                    { ((yyval.exprList)=(yyvsp[-2].exprList))->Append((yyvsp[0].expr)); }
+#line 2153 "y.tab.c"
+    break;
+
+  case 93: /* ExprList: Expr  */
+#line 283 "parser.y"
+                                    { ((yyval.exprList) = new List<Expr*>)->Append((yyvsp[0].expr)); }
+#line 2159 "y.tab.c"
+    break;
+
+  case 94: /* OptElse: T_Else Stmt  */
+#line 286 "parser.y"
+                                    { (yyval.stmt) = (yyvsp[0].stmt); }
+#line 2165 "y.tab.c"
+    break;
+
+  case 95: /* OptElse: %empty  */
+#line 288 "parser.y"
+                                    { (yyval.stmt) = NULL; }
+#line 2171 "y.tab.c"
+    break;
+
+
+#line 2175 "y.tab.c"
+
+      default: break;
+    }
+  /* User semantic actions sometimes alter yychar, and that requires
+     that yytoken be updated with the new translation.  We take the
+     approach of translating immediately before every use of yytoken.
+     One alternative is translating here after every semantic action,
+     but that translation would be missed if the semantic action invokes
+     YYABORT, YYACCEPT, or YYERROR immediately after altering yychar or
+     if it invokes YYBACKUP.  In the case of YYABORT or YYACCEPT, an
+     incorrect destructor might then be invoked immediately.  In the
+     case of YYERROR or YYBACKUP, subsequent parser actions might lead
+     to an incorrect destructor call or verbose syntax error message
+     before the lookahead is translated.  */
+  YY_SYMBOL_PRINT ("-> $$ =", YY_CAST (yysymbol_kind_t, yyr1[yyn]), &yyval, &yyloc);
+
+  YYPOPSTACK (yylen);
+  yylen = 0;
+
+  *++yyvsp = yyval;
+  *++yylsp = yyloc;
+
+  /* Now 'shift' the result of the reduction.  Determine what state
+     that goes to, based on the state we popped back to and the rule
+     number reduced by.  */
+  {
+    const int yylhs = yyr1[yyn] - YYNTOKENS;
+    const int yyi = yypgoto[yylhs] + *yyssp;
+    yystate = (0 <= yyi && yyi <= YYLAST && yycheck[yyi] == *yyssp
+               ? yytable[yyi]
+               : yydefgoto[yylhs]);
+  }
+
+  goto yynewstate;
+
+
+/*--------------------------------------.
+| yyerrlab -- here on detecting error.  |
+`--------------------------------------*/
+yyerrlab:
+  /* Make sure we have latest lookahead translation.  See comments at
+     user semantic actions for why this is necessary.  */
+  yytoken = yychar == YYEMPTY ? YYSYMBOL_YYEMPTY : YYTRANSLATE (yychar);
+  /* If not already recovering from an error, report this error.  */
+  if (!yyerrstatus)
+    {
+      ++yynerrs;
+      yyerror (YY_("syntax error"));
+    }
+
+  yyerror_range[1] = yylloc;
+  if (yyerrstatus == 3)
+    {
+      /* If just tried and failed to reuse lookahead token after an
+         error, discard it.  */
+
+      if (yychar <= YYEOF)
+        {
+          /* Return failure if at end of input.  */
+          if (yychar == YYEOF)
+            YYABORT;
+        }
+      else
+        {
+          yydestruct ("Error: discarding",
+                      yytoken, &yylval, &yylloc);
+          yychar = YYEMPTY;
+        }
+    }
+
+  /* Else will try to reuse lookahead token after shifting the error
+     token.  */
+  goto yyerrlab1;
+
+
+/*---------------------------------------------------.
+| yyerrorlab -- error raised explicitly by YYERROR.  |
+`---------------------------------------------------*/
+yyerrorlab:
+  /* Pacify compilers when the user code never invokes YYERROR and the
+     label yyerrorlab therefore never appears in user code.  */
+  if (0)
+    YYERROR;
+  ++yynerrs;
+
+  /* Do not reclaim the symbols of the rule whose action triggered
+     this YYERROR.  */
+  YYPOPSTACK (yylen);
+  yylen = 0;
+  YY_STACK_PRINT (yyss, yyssp);
+  yystate = *yyssp;
+  goto yyerrlab1;
+
+
+/*-------------------------------------------------------------.
+| yyerrlab1 -- common code for both syntax error and YYERROR.  |
+`-------------------------------------------------------------*/
+yyerrlab1:
+  yyerrstatus = 3;      /* Each real token shifted decrements this.  */
+
+  /* Pop stack until we find a state that shifts the error token.  */
+  for (;;)
+    {
+      yyn = yypact[yystate];
+      if (!yypact_value_is_default (yyn))
+        {
+          yyn += YYSYMBOL_YYerror;
+          if (0 <= yyn && yyn <= YYLAST && yycheck[yyn] == YYSYMBOL_YYerror)
+            {
+              yyn = yytable[yyn];
+              if (0 < yyn)
+                break;
+            }
+        }
+
+      /* Pop the current state because it cannot handle the error token.  */
+      if (yyssp == yyss)
+        YYABORT;
+
+      yyerror_range[1] = *yylsp;
+      yydestruct ("Error: popping",
+                  YY_ACCESSING_SYMBOL (yystate), yyvsp, yylsp);
+      YYPOPSTACK (1);
+      yystate = *yyssp;
+      YY_STACK_PRINT (yyss, yyssp);
+    }
+
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  *++yyvsp = yylval;
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+
+  yyerror_range[2] = yylloc;
+  ++yylsp;
+  YYLLOC_DEFAULT (*yylsp, yyerror_range, 2);
+
+  /* Shift the error token.  */
+  YY_SYMBOL_PRINT ("Shifting", YY_ACCESSING_SYMBOL (yyn), yyvsp, yylsp);
+
+  yystate = yyn;
+  goto yynewstate;
+
+
+/*-------------------------------------.
+| yyacceptlab -- YYACCEPT comes here.  |
+`-------------------------------------*/
+yyacceptlab:
+  yyresult = 0;
+  goto yyreturnlab;
+
+
+/*-----------------------------------.
+| yyabortlab -- YYABORT comes here.  |
+`-----------------------------------*/
+yyabortlab:
+  yyresult = 1;
+  goto yyreturnlab;
+
+
+/*-----------------------------------------------------------.
+| yyexhaustedlab -- YYNOMEM (memory exhaustion) comes here.  |
+`-----------------------------------------------------------*/
+yyexhaustedlab:
+  yyerror (YY_("memory exhausted"));
+  yyresult = 2;
+  goto yyreturnlab;
+
+
+/*----------------------------------------------------------.
+| yyreturnlab -- parsing is finished, clean up and return.  |
+`----------------------------------------------------------*/
+yyreturnlab:
+  if (yychar != YYEMPTY)
+    {
+      /* Make sure we have latest lookahead translation.  See comments at
+         user semantic actions for why this is necessary.  */
+      yytoken = YYTRANSLATE (yychar);
+      yydestruct ("Cleanup: discarding lookahead",
+                  yytoken, &yylval, &yylloc);
+    }
+  /* Do not reclaim the symbols of the rule whose action triggered
+     this YYABORT or YYACCEPT.  */
+  YYPOPSTACK (yylen);
+  YY_STACK_PRINT (yyss, yyssp);
+  while (yyssp != yyss)
+    {
+      yydestruct ("Cleanup: popping",
+                  YY_ACCESSING_SYMBOL (+*yyssp), yyvsp, yylsp);
+      YYPOPSTACK (1);
+    }
+#ifndef yyoverflow
+  if (yyss != yyssa)
+    YYSTACK_FREE (yyss);
+#endif
+
+  return yyresult;
+}
+
+#line 291 "parser.y"
+
+
+
+/* Function: InitParser
+ * --------------------
+ * This function will be called before any calls to yyparse().  It is designed
+ * to give you an opportunity to do anything that must be done to initialize
+ * the parser (set global variables, configure starting state, etc.). One
+ * thing it already does for you is assign the value of the global variable
+ * yydebug that controls whether yacc prints debugging information about
+ * parser actions (shift/reduce) and contents of state stack during parser.
+ * If set to false, no information is printed. Setting it to true will give
+ * you a running trail that might be helpful when debugging your parser.
+ * Please be sure the variable is set to false when submitting your final
+ * version.
+ */
+void InitParser()
+{
+   PrintDebug("parser", "Initializing parser");
+   yydebug = false;
+}